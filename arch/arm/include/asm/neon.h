@@ -0,0 +1,27 @@
+/*
+ *  arch/arm/include/asm/neon.h
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+#ifndef __ASM_ARM_NEON_H
+#define __ASM_ARM_NEON_H
+
+#include <asm/hwcap.h>
+
+#define cpu_has_neon()		(!!(elf_hwcap & HWCAP_NEON))
+
+/*
+ * NEON code in the kernel must live in its own compilation unit, built
+ * with -mfpu=neon, and only be called from between kernel_neon_begin()
+ * and kernel_neon_end(). Everything else is built with -msoft-float, so
+ * the compiler never emits NEON or VFP instructions outside such a pair.
+ *
+ * kernel_neon_begin() disables preemption and must not be used from
+ * interrupt context.
+ */
+void kernel_neon_begin(void);
+void kernel_neon_end(void);
+
+#endif /* __ASM_ARM_NEON_H */
@@ -0,0 +1,156 @@
+/*
+ * linux/arch/arm/lib/xor-neon.c
+ *
+ * XOR block routines using the ARM NEON unit.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+/*
+ * This file is built with -mfpu=neon and uses the GCC NEON intrinsics,
+ * whose header does not mix with the kernel ones, so nothing but
+ * <linux/export.h> is pulled in here. The callers in <asm/xor.h> take
+ * care of kernel_neon_begin()/kernel_neon_end().
+ */
+#include <arm_neon.h>
+#include <linux/export.h>
+
+/* Each iteration handles one 64 byte line: four quadword registers */
+#define XOR_NEON_LINE		64
+
+void xor_neon_2(unsigned long bytes, unsigned long *p1, unsigned long *p2)
+{
+	uint8_t *d = (uint8_t *)p1, *s1 = (uint8_t *)p2;
+	unsigned long lines = bytes / XOR_NEON_LINE;
+
+	do {
+		uint8x16_t v0 = vld1q_u8(d +  0), v1 = vld1q_u8(d + 16);
+		uint8x16_t v2 = vld1q_u8(d + 32), v3 = vld1q_u8(d + 48);
+
+		v0 = veorq_u8(v0, vld1q_u8(s1 +  0));
+		v1 = veorq_u8(v1, vld1q_u8(s1 + 16));
+		v2 = veorq_u8(v2, vld1q_u8(s1 + 32));
+		v3 = veorq_u8(v3, vld1q_u8(s1 + 48));
+
+		vst1q_u8(d +  0, v0);
+		vst1q_u8(d + 16, v1);
+		vst1q_u8(d + 32, v2);
+		vst1q_u8(d + 48, v3);
+
+		d += XOR_NEON_LINE;
+		s1 += XOR_NEON_LINE;
+	} while (--lines);
+}
+EXPORT_SYMBOL(xor_neon_2);
+
+void xor_neon_3(unsigned long bytes, unsigned long *p1, unsigned long *p2,
+		unsigned long *p3)
+{
+	uint8_t *d = (uint8_t *)p1, *s1 = (uint8_t *)p2, *s2 = (uint8_t *)p3;
+	unsigned long lines = bytes / XOR_NEON_LINE;
+
+	do {
+		uint8x16_t v0 = vld1q_u8(d +  0), v1 = vld1q_u8(d + 16);
+		uint8x16_t v2 = vld1q_u8(d + 32), v3 = vld1q_u8(d + 48);
+
+		v0 = veorq_u8(v0, vld1q_u8(s1 +  0));
+		v1 = veorq_u8(v1, vld1q_u8(s1 + 16));
+		v2 = veorq_u8(v2, vld1q_u8(s1 + 32));
+		v3 = veorq_u8(v3, vld1q_u8(s1 + 48));
+		v0 = veorq_u8(v0, vld1q_u8(s2 +  0));
+		v1 = veorq_u8(v1, vld1q_u8(s2 + 16));
+		v2 = veorq_u8(v2, vld1q_u8(s2 + 32));
+		v3 = veorq_u8(v3, vld1q_u8(s2 + 48));
+
+		vst1q_u8(d +  0, v0);
+		vst1q_u8(d + 16, v1);
+		vst1q_u8(d + 32, v2);
+		vst1q_u8(d + 48, v3);
+
+		d += XOR_NEON_LINE;
+		s1 += XOR_NEON_LINE;
+		s2 += XOR_NEON_LINE;
+	} while (--lines);
+}
+EXPORT_SYMBOL(xor_neon_3);
+
+void xor_neon_4(unsigned long bytes, unsigned long *p1, unsigned long *p2,
+		unsigned long *p3, unsigned long *p4)
+{
+	uint8_t *d = (uint8_t *)p1, *s1 = (uint8_t *)p2, *s2 = (uint8_t *)p3;
+	uint8_t *s3 = (uint8_t *)p4;
+	unsigned long lines = bytes / XOR_NEON_LINE;
+
+	do {
+		uint8x16_t v0 = vld1q_u8(d +  0), v1 = vld1q_u8(d + 16);
+		uint8x16_t v2 = vld1q_u8(d + 32), v3 = vld1q_u8(d + 48);
+
+		v0 = veorq_u8(v0, vld1q_u8(s1 +  0));
+		v1 = veorq_u8(v1, vld1q_u8(s1 + 16));
+		v2 = veorq_u8(v2, vld1q_u8(s1 + 32));
+		v3 = veorq_u8(v3, vld1q_u8(s1 + 48));
+		v0 = veorq_u8(v0, vld1q_u8(s2 +  0));
+		v1 = veorq_u8(v1, vld1q_u8(s2 + 16));
+		v2 = veorq_u8(v2, vld1q_u8(s2 + 32));
+		v3 = veorq_u8(v3, vld1q_u8(s2 + 48));
+		v0 = veorq_u8(v0, vld1q_u8(s3 +  0));
+		v1 = veorq_u8(v1, vld1q_u8(s3 + 16));
+		v2 = veorq_u8(v2, vld1q_u8(s3 + 32));
+		v3 = veorq_u8(v3, vld1q_u8(s3 + 48));
+
+		vst1q_u8(d +  0, v0);
+		vst1q_u8(d + 16, v1);
+		vst1q_u8(d + 32, v2);
+		vst1q_u8(d + 48, v3);
+
+		d += XOR_NEON_LINE;
+		s1 += XOR_NEON_LINE;
+		s2 += XOR_NEON_LINE;
+		s3 += XOR_NEON_LINE;
+	} while (--lines);
+}
+EXPORT_SYMBOL(xor_neon_4);
+
+void xor_neon_5(unsigned long bytes, unsigned long *p1, unsigned long *p2,
+		unsigned long *p3, unsigned long *p4, unsigned long *p5)
+{
+	uint8_t *d = (uint8_t *)p1, *s1 = (uint8_t *)p2, *s2 = (uint8_t *)p3;
+	uint8_t *s3 = (uint8_t *)p4, *s4 = (uint8_t *)p5;
+	unsigned long lines = bytes / XOR_NEON_LINE;
+
+	do {
+		uint8x16_t v0 = vld1q_u8(d +  0), v1 = vld1q_u8(d + 16);
+		uint8x16_t v2 = vld1q_u8(d + 32), v3 = vld1q_u8(d + 48);
+
+		v0 = veorq_u8(v0, vld1q_u8(s1 +  0));
+		v1 = veorq_u8(v1, vld1q_u8(s1 + 16));
+		v2 = veorq_u8(v2, vld1q_u8(s1 + 32));
+		v3 = veorq_u8(v3, vld1q_u8(s1 + 48));
+		v0 = veorq_u8(v0, vld1q_u8(s2 +  0));
+		v1 = veorq_u8(v1, vld1q_u8(s2 + 16));
+		v2 = veorq_u8(v2, vld1q_u8(s2 + 32));
+		v3 = veorq_u8(v3, vld1q_u8(s2 + 48));
+		v0 = veorq_u8(v0, vld1q_u8(s3 +  0));
+		v1 = veorq_u8(v1, vld1q_u8(s3 + 16));
+		v2 = veorq_u8(v2, vld1q_u8(s3 + 32));
+		v3 = veorq_u8(v3, vld1q_u8(s3 + 48));
+		v0 = veorq_u8(v0, vld1q_u8(s4 +  0));
+		v1 = veorq_u8(v1, vld1q_u8(s4 + 16));
+		v2 = veorq_u8(v2, vld1q_u8(s4 + 32));
+		v3 = veorq_u8(v3, vld1q_u8(s4 + 48));
+
+		vst1q_u8(d +  0, v0);
+		vst1q_u8(d + 16, v1);
+		vst1q_u8(d + 32, v2);
+		vst1q_u8(d + 48, v3);
+
+		d += XOR_NEON_LINE;
+		s1 += XOR_NEON_LINE;
+		s2 += XOR_NEON_LINE;
+		s3 += XOR_NEON_LINE;
+		s4 += XOR_NEON_LINE;
+	} while (--lines);
+}
+EXPORT_SYMBOL(xor_neon_5);
@@ -29,6 +29,7 @@
 #include <linux/fault-inject.h>
 #include <linux/list_sort.h>
 #include <linux/delay.h>
+#include <linux/blk-iopoll.h>
 
 #define CREATE_TRACE_POINTS
 #include <trace/events/block.h>
@@ -54,7 +55,7 @@ struct kmem_cache *blk_requestq_cachep;
  */
 static struct workqueue_struct *kblockd_workqueue;
 
-static void drive_stat_acct(struct request *rq, int new_io)
+void drive_stat_acct(struct request *rq, int new_io)
 {
 	struct hd_struct *part;
 	int rw = rq_data_dir(rq);
@@ -421,6 +422,8 @@ void blk_cleanup_queue(struct request_queue *q)
 	 */
 	if (q->elevator)
 		blk_drain_queue(q, true);
+	if (q->mq_ops)
+		blk_mq_drain_queue(q);
 
 	/* @q won't process any more request, flush async actions */
 	del_timer_sync(&q->backing_dev_info.laptop_mode_wb_timer);
@@ -482,7 +485,15 @@ struct request_queue *blk_alloc_queue_node(gfp_t gfp_mask, int node_id)
 		return NULL;
 	}
 
+	q->dio_poll_stat = alloc_percpu(struct blk_poll_stat);
+	if (!q->dio_poll_stat) {
+		bdi_destroy(&q->backing_dev_info);
+		kmem_cache_free(blk_requestq_cachep, q);
+		return NULL;
+	}
+
 	if (blk_throtl_init(q)) {
+		free_percpu(q->dio_poll_stat);
 		kmem_cache_free(blk_requestq_cachep, q);
 		return NULL;
 	}
@@ -1843,7 +1854,7 @@ static void blk_account_io_completion(struct request *req, unsigned int bytes)
 	}
 }
 
-static void blk_account_io_done(struct request *req)
+void blk_account_io_done(struct request *req)
 {
 	/*
 	 * Account IO completion.  flush_rq isn't accounted as a
@@ -11,6 +11,9 @@
 #include <linux/cpu.h>
 #include <linux/blk-iopoll.h>
 #include <linux/delay.h>
+#include <linux/hrtimer.h>
+#include <linux/log2.h>
+#include <linux/percpu.h>
 
 #include "blk.h"
 
@@ -189,6 +192,108 @@ void blk_iopoll_init(struct blk_iopoll *iop, int weight, blk_iopoll_fn *poll_fn)
 }
 EXPORT_SYMBOL(blk_iopoll_init);
 
+/*
+ * Polled completion for synchronous direct I/O.
+ *
+ * On a device that completes a small read in a few microseconds, the
+ * wakeup and the two context switches of sleeping for the completion
+ * interrupt are a good part of the latency. With dio_poll set, the
+ * submitter busy waits for the completion instead, so the interrupt finds
+ * it still running. In hybrid mode it first sleeps for half of the mean
+ * service time seen on the queue, to not burn the cpu for all of it.
+ */
+#define BLK_POLL_MIN_SPIN_NS	(10 * NSEC_PER_USEC)
+#define BLK_POLL_MIN_SLEEP_NS	(5 * NSEC_PER_USEC)
+
+static inline u64 blk_poll_now(void)
+{
+	return ktime_to_ns(ktime_get());
+}
+
+/**
+ * blk_poll_wait - Wait for synchronous I/O without sleeping on it
+ * @q:        The queue the I/O was submitted to
+ * @start:    When it was submitted, in ktime_get() ns
+ * @done:     Returns true once the I/O has completed
+ * @data:     Argument for @done
+ *
+ * Description:
+ *     Spins until @done returns true, in hybrid mode after sleeping for
+ *     half of the mean service time of @q. The caller must be woken by the
+ *     completion like for a normal sleep. Returns false if the caller has
+ *     to sleep for the completion after all: polling is off on @q, we need
+ *     to reschedule, or the I/O takes twice as long as it usually does.
+ **/
+bool blk_poll_wait(struct request_queue *q, u64 start,
+		   bool (*done)(void *), void *data)
+{
+	unsigned long mean = ACCESS_ONCE(q->dio_poll_mean);
+	u64 now, limit, spin_start;
+	bool ret;
+
+	switch (ACCESS_ONCE(q->dio_poll)) {
+	case BLK_POLL_HYBRID:
+		if (mean / 2 >= BLK_POLL_MIN_SLEEP_NS) {
+			ktime_t expires = ns_to_ktime(start + mean / 2);
+
+			set_current_state(TASK_UNINTERRUPTIBLE);
+			if (!done(data))
+				schedule_hrtimeout(&expires, HRTIMER_MODE_ABS);
+			__set_current_state(TASK_RUNNING);
+		}
+		/* fall through */
+	case BLK_POLL_SPIN:
+		break;
+	default:
+		return false;
+	}
+
+	limit = start + max_t(u64, 2 * mean, BLK_POLL_MIN_SPIN_NS);
+	now = spin_start = blk_poll_now();
+	while (!(ret = done(data))) {
+		if (need_resched() || now > limit)
+			break;
+		cpu_relax();
+		now = blk_poll_now();
+	}
+
+	this_cpu_add(q->dio_poll_stat->spin_ns, now - spin_start);
+	return ret;
+}
+EXPORT_SYMBOL(blk_poll_wait);
+
+/**
+ * blk_poll_account - Account a synchronous I/O to its queue
+ * @q:        The queue the I/O was submitted to
+ * @service:  Time from submission to the completion, in ns
+ * @wait:     Time from submission until the submitter saw it, in ns
+ * @how:      BLK_POLL_SLEPT, BLK_POLL_HIT or BLK_POLL_MISS
+ *
+ * Description:
+ *     @service feeds the mean service time estimate of @q that hybrid
+ *     polling sleeps for, while polling is on, @wait the histograms in
+ *     dio_poll_stat.
+ **/
+void blk_poll_account(struct request_queue *q, u64 service, u64 wait, int how)
+{
+	unsigned long mean;
+	int slot = wait ? ilog2(wait) : 0;
+
+	if (slot >= BLK_POLL_SLOTS)
+		slot = BLK_POLL_SLOTS - 1;
+	this_cpu_inc(q->dio_poll_stat->lat[how][slot]);
+
+	/*
+	 * Only polling needs the mean, don't write the shared cacheline on
+	 * every I/O otherwise. Racy, but it is only an estimate.
+	 */
+	if (service && ACCESS_ONCE(q->dio_poll)) {
+		mean = ACCESS_ONCE(q->dio_poll_mean);
+		ACCESS_ONCE(q->dio_poll_mean) = mean - mean / 8 + service / 8;
+	}
+}
+EXPORT_SYMBOL(blk_poll_account);
+
 static int __cpuinit blk_iopoll_cpu_notify(struct notifier_block *self,
 					  unsigned long action, void *hcpu)
 {
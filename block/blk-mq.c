@@ -0,0 +1,560 @@
+/*
+ * Multi-queue request path for fast block devices.
+ *
+ * Request based drivers normally serialize every submission, merge and
+ * completion on q->queue_lock, which caps small random I/O on fast
+ * devices at what one lock can sustain. Here a bio is turned into a
+ * request taken from a preallocated, tagged pool of the hardware queue
+ * it maps to, queued on a per-cpu software queue and handed straight to
+ * the driver's ->queue_rq(). There is no I/O scheduler, no merging and
+ * no request timeout handling; completions can be steered back to the
+ * submitting cpu.
+ */
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/bio.h>
+#include <linux/blkdev.h>
+#include <linux/blk-mq.h>
+#include <linux/init.h>
+#include <linux/slab.h>
+#include <linux/percpu.h>
+#include <linux/smp.h>
+#include <linux/delay.h>
+#include <linux/workqueue.h>
+#include <trace/events/block.h>
+
+#include "blk.h"
+
+/*
+ * Per-cpu software queue
+ */
+struct blk_mq_ctx {
+	struct {
+		spinlock_t		lock;
+		struct list_head	rq_list;
+	} ____cacheline_aligned_in_smp;
+
+	unsigned int		cpu;
+	unsigned int		index_hw;	/* bit in hctx->ctx_map */
+	unsigned int		last_tag;	/* tag allocation hint */
+	struct blk_mq_hw_ctx	*hctx;
+};
+
+struct blk_mq_hw_ctx *blk_mq_map_queue(struct request_queue *q, const int cpu)
+{
+	return q->queue_hw_ctx[q->mq_map[cpu]];
+}
+EXPORT_SYMBOL(blk_mq_map_queue);
+
+static struct blk_mq_hw_ctx *blk_mq_hctx(struct request_queue *q, int cpu)
+{
+	if (q->mq_ops->map_queue)
+		return q->mq_ops->map_queue(q, cpu);
+	return blk_mq_map_queue(q, cpu);
+}
+
+static bool blk_mq_tags_full(struct blk_mq_hw_ctx *hctx)
+{
+	return find_first_zero_bit(hctx->tag_map, hctx->queue_depth) >=
+		hctx->queue_depth;
+}
+
+static bool blk_mq_tags_busy(struct blk_mq_hw_ctx *hctx)
+{
+	return find_first_bit(hctx->tag_map, hctx->queue_depth) <
+		hctx->queue_depth;
+}
+
+/*
+ * Grab a free tag, starting where this cpu left off last time so that
+ * cpus sharing a hardware queue don't all fight over the first word of
+ * the bitmap. Called with preemption disabled.
+ */
+static int blk_mq_get_tag(struct blk_mq_hw_ctx *hctx, struct blk_mq_ctx *ctx)
+{
+	unsigned int depth = hctx->queue_depth;
+	unsigned int start = ctx->last_tag;
+	bool wrapped = false;
+	unsigned int tag;
+
+	if (start >= depth)
+		start = 0;
+
+	for (;;) {
+		tag = find_next_zero_bit(hctx->tag_map, depth, start);
+		if (tag >= depth) {
+			if (wrapped || !start)
+				return -1;
+			wrapped = true;
+			start = 0;
+			continue;
+		}
+		if (!test_and_set_bit_lock(tag, hctx->tag_map))
+			break;
+		start = tag;
+	}
+
+	ctx->last_tag = tag + 1;
+	return tag;
+}
+
+static void blk_mq_put_tag(struct blk_mq_hw_ctx *hctx, unsigned int tag)
+{
+	/* the request must be torn down before the tag can be taken again */
+	clear_bit_unlock(tag, hctx->tag_map);
+	smp_mb__after_clear_bit();
+	if (waitqueue_active(&hctx->tag_wait))
+		wake_up(&hctx->tag_wait);
+}
+
+/*
+ * Allocate a request from the hardware queue of the current cpu, waiting
+ * for a tag if they are all in flight. Returns with preemption disabled,
+ * which blk_mq_make_request() drops once the request is queued.
+ */
+static struct request *blk_mq_get_request(struct request_queue *q,
+					  struct blk_mq_ctx **ctxp)
+{
+	struct blk_mq_hw_ctx *hctx;
+	struct blk_mq_ctx *ctx;
+	struct request *rq;
+	int tag;
+
+	for (;;) {
+		ctx = per_cpu_ptr(q->queue_ctx, get_cpu());
+		hctx = ctx->hctx;
+		tag = blk_mq_get_tag(hctx, ctx);
+		if (tag >= 0)
+			break;
+		put_cpu();
+
+		wait_event(hctx->tag_wait, !blk_mq_tags_full(hctx));
+	}
+
+	rq = hctx->rqs[tag];
+	blk_rq_init(q, rq);
+	if (blk_queue_io_stat(q))
+		rq->cmd_flags |= REQ_IO_STAT;
+	rq->tag = tag;
+	rq->mq_ctx = ctx;
+	rq->cpu = ctx->cpu;
+
+	*ctxp = ctx;
+	return rq;
+}
+
+static void blk_mq_free_request(struct request *rq)
+{
+	struct blk_mq_hw_ctx *hctx = rq->mq_ctx->hctx;
+
+	rq->mq_ctx = NULL;
+	blk_mq_put_tag(hctx, rq->tag);
+}
+
+/*
+ * Move everything queued on the software queues of @hctx, and whatever
+ * the driver pushed back earlier, to the driver. Runs without any queue
+ * wide lock, so it may run on several cpus at once for the same @hctx.
+ */
+static void blk_mq_run_hw_queue(struct blk_mq_hw_ctx *hctx, bool async);
+
+static void __blk_mq_run_hw_queue(struct blk_mq_hw_ctx *hctx)
+{
+	struct request_queue *q = hctx->queue;
+	struct request *rq;
+	LIST_HEAD(rq_list);
+	unsigned int bit;
+
+	if (unlikely(test_bit(BLK_MQ_S_STOPPED, &hctx->state)))
+		return;
+
+	/* requests the driver could not take last time go first */
+	if (!list_empty_careful(&hctx->dispatch)) {
+		spin_lock(&hctx->lock);
+		list_splice_init(&hctx->dispatch, &rq_list);
+		spin_unlock(&hctx->lock);
+	}
+
+	for_each_set_bit(bit, hctx->ctx_map, hctx->nr_ctx) {
+		struct blk_mq_ctx *ctx = hctx->ctxs[bit];
+
+		clear_bit(bit, hctx->ctx_map);
+		spin_lock(&ctx->lock);
+		list_splice_tail_init(&ctx->rq_list, &rq_list);
+		spin_unlock(&ctx->lock);
+	}
+
+	while (!list_empty(&rq_list)) {
+		int ret;
+
+		rq = list_entry_rq(rq_list.next);
+		list_del_init(&rq->queuelist);
+
+		trace_block_rq_issue(q, rq);
+		ret = q->mq_ops->queue_rq(hctx, rq);
+		if (ret == BLK_MQ_RQ_QUEUE_OK)
+			continue;
+		if (ret == BLK_MQ_RQ_QUEUE_BUSY) {
+			list_add(&rq->queuelist, &rq_list);
+			break;
+		}
+
+		WARN_ON_ONCE(ret != BLK_MQ_RQ_QUEUE_ERROR);
+		blk_mq_end_io(rq, -EIO);
+	}
+
+	/*
+	 * The driver is out of resources and has stopped the queue. Keep the
+	 * rest in order for the next run, which the driver starts with
+	 * blk_mq_start_hw_queue(). If that already happened, the run it
+	 * started may have missed them, so run the queue again.
+	 */
+	if (!list_empty(&rq_list)) {
+		spin_lock(&hctx->lock);
+		list_splice(&rq_list, &hctx->dispatch);
+		spin_unlock(&hctx->lock);
+
+		smp_mb();
+		if (!test_bit(BLK_MQ_S_STOPPED, &hctx->state))
+			blk_mq_run_hw_queue(hctx, true);
+	}
+}
+
+static void blk_mq_run_hw_queue(struct blk_mq_hw_ctx *hctx, bool async)
+{
+	if (unlikely(test_bit(BLK_MQ_S_STOPPED, &hctx->state)))
+		return;
+
+	if (async)
+		kblockd_schedule_work(hctx->queue, &hctx->run_work);
+	else
+		__blk_mq_run_hw_queue(hctx);
+}
+
+static void blk_mq_run_work_fn(struct work_struct *work)
+{
+	struct blk_mq_hw_ctx *hctx;
+
+	hctx = container_of(work, struct blk_mq_hw_ctx, run_work);
+	__blk_mq_run_hw_queue(hctx);
+}
+
+void blk_mq_run_queues(struct request_queue *q, bool async)
+{
+	struct blk_mq_hw_ctx *hctx;
+	unsigned int i;
+
+	queue_for_each_hw_ctx(q, hctx, i)
+		blk_mq_run_hw_queue(hctx, async);
+}
+EXPORT_SYMBOL(blk_mq_run_queues);
+
+void blk_mq_stop_hw_queue(struct blk_mq_hw_ctx *hctx)
+{
+	set_bit(BLK_MQ_S_STOPPED, &hctx->state);
+}
+EXPORT_SYMBOL(blk_mq_stop_hw_queue);
+
+/*
+ * May be called from interrupt context, the queue is run from kblockd
+ */
+void blk_mq_start_hw_queue(struct blk_mq_hw_ctx *hctx)
+{
+	clear_bit(BLK_MQ_S_STOPPED, &hctx->state);
+	/* pairs with the re-check in __blk_mq_run_hw_queue() */
+	smp_mb__after_clear_bit();
+	blk_mq_run_hw_queue(hctx, true);
+}
+EXPORT_SYMBOL(blk_mq_start_hw_queue);
+
+void blk_mq_start_stopped_hw_queues(struct request_queue *q)
+{
+	struct blk_mq_hw_ctx *hctx;
+	unsigned int i;
+
+	queue_for_each_hw_ctx(q, hctx, i)
+		if (test_and_clear_bit(BLK_MQ_S_STOPPED, &hctx->state))
+			blk_mq_run_hw_queue(hctx, true);
+}
+EXPORT_SYMBOL(blk_mq_start_stopped_hw_queues);
+
+static void blk_mq_make_request(struct request_queue *q, struct bio *bio)
+{
+	struct blk_mq_ctx *ctx;
+	struct request *rq;
+
+	blk_queue_bounce(q, &bio);
+
+	if (unlikely(blk_queue_dead(q))) {
+		bio_endio(bio, -ENODEV);
+		return;
+	}
+
+	rq = blk_mq_get_request(q, &ctx);
+	init_request_from_bio(rq, bio);
+	drive_stat_acct(rq, 1);
+
+	spin_lock(&ctx->lock);
+	list_add_tail(&rq->queuelist, &ctx->rq_list);
+	spin_unlock(&ctx->lock);
+	set_bit(ctx->index_hw, ctx->hctx->ctx_map);
+	put_cpu();
+
+	blk_mq_run_hw_queue(ctx->hctx, false);
+}
+
+/**
+ * blk_mq_end_io - end I/O on a request from a multi-queue driver
+ * @rq:		the request being completed
+ * @error:	0 for success, < 0 for error
+ *
+ * Completes all of @rq and gives its tag back. May be called from
+ * interrupt context.
+ */
+void blk_mq_end_io(struct request *rq, int error)
+{
+	if (blk_update_request(rq, error, blk_rq_bytes(rq)))
+		BUG();
+
+	blk_account_io_done(rq);
+	blk_mq_free_request(rq);
+}
+EXPORT_SYMBOL(blk_mq_end_io);
+
+#if defined(CONFIG_SMP) && defined(CONFIG_USE_GENERIC_SMP_HELPERS)
+static void blk_mq_end_io_remote(void *data)
+{
+	struct request *rq = data;
+
+	blk_mq_end_io(rq, rq->errors);
+}
+
+static bool blk_mq_end_io_ipi(struct request *rq, int error)
+{
+	int cpu = smp_processor_id();
+
+	if (cpu == rq->cpu || !cpu_online(rq->cpu))
+		return false;
+
+	rq->errors = error;
+	rq->csd.func = blk_mq_end_io_remote;
+	rq->csd.info = rq;
+	rq->csd.flags = 0;
+	__smp_call_function_single(rq->cpu, &rq->csd, 0);
+	return true;
+}
+#else
+static bool blk_mq_end_io_ipi(struct request *rq, int error)
+{
+	return false;
+}
+#endif
+
+/**
+ * blk_mq_complete_request - end I/O on a request, on the submitting cpu
+ * @rq:		the request being completed
+ * @error:	0 for success, < 0 for error
+ *
+ * Like blk_mq_end_io(), but if the queue was registered with
+ * BLK_MQ_F_SHOULD_IPI and @rq was submitted on another cpu, the
+ * completion is sent there, where the submitter's data is cache hot.
+ */
+void blk_mq_complete_request(struct request *rq, int error)
+{
+	struct blk_mq_hw_ctx *hctx = rq->mq_ctx->hctx;
+
+	preempt_disable();
+	if (!(hctx->flags & BLK_MQ_F_SHOULD_IPI) ||
+	    !blk_mq_end_io_ipi(rq, error))
+		blk_mq_end_io(rq, error);
+	preempt_enable();
+}
+EXPORT_SYMBOL(blk_mq_complete_request);
+
+/*
+ * Wait for all requests of a dying queue to complete
+ */
+void blk_mq_drain_queue(struct request_queue *q)
+{
+	struct blk_mq_hw_ctx *hctx;
+	unsigned int i;
+
+	queue_for_each_hw_ctx(q, hctx, i) {
+		while (blk_mq_tags_busy(hctx)) {
+			blk_mq_run_hw_queue(hctx, false);
+			msleep(10);
+		}
+	}
+}
+
+static struct blk_mq_hw_ctx *blk_mq_alloc_hctx(struct request_queue *q,
+					       struct blk_mq_reg *reg,
+					       unsigned int num)
+{
+	int node = reg->numa_node;
+	struct blk_mq_hw_ctx *hctx;
+	unsigned int i;
+
+	hctx = kzalloc_node(sizeof(*hctx), GFP_KERNEL, node);
+	if (!hctx)
+		return NULL;
+
+	spin_lock_init(&hctx->lock);
+	INIT_LIST_HEAD(&hctx->dispatch);
+	INIT_WORK(&hctx->run_work, blk_mq_run_work_fn);
+	init_waitqueue_head(&hctx->tag_wait);
+	hctx->queue = q;
+	hctx->queue_num = num;
+	hctx->queue_depth = reg->queue_depth;
+	hctx->flags = reg->flags;
+
+	hctx->ctxs = kzalloc_node(nr_cpu_ids * sizeof(void *), GFP_KERNEL,
+				  node);
+	hctx->ctx_map = kzalloc_node(BITS_TO_LONGS(nr_cpu_ids) * sizeof(long),
+				     GFP_KERNEL, node);
+	hctx->tag_map = kzalloc_node(BITS_TO_LONGS(reg->queue_depth) *
+				     sizeof(long), GFP_KERNEL, node);
+	hctx->rqs = kzalloc_node(reg->queue_depth * sizeof(void *),
+				 GFP_KERNEL, node);
+	if (!hctx->ctxs || !hctx->ctx_map || !hctx->tag_map || !hctx->rqs)
+		return hctx;
+
+	for (i = 0; i < reg->queue_depth; i++) {
+		hctx->rqs[i] = kzalloc_node(sizeof(struct request) +
+					    reg->cmd_size, GFP_KERNEL, node);
+		if (!hctx->rqs[i])
+			break;
+	}
+	return hctx;
+}
+
+static bool blk_mq_hctx_complete(struct blk_mq_hw_ctx *hctx)
+{
+	return hctx->ctxs && hctx->ctx_map && hctx->tag_map && hctx->rqs &&
+		hctx->rqs[hctx->queue_depth - 1];
+}
+
+static void blk_mq_free_hctx(struct blk_mq_hw_ctx *hctx)
+{
+	unsigned int i;
+
+	if (hctx->rqs)
+		for (i = 0; i < hctx->queue_depth; i++)
+			kfree(hctx->rqs[i]);
+	kfree(hctx->rqs);
+	kfree(hctx->tag_map);
+	kfree(hctx->ctx_map);
+	kfree(hctx->ctxs);
+	kfree(hctx);
+}
+
+static void blk_mq_free_hw_queues(struct request_queue *q, unsigned int nr,
+				  unsigned int nr_inited)
+{
+	struct blk_mq_hw_ctx *hctx;
+	unsigned int i;
+
+	/* the array itself may be what failed to allocate */
+	if (q->queue_hw_ctx) {
+		for (i = 0; i < nr; i++) {
+			hctx = q->queue_hw_ctx[i];
+			if (!hctx)
+				continue;
+			cancel_work_sync(&hctx->run_work);
+			if (i < nr_inited && q->mq_ops->exit_hctx)
+				q->mq_ops->exit_hctx(hctx, i);
+			blk_mq_free_hctx(hctx);
+		}
+	}
+	kfree(q->queue_hw_ctx);
+	q->queue_hw_ctx = NULL;
+	free_percpu(q->queue_ctx);
+	q->queue_ctx = NULL;
+	kfree(q->mq_map);
+	q->mq_map = NULL;
+}
+
+/**
+ * blk_mq_init_queue - set up a multi-queue request queue
+ * @reg:		hardware queue count and depth, driver operations
+ * @driver_data:	stored in q->queuedata
+ *
+ * Returns the queue or an ERR_PTR(). The queue is torn down with
+ * blk_cleanup_queue(), which waits for the requests in flight.
+ */
+struct request_queue *blk_mq_init_queue(struct blk_mq_reg *reg,
+					void *driver_data)
+{
+	struct request_queue *q;
+	struct blk_mq_hw_ctx *hctx;
+	unsigned int nr_hw, nr_inited = 0, i;
+	int cpu, ret = -ENOMEM;
+
+	if (!reg->nr_hw_queues || !reg->ops->queue_rq ||
+	    !reg->queue_depth || reg->queue_depth > BLK_MQ_MAX_DEPTH)
+		return ERR_PTR(-EINVAL);
+
+	nr_hw = min_t(unsigned int, reg->nr_hw_queues, nr_cpu_ids);
+
+	q = blk_alloc_queue_node(GFP_KERNEL, reg->numa_node);
+	if (!q)
+		return ERR_PTR(-ENOMEM);
+
+	q->mq_ops = reg->ops;
+	q->queuedata = driver_data;
+	q->queue_ctx = alloc_percpu(struct blk_mq_ctx);
+	q->queue_hw_ctx = kzalloc_node(nr_hw * sizeof(void *), GFP_KERNEL,
+				       reg->numa_node);
+	q->mq_map = kzalloc(nr_cpu_ids * sizeof(unsigned int), GFP_KERNEL);
+	if (!q->queue_ctx || !q->queue_hw_ctx || !q->mq_map)
+		goto err;
+
+	for (i = 0; i < nr_hw; i++) {
+		hctx = blk_mq_alloc_hctx(q, reg, i);
+		q->queue_hw_ctx[i] = hctx;
+		if (!hctx || !blk_mq_hctx_complete(hctx))
+			goto err;
+	}
+	q->nr_hw_queues = nr_hw;
+
+	/* spread the possible cpus evenly over the hardware queues */
+	for_each_possible_cpu(cpu) {
+		struct blk_mq_ctx *ctx = per_cpu_ptr(q->queue_ctx, cpu);
+
+		q->mq_map[cpu] = cpu * nr_hw / nr_cpu_ids;
+		spin_lock_init(&ctx->lock);
+		INIT_LIST_HEAD(&ctx->rq_list);
+		ctx->cpu = cpu;
+		ctx->hctx = blk_mq_hctx(q, cpu);
+		ctx->index_hw = ctx->hctx->nr_ctx;
+		ctx->hctx->ctxs[ctx->hctx->nr_ctx++] = ctx;
+	}
+
+	for (i = 0; i < nr_hw && reg->ops->init_hctx; i++) {
+		ret = reg->ops->init_hctx(q->queue_hw_ctx[i], driver_data, i);
+		if (ret)
+			goto err;
+		nr_inited++;
+	}
+
+	blk_queue_make_request(q, blk_mq_make_request);
+	queue_flag_set_unlocked(QUEUE_FLAG_IO_STAT, q);
+	return q;
+
+err:
+	blk_mq_free_hw_queues(q, nr_hw, nr_inited);
+	q->nr_hw_queues = 0;
+	q->mq_ops = NULL;
+	blk_cleanup_queue(q);
+	return ERR_PTR(ret);
+}
+EXPORT_SYMBOL(blk_mq_init_queue);
+
+/*
+ * Called when the last reference to the queue is dropped
+ */
+void blk_mq_free_queue(struct request_queue *q)
+{
+	blk_mq_free_hw_queues(q, q->nr_hw_queues, q->nr_hw_queues);
+	q->nr_hw_queues = 0;
+}
@@ -7,6 +7,7 @@
 #include <linux/bio.h>
 #include <linux/blkdev.h>
 #include <linux/blktrace_api.h>
+#include <linux/blk-iopoll.h>
 
 #include "blk.h"
 
@@ -273,6 +274,57 @@ queue_rq_affinity_store(struct request_queue *q, const char *page, size_t count)
 	return ret;
 }
 
+static ssize_t queue_dio_poll_show(struct request_queue *q, char *page)
+{
+	return queue_var_show(q->dio_poll, page);
+}
+
+static ssize_t
+queue_dio_poll_store(struct request_queue *q, const char *page, size_t count)
+{
+	unsigned long val;
+	ssize_t ret;
+
+	ret = queue_var_store(&val, page, count);
+	if (val > BLK_POLL_HYBRID)
+		return -EINVAL;
+
+	q->dio_poll = val;
+	return ret;
+}
+
+static ssize_t queue_dio_poll_stat_show(struct request_queue *q, char *page)
+{
+	static const char *name[BLK_POLL_NR] = { "slept", "hit", "miss" };
+	unsigned long lat[BLK_POLL_SLOTS];
+	u64 spin_ns = 0;
+	ssize_t ret;
+	int cpu, how, i;
+
+	for_each_possible_cpu(cpu)
+		spin_ns += per_cpu_ptr(q->dio_poll_stat, cpu)->spin_ns;
+	ret = sprintf(page, "mean_ns %lu spin_ns %llu\n", q->dio_poll_mean,
+		      (unsigned long long)spin_ns);
+
+	for (how = 0; how < BLK_POLL_NR; how++) {
+		memset(lat, 0, sizeof(lat));
+		for_each_possible_cpu(cpu) {
+			struct blk_poll_stat *stat =
+				per_cpu_ptr(q->dio_poll_stat, cpu);
+
+			for (i = 0; i < BLK_POLL_SLOTS; i++)
+				lat[i] += stat->lat[how][i];
+		}
+
+		ret += sprintf(page + ret, "%s", name[how]);
+		for (i = 0; i < BLK_POLL_SLOTS; i++)
+			ret += sprintf(page + ret, " %lu", lat[i]);
+		ret += sprintf(page + ret, "\n");
+	}
+
+	return ret;
+}
+
 static struct queue_sysfs_entry queue_requests_entry = {
 	.attr = {.name = "nr_requests", .mode = S_IRUGO | S_IWUSR },
 	.show = queue_requests_show,
@@ -387,6 +439,17 @@ static struct queue_sysfs_entry queue_random_entry = {
 	.store = queue_store_random,
 };
 
+static struct queue_sysfs_entry queue_dio_poll_entry = {
+	.attr = {.name = "dio_poll", .mode = S_IRUGO | S_IWUSR },
+	.show = queue_dio_poll_show,
+	.store = queue_dio_poll_store,
+};
+
+static struct queue_sysfs_entry queue_dio_poll_stat_entry = {
+	.attr = {.name = "dio_poll_stat", .mode = S_IRUGO },
+	.show = queue_dio_poll_stat_show,
+};
+
 static struct attribute *default_attrs[] = {
 	&queue_requests_entry.attr,
 	&queue_ra_entry.attr,
@@ -409,6 +472,8 @@ static struct attribute *default_attrs[] = {
 	&queue_rq_affinity_entry.attr,
 	&queue_iostats_entry.attr,
 	&queue_random_entry.attr,
+	&queue_dio_poll_entry.attr,
+	&queue_dio_poll_stat_entry.attr,
 	NULL,
 };
 
@@ -490,6 +555,11 @@ static void blk_release_queue(struct kobject *kobj)
 	if (q->queue_tags)
 		__blk_queue_free_tags(q);
 
+	if (q->mq_ops)
+		blk_mq_free_queue(q);
+
+	free_percpu(q->dio_poll_stat);
+
 	blk_throtl_release(q);
 	blk_trace_shutdown(q);
 
@@ -0,0 +1,529 @@
+/*
+ *  Flash i/o scheduler.
+ *
+ *  For eMMC, SD and raw NAND backed devices, where seeks are free but a
+ *  read stuck behind a deep queue of writes in the device waits for all
+ *  of them. Reads are always dispatched first, in FIFO order. Writes are
+ *  dispatched only while fewer than write_depth of them are in the
+ *  device, and write_depth is adjusted from the measured read latency:
+ *  halved when a read takes longer than target_latency, and raised by one
+ *  after write_depth reads in a row met the target. Writes that waited
+ *  longer than write_expire are dispatched ahead of reads.
+ *
+ *  Read and write service time percentiles are exported in sysfs.
+ *  See Documentation/block/flash-iosched.txt
+ */
+#include <linux/kernel.h>
+#include <linux/fs.h>
+#include <linux/blkdev.h>
+#include <linux/elevator.h>
+#include <linux/bio.h>
+#include <linux/module.h>
+#include <linux/slab.h>
+#include <linux/init.h>
+#include <linux/compiler.h>
+#include <linux/rbtree.h>
+#include <linux/ktime.h>
+#include <linux/math64.h>
+
+static const int target_latency = 2000;	/* read latency target in usecs */
+static const int write_expire = HZ;	/* max time before a write is submitted */
+static const int max_write_depth = 32;	/* upper bound of write_depth */
+static const int read_idle = HZ / 10;	/* no reads for this long, lift the limit */
+
+/*
+ * Latencies are kept in usecs in log-linear buckets: values below 8 get a
+ * bucket each, every power of two above that is split into 8 buckets, so
+ * percentiles are accurate to 12.5%.
+ */
+#define FLASH_LAT_SUB_BITS	3
+#define FLASH_LAT_SUB		(1 << FLASH_LAT_SUB_BITS)
+#define FLASH_LAT_BUCKETS	(FLASH_LAT_SUB * (32 - FLASH_LAT_SUB_BITS + 1))
+
+struct flash_lat_hist {
+	unsigned long nr;
+	unsigned long max;
+	unsigned long bucket[FLASH_LAT_BUCKETS];
+};
+
+struct flash_data {
+	/*
+	 * run time data
+	 */
+
+	/*
+	 * requests are present on both sort_list (for front merges) and
+	 * fifo_list (dispatch order)
+	 */
+	struct rb_root sort_list[2];
+	struct list_head fifo_list[2];
+
+	unsigned int inflight[2];	/* dispatched, not yet completed */
+	unsigned int write_depth;	/* current write dispatch budget */
+	unsigned int good_reads;	/* reads within target since last change */
+	ktime_t last_cut;		/* when write_depth was last halved */
+	unsigned long last_read;	/* jiffies of the last read completion */
+
+	struct flash_lat_hist lat[2];
+
+	/*
+	 * settings that change how the i/o scheduler behaves
+	 */
+	int target_latency;
+	int write_expire;
+	int max_write_depth;
+	int front_merges;
+};
+
+/*
+ * ktime of the request's activation in ns, valid between activate and
+ * completion. Split over two private pointers to keep all 64 bits on 32 bit.
+ */
+static inline void flash_set_start(struct request *rq)
+{
+	u64 now = ktime_to_ns(ktime_get());
+
+	rq->elevator_private[0] = (void *)(unsigned long)lower_32_bits(now);
+	rq->elevator_private[1] = (void *)(unsigned long)upper_32_bits(now);
+}
+
+static inline unsigned long flash_elapsed_us(struct request *rq)
+{
+	u64 start = (u64)(unsigned long)rq->elevator_private[1] << 32 |
+		    (unsigned long)rq->elevator_private[0];
+	u64 us = div_u64(ktime_to_ns(ktime_get()) - start, NSEC_PER_USEC);
+
+	return min_t(u64, us, ULONG_MAX);
+}
+
+static unsigned int flash_lat_bucket(unsigned long us)
+{
+	unsigned int msb;
+
+	if (us < FLASH_LAT_SUB)
+		return us;
+
+	msb = fls_long(us) - 1;
+	if (msb > 31)
+		return FLASH_LAT_BUCKETS - 1;
+	return (msb - FLASH_LAT_SUB_BITS + 1) * FLASH_LAT_SUB +
+		((us >> (msb - FLASH_LAT_SUB_BITS)) & (FLASH_LAT_SUB - 1));
+}
+
+/* upper bound of a bucket in usecs */
+static unsigned long flash_lat_bucket_max(unsigned int b)
+{
+	unsigned int msb, sub;
+
+	if (b < FLASH_LAT_SUB)
+		return b;
+
+	msb = b / FLASH_LAT_SUB + FLASH_LAT_SUB_BITS - 1;
+	sub = b % FLASH_LAT_SUB;
+	return ((FLASH_LAT_SUB + sub + 1UL) << (msb - FLASH_LAT_SUB_BITS)) - 1;
+}
+
+static void flash_lat_add(struct flash_lat_hist *h, unsigned long us)
+{
+	h->bucket[flash_lat_bucket(us)]++;
+	h->nr++;
+	if (us > h->max)
+		h->max = us;
+}
+
+static inline struct rb_root *
+flash_rb_root(struct flash_data *fd, struct request *rq)
+{
+	return &fd->sort_list[rq_data_dir(rq)];
+}
+
+/*
+ * add rq to rbtree and fifo
+ */
+static void
+flash_add_request(struct request_queue *q, struct request *rq)
+{
+	struct flash_data *fd = q->elevator->elevator_data;
+	const int data_dir = rq_data_dir(rq);
+
+	elv_rb_add(flash_rb_root(fd, rq), rq);
+
+	/*
+	 * set expire time and add to fifo list
+	 */
+	rq_set_fifo_time(rq, jiffies + fd->write_expire);
+	list_add_tail(&rq->queuelist, &fd->fifo_list[data_dir]);
+}
+
+/*
+ * remove rq from rbtree and fifo.
+ */
+static void flash_remove_request(struct request_queue *q, struct request *rq)
+{
+	struct flash_data *fd = q->elevator->elevator_data;
+
+	rq_fifo_clear(rq);
+	elv_rb_del(flash_rb_root(fd, rq), rq);
+}
+
+static int
+flash_merge(struct request_queue *q, struct request **req, struct bio *bio)
+{
+	struct flash_data *fd = q->elevator->elevator_data;
+	struct request *__rq;
+
+	/*
+	 * check for front merge
+	 */
+	if (fd->front_merges) {
+		sector_t sector = bio->bi_sector + bio_sectors(bio);
+
+		__rq = elv_rb_find(&fd->sort_list[bio_data_dir(bio)], sector);
+		if (__rq) {
+			BUG_ON(sector != blk_rq_pos(__rq));
+
+			if (elv_rq_merge_ok(__rq, bio)) {
+				*req = __rq;
+				return ELEVATOR_FRONT_MERGE;
+			}
+		}
+	}
+
+	return ELEVATOR_NO_MERGE;
+}
+
+static void flash_merged_request(struct request_queue *q,
+				 struct request *req, int type)
+{
+	struct flash_data *fd = q->elevator->elevator_data;
+
+	/*
+	 * if the merge was a front merge, we need to reposition request
+	 */
+	if (type == ELEVATOR_FRONT_MERGE) {
+		elv_rb_del(flash_rb_root(fd, req), req);
+		elv_rb_add(flash_rb_root(fd, req), req);
+	}
+}
+
+static void
+flash_merged_requests(struct request_queue *q, struct request *req,
+		      struct request *next)
+{
+	/*
+	 * if next expires before rq, assign its expire time to rq
+	 * and move into next position (next will be deleted) in fifo
+	 */
+	if (!list_empty(&req->queuelist) && !list_empty(&next->queuelist)) {
+		if (time_before(rq_fifo_time(next), rq_fifo_time(req))) {
+			list_move(&req->queuelist, &next->queuelist);
+			rq_set_fifo_time(req, rq_fifo_time(next));
+		}
+	}
+
+	/*
+	 * kill knowledge of next, this one is a goner
+	 */
+	flash_remove_request(q, next);
+}
+
+/*
+ * move the oldest request of a direction to the dispatch queue
+ */
+static void flash_dispatch_fifo(struct flash_data *fd, struct request_queue *q,
+				int data_dir)
+{
+	struct request *rq = rq_entry_fifo(fd->fifo_list[data_dir].next);
+
+	flash_remove_request(q, rq);
+	elv_dispatch_add_tail(q, rq);
+	fd->inflight[data_dir]++;
+}
+
+static int flash_dispatch_requests(struct request_queue *q, int force)
+{
+	struct flash_data *fd = q->elevator->elevator_data;
+	const int reads = !list_empty(&fd->fifo_list[READ]);
+	const int writes = !list_empty(&fd->fifo_list[WRITE]);
+
+	if (writes) {
+		struct request *rq = rq_entry_fifo(fd->fifo_list[WRITE].next);
+
+		/* a write waited too long, reads have to wait this once */
+		if (force || time_after(jiffies, rq_fifo_time(rq)))
+			goto dispatch_write;
+	}
+
+	if (reads) {
+		flash_dispatch_fifo(fd, q, READ);
+		return 1;
+	}
+
+	if (!writes)
+		return 0;
+
+	/* nobody is reading, there is no latency to protect */
+	if (time_after(jiffies, fd->last_read + read_idle))
+		fd->write_depth = fd->max_write_depth;
+
+	/*
+	 * Hold writes back while the budget is used up, the completion of
+	 * one of them runs the queue again.
+	 */
+	if (fd->inflight[WRITE] >= fd->write_depth)
+		return 0;
+
+dispatch_write:
+	flash_dispatch_fifo(fd, q, WRITE);
+	return 1;
+}
+
+static void flash_activate_request(struct request_queue *q, struct request *rq)
+{
+	flash_set_start(rq);
+}
+
+/*
+ * Account the service time of @rq and adjust the write budget from the
+ * latency reads see.
+ */
+static void flash_completed_request(struct request_queue *q,
+				    struct request *rq)
+{
+	struct flash_data *fd = q->elevator->elevator_data;
+	const int data_dir = rq_data_dir(rq);
+	unsigned long us = flash_elapsed_us(rq);
+
+	fd->inflight[data_dir]--;
+	flash_lat_add(&fd->lat[data_dir], us);
+
+	if (data_dir == READ) {
+		fd->last_read = jiffies;
+
+		if (us > fd->target_latency) {
+			ktime_t now = ktime_get();
+
+			/*
+			 * Cut at most once per target interval, reads
+			 * queued behind the same writes all come back late.
+			 */
+			fd->good_reads = 0;
+			if (ktime_us_delta(now, fd->last_cut) >
+			    fd->target_latency) {
+				fd->write_depth = max(fd->write_depth / 2, 1U);
+				fd->last_cut = now;
+			}
+		} else if (++fd->good_reads >= fd->write_depth) {
+			fd->good_reads = 0;
+			if (fd->write_depth < fd->max_write_depth)
+				fd->write_depth++;
+			else
+				fd->write_depth = fd->max_write_depth;
+		}
+	}
+
+	/* writes were held back and there is room now */
+	if (!list_empty(&fd->fifo_list[WRITE]) &&
+	    fd->inflight[WRITE] < fd->write_depth)
+		blk_run_queue_async(q);
+}
+
+static void flash_exit_queue(struct elevator_queue *e)
+{
+	struct flash_data *fd = e->elevator_data;
+
+	BUG_ON(!list_empty(&fd->fifo_list[READ]));
+	BUG_ON(!list_empty(&fd->fifo_list[WRITE]));
+
+	kfree(fd);
+}
+
+/*
+ * initialize elevator private data (flash_data).
+ */
+static void *flash_init_queue(struct request_queue *q)
+{
+	struct flash_data *fd;
+
+	fd = kmalloc_node(sizeof(*fd), GFP_KERNEL | __GFP_ZERO, q->node);
+	if (!fd)
+		return NULL;
+
+	INIT_LIST_HEAD(&fd->fifo_list[READ]);
+	INIT_LIST_HEAD(&fd->fifo_list[WRITE]);
+	fd->sort_list[READ] = RB_ROOT;
+	fd->sort_list[WRITE] = RB_ROOT;
+	fd->target_latency = target_latency;
+	fd->write_expire = write_expire;
+	fd->max_write_depth = max_write_depth;
+	fd->write_depth = max_write_depth;
+	fd->front_merges = 1;
+	fd->last_read = jiffies;
+	fd->last_cut = ktime_get();
+	return fd;
+}
+
+/*
+ * sysfs parts below
+ */
+
+static ssize_t
+flash_var_show(int var, char *page)
+{
+	return sprintf(page, "%d\n", var);
+}
+
+static ssize_t
+flash_var_store(int *var, const char *page, size_t count)
+{
+	char *p = (char *) page;
+
+	*var = simple_strtol(p, &p, 10);
+	return count;
+}
+
+#define SHOW_FUNCTION(__FUNC, __VAR, __CONV)				\
+static ssize_t __FUNC(struct elevator_queue *e, char *page)		\
+{									\
+	struct flash_data *fd = e->elevator_data;			\
+	int __data = __VAR;						\
+	if (__CONV)							\
+		__data = jiffies_to_msecs(__data);			\
+	return flash_var_show(__data, (page));				\
+}
+SHOW_FUNCTION(flash_target_latency_show, fd->target_latency, 0);
+SHOW_FUNCTION(flash_write_expire_show, fd->write_expire, 1);
+SHOW_FUNCTION(flash_max_write_depth_show, fd->max_write_depth, 0);
+SHOW_FUNCTION(flash_write_depth_show, fd->write_depth, 0);
+SHOW_FUNCTION(flash_front_merges_show, fd->front_merges, 0);
+#undef SHOW_FUNCTION
+
+#define STORE_FUNCTION(__FUNC, __PTR, MIN, MAX, __CONV)			\
+static ssize_t __FUNC(struct elevator_queue *e, const char *page, size_t count)	\
+{									\
+	struct flash_data *fd = e->elevator_data;			\
+	int __data;							\
+	int ret = flash_var_store(&__data, (page), count);		\
+	if (__data < (MIN))						\
+		__data = (MIN);						\
+	else if (__data > (MAX))					\
+		__data = (MAX);						\
+	if (__CONV)							\
+		*(__PTR) = msecs_to_jiffies(__data);			\
+	else								\
+		*(__PTR) = __data;					\
+	return ret;							\
+}
+STORE_FUNCTION(flash_target_latency_store, &fd->target_latency, 1, INT_MAX, 0);
+STORE_FUNCTION(flash_write_expire_store, &fd->write_expire, 0, INT_MAX, 1);
+STORE_FUNCTION(flash_max_write_depth_store, &fd->max_write_depth, 1, BLKDEV_MAX_RQ, 0);
+STORE_FUNCTION(flash_front_merges_store, &fd->front_merges, 0, 1, 0);
+#undef STORE_FUNCTION
+
+/*
+ * "p50 p90 p99 p99.9 max" service time in usecs, from activation of the
+ * request in the driver to its completion. Writing anything resets it.
+ */
+static ssize_t flash_lat_show(struct flash_lat_hist *h, char *page)
+{
+	static const unsigned int pct[] = { 500, 900, 990, 999 };
+	unsigned long val[ARRAY_SIZE(pct)];
+	unsigned long sum = 0;
+	unsigned int b, i = 0;
+
+	memset(val, 0, sizeof(val));
+	for (b = 0; b < FLASH_LAT_BUCKETS && i < ARRAY_SIZE(pct); b++) {
+		sum += h->bucket[b];
+		while (i < ARRAY_SIZE(pct) && h->nr &&
+		       (u64)sum * 1000 >= (u64)h->nr * pct[i])
+			val[i++] = min(flash_lat_bucket_max(b), h->max);
+	}
+
+	return sprintf(page, "%lu %lu %lu %lu %lu\n",
+		       val[0], val[1], val[2], val[3], h->max);
+}
+
+static ssize_t flash_read_latency_show(struct elevator_queue *e, char *page)
+{
+	struct flash_data *fd = e->elevator_data;
+
+	return flash_lat_show(&fd->lat[READ], page);
+}
+
+static ssize_t flash_write_latency_show(struct elevator_queue *e, char *page)
+{
+	struct flash_data *fd = e->elevator_data;
+
+	return flash_lat_show(&fd->lat[WRITE], page);
+}
+
+static ssize_t flash_read_latency_store(struct elevator_queue *e,
+					const char *page, size_t count)
+{
+	struct flash_data *fd = e->elevator_data;
+
+	memset(&fd->lat[READ], 0, sizeof(fd->lat[READ]));
+	return count;
+}
+
+static ssize_t flash_write_latency_store(struct elevator_queue *e,
+					 const char *page, size_t count)
+{
+	struct flash_data *fd = e->elevator_data;
+
+	memset(&fd->lat[WRITE], 0, sizeof(fd->lat[WRITE]));
+	return count;
+}
+
+#define FD_ATTR(name) \
+	__ATTR(name, S_IRUGO|S_IWUSR, flash_##name##_show, \
+				      flash_##name##_store)
+
+static struct elv_fs_entry flash_attrs[] = {
+	FD_ATTR(target_latency),
+	FD_ATTR(write_expire),
+	FD_ATTR(max_write_depth),
+	__ATTR(write_depth, S_IRUGO, flash_write_depth_show, NULL),
+	FD_ATTR(front_merges),
+	FD_ATTR(read_latency),
+	FD_ATTR(write_latency),
+	__ATTR_NULL
+};
+
+static struct elevator_type iosched_flash = {
+	.ops = {
+		.elevator_merge_fn = 		flash_merge,
+		.elevator_merged_fn =		flash_merged_request,
+		.elevator_merge_req_fn =	flash_merged_requests,
+		.elevator_dispatch_fn =		flash_dispatch_requests,
+		.elevator_add_req_fn =		flash_add_request,
+		.elevator_activate_req_fn =	flash_activate_request,
+		.elevator_completed_req_fn =	flash_completed_request,
+		.elevator_former_req_fn =	elv_rb_former_request,
+		.elevator_latter_req_fn =	elv_rb_latter_request,
+		.elevator_init_fn =		flash_init_queue,
+		.elevator_exit_fn =		flash_exit_queue,
+	},
+
+	.elevator_attrs = flash_attrs,
+	.elevator_name = "flash",
+	.elevator_owner = THIS_MODULE,
+};
+
+static int __init flash_init(void)
+{
+	elv_register(&iosched_flash);
+
+	return 0;
+}
+
+static void __exit flash_exit(void)
+{
+	elv_unregister(&iosched_flash);
+}
+
+module_init(flash_init);
+module_exit(flash_exit);
+
+MODULE_LICENSE("GPL");
+MODULE_DESCRIPTION("flash IO scheduler");
@@ -0,0 +1,273 @@
+/*
+ * null_blk - a block device that completes every request without doing
+ * any I/O, to measure the overhead of the block layer itself.
+ *
+ * The request path is selected with queue_mode:
+ *
+ *   0	bio based, ->make_request_fn() ends the bio right away
+ *   1	request based, single queue behind q->queue_lock
+ *   2	multi-queue, see block/blk-mq.c
+ *
+ * Comparing the modes with many submitting threads shows how far the
+ * single queue lock limits small random I/O, see
+ * Documentation/block/null_blk.txt.
+ */
+#include <linux/module.h>
+#include <linux/moduleparam.h>
+#include <linux/kernel.h>
+#include <linux/init.h>
+#include <linux/slab.h>
+#include <linux/fs.h>
+#include <linux/bio.h>
+#include <linux/blkdev.h>
+#include <linux/blk-mq.h>
+#include <linux/genhd.h>
+#include <linux/list.h>
+#include <linux/mutex.h>
+
+enum {
+	NULL_Q_BIO		= 0,
+	NULL_Q_RQ		= 1,
+	NULL_Q_MQ		= 2,
+};
+
+enum {
+	NULL_IRQ_NONE		= 0,
+	NULL_IRQ_SOFTIRQ	= 1,
+};
+
+struct nullb {
+	struct list_head list;
+	unsigned int index;
+	struct request_queue *q;
+	struct gendisk *disk;
+	spinlock_t lock;
+};
+
+static LIST_HEAD(nullb_list);
+static DEFINE_MUTEX(nullb_lock);
+static int null_major;
+
+static int queue_mode = NULL_Q_MQ;
+module_param(queue_mode, int, S_IRUGO);
+MODULE_PARM_DESC(queue_mode, "Block interface: 0=bio, 1=rq, 2=multi-queue");
+
+static int irqmode = NULL_IRQ_SOFTIRQ;
+module_param(irqmode, int, S_IRUGO);
+MODULE_PARM_DESC(irqmode, "Completion: 0=inline, 1=on the submitting cpu");
+
+static int submit_queues;
+module_param(submit_queues, int, S_IRUGO);
+MODULE_PARM_DESC(submit_queues, "Hardware queues for multi-queue, default one per cpu");
+
+static int hw_queue_depth = 64;
+module_param(hw_queue_depth, int, S_IRUGO);
+MODULE_PARM_DESC(hw_queue_depth, "Queue depth of each hardware queue");
+
+static int nr_devices = 1;
+module_param(nr_devices, int, S_IRUGO);
+MODULE_PARM_DESC(nr_devices, "Number of devices to register");
+
+static int gb = 250;
+module_param(gb, int, S_IRUGO);
+MODULE_PARM_DESC(gb, "Size in GB");
+
+static int bs = 512;
+module_param(bs, int, S_IRUGO);
+MODULE_PARM_DESC(bs, "Logical block size in bytes");
+
+static void null_request_fn(struct request_queue *q)
+{
+	struct request *rq;
+
+	while ((rq = blk_fetch_request(q)) != NULL) {
+		if (irqmode == NULL_IRQ_SOFTIRQ)
+			blk_complete_request(rq);
+		else
+			__blk_end_request_all(rq, 0);
+	}
+}
+
+static void null_softirq_done_fn(struct request *rq)
+{
+	blk_end_request_all(rq, 0);
+}
+
+static void null_make_request(struct request_queue *q, struct bio *bio)
+{
+	bio_endio(bio, 0);
+}
+
+static int null_queue_rq(struct blk_mq_hw_ctx *hctx, struct request *rq)
+{
+	if (irqmode == NULL_IRQ_SOFTIRQ)
+		blk_mq_complete_request(rq, 0);
+	else
+		blk_mq_end_io(rq, 0);
+	return BLK_MQ_RQ_QUEUE_OK;
+}
+
+static struct blk_mq_ops null_mq_ops = {
+	.queue_rq	= null_queue_rq,
+};
+
+static int null_open(struct block_device *bdev, fmode_t mode)
+{
+	return 0;
+}
+
+static int null_release(struct gendisk *disk, fmode_t mode)
+{
+	return 0;
+}
+
+static const struct block_device_operations null_fops = {
+	.owner		= THIS_MODULE,
+	.open		= null_open,
+	.release	= null_release,
+};
+
+static struct request_queue *null_alloc_queue(struct nullb *nullb)
+{
+	struct blk_mq_reg reg;
+	struct request_queue *q;
+
+	switch (queue_mode) {
+	case NULL_Q_MQ:
+		memset(&reg, 0, sizeof(reg));
+		reg.ops = &null_mq_ops;
+		reg.nr_hw_queues = submit_queues;
+		reg.queue_depth = hw_queue_depth;
+		reg.numa_node = NUMA_NO_NODE;
+		if (irqmode == NULL_IRQ_SOFTIRQ)
+			reg.flags |= BLK_MQ_F_SHOULD_IPI;
+		q = blk_mq_init_queue(&reg, nullb);
+		return IS_ERR(q) ? NULL : q;
+	case NULL_Q_RQ:
+		q = blk_init_queue(null_request_fn, &nullb->lock);
+		if (q) {
+			blk_queue_softirq_done(q, null_softirq_done_fn);
+			q->queuedata = nullb;
+		}
+		return q;
+	default:
+		q = blk_alloc_queue(GFP_KERNEL);
+		if (q) {
+			blk_queue_make_request(q, null_make_request);
+			q->queuedata = nullb;
+		}
+		return q;
+	}
+}
+
+static int null_add_dev(void)
+{
+	struct gendisk *disk;
+	struct nullb *nullb;
+	sector_t size;		/* in 512 byte sectors */
+
+	nullb = kzalloc(sizeof(*nullb), GFP_KERNEL);
+	if (!nullb)
+		return -ENOMEM;
+
+	spin_lock_init(&nullb->lock);
+	nullb->q = null_alloc_queue(nullb);
+	if (!nullb->q)
+		goto out_free;
+
+	queue_flag_set_unlocked(QUEUE_FLAG_NONROT, nullb->q);
+	blk_queue_logical_block_size(nullb->q, bs);
+	blk_queue_physical_block_size(nullb->q, bs);
+
+	disk = nullb->disk = alloc_disk(1);
+	if (!disk)
+		goto out_cleanup;
+
+	mutex_lock(&nullb_lock);
+	nullb->index = list_empty(&nullb_list) ? 0 :
+		list_entry(nullb_list.prev, struct nullb, list)->index + 1;
+	list_add_tail(&nullb->list, &nullb_list);
+	mutex_unlock(&nullb_lock);
+
+	size = (sector_t)gb * 1024 * 1024 * 2;
+	set_capacity(disk, size);
+
+	disk->flags |= GENHD_FL_EXT_DEVT;
+	disk->major = null_major;
+	disk->first_minor = nullb->index;
+	disk->fops = &null_fops;
+	disk->private_data = nullb;
+	disk->queue = nullb->q;
+	sprintf(disk->disk_name, "nullb%d", nullb->index);
+	add_disk(disk);
+	return 0;
+
+out_cleanup:
+	blk_cleanup_queue(nullb->q);
+out_free:
+	kfree(nullb);
+	return -ENOMEM;
+}
+
+static void null_del_dev(struct nullb *nullb)
+{
+	list_del_init(&nullb->list);
+	del_gendisk(nullb->disk);
+	blk_cleanup_queue(nullb->q);
+	put_disk(nullb->disk);
+	kfree(nullb);
+}
+
+static void null_del_all(void)
+{
+	struct nullb *nullb;
+
+	mutex_lock(&nullb_lock);
+	while (!list_empty(&nullb_list)) {
+		nullb = list_entry(nullb_list.next, struct nullb, list);
+		null_del_dev(nullb);
+	}
+	mutex_unlock(&nullb_lock);
+}
+
+static int __init null_init(void)
+{
+	int i;
+
+	if (bs < 512 || bs > PAGE_SIZE || !is_power_of_2(bs)) {
+		pr_warn("null_blk: invalid block size %d, using 512\n", bs);
+		bs = 512;
+	}
+	if (queue_mode < NULL_Q_BIO || queue_mode > NULL_Q_MQ)
+		queue_mode = NULL_Q_MQ;
+	if (submit_queues <= 0 || submit_queues > nr_cpu_ids)
+		submit_queues = num_online_cpus();
+	if (hw_queue_depth <= 0 || hw_queue_depth > BLK_MQ_MAX_DEPTH)
+		hw_queue_depth = 64;
+
+	null_major = register_blkdev(0, "nullb");
+	if (null_major < 0)
+		return null_major;
+
+	for (i = 0; i < nr_devices; i++) {
+		if (null_add_dev()) {
+			null_del_all();
+			unregister_blkdev(null_major, "nullb");
+			return -ENOMEM;
+		}
+	}
+
+	pr_info("null_blk: module loaded\n");
+	return 0;
+}
+
+static void __exit null_exit(void)
+{
+	null_del_all();
+	unregister_blkdev(null_major, "nullb");
+}
+
+module_init(null_init);
+module_exit(null_exit);
+
+MODULE_LICENSE("GPL");
@@ -19,6 +19,9 @@
 #include <linux/workqueue.h>
 #include <linux/backing-dev.h>
 #include <linux/percpu.h>
+#include <linux/cpu.h>
+#include <linux/rbtree.h>
+#include <linux/sched.h>
 #include <linux/atomic.h>
 #include <linux/scatterlist.h>
 #include <asm/page.h>
@@ -42,8 +45,10 @@ struct convert_context {
 	unsigned int offset_out;
 	unsigned int idx_in;
 	unsigned int idx_out;
+	unsigned int sectors_left;
 	sector_t sector;
 	atomic_t pending;
+	u64 start_time;
 };
 
 /*
@@ -60,6 +65,10 @@ struct dm_crypt_io {
 	int error;
 	sector_t sector;
 	struct dm_crypt_io *base_io;
+
+	/* Bytes of base_bio covered by a chunk of a split bio, else 0 */
+	unsigned int chunk_size;
+	struct rb_node rb_node;
 };
 
 struct dm_crypt_request {
@@ -102,7 +111,8 @@ struct iv_lmk_private {
  * Crypt: maps a linear range of a block device
  * and encrypts / decrypts at the same time.
  */
-enum flags { DM_CRYPT_SUSPENDED, DM_CRYPT_KEY_VALID };
+enum flags { DM_CRYPT_SUSPENDED, DM_CRYPT_KEY_VALID,
+	     DM_CRYPT_PARALLEL, DM_CRYPT_SORT_WRITES };
 
 /*
  * Duplicated per-CPU state for cipher.
@@ -111,6 +121,18 @@ struct crypt_cpu {
 	struct ablkcipher_request *req;
 	/* ESSIV: struct crypto_cipher *essiv_tfm */
 	void *iv_private;
+
+	/*
+	 * Statistics, summed over all CPUs for the status line. They are
+	 * updated from completion context too, hence the irqsafe_cpu ops,
+	 * and convert_ns is atomic64_t so that it reads whole on 32-bit.
+	 */
+	unsigned long queued;		/* ios handed to kcryptd */
+	unsigned long dequeued;		/* ... and picked up by it */
+	unsigned long chunks;		/* chunks split off large bios */
+	unsigned long converted;	/* finished conversions */
+	atomic64_t convert_ns;		/* time spent in them */
+
 	struct crypto_ablkcipher *tfms[0];
 };
 
@@ -134,6 +156,14 @@ struct crypt_config {
 	struct workqueue_struct *io_queue;
 	struct workqueue_struct *crypt_queue;
 
+	/*
+	 * With sort_writes, encrypted write clones are collected here and
+	 * submitted in sector order by write_work on io_queue.
+	 */
+	spinlock_t write_lock;
+	struct rb_root write_tree;
+	struct work_struct write_work;
+
 	char *cipher;
 	char *cipher_string;
 
@@ -177,6 +207,12 @@ struct crypt_config {
 #define MIN_IOS        16
 #define MIN_POOL_PAGES 32
 
+/*
+ * In parallel mode, bios larger than this are split into chunks of this
+ * many sectors, each converted by the kcryptd worker of a different CPU.
+ */
+#define DM_CRYPT_CHUNK_SECTORS	128
+
 static struct kmem_cache *_crypt_io_pool;
 
 static void clone_init(struct dm_crypt_io *, struct bio *);
@@ -664,6 +700,7 @@ static void crypt_convert_init(struct crypt_config *cc,
 	ctx->offset_out = 0;
 	ctx->idx_in = bio_in ? bio_in->bi_idx : 0;
 	ctx->idx_out = bio_out ? bio_out->bi_idx : 0;
+	ctx->sectors_left = bio_in ? bio_sectors(bio_in) : 0;
 	ctx->sector = sector + cc->iv_offset;
 	init_completion(&ctx->restart);
 }
@@ -770,8 +807,10 @@ static int crypt_convert(struct crypt_config *cc,
 	int r;
 
 	atomic_set(&ctx->pending, 1);
+	ctx->start_time = local_clock();
 
-	while(ctx->idx_in < ctx->bio_in->bi_vcnt &&
+	while(ctx->sectors_left &&
+	      ctx->idx_in < ctx->bio_in->bi_vcnt &&
 	      ctx->idx_out < ctx->bio_out->bi_vcnt) {
 
 		crypt_alloc_req(cc, ctx);
@@ -789,12 +828,14 @@ static int crypt_convert(struct crypt_config *cc,
 		case -EINPROGRESS:
 			this_cc->req = NULL;
 			ctx->sector++;
+			ctx->sectors_left--;
 			continue;
 
 		/* sync */
 		case 0:
 			atomic_dec(&ctx->pending);
 			ctx->sector++;
+			ctx->sectors_left--;
 			cond_resched();
 			continue;
 
@@ -808,6 +849,17 @@ static int crypt_convert(struct crypt_config *cc,
 	return 0;
 }
 
+/*
+ * Called once all blocks of a conversion have completed.
+ */
+static void crypt_convert_done(struct crypt_config *cc,
+			       struct convert_context *ctx)
+{
+	irqsafe_cpu_inc(cc->cpu->converted);
+	atomic64_add(local_clock() - ctx->start_time,
+		     &__this_cpu_ptr(cc->cpu)->convert_ns);
+}
+
 static void dm_crypt_bio_destructor(struct bio *bio)
 {
 	struct dm_crypt_io *io = bio->bi_private;
@@ -896,6 +948,7 @@ static struct dm_crypt_io *crypt_io_alloc(struct dm_target *ti,
 	io->sector = sector;
 	io->error = 0;
 	io->base_io = NULL;
+	io->chunk_size = 0;
 	atomic_set(&io->pending, 0);
 
 	return io;
@@ -1044,6 +1097,62 @@ static void kcryptd_queue_io(struct dm_crypt_io *io)
 	queue_work(cc->io_queue, &io->work);
 }
 
+/*
+ * sort_writes: hand the encrypted clone to write_work, which submits
+ * everything collected so far in ascending sector order. Writes coming
+ * back from several crypt workers reach the device sorted and plugged
+ * instead of in whatever order the CPUs finished them.
+ */
+static void kcryptd_queue_write_sorted(struct dm_crypt_io *io)
+{
+	struct crypt_config *cc = io->target->private;
+	sector_t sector = io->ctx.bio_out->bi_sector;
+	struct rb_node **p, *parent = NULL;
+	unsigned long flags;
+
+	spin_lock_irqsave(&cc->write_lock, flags);
+	p = &cc->write_tree.rb_node;
+	while (*p) {
+		parent = *p;
+		if (sector < rb_entry(parent, struct dm_crypt_io,
+				      rb_node)->ctx.bio_out->bi_sector)
+			p = &parent->rb_left;
+		else
+			p = &parent->rb_right;
+	}
+	rb_link_node(&io->rb_node, parent, p);
+	rb_insert_color(&io->rb_node, &cc->write_tree);
+	spin_unlock_irqrestore(&cc->write_lock, flags);
+
+	queue_work(cc->io_queue, &cc->write_work);
+}
+
+static void kcryptd_io_write_sorted(struct work_struct *work)
+{
+	struct crypt_config *cc = container_of(work, struct crypt_config,
+					       write_work);
+	struct rb_root write_tree;
+	struct dm_crypt_io *io;
+	struct blk_plug plug;
+
+	spin_lock_irq(&cc->write_lock);
+	write_tree = cc->write_tree;
+	cc->write_tree = RB_ROOT;
+	spin_unlock_irq(&cc->write_lock);
+
+	if (RB_EMPTY_ROOT(&write_tree))
+		return;
+
+	blk_start_plug(&plug);
+	do {
+		io = rb_entry(rb_first(&write_tree), struct dm_crypt_io,
+			      rb_node);
+		rb_erase(&io->rb_node, &write_tree);
+		kcryptd_io_write(io);
+	} while (!RB_EMPTY_ROOT(&write_tree));
+	blk_finish_plug(&plug);
+}
+
 static void kcryptd_crypt_write_io_submit(struct dm_crypt_io *io, int async)
 {
 	struct bio *clone = io->ctx.bio_out;
@@ -1061,12 +1170,110 @@ static void kcryptd_crypt_write_io_submit(struct dm_crypt_io *io, int async)
 
 	clone->bi_sector = cc->start + io->sector;
 
-	if (async)
+	if (test_bit(DM_CRYPT_SORT_WRITES, &cc->flags))
+		kcryptd_queue_write_sorted(io);
+	else if (async)
 		kcryptd_queue_io(io);
 	else
 		generic_make_request(clone);
 }
 
+static void kcryptd_crypt(struct work_struct *work);
+
+/*
+ * Should this bio be split across the crypt workers of several CPUs?
+ * Chunks and fragments are never split further.
+ */
+static bool kcryptd_crypt_should_split(struct dm_crypt_io *io)
+{
+	struct crypt_config *cc = io->target->private;
+
+	return test_bit(DM_CRYPT_PARALLEL, &cc->flags) &&
+	       !io->base_io &&
+	       bio_sectors(io->base_bio) > DM_CRYPT_CHUNK_SECTORS &&
+	       num_online_cpus() > 1;
+}
+
+/*
+ * Carve io->base_bio into chunks of DM_CRYPT_CHUNK_SECTORS and queue each
+ * one, as a dm_crypt_io of its own accounted against io, on the crypt
+ * worker of the next online CPU. The chunks complete in any order; the
+ * base bio is ended by the last one through crypt_dec_pending().
+ */
+static void kcryptd_crypt_split(struct dm_crypt_io *io)
+{
+	struct crypt_config *cc = io->target->private;
+	struct bio *base_bio = io->base_bio;
+	struct dm_crypt_io *chunk;
+	unsigned idx = base_bio->bi_idx, offset = 0;
+	unsigned remaining = bio_sectors(base_bio);
+	sector_t sector = io->sector;
+	unsigned n, len;
+	int cpu;
+
+	/* Prevent io from disappearing until all chunks are queued */
+	crypt_inc_pending(io);
+
+	get_online_cpus();
+	cpu = raw_smp_processor_id();
+
+	while (remaining) {
+		n = min_t(unsigned, remaining, DM_CRYPT_CHUNK_SECTORS);
+
+		chunk = crypt_io_alloc(io->target, base_bio, sector);
+		chunk->base_io = io;
+		chunk->chunk_size = n << SECTOR_SHIFT;
+		crypt_inc_pending(io);
+
+		crypt_convert_init(cc, &chunk->ctx, NULL, base_bio, sector);
+		chunk->ctx.idx_in = idx;
+		chunk->ctx.offset_in = offset;
+		chunk->ctx.sectors_left = n;
+
+		/*
+		 * A read chunk is decrypted in place and starts out with the
+		 * reference that the read clone holds for an unsplit bio,
+		 * dropped by kcryptd_crypt_read_done().
+		 */
+		if (bio_data_dir(base_bio) == READ) {
+			chunk->ctx.bio_out = base_bio;
+			chunk->ctx.idx_out = idx;
+			chunk->ctx.offset_out = offset;
+			crypt_inc_pending(chunk);
+		}
+
+		/* Step over the chunk in the base bio */
+		len = chunk->chunk_size;
+		while (len) {
+			struct bio_vec *bv = bio_iovec_idx(base_bio, idx);
+			unsigned step = min(len, bv->bv_len - offset);
+
+			len -= step;
+			offset += step;
+			if (offset == bv->bv_len) {
+				offset = 0;
+				idx++;
+			}
+		}
+
+		sector += n;
+		remaining -= n;
+
+		cpu = cpumask_next(cpu, cpu_online_mask);
+		if (cpu >= nr_cpu_ids)
+			cpu = cpumask_first(cpu_online_mask);
+
+		irqsafe_cpu_inc(cc->cpu->chunks);
+		irqsafe_cpu_inc(cc->cpu->queued);
+		INIT_WORK(&chunk->work, kcryptd_crypt);
+		queue_work_on(cpu, cc->crypt_queue, &chunk->work);
+	}
+
+	put_online_cpus();
+
+	crypt_dec_pending(io);
+}
+
 static void kcryptd_crypt_write_convert(struct dm_crypt_io *io)
 {
 	struct crypt_config *cc = io->target->private;
@@ -1074,15 +1281,23 @@ static void kcryptd_crypt_write_convert(struct dm_crypt_io *io)
 	struct dm_crypt_io *new_io;
 	int crypt_finished;
 	unsigned out_of_pages = 0;
-	unsigned remaining = io->base_bio->bi_size;
+	unsigned remaining = io->chunk_size ? : io->base_bio->bi_size;
 	sector_t sector = io->sector;
 	int r;
 
+	if (kcryptd_crypt_should_split(io)) {
+		kcryptd_crypt_split(io);
+		return;
+	}
+
 	/*
 	 * Prevent io from disappearing until this function completes.
 	 */
 	crypt_inc_pending(io);
-	crypt_convert_init(cc, &io->ctx, NULL, io->base_bio, sector);
+
+	/* Chunks of a split bio come with their context set up */
+	if (!io->chunk_size)
+		crypt_convert_init(cc, &io->ctx, NULL, io->base_bio, sector);
 
 	/*
 	 * The allocated buffers can be smaller than the whole bio,
@@ -1111,6 +1326,7 @@ static void kcryptd_crypt_write_convert(struct dm_crypt_io *io)
 
 		/* Encryption was already finished, submit io now */
 		if (crypt_finished) {
+			crypt_convert_done(cc, &io->ctx);
 			kcryptd_crypt_write_io_submit(io, 0);
 
 			/*
@@ -1133,8 +1349,12 @@ static void kcryptd_crypt_write_convert(struct dm_crypt_io *io)
 		/*
 		 * With async crypto it is unsafe to share the crypto context
 		 * between fragments, so switch to a new dm_crypt_io structure.
+		 * The same goes for sorted writes, where the submitted io
+		 * waits in the write tree.
 		 */
-		if (unlikely(!crypt_finished && remaining)) {
+		if (unlikely((!crypt_finished ||
+			      test_bit(DM_CRYPT_SORT_WRITES, &cc->flags)) &&
+			     remaining)) {
 			new_io = crypt_io_alloc(io->target, io->base_bio,
 						sector);
 			crypt_inc_pending(new_io);
@@ -1142,6 +1362,7 @@ static void kcryptd_crypt_write_convert(struct dm_crypt_io *io)
 					   io->base_bio, sector);
 			new_io->ctx.idx_in = io->ctx.idx_in;
 			new_io->ctx.offset_in = io->ctx.offset_in;
+			new_io->ctx.sectors_left = io->ctx.sectors_left;
 
 			/*
 			 * Fragments after the first use the base_io
@@ -1172,17 +1393,27 @@ static void kcryptd_crypt_read_convert(struct dm_crypt_io *io)
 	struct crypt_config *cc = io->target->private;
 	int r = 0;
 
+	if (kcryptd_crypt_should_split(io)) {
+		kcryptd_crypt_split(io);
+		kcryptd_crypt_read_done(io);
+		return;
+	}
+
 	crypt_inc_pending(io);
 
-	crypt_convert_init(cc, &io->ctx, io->base_bio, io->base_bio,
-			   io->sector);
+	/* Chunks of a split bio come with their context set up */
+	if (!io->chunk_size)
+		crypt_convert_init(cc, &io->ctx, io->base_bio, io->base_bio,
+				   io->sector);
 
 	r = crypt_convert(cc, &io->ctx);
 	if (r < 0)
 		io->error = -EIO;
 
-	if (atomic_dec_and_test(&io->ctx.pending))
+	if (atomic_dec_and_test(&io->ctx.pending)) {
+		crypt_convert_done(cc, &io->ctx);
 		kcryptd_crypt_read_done(io);
+	}
 
 	crypt_dec_pending(io);
 }
@@ -1211,6 +1442,8 @@ static void kcryptd_async_done(struct crypto_async_request *async_req,
 	if (!atomic_dec_and_test(&ctx->pending))
 		return;
 
+	crypt_convert_done(cc, ctx);
+
 	if (bio_data_dir(io->base_bio) == READ)
 		kcryptd_crypt_read_done(io);
 	else
@@ -1220,6 +1453,9 @@ static void kcryptd_async_done(struct crypto_async_request *async_req,
 static void kcryptd_crypt(struct work_struct *work)
 {
 	struct dm_crypt_io *io = container_of(work, struct dm_crypt_io, work);
+	struct crypt_config *cc = io->target->private;
+
+	irqsafe_cpu_inc(cc->cpu->dequeued);
 
 	if (bio_data_dir(io->base_bio) == READ)
 		kcryptd_crypt_read_convert(io);
@@ -1231,6 +1467,7 @@ static void kcryptd_queue_crypt(struct dm_crypt_io *io)
 {
 	struct crypt_config *cc = io->target->private;
 
+	irqsafe_cpu_inc(cc->cpu->queued);
 	INIT_WORK(&io->work, kcryptd_crypt);
 	queue_work(cc->crypt_queue, &io->work);
 }
@@ -1583,7 +1820,7 @@ static int crypt_ctr(struct dm_target *ti, unsigned int argc, char **argv)
 	const char *opt_string;
 
 	static struct dm_arg _args[] = {
-		{0, 1, "Invalid number of feature args"},
+		{0, 3, "Invalid number of feature args"},
 	};
 
 	if (argc < 5) {
@@ -1667,18 +1904,32 @@ static int crypt_ctr(struct dm_target *ti, unsigned int argc, char **argv)
 		if (ret)
 			goto bad;
 
-		opt_string = dm_shift_arg(&as);
+		while (opt_params--) {
+			opt_string = dm_shift_arg(&as);
+			if (!opt_string) {
+				ret = -EINVAL;
+				ti->error = "Not enough feature arguments";
+				goto bad;
+			}
 
-		if (opt_params == 1 && opt_string &&
-		    !strcasecmp(opt_string, "allow_discards"))
-			ti->num_discard_requests = 1;
-		else if (opt_params) {
-			ret = -EINVAL;
-			ti->error = "Invalid feature arguments";
-			goto bad;
+			if (!strcasecmp(opt_string, "allow_discards"))
+				ti->num_discard_requests = 1;
+			else if (!strcasecmp(opt_string, "parallel"))
+				set_bit(DM_CRYPT_PARALLEL, &cc->flags);
+			else if (!strcasecmp(opt_string, "sort_writes"))
+				set_bit(DM_CRYPT_SORT_WRITES, &cc->flags);
+			else {
+				ret = -EINVAL;
+				ti->error = "Invalid feature arguments";
+				goto bad;
+			}
 		}
 	}
 
+	spin_lock_init(&cc->write_lock);
+	cc->write_tree = RB_ROOT;
+	INIT_WORK(&cc->write_work, kcryptd_io_write_sorted);
+
 	ret = -ENOMEM;
 	cc->io_queue = alloc_workqueue("kcryptd_io",
 				       WQ_NON_REENTRANT|
@@ -1743,11 +1994,28 @@ static int crypt_status(struct dm_target *ti, status_type_t type,
 			char *result, unsigned int maxlen)
 {
 	struct crypt_config *cc = ti->private;
-	unsigned int sz = 0;
+	struct crypt_cpu *cpu_cc;
+	unsigned long queued = 0, dequeued = 0, chunks = 0, converted = 0;
+	u64 convert_ns = 0;
+	unsigned int sz = 0, num_feature_args;
+	int cpu;
 
 	switch (type) {
 	case STATUSTYPE_INFO:
-		result[0] = '\0';
+		/*
+		 * <queue depth> <chunks> <conversions> <conversion usecs>
+		 */
+		for_each_possible_cpu(cpu) {
+			cpu_cc = per_cpu_ptr(cc->cpu, cpu);
+			queued += cpu_cc->queued;
+			dequeued += cpu_cc->dequeued;
+			chunks += cpu_cc->chunks;
+			converted += cpu_cc->converted;
+			convert_ns += atomic64_read(&cpu_cc->convert_ns);
+		}
+		do_div(convert_ns, NSEC_PER_USEC);
+		DMEMIT("%ld %lu %lu %llu", (long)(queued - dequeued), chunks,
+		       converted, (unsigned long long)convert_ns);
 		break;
 
 	case STATUSTYPE_TABLE:
@@ -1768,8 +2036,18 @@ static int crypt_status(struct dm_target *ti, status_type_t type,
 		DMEMIT(" %llu %s %llu", (unsigned long long)cc->iv_offset,
 				cc->dev->name, (unsigned long long)cc->start);
 
-		if (ti->num_discard_requests)
-			DMEMIT(" 1 allow_discards");
+		num_feature_args = !!ti->num_discard_requests +
+			!!test_bit(DM_CRYPT_PARALLEL, &cc->flags) +
+			!!test_bit(DM_CRYPT_SORT_WRITES, &cc->flags);
+		if (num_feature_args) {
+			DMEMIT(" %u", num_feature_args);
+			if (ti->num_discard_requests)
+				DMEMIT(" allow_discards");
+			if (test_bit(DM_CRYPT_PARALLEL, &cc->flags))
+				DMEMIT(" parallel");
+			if (test_bit(DM_CRYPT_SORT_WRITES, &cc->flags))
+				DMEMIT(" sort_writes");
+		}
 
 		break;
 	}
@@ -1867,7 +2145,7 @@ static int crypt_iterate_devices(struct dm_target *ti,
 
 static struct target_type crypt_target = {
 	.name   = "crypt",
-	.version = {1, 11, 0},
+	.version = {1, 12, 0},
 	.module = THIS_MODULE,
 	.ctr    = crypt_ctr,
 	.dtr    = crypt_dtr,
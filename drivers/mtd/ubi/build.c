@@ -575,20 +575,23 @@ static void free_internal_volumes(struct ubi_device *ubi)
  * This function returns zero in case of success and a negative error code in
  * case of failure.
  *
- * Note, currently this is the only method to attach UBI devices. Hopefully in
- * the future we'll have more scalable attaching methods and avoid full media
- * scanning. But even in this case scanning will be needed as a fall-back
- * attaching method if there are some on-flash table corruptions.
+ * Note, if the fastmap is enabled, 'ubi_scan()' tries to build the scanning
+ * information from it first, and scans the whole media only if there is no
+ * usable fastmap.
  */
 static int attach_by_scanning(struct ubi_device *ubi)
 {
 	int err;
 	struct ubi_scan_info *si;
+	unsigned long start = jiffies;
 
 	si = ubi_scan(ubi);
 	if (IS_ERR(si))
 		return PTR_ERR(si);
 
+	ubi_msg("%s took %u ms", si->is_fastmap ? "fastmap attach" : "scanning",
+		jiffies_to_msecs(jiffies - start));
+
 	ubi->bad_peb_count = si->bad_peb_count;
 	ubi->good_peb_count = ubi->peb_count - ubi->bad_peb_count;
 	ubi->corr_peb_count = si->corr_peb_count;
@@ -940,6 +943,8 @@ int ubi_attach_mtd_dev(struct mtd_info *mtd, int ubi_num, int vid_hdr_offset)
 	mutex_init(&ubi->ckvol_mutex);
 	mutex_init(&ubi->device_mutex);
 	spin_lock_init(&ubi->volumes_lock);
+	init_rwsem(&ubi->fm_eba_sem);
+	mutex_init(&ubi->fm_mutex);
 
 	ubi_msg("attaching mtd%d to ubi%d", mtd->index, ubi_num);
 	dbg_msg("sizeof(struct ubi_scan_leb) %zu", sizeof(struct ubi_scan_leb));
@@ -958,6 +963,10 @@ int ubi_attach_mtd_dev(struct mtd_info *mtd, int ubi_num, int vid_hdr_offset)
 	if (!ubi->peb_buf2)
 		goto out_free;
 
+	err = ubi_fastmap_init(ubi);
+	if (err)
+		goto out_free;
+
 	err = ubi_debugging_init_dev(ubi);
 	if (err)
 		goto out_free;
@@ -974,6 +983,11 @@ int ubi_attach_mtd_dev(struct mtd_info *mtd, int ubi_num, int vid_hdr_offset)
 			goto out_detach;
 	}
 
+	/* Record the attached state, this also fills the fastmap pools */
+	err = ubi_update_fastmap(ubi);
+	if (err)
+		goto out_detach;
+
 	err = uif_init(ubi, &ref);
 	if (err)
 		goto out_detach;
@@ -1034,6 +1048,7 @@ out_detach:
 out_debugging:
 	ubi_debugging_exit_dev(ubi);
 out_free:
+	ubi_fastmap_close(ubi);
 	vfree(ubi->peb_buf1);
 	vfree(ubi->peb_buf2);
 	if (ref)
@@ -1093,6 +1108,15 @@ int ubi_detach_mtd_dev(int ubi_num, int anyway)
 	if (ubi->bgt_thread)
 		kthread_stop(ubi->bgt_thread);
 
+	/*
+	 * Write the final fastmap while the volumes are still there, so that
+	 * the next attach is a fast one. The thread is gone, do not wake it.
+	 */
+	spin_lock(&ubi->wl_lock);
+	ubi->thread_enabled = 0;
+	spin_unlock(&ubi->wl_lock);
+	ubi_update_fastmap(ubi);
+
 	/*
 	 * Get a reference to the device in order to prevent 'dev_release()'
 	 * from freeing the @ubi object.
@@ -1106,6 +1130,7 @@ int ubi_detach_mtd_dev(int ubi_num, int anyway)
 	vfree(ubi->vtbl);
 	put_mtd_device(ubi->mtd);
 	ubi_debugging_exit_dev(ubi);
+	ubi_fastmap_close(ubi);
 	vfree(ubi->peb_buf1);
 	vfree(ubi->peb_buf2);
 	ubi_msg("mtd%d is detached from ubi%d", ubi->mtd->index, ubi->ubi_num);
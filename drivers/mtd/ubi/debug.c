@@ -403,6 +403,75 @@ static const struct file_operations dfs_fops = {
 	.owner  = THIS_MODULE,
 };
 
+/* Read the WL statistics debugfs file */
+static ssize_t dfs_wl_stats_read(struct file *file, char __user *user_buf,
+				 size_t count, loff_t *ppos)
+{
+	unsigned long ubi_num = (unsigned long)file->private_data;
+	struct ubi_device *ubi;
+	struct ubi_wl_stats st;
+	struct ubi_work *wrk;
+	int len, free_count, deferred = 0;
+	int erase = 0, torture = 0, other = 0;
+	char *buf;
+
+	ubi = ubi_get_device(ubi_num);
+	if (!ubi)
+		return -ENODEV;
+
+	buf = kmalloc(PAGE_SIZE, GFP_KERNEL);
+	if (!buf) {
+		count = -ENOMEM;
+		goto out;
+	}
+
+	spin_lock(&ubi->wl_lock);
+	list_for_each_entry(wrk, &ubi->works, list)
+		if (!ubi_is_erase_work(wrk))
+			other += 1;
+		else if (wrk->torture)
+			torture += 1;
+		else
+			erase += 1;
+	free_count = ubi->free_count;
+#ifdef CONFIG_MTD_UBI_FASTMAP
+	deferred = ubi->fm_deferred_count;
+#endif
+	st = ubi->wl_stats;
+	spin_unlock(&ubi->wl_lock);
+
+	len = snprintf(buf, PAGE_SIZE,
+		       "free PEBs:             %d\n"
+		       "erase reserve:         %d\n"
+		       "queued erasures:       %d\n"
+		       "queued torture tests:  %d\n"
+		       "queued other works:    %d\n"
+		       "deferred erasures:     %d\n"
+		       "erased PEBs:           %llu\n"
+		       "tortured PEBs:         %llu\n"
+		       "erase batches:         %llu\n"
+		       "writer stalls:         %llu\n"
+		       "stall time, us:        %llu\n"
+		       "max. stall time, us:   %u\n",
+		       free_count, CONFIG_MTD_UBI_ERASE_RESERVE, erase, torture,
+		       other, deferred, st.erased, st.tortured, st.batches,
+		       st.stalls, st.stall_us, st.max_stall_us);
+	count = simple_read_from_buffer(user_buf, count, ppos, buf, len);
+	kfree(buf);
+
+out:
+	ubi_put_device(ubi);
+	return count;
+}
+
+/* File operations for the WL statistics debugfs file */
+static const struct file_operations dfs_wl_stats_fops = {
+	.read   = dfs_wl_stats_read,
+	.open   = default_open,
+	.llseek = no_llseek,
+	.owner  = THIS_MODULE,
+};
+
 /**
  * ubi_debugfs_init_dev - initialize debugfs for an UBI device.
  * @ubi: UBI device description object
@@ -468,6 +537,13 @@ int ubi_debugfs_init_dev(struct ubi_device *ubi)
 		goto out_remove;
 	d->dfs_emulate_io_failures = dent;
 
+	fname = "wl_stats";
+	dent = debugfs_create_file(fname, S_IRUSR, d->dfs_dir, (void *)ubi_num,
+				   &dfs_wl_stats_fops);
+	if (IS_ERR_OR_NULL(dent))
+		goto out_remove;
+	d->dfs_wl_stats = dent;
+
 	return 0;
 
 out_remove:
@@ -98,6 +98,7 @@ void ubi_debugfs_exit_dev(struct ubi_device *ubi);
  * @dfs_disable_bgt: debugfs knob to disable the background task
  * @dfs_emulate_bitflips: debugfs knob to emulate bit-flips
  * @dfs_emulate_io_failures: debugfs knob to emulate write/erase failures
+ * @dfs_wl_stats: debugfs file with the WL work queue statistics
  */
 struct ubi_debug_info {
 	unsigned int chk_gen:1;
@@ -112,6 +113,7 @@ struct ubi_debug_info {
 	struct dentry *dfs_disable_bgt;
 	struct dentry *dfs_emulate_bitflips;
 	struct dentry *dfs_emulate_io_failures;
+	struct dentry *dfs_wl_stats;
 };
 
 /**
@@ -0,0 +1,1187 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See
+ * the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ */
+
+/*
+ * UBI fastmap sub-system.
+ *
+ * Attaching an MTD device normally means reading the EC and VID headers of
+ * every physical eraseblock, so the attach time grows linearly with the flash
+ * size. The fastmap is a snapshot of the attaching information - the EBA
+ * tables of all volumes and the state and erase counter of every PEB - which
+ * is stored on the flash itself and lets UBI attach by reading only a few
+ * dozens of PEBs.
+ *
+ * The fastmap occupies a few PEBs below %UBI_FM_MAX_START. The first of them,
+ * the anchor, holds &struct ubi_fm_sb which lists the others. At attach time
+ * the PEBs below %UBI_FM_MAX_START are scanned for anchors, and the one with
+ * the highest sequence number is used.
+ *
+ * A fastmap only stays valid if the PEBs it describes do not change behind its
+ * back. This is ensured as follows.
+ *
+ * o Free PEBs are handed out only through the pools (see
+ *   &struct ubi_fm_pool), which are recorded in the fastmap and are always
+ *   scanned at attach time. When a pool is exhausted, a new fastmap is written
+ *   and the pools are refilled.
+ * o PEBs which the fastmap records as holding data are not erased until the
+ *   next fastmap is written (see @ubi->fm_deferred in the WL sub-system).
+ * o New fastmap PEBs are free PEBs below %UBI_FM_MAX_START, which are scanned
+ *   at attach time anyway, so a half-written fastmap cannot go unnoticed.
+ *
+ * Whenever something does not add up at attach time, UBI warns and falls back
+ * to scanning the whole flash, exactly as without the fastmap. A fastmap is
+ * written at attach and detach time and whenever a pool runs empty.
+ */
+
+#include <linux/crc32.h>
+#include <linux/bitmap.h>
+#include "ubi.h"
+
+/* States of the PEBs while attaching from the fastmap */
+enum {
+	FM_PEB_UNKNOWN = 0,
+	FM_PEB_FREE,
+	FM_PEB_USED,
+	FM_PEB_SCRUB,
+	FM_PEB_ERASE,
+	FM_PEB_POOL,
+	FM_PEB_BLOCK,
+};
+
+/* Flag of used PEBs referred to by an EBA table entry */
+#define FM_PEB_MAPPED 0x80
+
+/* What the headers of a PEB in the anchor area look like */
+enum {
+	AREA_OTHER = 0,
+	AREA_BAD,
+	AREA_EMPTY,
+	AREA_ANCHOR,
+};
+
+/**
+ * struct fm_attach_info - temporary state of attaching from the fastmap.
+ * @anchor: the fastmap anchor PEB, %-1 if none was found
+ * @sqnum: sequence number of the anchor
+ * @image_seq: image sequence number found in the EC header of the anchor
+ * @area: what the PEBs of the anchor area contain (%AREA_OTHER, etc)
+ * @area_ec: erase counters of the PEBs of the anchor area
+ * @state: state of each PEB according to the fastmap (%FM_PEB_FREE, etc)
+ * @ec: erase counter of each PEB according to the fastmap
+ * @ech: EC header buffer
+ * @vidh: VID header buffer
+ */
+struct fm_attach_info {
+	int anchor;
+	unsigned long long sqnum;
+	int image_seq;
+	u8 area[UBI_FM_MAX_START];
+	int area_ec[UBI_FM_MAX_START];
+	u8 *state;
+	int *ec;
+	struct ubi_ec_hdr *ech;
+	struct ubi_vid_hdr *vidh;
+};
+
+/**
+ * ubi_fastmap_init - initialize the fastmap sub-system.
+ * @ubi: UBI device description object
+ *
+ * This function calculates the size of the fastmap and of the pools for the
+ * geometry of @ubi and allocates the fastmap buffers. Returns zero in case of
+ * success and a negative error code in case of failure.
+ */
+int ubi_fastmap_init(struct ubi_device *ubi)
+{
+	size_t size;
+
+	size = sizeof(struct ubi_fm_sb) + sizeof(struct ubi_fm_hdr) +
+	       2 * sizeof(struct ubi_fm_scan_pool) +
+	       ubi->peb_count * (sizeof(struct ubi_fm_ec) + sizeof(__be32)) +
+	       (UBI_MAX_VOLUMES + UBI_INT_VOL_COUNT) *
+	       sizeof(struct ubi_fm_volhdr);
+	ubi->fm_size = roundup(size, ubi->leb_size);
+
+	if (ubi->fm_size / ubi->leb_size > UBI_FM_MAX_BLOCKS) {
+		ubi_msg("fastmap would need %d PEBs, more than %d, not using it",
+			ubi->fm_size / ubi->leb_size, UBI_FM_MAX_BLOCKS);
+		ubi->fm_disabled = 1;
+		return 0;
+	}
+
+	ubi->fm_pool.max_size = clamp(ubi->peb_count / 20,
+				      UBI_FM_MIN_POOL_SIZE,
+				      UBI_FM_MAX_POOL_SIZE);
+	ubi->fm_wl_pool.max_size = ubi->fm_pool.max_size / 2;
+
+	ubi->fm_recorded = kcalloc(BITS_TO_LONGS(ubi->peb_count),
+				   sizeof(unsigned long), GFP_KERNEL);
+	if (!ubi->fm_recorded)
+		return -ENOMEM;
+
+	ubi->fm_buf = vmalloc(ubi->fm_size);
+	if (!ubi->fm_buf) {
+		kfree(ubi->fm_recorded);
+		ubi->fm_recorded = NULL;
+		return -ENOMEM;
+	}
+
+	dbg_msg("fastmap size %d bytes, pool sizes %d/%d", ubi->fm_size,
+		ubi->fm_pool.max_size, ubi->fm_wl_pool.max_size);
+	return 0;
+}
+
+/**
+ * ubi_fastmap_close - free the fastmap buffers.
+ * @ubi: UBI device description object
+ */
+void ubi_fastmap_close(struct ubi_device *ubi)
+{
+	vfree(ubi->fm_buf);
+	kfree(ubi->fm_recorded);
+	ubi->fm_buf = NULL;
+	ubi->fm_recorded = NULL;
+}
+
+/**
+ * scan_anchor_area - read the headers of the PEBs the anchor may live in.
+ * @ubi: UBI device description object
+ * @fai: attach state to fill
+ *
+ * This function fills @fai->area and @fai->area_ec and finds the anchor with
+ * the highest sequence number. Returns zero in case of success and a negative
+ * error code in case of failure.
+ */
+static int scan_anchor_area(struct ubi_device *ubi,
+			    struct fm_attach_info *fai)
+{
+	int pnum, err, count = min(ubi->peb_count, UBI_FM_MAX_START);
+	unsigned long long sqnum;
+	long long ec;
+
+	fai->anchor = -1;
+	for (pnum = 0; pnum < count; pnum++) {
+		cond_resched();
+
+		err = ubi_io_is_bad(ubi, pnum);
+		if (err < 0)
+			return err;
+		if (err) {
+			fai->area[pnum] = AREA_BAD;
+			continue;
+		}
+
+		err = ubi_io_read_ec_hdr(ubi, pnum, fai->ech, 0);
+		if (err < 0)
+			return err;
+		if (err && err != UBI_IO_BITFLIPS)
+			continue;
+
+		ec = be64_to_cpu(fai->ech->ec);
+		if (fai->ech->version != UBI_VERSION ||
+		    ec > UBI_MAX_ERASECOUNTER)
+			continue;
+		fai->area_ec[pnum] = ec;
+
+		err = ubi_io_read_vid_hdr(ubi, pnum, fai->vidh, 0);
+		if (err < 0)
+			return err;
+		if (err == UBI_IO_FF) {
+			fai->area[pnum] = AREA_EMPTY;
+			continue;
+		}
+		if (err && err != UBI_IO_BITFLIPS)
+			continue;
+		if (be32_to_cpu(fai->vidh->vol_id) != UBI_FM_SB_VOLUME_ID)
+			continue;
+
+		fai->area[pnum] = AREA_ANCHOR;
+		sqnum = be64_to_cpu(fai->vidh->sqnum);
+		dbg_bld("fastmap anchor at PEB %d, sqnum %llu", pnum, sqnum);
+		if (fai->anchor == -1 || sqnum > fai->sqnum) {
+			fai->anchor = pnum;
+			fai->sqnum = sqnum;
+			fai->image_seq = be32_to_cpu(fai->ech->image_seq);
+		}
+	}
+
+	return 0;
+}
+
+/**
+ * read_fastmap - read and check the fastmap.
+ * @ubi: UBI device description object
+ * @fai: attach state
+ * @buf: buffer of @ubi->fm_size bytes to read the fastmap to
+ *
+ * Returns zero if the fastmap was read and is intact, %UBI_NO_FASTMAP if it is
+ * not, and a negative error code in case of failure.
+ */
+static int read_fastmap(struct ubi_device *ubi, struct fm_attach_info *fai,
+			void *buf)
+{
+	struct ubi_fm_sb *fmsb = buf;
+	int i, err, pnum, used_blocks = ubi->fm_size / ubi->leb_size;
+	uint32_t crc;
+
+	for (i = 0; i < used_blocks; i++) {
+		if (i == 0)
+			pnum = fai->anchor;
+		else {
+			pnum = be32_to_cpu(fmsb->block_loc[i]);
+			if (pnum < 0 || pnum >= UBI_FM_MAX_START ||
+			    pnum >= ubi->peb_count) {
+				ubi_warn("bad fastmap PEB %d", pnum);
+				return UBI_NO_FASTMAP;
+			}
+
+			err = ubi_io_read_vid_hdr(ubi, pnum, fai->vidh, 0);
+			if (err < 0)
+				return err;
+			if ((err && err != UBI_IO_BITFLIPS) ||
+			    be32_to_cpu(fai->vidh->vol_id) !=
+						UBI_FM_DATA_VOLUME_ID ||
+			    be32_to_cpu(fai->vidh->lnum) != i ||
+			    be64_to_cpu(fai->vidh->sqnum) != fai->sqnum) {
+				ubi_warn("fastmap PEB %d does not belong to "
+					 "the fastmap at PEB %d", pnum,
+					 fai->anchor);
+				return UBI_NO_FASTMAP;
+			}
+		}
+
+		err = ubi_io_read_data(ubi, buf + i * ubi->leb_size, pnum, 0,
+				       ubi->leb_size);
+		if (err && err != UBI_IO_BITFLIPS) {
+			if (err != -EBADMSG)
+				return err;
+			ubi_warn("cannot read fastmap PEB %d", pnum);
+			return UBI_NO_FASTMAP;
+		}
+
+		if (i == 0 && (be32_to_cpu(fmsb->magic) != UBI_FM_SB_MAGIC ||
+			       fmsb->version != UBI_FM_FMT_VERSION ||
+			       be32_to_cpu(fmsb->used_blocks) != used_blocks ||
+			       be32_to_cpu(fmsb->block_loc[0]) != pnum ||
+			       be64_to_cpu(fmsb->sqnum) != fai->sqnum)) {
+			ubi_warn("bad fastmap super block at PEB %d", pnum);
+			return UBI_NO_FASTMAP;
+		}
+	}
+
+	crc = crc32(UBI_CRC32_INIT, buf + sizeof(struct ubi_fm_sb),
+		    ubi->fm_size - sizeof(struct ubi_fm_sb));
+	if (crc != be32_to_cpu(fmsb->data_crc)) {
+		ubi_warn("bad fastmap data CRC %#08x, stored %#08x", crc,
+			 be32_to_cpu(fmsb->data_crc));
+		return UBI_NO_FASTMAP;
+	}
+
+	return 0;
+}
+
+/**
+ * mark_peb - record the state of a PEB as found in the fastmap.
+ * @ubi: UBI device description object
+ * @fai: attach state
+ * @pnum: the physical eraseblock
+ * @state: the state of the PEB
+ * @ec: its erase counter
+ *
+ * Returns zero in case of success and %UBI_NO_FASTMAP if @pnum is invalid or
+ * is mentioned in the fastmap more than once.
+ */
+static int mark_peb(struct ubi_device *ubi, struct fm_attach_info *fai,
+		    int pnum, int state, int ec)
+{
+	if (pnum < 0 || pnum >= ubi->peb_count ||
+	    fai->state[pnum] != FM_PEB_UNKNOWN || ec > UBI_MAX_ERASECOUNTER) {
+		ubi_warn("bad fastmap record for PEB %d", pnum);
+		return UBI_NO_FASTMAP;
+	}
+
+	fai->state[pnum] = state;
+	fai->ec[pnum] = ec;
+	return 0;
+}
+
+/**
+ * add_peb - add a PEB to one of the lists of the scanning information.
+ * @si: scanning information
+ * @list: the list to add to
+ * @pnum: the physical eraseblock
+ * @ec: its erase counter
+ * @to_head: if not zero, add to the head of the list
+ *
+ * Returns zero in case of success and %-ENOMEM in case of failure.
+ */
+static int add_peb(struct ubi_scan_info *si, struct list_head *list,
+		   int pnum, int ec, int to_head)
+{
+	struct ubi_scan_leb *seb;
+
+	seb = kmem_cache_alloc(si->scan_leb_slab, GFP_KERNEL);
+	if (!seb)
+		return -ENOMEM;
+
+	seb->pnum = pnum;
+	seb->ec = ec;
+	seb->lnum = -1;
+	if (to_head)
+		list_add(&seb->u.list, list);
+	else
+		list_add_tail(&seb->u.list, list);
+
+	if (ec != UBI_SCAN_UNKNOWN_EC) {
+		si->ec_sum += ec;
+		si->ec_count += 1;
+		if (ec > si->max_ec)
+			si->max_ec = ec;
+		if (ec < si->min_ec)
+			si->min_ec = ec;
+	}
+
+	return 0;
+}
+
+/**
+ * add_fm_volumes - add the volumes recorded in the fastmap.
+ * @ubi: UBI device description object
+ * @si: scanning information
+ * @fai: attach state
+ * @buf: the fastmap
+ * @pos: offset of the first &struct ubi_fm_volhdr in @buf
+ * @vol_count: number of recorded volumes
+ *
+ * Returns zero in case of success, %UBI_NO_FASTMAP if the volume records are
+ * inconsistent and a negative error code in case of failure.
+ */
+static int add_fm_volumes(struct ubi_device *ubi, struct ubi_scan_info *si,
+			  struct fm_attach_info *fai, void *buf, size_t pos,
+			  int vol_count)
+{
+	int i, lnum, pnum, vol_id, reserved_pebs, used_ebs, err;
+	struct ubi_fm_volhdr *fmvhdr;
+	struct ubi_vid_hdr vid_hdr;
+	__be32 *eba;
+
+	if (vol_count > UBI_MAX_VOLUMES + UBI_INT_VOL_COUNT)
+		goto bad;
+
+	for (i = 0; i < vol_count; i++) {
+		if (pos + sizeof(struct ubi_fm_volhdr) > ubi->fm_size)
+			goto bad;
+		fmvhdr = buf + pos;
+		pos += sizeof(struct ubi_fm_volhdr);
+
+		vol_id = be32_to_cpu(fmvhdr->vol_id);
+		reserved_pebs = be32_to_cpu(fmvhdr->reserved_pebs);
+		used_ebs = be32_to_cpu(fmvhdr->used_ebs);
+		if (be32_to_cpu(fmvhdr->magic) != UBI_FM_EBA_MAGIC ||
+		    vol_id < 0 ||
+		    (vol_id >= UBI_MAX_VOLUMES &&
+		     vol_id != UBI_LAYOUT_VOLUME_ID) ||
+		    (fmvhdr->vol_type != UBI_VID_DYNAMIC &&
+		     fmvhdr->vol_type != UBI_VID_STATIC) ||
+		    reserved_pebs < 0 || reserved_pebs > ubi->peb_count ||
+		    pos + reserved_pebs * sizeof(__be32) > ubi->fm_size)
+			goto bad;
+
+		memset(&vid_hdr, 0, sizeof(struct ubi_vid_hdr));
+		vid_hdr.vol_type = fmvhdr->vol_type;
+		vid_hdr.compat = fmvhdr->compat;
+		vid_hdr.vol_id = fmvhdr->vol_id;
+		vid_hdr.used_ebs = fmvhdr->used_ebs;
+		vid_hdr.data_pad = fmvhdr->data_pad;
+
+		eba = buf + pos;
+		pos += reserved_pebs * sizeof(__be32);
+		for (lnum = 0; lnum < reserved_pebs; lnum++) {
+			int state;
+
+			if (eba[lnum] == cpu_to_be32(UBI_FM_UNMAPPED))
+				continue;
+
+			pnum = be32_to_cpu(eba[lnum]);
+			if (pnum < 0 || pnum >= ubi->peb_count)
+				goto bad;
+			state = fai->state[pnum];
+			if (state != FM_PEB_USED && state != FM_PEB_SCRUB)
+				goto bad;
+
+			vid_hdr.lnum = cpu_to_be32(lnum);
+			if (fmvhdr->vol_type == UBI_VID_STATIC) {
+				if (lnum == used_ebs - 1)
+					vid_hdr.data_size = fmvhdr->last_eb_bytes;
+				else
+					vid_hdr.data_size = cpu_to_be32(
+						ubi->leb_size -
+						be32_to_cpu(fmvhdr->data_pad));
+			}
+
+			err = ubi_scan_add_used(ubi, si, pnum, fai->ec[pnum],
+						&vid_hdr,
+						state == FM_PEB_SCRUB);
+			if (err)
+				return err;
+
+			fai->state[pnum] |= FM_PEB_MAPPED;
+			si->ec_sum += fai->ec[pnum];
+			si->ec_count += 1;
+			if (fai->ec[pnum] > si->max_ec)
+				si->max_ec = fai->ec[pnum];
+			if (fai->ec[pnum] < si->min_ec)
+				si->min_ec = fai->ec[pnum];
+		}
+	}
+
+	return 0;
+
+bad:
+	ubi_warn("bad fastmap volume record");
+	return UBI_NO_FASTMAP;
+}
+
+/**
+ * erase_stale_anchor - get rid of an outdated fastmap anchor while attaching.
+ * @ubi: UBI device description object
+ * @si: scanning information
+ * @pnum: the physical eraseblock
+ * @ec: its erase counter
+ *
+ * See the comment about stale anchors in 'ubi_scan_process_peb()'. Returns
+ * zero in case of success and a negative error code in case of failure.
+ */
+static int erase_stale_anchor(struct ubi_device *ubi,
+			      struct ubi_scan_info *si, int pnum, int ec)
+{
+	int err;
+
+	if (!ubi->ro_mode) {
+		dbg_bld("erase stale fastmap anchor PEB %d", pnum);
+		err = ubi_scan_erase_peb(ubi, si, pnum, ec + 1);
+		if (!err)
+			return add_peb(si, &si->free, pnum, ec + 1, 0);
+		if (err == -ENOMEM)
+			return err;
+	}
+
+	return add_peb(si, &si->erase, pnum, ec, 1);
+}
+
+/**
+ * attach_from_fastmap - build the scanning information from the fastmap.
+ * @ubi: UBI device description object
+ * @si: scanning information to fill
+ * @fai: attach state
+ * @buf: the fastmap
+ *
+ * Returns zero in case of success, %UBI_NO_FASTMAP if the fastmap does not
+ * match the flash and a negative error code in case of failure.
+ */
+static int attach_from_fastmap(struct ubi_device *ubi,
+			       struct ubi_scan_info *si,
+			       struct fm_attach_info *fai, void *buf)
+{
+	static const int list_state[] = { FM_PEB_FREE, FM_PEB_USED,
+					  FM_PEB_SCRUB, FM_PEB_ERASE };
+	struct ubi_fm_sb *fmsb = buf;
+	struct ubi_fm_hdr *fmhdr;
+	struct ubi_fm_scan_pool *fmpl;
+	struct ubi_fm_ec *fmec;
+	struct ubi_scan_leb *seb;
+	int i, j, err, pnum, ec, corr = 0, counts[ARRAY_SIZE(list_state)];
+	size_t pos = sizeof(struct ubi_fm_sb);
+
+	fmhdr = buf + pos;
+	pos += sizeof(struct ubi_fm_hdr);
+	if (be32_to_cpu(fmhdr->magic) != UBI_FM_HDR_MAGIC)
+		goto bad;
+
+	counts[0] = be32_to_cpu(fmhdr->free_peb_count);
+	counts[1] = be32_to_cpu(fmhdr->used_peb_count);
+	counts[2] = be32_to_cpu(fmhdr->scrub_peb_count);
+	counts[3] = be32_to_cpu(fmhdr->erase_peb_count);
+
+	ubi->image_seq = fai->image_seq;
+
+	/* The PEBs of the two pools come first */
+	for (i = 0; i < 2; i++) {
+		fmpl = buf + pos;
+		pos += sizeof(struct ubi_fm_scan_pool);
+		if (be32_to_cpu(fmpl->magic) != UBI_FM_POOL_MAGIC ||
+		    be16_to_cpu(fmpl->size) > UBI_FM_MAX_POOL_SIZE)
+			goto bad;
+
+		for (j = 0; j < be16_to_cpu(fmpl->size); j++) {
+			err = mark_peb(ubi, fai, be32_to_cpu(fmpl->pebs[j]),
+				       FM_PEB_POOL, UBI_SCAN_UNKNOWN_EC);
+			if (err)
+				return err;
+		}
+	}
+
+	/* Then the free, used, scrub and erase lists */
+	for (i = 0; i < ARRAY_SIZE(list_state); i++) {
+		if (counts[i] < 0 || counts[i] > ubi->peb_count ||
+		    pos + counts[i] * sizeof(struct ubi_fm_ec) > ubi->fm_size)
+			goto bad;
+
+		for (j = 0; j < counts[i]; j++) {
+			fmec = buf + pos;
+			pos += sizeof(struct ubi_fm_ec);
+			err = mark_peb(ubi, fai, be32_to_cpu(fmec->pnum),
+				       list_state[i], be32_to_cpu(fmec->ec));
+			if (err)
+				return err;
+		}
+	}
+
+	for (i = 0; i < ubi->fm_size / ubi->leb_size; i++) {
+		pnum = be32_to_cpu(fmsb->block_loc[i]);
+		ec = be32_to_cpu(fmsb->block_ec[i]);
+		err = mark_peb(ubi, fai, pnum, FM_PEB_BLOCK, ec);
+		if (err)
+			return err;
+
+		err = add_peb(si, &si->fastmap, pnum, ec, 0);
+		if (err)
+			return err;
+		seb = list_entry(si->fastmap.prev, struct ubi_scan_leb,
+				 u.list);
+		seb->lnum = i;
+	}
+
+	err = add_fm_volumes(ubi, si, fai, buf, pos,
+			     be32_to_cpu(fmhdr->vol_count));
+	if (err)
+		return err;
+
+	/*
+	 * The pool PEBs may have been written to after the fastmap, so they
+	 * are scanned as usual. Newer copies of LEBs found there replace the
+	 * ones the fastmap refers to.
+	 */
+	for (pnum = 0; pnum < ubi->peb_count; pnum++)
+		if (fai->state[pnum] == FM_PEB_POOL) {
+			cond_resched();
+			err = ubi_scan_process_peb(ubi, si, pnum);
+			if (err)
+				return err;
+		}
+
+	for (pnum = 0; pnum < ubi->peb_count; pnum++) {
+		int area = pnum < UBI_FM_MAX_START ? fai->area[pnum] : -1;
+		int state = fai->state[pnum];
+
+		cond_resched();
+		ec = fai->ec[pnum];
+		switch (state & ~FM_PEB_MAPPED) {
+		case FM_PEB_USED:
+		case FM_PEB_SCRUB:
+			/*
+			 * Data recorded by the fastmap is never erased before
+			 * the next fastmap is written, so these PEBs cannot
+			 * look empty.
+			 */
+			if (area == AREA_EMPTY || area == AREA_ANCHOR)
+				goto bad;
+			set_bit(pnum, ubi->fm_recorded);
+			if (!(state & FM_PEB_MAPPED))
+				/* Not referred to by any LEB anymore */
+				err = add_peb(si, &si->erase, pnum, ec, 0);
+			break;
+		case FM_PEB_FREE:
+			if (area == AREA_ANCHOR)
+				err = erase_stale_anchor(ubi, si, pnum, ec);
+			else if (area == AREA_EMPTY)
+				err = add_peb(si, &si->free, pnum,
+					      fai->area_ec[pnum], 0);
+			else if (area != -1)
+				/*
+				 * Possibly a half-written newer fastmap,
+				 * which was not finished because of a power
+				 * cut.
+				 */
+				err = add_peb(si, &si->erase, pnum, ec, 1);
+			else
+				err = add_peb(si, &si->free, pnum, ec, 0);
+			break;
+		case FM_PEB_ERASE:
+			if (area == AREA_ANCHOR && pnum != fai->anchor) {
+				err = erase_stale_anchor(ubi, si, pnum, ec);
+				break;
+			}
+
+			/* The PEB may have gone bad while being erased */
+			if (area == -1) {
+				err = ubi_io_is_bad(ubi, pnum);
+				if (err < 0)
+					return err;
+			} else
+				err = area == AREA_BAD;
+			if (err)
+				si->bad_peb_count += 1;
+			else
+				err = add_peb(si, &si->erase, pnum, ec, 0);
+			break;
+		case FM_PEB_POOL:
+		case FM_PEB_BLOCK:
+			err = 0;
+			break;
+		default:
+			if (area == AREA_ANCHOR)
+				goto bad;
+
+			if (area == -1) {
+				err = ubi_io_is_bad(ubi, pnum);
+				if (err < 0)
+					return err;
+			} else
+				err = area == AREA_BAD;
+			if (err) {
+				si->bad_peb_count += 1;
+				err = 0;
+				break;
+			}
+
+			/* Neither bad nor known - must have been corrupted */
+			corr += 1;
+			si->corr_peb_count += 1;
+			err = add_peb(si, &si->corr, pnum, UBI_SCAN_UNKNOWN_EC,
+				      0);
+			break;
+		}
+		if (err)
+			return err;
+	}
+
+	if (corr != be32_to_cpu(fmhdr->corr_peb_count)) {
+		ubi_warn("%d corrupted PEBs found, the fastmap knows %d",
+			 corr, be32_to_cpu(fmhdr->corr_peb_count));
+		return UBI_NO_FASTMAP;
+	}
+
+	if (si->max_sqnum < be64_to_cpu(fmsb->sqnum))
+		si->max_sqnum = be64_to_cpu(fmsb->sqnum);
+	si->is_fastmap = 1;
+	ubi->fm_used_blocks = ubi->fm_size / ubi->leb_size;
+	return 0;
+
+bad:
+	ubi_warn("the fastmap does not match the flash");
+	return UBI_NO_FASTMAP;
+}
+
+/**
+ * ubi_scan_fastmap - attach an MTD device using the fastmap.
+ * @ubi: UBI device description object
+ * @si: empty scanning information to fill
+ *
+ * This function looks for a fastmap and builds the scanning information from
+ * it. Returns zero in case of success and %UBI_NO_FASTMAP if there is no
+ * usable fastmap, in which case @si may contain garbage and the caller has to
+ * scan the whole flash. In case of failure, a negative error code is
+ * returned.
+ */
+int ubi_scan_fastmap(struct ubi_device *ubi, struct ubi_scan_info *si)
+{
+	struct fm_attach_info *fai;
+	int err = -ENOMEM;
+
+	fai = kzalloc(sizeof(struct fm_attach_info), GFP_KERNEL);
+	if (!fai)
+		return -ENOMEM;
+
+	fai->state = vzalloc(ubi->peb_count);
+	if (!fai->state)
+		goto out_free;
+
+	fai->ec = vmalloc(ubi->peb_count * sizeof(int));
+	if (!fai->ec)
+		goto out_free;
+
+	fai->ech = kzalloc(ubi->ec_hdr_alsize, GFP_KERNEL);
+	if (!fai->ech)
+		goto out_free;
+
+	fai->vidh = ubi_zalloc_vid_hdr(ubi, GFP_KERNEL);
+	if (!fai->vidh)
+		goto out_free;
+
+	err = scan_anchor_area(ubi, fai);
+	if (err)
+		goto out_free;
+
+	if (fai->anchor == -1) {
+		ubi_msg("no fastmap found");
+		err = UBI_NO_FASTMAP;
+		goto out_free;
+	}
+
+	err = read_fastmap(ubi, fai, ubi->fm_buf);
+	if (err)
+		goto out_free;
+
+	err = attach_from_fastmap(ubi, si, fai, ubi->fm_buf);
+	if (!err)
+		ubi_msg("attached from the fastmap at PEB %d, sqnum %llu",
+			fai->anchor, fai->sqnum);
+
+out_free:
+	if (err == UBI_NO_FASTMAP) {
+		ubi_msg("scanning all PEBs instead");
+		bitmap_zero(ubi->fm_recorded, ubi->peb_count);
+		ubi->fm_used_blocks = 0;
+		ubi->image_seq = 0;
+	}
+	if (fai->vidh)
+		ubi_free_vid_hdr(ubi, fai->vidh);
+	kfree(fai->ech);
+	vfree(fai->ec);
+	vfree(fai->state);
+	kfree(fai);
+	return err;
+}
+
+/**
+ * erase_block - synchronously erase a fastmap physical eraseblock.
+ * @ubi: UBI device description object
+ * @e: the physical eraseblock
+ *
+ * This function erases @e and writes a new EC header to it. Returns zero in
+ * case of success and a negative error code in case of failure.
+ */
+static int erase_block(struct ubi_device *ubi, struct ubi_wl_entry *e)
+{
+	int err;
+	struct ubi_ec_hdr *ec_hdr;
+	long long ec = e->ec;
+
+	ec_hdr = kzalloc(ubi->ec_hdr_alsize, GFP_NOFS);
+	if (!ec_hdr)
+		return -ENOMEM;
+
+	err = ubi_io_sync_erase(ubi, e->pnum, 0);
+	if (err < 0)
+		goto out_free;
+
+	ec += err;
+	if (ec > UBI_MAX_ERASECOUNTER) {
+		ubi_err("erase counter overflow at PEB %d, EC %lld",
+			e->pnum, ec);
+		err = -EINVAL;
+		goto out_free;
+	}
+
+	ec_hdr->ec = cpu_to_be64(ec);
+	err = ubi_io_write_ec_hdr(ubi, e->pnum, ec_hdr);
+	if (err)
+		goto out_free;
+
+	e->ec = ec;
+	spin_lock(&ubi->wl_lock);
+	if (e->ec > ubi->max_ec)
+		ubi->max_ec = e->ec;
+	spin_unlock(&ubi->wl_lock);
+
+out_free:
+	kfree(ec_hdr);
+	return err;
+}
+
+/**
+ * release_blocks - give fastmap physical eraseblocks back to the WL
+ *                  sub-system.
+ * @ubi: UBI device description object
+ * @blocks: the PEBs, the anchor first, %NULL entries are skipped
+ * @count: number of entries in @blocks
+ *
+ * The anchor is erased synchronously, so that this fastmap is gone before UBI
+ * carries on without it. If that fails, UBI switches to read-only mode, since
+ * the flash would not match the fastmap anymore. The other PEBs are just
+ * scheduled for erasure.
+ */
+static void release_blocks(struct ubi_device *ubi,
+			   struct ubi_wl_entry **blocks, int count)
+{
+	int i, erased = 0;
+
+	for (i = 0; i < count; i++) {
+		if (!blocks[i])
+			continue;
+
+		if (i == 0 && !ubi->ro_mode) {
+			erased = !erase_block(ubi, blocks[0]);
+			if (!erased) {
+				ubi_err("cannot erase fastmap anchor PEB %d",
+					blocks[0]->pnum);
+				ubi_ro_mode(ubi);
+			}
+		}
+
+		if (ubi_wl_put_fm_peb(ubi, blocks[i], i == 0 && erased))
+			ubi_err("cannot release fastmap PEB %d",
+				blocks[i]->pnum);
+		blocks[i] = NULL;
+	}
+}
+
+/**
+ * write_fastmap - take a snapshot of the attaching information and write it.
+ * @ubi: UBI device description object
+ * @new_fm: the PEBs to write the fastmap to, the anchor first
+ * @old_fm: PEBs of the previous fastmap which are not re-used, %NULL entries
+ *          are skipped
+ * @old_used: number of entries in @old_fm
+ * @recorded: bitmap to set the bits of the PEBs holding data in
+ *
+ * The caller has to hold @ubi->fm_eba_sem and @ubi->work_sem for writing, so
+ * that neither the EBA tables nor the WL trees change meanwhile. Returns zero
+ * in case of success and a negative error code in case of failure.
+ */
+static int write_fastmap(struct ubi_device *ubi, struct ubi_wl_entry **new_fm,
+			 struct ubi_wl_entry **old_fm, int old_used,
+			 unsigned long *recorded)
+{
+	struct ubi_fm_pool *pools[] = { &ubi->fm_pool, &ubi->fm_wl_pool };
+	int i, j, err, used_blocks = ubi->fm_size / ubi->leb_size;
+	int free_peb_count = 0, used_peb_count = 0, scrub_peb_count = 0;
+	int erase_peb_count = 0, vol_count = 0;
+	void *buf = ubi->fm_buf;
+	struct ubi_fm_sb *fmsb = buf;
+	struct ubi_fm_hdr *fmhdr;
+	struct ubi_fm_scan_pool *fmpl;
+	struct ubi_fm_volhdr *fmvhdr;
+	struct ubi_vid_hdr *vid_hdr;
+	struct ubi_wl_entry *e;
+	struct ubi_work *wrk;
+	struct rb_node *rb;
+	unsigned long long sqnum;
+	size_t pos = sizeof(struct ubi_fm_sb);
+	__be32 *eba;
+
+#define fm_add_ec(e) do {						\
+		struct ubi_fm_ec *fmec = buf + pos;			\
+									\
+		fmec->pnum = cpu_to_be32((e)->pnum);			\
+		fmec->ec = cpu_to_be32((e)->ec);			\
+		pos += sizeof(struct ubi_fm_ec);			\
+	} while (0)
+
+	memset(buf, 0, ubi->fm_size);
+
+	fmhdr = buf + pos;
+	pos += sizeof(struct ubi_fm_hdr);
+	fmhdr->magic = cpu_to_be32(UBI_FM_HDR_MAGIC);
+
+	spin_lock(&ubi->wl_lock);
+	for (i = 0; i < ARRAY_SIZE(pools); i++) {
+		fmpl = buf + pos;
+		pos += sizeof(struct ubi_fm_scan_pool);
+		fmpl->magic = cpu_to_be32(UBI_FM_POOL_MAGIC);
+		fmpl->size = cpu_to_be16(pools[i]->size);
+		fmpl->max_size = cpu_to_be16(pools[i]->max_size);
+		for (j = 0; j < pools[i]->size; j++)
+			fmpl->pebs[j] = cpu_to_be32(pools[i]->pebs[j]);
+	}
+
+	ubi_rb_for_each_entry(rb, e, &ubi->free, u.rb) {
+		fm_add_ec(e);
+		free_peb_count += 1;
+	}
+
+	ubi_rb_for_each_entry(rb, e, &ubi->used, u.rb) {
+		fm_add_ec(e);
+		set_bit(e->pnum, recorded);
+		used_peb_count += 1;
+	}
+
+	ubi_rb_for_each_entry(rb, e, &ubi->erroneous, u.rb) {
+		fm_add_ec(e);
+		set_bit(e->pnum, recorded);
+		used_peb_count += 1;
+	}
+
+	for (i = 0; i < UBI_PROT_QUEUE_LEN; i++)
+		list_for_each_entry(e, &ubi->pq[i], u.list) {
+			fm_add_ec(e);
+			set_bit(e->pnum, recorded);
+			used_peb_count += 1;
+		}
+
+	ubi_rb_for_each_entry(rb, e, &ubi->scrub, u.rb) {
+		fm_add_ec(e);
+		set_bit(e->pnum, recorded);
+		scrub_peb_count += 1;
+	}
+
+	list_for_each_entry(wrk, &ubi->works, list)
+		if (ubi_is_erase_work(wrk)) {
+			fm_add_ec(wrk->e);
+			erase_peb_count += 1;
+		}
+
+	list_for_each_entry(wrk, &ubi->fm_deferred, list) {
+		fm_add_ec(wrk->e);
+		erase_peb_count += 1;
+	}
+	spin_unlock(&ubi->wl_lock);
+
+	for (i = 0; i < old_used; i++)
+		if (old_fm[i]) {
+			fm_add_ec(old_fm[i]);
+			erase_peb_count += 1;
+		}
+#undef fm_add_ec
+
+	fmhdr->free_peb_count = cpu_to_be32(free_peb_count);
+	fmhdr->used_peb_count = cpu_to_be32(used_peb_count);
+	fmhdr->scrub_peb_count = cpu_to_be32(scrub_peb_count);
+	fmhdr->erase_peb_count = cpu_to_be32(erase_peb_count);
+
+	err = 0;
+	spin_lock(&ubi->volumes_lock);
+	fmhdr->bad_peb_count = cpu_to_be32(ubi->bad_peb_count);
+	fmhdr->corr_peb_count = cpu_to_be32(ubi->corr_peb_count);
+	for (i = 0; i < UBI_MAX_VOLUMES + UBI_INT_VOL_COUNT; i++) {
+		struct ubi_volume *vol = ubi->volumes[i];
+
+		if (!vol)
+			continue;
+
+		if (pos + sizeof(struct ubi_fm_volhdr) +
+		    vol->reserved_pebs * sizeof(__be32) > ubi->fm_size) {
+			err = -ENOSPC;
+			break;
+		}
+
+		fmvhdr = buf + pos;
+		pos += sizeof(struct ubi_fm_volhdr);
+		fmvhdr->magic = cpu_to_be32(UBI_FM_EBA_MAGIC);
+		fmvhdr->vol_id = cpu_to_be32(vol->vol_id);
+		fmvhdr->data_pad = cpu_to_be32(vol->data_pad);
+		fmvhdr->reserved_pebs = cpu_to_be32(vol->reserved_pebs);
+		if (vol->vol_id == UBI_LAYOUT_VOLUME_ID)
+			fmvhdr->compat = UBI_LAYOUT_VOLUME_COMPAT;
+		if (vol->vol_type == UBI_STATIC_VOLUME) {
+			fmvhdr->vol_type = UBI_VID_STATIC;
+			fmvhdr->used_ebs = cpu_to_be32(vol->used_ebs);
+			fmvhdr->last_eb_bytes = cpu_to_be32(vol->last_eb_bytes);
+		} else
+			fmvhdr->vol_type = UBI_VID_DYNAMIC;
+
+		eba = buf + pos;
+		pos += vol->reserved_pebs * sizeof(__be32);
+		for (j = 0; j < vol->reserved_pebs; j++)
+			eba[j] = vol->eba_tbl[j] < 0 ?
+				 cpu_to_be32(UBI_FM_UNMAPPED) :
+				 cpu_to_be32(vol->eba_tbl[j]);
+		vol_count += 1;
+	}
+	spin_unlock(&ubi->volumes_lock);
+	if (err) {
+		ubi_err("fastmap of %d bytes is too small", ubi->fm_size);
+		return err;
+	}
+	fmhdr->vol_count = cpu_to_be32(vol_count);
+
+	/* No write so far has a higher sequence number than the fastmap */
+	sqnum = ubi_next_sqnum(ubi);
+	fmsb->magic = cpu_to_be32(UBI_FM_SB_MAGIC);
+	fmsb->version = UBI_FM_FMT_VERSION;
+	fmsb->used_blocks = cpu_to_be32(used_blocks);
+	for (i = 0; i < used_blocks; i++) {
+		fmsb->block_loc[i] = cpu_to_be32(new_fm[i]->pnum);
+		fmsb->block_ec[i] = cpu_to_be32(new_fm[i]->ec);
+	}
+	fmsb->sqnum = cpu_to_be64(sqnum);
+	fmsb->data_crc = cpu_to_be32(crc32(UBI_CRC32_INIT,
+					   buf + sizeof(struct ubi_fm_sb),
+					   ubi->fm_size -
+					   sizeof(struct ubi_fm_sb)));
+
+	vid_hdr = ubi_zalloc_vid_hdr(ubi, GFP_NOFS);
+	if (!vid_hdr)
+		return -ENOMEM;
+
+	vid_hdr->vol_type = UBI_VID_DYNAMIC;
+	vid_hdr->compat = UBI_FM_VOLUME_COMPAT;
+	vid_hdr->sqnum = cpu_to_be64(sqnum);
+
+	/* The anchor goes last, it makes the new fastmap valid */
+	for (i = used_blocks - 1; i >= 0; i--) {
+		int pnum = new_fm[i]->pnum;
+
+		vid_hdr->vol_id = cpu_to_be32(i ? UBI_FM_DATA_VOLUME_ID :
+						  UBI_FM_SB_VOLUME_ID);
+		vid_hdr->lnum = cpu_to_be32(i);
+		err = ubi_io_write_vid_hdr(ubi, pnum, vid_hdr);
+		if (err) {
+			ubi_err("cannot write fastmap VID header to PEB %d",
+				pnum);
+			break;
+		}
+
+		err = ubi_io_write_data(ubi, buf + i * ubi->leb_size, pnum, 0,
+					ubi->leb_size);
+		if (err) {
+			ubi_err("cannot write fastmap data to PEB %d", pnum);
+			break;
+		}
+	}
+
+	ubi_free_vid_hdr(ubi, vid_hdr);
+	if (!err)
+		dbg_msg("fastmap written to PEB %d, sqnum %llu: %d free, "
+			"%d used, %d scrub, %d erase PEBs, %d volumes",
+			new_fm[0]->pnum, sqnum, free_peb_count,
+			used_peb_count, scrub_peb_count, erase_peb_count,
+			vol_count);
+	return err;
+}
+
+/**
+ * ubi_update_fastmap - write a new fastmap.
+ * @ubi: UBI device description object
+ *
+ * This function refills the pools and writes a fastmap describing the current
+ * state of @ubi. The previous fastmap is erased afterwards, and the erasures
+ * it was holding back are released.
+ *
+ * If the fastmap cannot be written, it is invalidated and disabled, and UBI
+ * carries on without it. Returns zero in that case as well as in case of
+ * success, and a negative error code if nothing was changed because of a
+ * failure.
+ */
+int ubi_update_fastmap(struct ubi_device *ubi)
+{
+	int i, err, got, used_blocks, old_used;
+	struct ubi_wl_entry *new_fm[UBI_FM_MAX_BLOCKS];
+	struct ubi_wl_entry *old_fm[UBI_FM_MAX_BLOCKS];
+	unsigned long *recorded;
+
+	/* In read-only mode the flash keeps matching the old fastmap */
+	if (ubi->ro_mode || ubi->fm_disabled)
+		return 0;
+
+	recorded = kcalloc(BITS_TO_LONGS(ubi->peb_count),
+			   sizeof(unsigned long), GFP_NOFS);
+	if (!recorded)
+		return -ENOMEM;
+
+	mutex_lock(&ubi->fm_mutex);
+	down_write(&ubi->fm_eba_sem);
+	down_write(&ubi->work_sem);
+
+	err = 0;
+	if (ubi->ro_mode || ubi->fm_disabled)
+		goto out_unlock;
+
+	used_blocks = ubi->fm_size / ubi->leb_size;
+	old_used = ubi->fm_used_blocks;
+	memcpy(old_fm, ubi->fm_blocks, sizeof(old_fm));
+	memset(new_fm, 0, sizeof(new_fm));
+
+	spin_lock(&ubi->wl_lock);
+	ubi_refill_pools(ubi);
+	for (got = 0; got < used_blocks; got++) {
+		new_fm[got] = ubi_wl_get_fm_peb(ubi);
+		if (!new_fm[got])
+			break;
+	}
+	spin_unlock(&ubi->wl_lock);
+
+	if (got < used_blocks && !old_used) {
+		/*
+		 * There is no fastmap on the flash yet, and there is not
+		 * enough free space in the anchor area for one. Move some
+		 * data out of there and try again next time. Meanwhile the
+		 * device is attached by scanning.
+		 */
+		dbg_msg("%d free PEBs in the anchor area, need %d", got,
+			used_blocks);
+		for (i = 0; i < got; i++)
+			ubi_wl_put_fm_peb(ubi, new_fm[i], 1);
+		err = ubi_ensure_anchor_pebs(ubi);
+		goto out_unlock;
+	}
+
+	/*
+	 * Not enough free PEBs in the anchor area? Re-use the PEBs of the old
+	 * fastmap, the anchor last. A power cut now means no fastmap and a
+	 * full scan on the next attach, which is fine.
+	 */
+	for (i = old_used - 1; got < used_blocks && i >= 0; i--) {
+		err = erase_block(ubi, old_fm[i]);
+		if (err)
+			goto out_fail;
+		new_fm[got++] = old_fm[i];
+		old_fm[i] = NULL;
+	}
+
+	if (got < used_blocks) {
+		err = -ENOSPC;
+		goto out_fail;
+	}
+
+	err = write_fastmap(ubi, new_fm, old_fm, old_used, recorded);
+	if (err)
+		goto out_fail;
+
+	release_blocks(ubi, old_fm, old_used);
+	memcpy(ubi->fm_blocks, new_fm, sizeof(new_fm));
+	ubi->fm_used_blocks = used_blocks;
+
+	spin_lock(&ubi->wl_lock);
+	swap(ubi->fm_recorded, recorded);
+	spin_unlock(&ubi->wl_lock);
+
+	/* The old fastmap is gone, so are the reasons to hold erasures back */
+	ubi_wl_release_deferred(ubi);
+	goto out_unlock;
+
+out_fail:
+	ubi_warn("cannot write the fastmap, error %d, disabling it", err);
+	release_blocks(ubi, new_fm, got);
+	release_blocks(ubi, old_fm, old_used);
+	memset(ubi->fm_blocks, 0, sizeof(ubi->fm_blocks));
+	ubi->fm_used_blocks = 0;
+	ubi_wl_disable_fastmap(ubi);
+	err = 0;
+
+out_unlock:
+	up_write(&ubi->work_sem);
+	up_write(&ubi->fm_eba_sem);
+	mutex_unlock(&ubi->fm_mutex);
+	kfree(recorded);
+	return err;
+}
+
+/**
+ * ubi_disable_fastmap - stop using the fastmap.
+ * @ubi: UBI device description object
+ *
+ * This function invalidates the fastmap on the flash and makes UBI work as if
+ * the fastmap was not compiled in. It is used at attach time, when there are
+ * not enough PEBs to keep a fastmap.
+ */
+void ubi_disable_fastmap(struct ubi_device *ubi)
+{
+	release_blocks(ubi, ubi->fm_blocks, ubi->fm_used_blocks);
+	ubi->fm_used_blocks = 0;
+	ubi_wl_disable_fastmap(ubi);
+}
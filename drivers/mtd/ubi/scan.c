@@ -827,7 +827,8 @@ out_unlock:
 }
 
 /**
- * process_eb - read, check UBI headers, and add them to scanning information.
+ * ubi_scan_process_peb - read, check UBI headers, and add them to scanning
+ *                        information.
  * @ubi: UBI device description object
  * @si: scanning information
  * @pnum: the physical eraseblock number
@@ -835,8 +836,8 @@ out_unlock:
  * This function returns a zero if the physical eraseblock was successfully
  * handled and a negative error code in case of failure.
  */
-static int process_eb(struct ubi_device *ubi, struct ubi_scan_info *si,
-		      int pnum)
+int ubi_scan_process_peb(struct ubi_device *ubi, struct ubi_scan_info *si,
+			 int pnum)
 {
 	long long uninitialized_var(ec);
 	int err, bitflips = 0, vol_id, ec_err = 0;
@@ -1011,6 +1012,29 @@ static int process_eb(struct ubi_device *ubi, struct ubi_scan_info *si,
 	}
 
 	vol_id = be32_to_cpu(vidh->vol_id);
+	if (vol_id == UBI_FM_SB_VOLUME_ID || vol_id == UBI_FM_DATA_VOLUME_ID) {
+		/*
+		 * Fastmap PEBs found here are not the ones the device is being
+		 * attached from, so they are stale. A stale fastmap anchor is
+		 * erased right away rather than just scheduled for erasure:
+		 * if a power cut preserved it, a later attach could pick it up
+		 * and trust an outdated fastmap.
+		 */
+		if (vol_id == UBI_FM_SB_VOLUME_ID && !ec_err && !ubi->ro_mode) {
+			dbg_bld("erase stale fastmap anchor PEB %d", pnum);
+			err = ubi_scan_erase_peb(ubi, si, pnum, ec + 1);
+			if (!err) {
+				ec += 1;
+				err = add_to_list(si, pnum, ec, 0, &si->free);
+			} else if (err != -ENOMEM)
+				err = add_to_list(si, pnum, ec, 1, &si->erase);
+		} else
+			err = add_to_list(si, pnum, ec, 1, &si->erase);
+		if (err)
+			return err;
+		goto adjust_mean_ec;
+	}
+
 	if (vol_id > UBI_MAX_VOLUMES && vol_id != UBI_LAYOUT_VOLUME_ID) {
 		int lnum = be32_to_cpu(vidh->lnum);
 
@@ -1141,37 +1165,83 @@ static int check_what_we_have(struct ubi_device *ubi, struct ubi_scan_info *si)
 }
 
 /**
- * ubi_scan - scan an MTD device.
- * @ubi: UBI device description object
+ * alloc_si - allocate and initialize an empty scanning information object.
  *
- * This function does full scanning of an MTD device and returns complete
- * information about it. In case of failure, an error code is returned.
+ * Returns the new object or %NULL if there is not enough memory.
  */
-struct ubi_scan_info *ubi_scan(struct ubi_device *ubi)
+static struct ubi_scan_info *alloc_si(void)
 {
-	int err, pnum;
-	struct rb_node *rb1, *rb2;
-	struct ubi_scan_volume *sv;
-	struct ubi_scan_leb *seb;
 	struct ubi_scan_info *si;
 
 	si = kzalloc(sizeof(struct ubi_scan_info), GFP_KERNEL);
 	if (!si)
-		return ERR_PTR(-ENOMEM);
+		return NULL;
 
 	INIT_LIST_HEAD(&si->corr);
 	INIT_LIST_HEAD(&si->free);
 	INIT_LIST_HEAD(&si->erase);
 	INIT_LIST_HEAD(&si->alien);
+	INIT_LIST_HEAD(&si->fastmap);
 	si->volumes = RB_ROOT;
 
-	err = -ENOMEM;
 	si->scan_leb_slab = kmem_cache_create("ubi_scan_leb_slab",
 					      sizeof(struct ubi_scan_leb),
 					      0, 0, NULL);
-	if (!si->scan_leb_slab)
-		goto out_si;
+	if (!si->scan_leb_slab) {
+		kfree(si);
+		return NULL;
+	}
+
+	return si;
+}
+
+/**
+ * scan_all - scan all physical eraseblocks of the UBI device.
+ * @ubi: UBI device description object
+ * @si: scanning information to fill
+ *
+ * This function returns zero in case of success and a negative error code in
+ * case of failure.
+ */
+static int scan_all(struct ubi_device *ubi, struct ubi_scan_info *si)
+{
+	int err, pnum;
 
+	for (pnum = 0; pnum < ubi->peb_count; pnum++) {
+		cond_resched();
+
+		dbg_gen("process PEB %d", pnum);
+		err = ubi_scan_process_peb(ubi, si, pnum);
+		if (err < 0)
+			return err;
+	}
+
+	dbg_msg("scanning is finished");
+	return 0;
+}
+
+/**
+ * ubi_scan - scan an MTD device.
+ * @ubi: UBI device description object
+ *
+ * This function does full scanning of an MTD device and returns complete
+ * information about it. If the fastmap is enabled and a valid fastmap is
+ * found, only the fastmap and the PEBs it does not cover are read instead.
+ * In case of failure, an error code is returned.
+ */
+struct ubi_scan_info *ubi_scan(struct ubi_device *ubi)
+{
+	int err;
+	struct rb_node *rb1, *rb2;
+	struct ubi_scan_volume *sv;
+	struct ubi_scan_leb *seb;
+	struct ubi_scan_info *si;
+
+	si = alloc_si();
+	if (!si)
+		return ERR_PTR(-ENOMEM);
+
+	err = -ENOMEM;
 	ech = kzalloc(ubi->ec_hdr_alsize, GFP_KERNEL);
 	if (!ech)
 		goto out_si;
@@ -1180,16 +1250,29 @@ struct ubi_scan_info *ubi_scan(struct ubi_device *ubi)
 	if (!vidh)
 		goto out_ech;
 
-	for (pnum = 0; pnum < ubi->peb_count; pnum++) {
-		cond_resched();
-
-		dbg_gen("process PEB %d", pnum);
-		err = process_eb(ubi, si, pnum);
+	err = UBI_NO_FASTMAP;
+#ifdef CONFIG_MTD_UBI_FASTMAP
+	if (!ubi->fm_disabled) {
+		err = ubi_scan_fastmap(ubi, si);
 		if (err < 0)
 			goto out_vidh;
+		if (err == UBI_NO_FASTMAP) {
+			/* Start over with a full scan */
+			ubi_scan_destroy_si(si);
+			si = alloc_si();
+			if (!si) {
+				err = -ENOMEM;
+				goto out_vidh_nosi;
+			}
+		}
 	}
+#endif
 
-	dbg_msg("scanning is finished");
+	if (err == UBI_NO_FASTMAP) {
+		err = scan_all(ubi, si);
+		if (err)
+			goto out_vidh;
+	}
 
 	/* Calculate mean erase counter */
 	if (si->ec_count)
@@ -1238,6 +1321,13 @@ out_ech:
 out_si:
 	ubi_scan_destroy_si(si);
 	return ERR_PTR(err);
+
+#ifdef CONFIG_MTD_UBI_FASTMAP
+out_vidh_nosi:
+	ubi_free_vid_hdr(ubi, vidh);
+	kfree(ech);
+	return ERR_PTR(err);
+#endif
 }
 
 /**
@@ -1300,6 +1390,10 @@ void ubi_scan_destroy_si(struct ubi_scan_info *si)
 		list_del(&seb->u.list);
 		kmem_cache_free(si->scan_leb_slab, seb);
 	}
+	list_for_each_entry_safe(seb, seb_tmp, &si->fastmap, u.list) {
+		list_del(&seb->u.list);
+		kmem_cache_free(si->scan_leb_slab, seb);
+	}
 
 	/* Destroy the volume RB-tree */
 	rb = si->volumes.rb_node;
@@ -1491,7 +1585,9 @@ static int paranoid_check_si(struct ubi_device *ubi, struct ubi_scan_info *si)
 				goto bad_vid_hdr;
 			}
 
-			if (seb->sqnum != be64_to_cpu(vidh->sqnum)) {
+			/* The fastmap does not record sequence numbers */
+			if (!si->is_fastmap &&
+			    seb->sqnum != be64_to_cpu(vidh->sqnum)) {
 				ubi_err("bad sqnum %llu", seb->sqnum);
 				goto bad_vid_hdr;
 			}
@@ -1530,7 +1626,8 @@ static int paranoid_check_si(struct ubi_device *ubi, struct ubi_scan_info *si)
 			goto bad_vid_hdr;
 		}
 
-		if (sv->last_data_size != be32_to_cpu(vidh->data_size)) {
+		if ((!si->is_fastmap || sv->vol_type == UBI_STATIC_VOLUME) &&
+		    sv->last_data_size != be32_to_cpu(vidh->data_size)) {
 			ubi_err("bad last_data_size %d", sv->last_data_size);
 			goto bad_vid_hdr;
 		}
@@ -1569,6 +1666,9 @@ static int paranoid_check_si(struct ubi_device *ubi, struct ubi_scan_info *si)
 	list_for_each_entry(seb, &si->alien, u.list)
 		buf[seb->pnum] = 1;
 
+	list_for_each_entry(seb, &si->fastmap, u.list)
+		buf[seb->pnum] = 1;
+
 	err = 0;
 	for (pnum = 0; pnum < ubi->peb_count; pnum++)
 		if (!buf[pnum]) {
@@ -93,6 +93,8 @@ struct ubi_scan_volume {
  * @erase: list of physical eraseblocks which have to be erased
  * @alien: list of physical eraseblocks which should not be used by UBI (e.g.,
  *         those belonging to "preserve"-compatible internal volumes)
+ * @fastmap: list of physical eraseblocks holding the fastmap the device was
+ *           attached from (@lnum is the position within the fastmap)
  * @corr_peb_count: count of PEBs in the @corr list
  * @empty_peb_count: count of PEBs which are presumably empty (contain only
  *                   0xFF bytes)
@@ -103,6 +105,8 @@ struct ubi_scan_volume {
  * @vols_found: number of volumes found during scanning
  * @highest_vol_id: highest volume ID
  * @is_empty: flag indicating whether the MTD device is empty or not
+ * @is_fastmap: flag indicating whether this information was built from the
+ *              fastmap rather than by scanning all physical eraseblocks
  * @min_ec: lowest erase counter value
  * @max_ec: highest erase counter value
  * @max_sqnum: highest sequence number value
@@ -121,6 +125,7 @@ struct ubi_scan_info {
 	struct list_head free;
 	struct list_head erase;
 	struct list_head alien;
+	struct list_head fastmap;
 	int corr_peb_count;
 	int empty_peb_count;
 	int alien_peb_count;
@@ -129,6 +134,7 @@ struct ubi_scan_info {
 	int vols_found;
 	int highest_vol_id;
 	int is_empty;
+	int is_fastmap;
 	int min_ec;
 	int max_ec;
 	unsigned long long max_sqnum;
@@ -168,6 +174,8 @@ struct ubi_scan_leb *ubi_scan_get_free_peb(struct ubi_device *ubi,
 					   struct ubi_scan_info *si);
 int ubi_scan_erase_peb(struct ubi_device *ubi, const struct ubi_scan_info *si,
 		       int pnum, int ec);
+int ubi_scan_process_peb(struct ubi_device *ubi, struct ubi_scan_info *si,
+			 int pnum);
 struct ubi_scan_info *ubi_scan(struct ubi_device *ubi);
 void ubi_scan_destroy_si(struct ubi_scan_info *si);
 
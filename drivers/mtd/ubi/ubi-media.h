@@ -312,6 +312,15 @@ struct ubi_vid_hdr {
 #define UBI_LAYOUT_VOLUME_NAME   "layout volume"
 #define UBI_LAYOUT_VOLUME_COMPAT UBI_COMPAT_REJECT
 
+/*
+ * The fastmap volumes. These are not real volumes: they are never attached
+ * and only mark the PEBs holding the fastmap (see "struct ubi_fm_sb"). Old
+ * UBI implementations simply erase them, which is harmless.
+ */
+#define UBI_FM_SB_VOLUME_ID	(UBI_LAYOUT_VOLUME_ID + 1)
+#define UBI_FM_DATA_VOLUME_ID	(UBI_LAYOUT_VOLUME_ID + 2)
+#define UBI_FM_VOLUME_COMPAT	UBI_COMPAT_DELETE
+
 /* The maximum number of volumes per one UBI device */
 #define UBI_MAX_VOLUMES 128
 
@@ -375,4 +384,155 @@ struct ubi_vtbl_record {
 	__be32  crc;
 } __packed;
 
+/* UBI fastmap on-flash data structures */
+
+/* Fastmap magic numbers */
+#define UBI_FM_SB_MAGIC		0x7B11D69F
+#define UBI_FM_HDR_MAGIC	0xD4B82EF7
+#define UBI_FM_POOL_MAGIC	0x67AF4D08
+#define UBI_FM_EBA_MAGIC	0xF0C040A8
+
+/* Version of the fastmap on-flash format */
+#define UBI_FM_FMT_VERSION	1
+
+/* The fastmap anchor PEB has to be one of the first %UBI_FM_MAX_START PEBs */
+#define UBI_FM_MAX_START	64
+
+/* The maximum number of PEBs a fastmap may occupy */
+#define UBI_FM_MAX_BLOCKS	32
+
+/* Minimum and maximum size of the PEB pools written into the fastmap */
+#define UBI_FM_MIN_POOL_SIZE	8
+#define UBI_FM_MAX_POOL_SIZE	256
+
+/**
+ * struct ubi_fm_sb - UBI fastmap super block.
+ * @magic: fastmap super block magic number (%UBI_FM_SB_MAGIC)
+ * @version: format version of this fastmap (%UBI_FM_FMT_VERSION)
+ * @padding1: reserved, zeroes
+ * @data_crc: CRC over the fastmap data following this super block
+ * @used_blocks: number of PEBs used by this fastmap
+ * @block_loc: an array containing the location of all PEBs of the fastmap
+ * @block_ec: the erase counter of each used PEB
+ * @sqnum: highest sequence number value at the time the fastmap was written
+ * @padding2: reserved, zeroes
+ *
+ * The fastmap is a snapshot of the attaching information (the EBA tables of
+ * all volumes and the state and erase counter of every PEB) which allows UBI
+ * to attach an MTD device without scanning all of it. The super block lives
+ * in the anchor PEB, the first PEB of the fastmap, which is always one of the
+ * first %UBI_FM_MAX_START PEBs, so at attach time only those have to be
+ * scanned to find it. The fastmap data starts right after the super block
+ * and continues in the following @used_blocks - 1 PEBs listed in
+ * @block_loc. It consists of a &struct ubi_fm_hdr followed by the two PEB
+ * pools, the erase counter lists and the per-volume EBA tables.
+ */
+struct ubi_fm_sb {
+	__be32 magic;
+	__u8 version;
+	__u8 padding1[3];
+	__be32 data_crc;
+	__be32 used_blocks;
+	__be32 block_loc[UBI_FM_MAX_BLOCKS];
+	__be32 block_ec[UBI_FM_MAX_BLOCKS];
+	__be64 sqnum;
+	__u8 padding2[32];
+} __packed;
+
+/**
+ * struct ubi_fm_hdr - header of the fastmap data set.
+ * @magic: fastmap header magic number (%UBI_FM_HDR_MAGIC)
+ * @free_peb_count: number of free PEBs known by this fastmap
+ * @used_peb_count: number of used PEBs known by this fastmap
+ * @scrub_peb_count: number of to be scrubbed PEBs known by this fastmap
+ * @erase_peb_count: number of to be erased PEBs known by this fastmap
+ * @bad_peb_count: number of bad PEBs known by this fastmap
+ * @corr_peb_count: number of corrupted PEBs known by this fastmap
+ * @vol_count: number of UBI volumes known by this fastmap
+ * @padding: reserved, zeroes
+ */
+struct ubi_fm_hdr {
+	__be32 magic;
+	__be32 free_peb_count;
+	__be32 used_peb_count;
+	__be32 scrub_peb_count;
+	__be32 erase_peb_count;
+	__be32 bad_peb_count;
+	__be32 corr_peb_count;
+	__be32 vol_count;
+	__u8 padding[4];
+} __packed;
+
+/* struct ubi_fm_hdr is followed by two struct ubi_fm_scan_pool */
+
+/**
+ * struct ubi_fm_scan_pool - Fastmap pool PEBs to be scanned while attaching
+ * @magic: pool magic number (%UBI_FM_POOL_MAGIC)
+ * @size: current pool size
+ * @max_size: maximal pool size
+ * @padding: reserved, zeroes
+ * @pebs: an array containing the location of all PEBs in this pool
+ *
+ * The pools contain the free PEBs UBI hands out between two fastmap writes,
+ * so they are the only PEBs whose state may differ from the one recorded in
+ * the fastmap. They are always scanned at attach time.
+ */
+struct ubi_fm_scan_pool {
+	__be32 magic;
+	__be16 size;
+	__be16 max_size;
+	__u8 padding[4];
+	__be32 pebs[UBI_FM_MAX_POOL_SIZE];
+} __packed;
+
+/*
+ * The second pool is followed by the free, used, scrub and erase lists of
+ * &struct ubi_fm_ec records, in this order.
+ */
+
+/**
+ * struct ubi_fm_ec - stores the erase counter of a PEB
+ * @pnum: PEB number
+ * @ec: ec of this PEB
+ */
+struct ubi_fm_ec {
+	__be32 pnum;
+	__be32 ec;
+} __packed;
+
+/**
+ * struct ubi_fm_volhdr - Fastmap volume header
+ * @magic: fastmap volume header magic number (%UBI_FM_EBA_MAGIC)
+ * @vol_id: volume id of the fastmapped volume
+ * @vol_type: type of the fastmapped volume (%UBI_VID_DYNAMIC or
+ *            %UBI_VID_STATIC)
+ * @compat: compatibility flags of the volume
+ * @padding1: reserved, zeroes
+ * @data_pad: data_pad value of the fastmapped volume
+ * @used_ebs: number of used LEBs within this volume as stored in its VID
+ *            headers (zero for dynamic volumes)
+ * @last_eb_bytes: number of bytes used in the last LEB of a static volume
+ * @reserved_pebs: number of entries in the EBA table which follows
+ * @padding2: reserved, zeroes
+ *
+ * Each volume header is followed by @reserved_pebs big-endian PEB numbers,
+ * the EBA table of the volume. Unmapped LEBs are recorded as
+ * %UBI_FM_UNMAPPED.
+ */
+struct ubi_fm_volhdr {
+	__be32 magic;
+	__be32 vol_id;
+	__u8 vol_type;
+	__u8 compat;
+	__u8 padding1[2];
+	__be32 data_pad;
+	__be32 used_ebs;
+	__be32 last_eb_bytes;
+	__be32 reserved_pebs;
+	__u8 padding2[8];
+} __packed;
+
+/* Marker of an unmapped LEB in the fastmap EBA table */
+#define UBI_FM_UNMAPPED 0xFFFFFFFF
+
 #endif /* !__UBI_MEDIA_H__ */
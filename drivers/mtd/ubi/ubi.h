@@ -107,6 +107,12 @@ enum {
 	UBI_IO_BITFLIPS,
 };
 
+/*
+ * Return code of 'ubi_scan_fastmap()' meaning that there is no usable fastmap
+ * and the device has to be attached by scanning.
+ */
+#define UBI_NO_FASTMAP 1
+
 /*
  * Return codes of the 'ubi_eba_copy_leb()' function.
  *
@@ -194,6 +200,44 @@ struct ubi_rename_entry {
 	struct list_head list;
 };
 
+/**
+ * struct ubi_fm_pool - in-memory fastmap pool.
+ * @pebs: numbers of the physical eraseblocks in this pool
+ * @used: how many physical eraseblocks were already handed out
+ * @size: total number of physical eraseblocks in this pool
+ * @max_size: maximum size of the pool
+ *
+ * Free physical eraseblocks are handed out only through the pools while the
+ * fastmap is enabled. The pool contents are recorded in the fastmap, so at
+ * attach time only the pool PEBs have to be scanned to learn what happened
+ * after the fastmap was written. When a pool is exhausted, a new fastmap is
+ * written and the pool is refilled.
+ */
+struct ubi_fm_pool {
+	int pebs[UBI_FM_MAX_POOL_SIZE];
+	int used;
+	int size;
+	int max_size;
+};
+
+/**
+ * struct ubi_wl_stats - statistics of the WL sub-system works.
+ * @stalls: how many times 'ubi_wl_get_peb()' had to wait for works to be done
+ * @stall_us: total time of those waits in microseconds
+ * @max_stall_us: the longest of those waits in microseconds
+ * @batches: how many times several erasures were done in one go
+ * @erased: count of physical eraseblocks erased by the erase works
+ * @tortured: how many of them were tortured
+ */
+struct ubi_wl_stats {
+	unsigned long long stalls;
+	unsigned long long stall_us;
+	unsigned int max_stall_us;
+	unsigned long long batches;
+	unsigned long long erased;
+	unsigned long long tortured;
+};
+
 struct ubi_volume_desc;
 
 /**
@@ -337,13 +381,16 @@ struct ubi_wl_entry;
  * @used: RB-tree of used physical eraseblocks
  * @erroneous: RB-tree of erroneous used physical eraseblocks
  * @free: RB-tree of free physical eraseblocks
+ * @free_count: count of physical eraseblocks in @free
  * @scrub: RB-tree of physical eraseblocks which need scrubbing
  * @pq: protection queue (contain physical eraseblocks which are temporarily
  *      protected from the wear-leveling worker)
  * @pq_head: protection queue head
  * @wl_lock: protects the @used, @free, @pq, @pq_head, @lookuptbl, @move_from,
  *	     @move_to, @move_to_put @erase_pending, @wl_scheduled, @works,
- *	     @erroneous, and @erroneous_peb_count fields
+ *	     @erroneous, @erroneous_peb_count, @fm_pool, @fm_wl_pool,
+ *	     @fm_deferred, @fm_deferred_count, @fm_update_needed, @free_count
+ *	     and @wl_stats fields
  * @move_mutex: serializes eraseblock moves
  * @work_sem: synchronizes the WL worker with use tasks
  * @wl_scheduled: non-zero if the wear-leveling was scheduled
@@ -354,6 +401,7 @@ struct ubi_wl_entry;
  * @move_to_put: if the "to" PEB was put
  * @works: list of pending works
  * @works_count: count of pending works
+ * @wl_stats: statistics of the pending works
  * @bgt_thread: background thread description object
  * @thread_enabled: if the background thread is enabled
  * @bgt_name: background thread name
@@ -387,6 +435,23 @@ struct ubi_wl_entry;
  *                  time (MTD write buffer size)
  * @mtd: MTD device descriptor
  *
+ * @fm_disabled: non-zero if the fastmap is not used
+ * @fm_blocks: wear-leveling entries of the PEBs holding the current fastmap
+ * @fm_used_blocks: number of PEBs in @fm_blocks
+ * @fm_size: fastmap size in bytes, a multiple of @leb_size
+ * @fm_pool: pool of free PEBs handed out by 'ubi_wl_get_peb()'
+ * @fm_wl_pool: pool of free PEBs used as wear-leveling targets
+ * @fm_recorded: bitmap of PEBs which the fastmap on the flash records as
+ *               holding data
+ * @fm_buf: buffer of @fm_size bytes the fastmap is read to and written from
+ * @fm_deferred: erase works of @fm_recorded PEBs, held back until the next
+ *               fastmap is written
+ * @fm_deferred_count: count of works in @fm_deferred
+ * @fm_update_needed: asks the background thread to write a new fastmap
+ * @fm_eba_sem: taken for reading while the EBA tables and WL trees are being
+ *              changed, and for writing while a fastmap snapshot is taken
+ * @fm_mutex: serializes fastmap writers
+ *
  * @peb_buf1: a buffer of PEB size used for different purposes
  * @peb_buf2: another buffer of PEB size used for different purposes
  * @buf_mutex: protects @peb_buf1 and @peb_buf2
@@ -430,6 +495,7 @@ struct ubi_device {
 	struct rb_root used;
 	struct rb_root erroneous;
 	struct rb_root free;
+	int free_count;
 	struct rb_root scrub;
 	struct list_head pq[UBI_PROT_QUEUE_LEN];
 	int pq_head;
@@ -443,6 +509,7 @@ struct ubi_device {
 	int move_to_put;
 	struct list_head works;
 	int works_count;
+	struct ubi_wl_stats wl_stats;
 	struct task_struct *bgt_thread;
 	int thread_enabled;
 	char bgt_name[sizeof(UBI_BGT_NAME_PATTERN)+2];
@@ -471,6 +538,21 @@ struct ubi_device {
 	int max_write_size;
 	struct mtd_info *mtd;
 
+	/* Fastmap stuff */
+	int fm_disabled;
+	struct ubi_wl_entry *fm_blocks[UBI_FM_MAX_BLOCKS];
+	int fm_used_blocks;
+	int fm_size;
+	struct ubi_fm_pool fm_pool;
+	struct ubi_fm_pool fm_wl_pool;
+	unsigned long *fm_recorded;
+	void *fm_buf;
+	struct list_head fm_deferred;
+	int fm_deferred_count;
+	int fm_update_needed;
+	struct rw_semaphore fm_eba_sem;
+	struct mutex fm_mutex;
+
 	void *peb_buf1;
 	void *peb_buf2;
 	struct mutex buf_mutex;
@@ -479,6 +561,28 @@ struct ubi_device {
 	struct ubi_debug_info *dbg;
 };
 
+/**
+ * struct ubi_work - UBI work description data structure.
+ * @list: a link in the list of pending works
+ * @func: worker function
+ * @e: physical eraseblock to erase
+ * @torture: if the physical eraseblock has to be tortured
+ * @anchor: move data out of the fastmap anchor area (wear-leveling works only)
+ *
+ * The @func pointer points to the worker function. If the @cancel argument is
+ * not zero, the worker has to free the resources and exit immediately. The
+ * worker has to return zero in case of success and a negative error code in
+ * case of failure.
+ */
+struct ubi_work {
+	struct list_head list;
+	int (*func)(struct ubi_device *ubi, struct ubi_work *wrk, int cancel);
+	/* The below fields are only relevant to erasure works */
+	struct ubi_wl_entry *e;
+	int torture;
+	int anchor;
+};
+
 #include "debug.h"
 
 extern struct kmem_cache *ubi_wl_entry_slab;
@@ -536,6 +640,7 @@ int ubi_eba_atomic_leb_change(struct ubi_device *ubi, struct ubi_volume *vol,
 int ubi_eba_copy_leb(struct ubi_device *ubi, int from, int to,
 		     struct ubi_vid_hdr *vid_hdr);
 int ubi_eba_init_scan(struct ubi_device *ubi, struct ubi_scan_info *si);
+unsigned long long ubi_next_sqnum(struct ubi_device *ubi);
 
 /* wl.c */
 int ubi_wl_get_peb(struct ubi_device *ubi, int dtype);
@@ -545,6 +650,34 @@ int ubi_wl_scrub_peb(struct ubi_device *ubi, int pnum);
 int ubi_wl_init_scan(struct ubi_device *ubi, struct ubi_scan_info *si);
 void ubi_wl_close(struct ubi_device *ubi);
 int ubi_thread(void *u);
+int ubi_is_erase_work(struct ubi_work *wrk);
+#ifdef CONFIG_MTD_UBI_FASTMAP
+void ubi_refill_pools(struct ubi_device *ubi);
+struct ubi_wl_entry *ubi_wl_get_fm_peb(struct ubi_device *ubi);
+int ubi_wl_put_fm_peb(struct ubi_device *ubi, struct ubi_wl_entry *e,
+		      int erased);
+void ubi_wl_release_deferred(struct ubi_device *ubi);
+void ubi_wl_disable_fastmap(struct ubi_device *ubi);
+int ubi_ensure_anchor_pebs(struct ubi_device *ubi);
+
+/* fastmap.c */
+int ubi_fastmap_init(struct ubi_device *ubi);
+void ubi_fastmap_close(struct ubi_device *ubi);
+int ubi_scan_fastmap(struct ubi_device *ubi, struct ubi_scan_info *si);
+int ubi_update_fastmap(struct ubi_device *ubi);
+void ubi_disable_fastmap(struct ubi_device *ubi);
+#else
+static inline int ubi_fastmap_init(struct ubi_device *ubi)
+{
+	ubi->fm_disabled = 1;
+	return 0;
+}
+static inline void ubi_fastmap_close(struct ubi_device *ubi) {}
+static inline int ubi_update_fastmap(struct ubi_device *ubi)
+{
+	return 0;
+}
+#endif
 
 /* io.c */
 int ubi_io_read(const struct ubi_device *ubi, void *buf, int pnum, int offset,
@@ -92,6 +92,21 @@
  * Depending on the sub-state, wear-leveling entries of the used physical
  * eraseblocks may be kept in one of those structures.
  *
+ * When the fastmap is enabled, free physical eraseblocks are not taken from the
+ * @wl->free tree directly. Instead, the tree feeds two small pools: one for
+ * 'ubi_wl_get_peb()' and one for wear-leveling targets. The pools are recorded
+ * in the fastmap, so only their PEBs can change state behind the fastmap's
+ * back. For the same reason, PEBs which the fastmap on the flash records as
+ * holding data are not erased until a newer fastmap is written; their erase
+ * works are kept in @wl->fm_deferred meanwhile.
+ *
+ * Writers should not have to wait for erasures, so the background thread tries
+ * to keep at least %WL_ERASE_RESERVE free physical eraseblocks. When there are
+ * fewer, erase works are done before anything else, several at a time.
+ * Wear-leveling moves, which consume free physical eraseblocks, are put off
+ * while erase works are pending, but not on a full device where the free
+ * count stays below the reserve. Scrubbing is not put off, it protects data.
+ *
  * Note, in this implementation, we keep a small in-RAM object for each physical
  * eraseblock. This is surely not a scalable solution. But it appears to be good
  * enough for moderately large flashes and it is simple. In future, one may
@@ -110,6 +125,7 @@
 #include <linux/crc32.h>
 #include <linux/freezer.h>
 #include <linux/kthread.h>
+#include <linux/ktime.h>
 #include "ubi.h"
 
 /* Number of physical eraseblocks reserved for wear-leveling purposes */
@@ -142,25 +158,21 @@
  */
 #define WL_MAX_FAILURES 32
 
-/**
- * struct ubi_work - UBI work description data structure.
- * @list: a link in the list of pending works
- * @func: worker function
- * @e: physical eraseblock to erase
- * @torture: if the physical eraseblock has to be tortured
- *
- * The @func pointer points to the worker function. If the @cancel argument is
- * not zero, the worker has to free the resources and exit immediately. The
- * worker has to return zero in case of success and a negative error code in
- * case of failure.
+/*
+ * When there are fewer free physical eraseblocks than this, erasures take
+ * precedence over the other works.
  */
-struct ubi_work {
-	struct list_head list;
-	int (*func)(struct ubi_device *ubi, struct ubi_work *wrk, int cancel);
-	/* The below fields are only relevant to erasure works */
-	struct ubi_wl_entry *e;
-	int torture;
-};
+#define WL_ERASE_RESERVE CONFIG_MTD_UBI_ERASE_RESERVE
+
+/* Maximum number of erase works done in one go */
+#define WL_ERASE_BATCH 8
+
+/*
+ * The fastmap wear-leveling pool is not refilled from the last free physical
+ * eraseblocks (not counting the bad block reserve), they are kept for the
+ * user pool.
+ */
+#define WL_POOL_RESERVE 5
 
 #ifdef CONFIG_MTD_UBI_DEBUG
 static int paranoid_check_ec(struct ubi_device *ubi, int pnum, int ec);
@@ -211,18 +223,113 @@ static void wl_tree_add(struct ubi_wl_entry *e, struct rb_root *root)
 	rb_insert_color(&e->u.rb, root);
 }
 
+static int erase_worker(struct ubi_device *ubi, struct ubi_work *wl_wrk,
+			int cancel);
+
 /**
- * do_work - do one pending work.
+ * ubi_is_erase_work - check whether a work is an erase work.
+ * @wrk: the work object to check
+ */
+int ubi_is_erase_work(struct ubi_work *wrk)
+{
+	return wrk->func == erase_worker;
+}
+
+/**
+ * low_on_free - check whether free physical eraseblocks are running out.
  * @ubi: UBI device description object
  *
- * This function returns zero in case of success and a negative error code in
- * case of failure.
+ * Returns non-zero if there are fewer than %WL_ERASE_RESERVE free physical
+ * eraseblocks, counting those still available in the fastmap pool. Note,
+ * @ubi->wl_lock has to be locked.
  */
-static int do_work(struct ubi_device *ubi)
+static int low_on_free(struct ubi_device *ubi)
+{
+	int count = ubi->free_count;
+
+#ifdef CONFIG_MTD_UBI_FASTMAP
+	if (!ubi->fm_disabled)
+		count += ubi->fm_pool.size - ubi->fm_pool.used;
+#endif
+	return count < WL_ERASE_RESERVE;
+}
+
+/**
+ * erase_works_pending - check whether erase works are queued.
+ * @ubi: UBI device description object
+ *
+ * Returns non-zero if there is an erase work in @ubi->works. Erase works
+ * deferred for the fastmap do not count. Note, @ubi->wl_lock has to be
+ * locked.
+ */
+static int erase_works_pending(struct ubi_device *ubi)
 {
-	int err;
 	struct ubi_work *wrk;
 
+	list_for_each_entry(wrk, &ubi->works, list)
+		if (ubi_is_erase_work(wrk))
+			return 1;
+	return 0;
+}
+
+/**
+ * pick_works - take the next works to do off the queue.
+ * @ubi: UBI device description object
+ * @batch: array of %WL_ERASE_BATCH elements to store the works in
+ *
+ * Works are normally done one by one in the order they were queued. But if
+ * the first one is an erase work, or if free physical eraseblocks are running
+ * out, up to %WL_ERASE_BATCH erase works are taken at once, the ones which
+ * need no torture testing first. Returns the number of works taken. Note,
+ * @ubi->wl_lock has to be locked.
+ */
+static int pick_works(struct ubi_device *ubi, struct ubi_work **batch)
+{
+	struct ubi_work *wrk, *tmp;
+	int n = 0, torture;
+
+	if (list_empty(&ubi->works))
+		return 0;
+
+	wrk = list_entry(ubi->works.next, struct ubi_work, list);
+	if (ubi_is_erase_work(wrk) || low_on_free(ubi))
+		for (torture = 0; torture < 2; torture++)
+			list_for_each_entry_safe(wrk, tmp, &ubi->works, list) {
+				if (n == WL_ERASE_BATCH)
+					break;
+				if (!ubi_is_erase_work(wrk) ||
+				    wrk->torture != torture)
+					continue;
+				list_del(&wrk->list);
+				batch[n++] = wrk;
+			}
+
+	if (!n) {
+		wrk = list_entry(ubi->works.next, struct ubi_work, list);
+		list_del(&wrk->list);
+		batch[n++] = wrk;
+	}
+
+	ubi->works_count -= n;
+	ubi_assert(ubi->works_count >= 0);
+	if (n > 1)
+		ubi->wl_stats.batches += 1;
+	return n;
+}
+
+/**
+ * do_work - do pending works.
+ * @ubi: UBI device description object
+ *
+ * This function does the next pending work, or a batch of erase works (see
+ * 'pick_works()'). Returns zero in case of success and a negative error code
+ * in case of failure.
+ */
+static int do_work(struct ubi_device *ubi)
+{
+	int i, n, err = 0;
+	struct ubi_work *batch[WL_ERASE_BATCH];
+
 	cond_resched();
 
 	/*
@@ -233,26 +340,29 @@ static int do_work(struct ubi_device *ubi)
 	 */
 	down_read(&ubi->work_sem);
 	spin_lock(&ubi->wl_lock);
-	if (list_empty(&ubi->works)) {
-		spin_unlock(&ubi->wl_lock);
-		up_read(&ubi->work_sem);
-		return 0;
-	}
-
-	wrk = list_entry(ubi->works.next, struct ubi_work, list);
-	list_del(&wrk->list);
-	ubi->works_count -= 1;
-	ubi_assert(ubi->works_count >= 0);
+	n = pick_works(ubi, batch);
 	spin_unlock(&ubi->wl_lock);
 
 	/*
-	 * Call the worker function. Do not touch the work structure
-	 * after this call as it will have been freed or reused by that
-	 * time by the worker function.
+	 * Call the worker functions. Do not touch a work structure after the
+	 * call as it will have been freed or reused by that time by the worker
+	 * function.
 	 */
-	err = wrk->func(ubi, wrk, 0);
-	if (err)
-		ubi_err("work failed with error code %d", err);
+	for (i = 0; i < n && !err; i++) {
+		err = batch[i]->func(ubi, batch[i], 0);
+		if (err)
+			ubi_err("work failed with error code %d", err);
+	}
+
+	if (i < n) {
+		/* Put the rest of the batch back in the queue, in order */
+		spin_lock(&ubi->wl_lock);
+		while (n > i) {
+			list_add(&batch[--n]->list, &ubi->works);
+			ubi->works_count += 1;
+		}
+		spin_unlock(&ubi->wl_lock);
+	}
 	up_read(&ubi->work_sem);
 
 	return err;
@@ -269,7 +379,9 @@ static int do_work(struct ubi_device *ubi)
  */
 static int produce_free_peb(struct ubi_device *ubi)
 {
-	int err;
+	int err = 0;
+	unsigned int us;
+	ktime_t start = ktime_get();
 
 	spin_lock(&ubi->wl_lock);
 	while (!ubi->free.rb_node) {
@@ -277,14 +389,21 @@ static int produce_free_peb(struct ubi_device *ubi)
 
 		dbg_wl("do one work synchronously");
 		err = do_work(ubi);
-		if (err)
-			return err;
 
 		spin_lock(&ubi->wl_lock);
+		if (err)
+			break;
 	}
+
+	/* The caller was stalled all this time */
+	us = ktime_us_delta(ktime_get(), start);
+	ubi->wl_stats.stalls += 1;
+	ubi->wl_stats.stall_us += us;
+	if (us > ubi->wl_stats.max_stall_us)
+		ubi->wl_stats.max_stall_us = us;
 	spin_unlock(&ubi->wl_lock);
 
-	return 0;
+	return err;
 }
 
 /**
@@ -379,6 +498,183 @@ static struct ubi_wl_entry *find_wl_entry(struct rb_root *root, int max)
 	return e;
 }
 
+/**
+ * request_fm_update - ask the background thread to write a new fastmap.
+ * @ubi: UBI device description object
+ *
+ * Note, @ubi->wl_lock has to be locked.
+ */
+static void request_fm_update(struct ubi_device *ubi)
+{
+	ubi->fm_update_needed = 1;
+	if (ubi->thread_enabled && !ubi_dbg_is_bgt_disabled(ubi))
+		wake_up_process(ubi->bgt_thread);
+}
+
+#ifdef CONFIG_MTD_UBI_FASTMAP
+/**
+ * pick_pool_peb - pick a free physical eraseblock for a fastmap pool.
+ * @ubi: UBI device description object
+ * @wl_target: non-zero if the PEB is going to be a wear-leveling target
+ * @anchor: non-zero if PEBs below %UBI_FM_MAX_START may be picked
+ *
+ * Wear-leveling targets are highly worn out PEBs, like 'ubi_wl_get_peb()'
+ * picks for long term data, everything else gets the least worn out PEBs.
+ * PEBs below %UBI_FM_MAX_START are left for the fastmap itself unless
+ * @anchor is set. Returns %NULL if there is no suitable PEB. Note,
+ * @ubi->wl_lock has to be locked.
+ */
+static struct ubi_wl_entry *pick_pool_peb(struct ubi_device *ubi,
+					  int wl_target, int anchor)
+{
+	struct rb_node *p;
+	struct ubi_wl_entry *e;
+
+	if (!ubi->free.rb_node)
+		return NULL;
+
+	if (wl_target) {
+		e = find_wl_entry(&ubi->free, WL_FREE_MAX_DIFF);
+		p = &e->u.rb;
+	} else
+		p = rb_first(&ubi->free);
+
+	while (p) {
+		e = rb_entry(p, struct ubi_wl_entry, u.rb);
+		if (anchor || e->pnum >= UBI_FM_MAX_START)
+			return e;
+		p = wl_target ? rb_prev(p) : rb_next(p);
+	}
+
+	return NULL;
+}
+
+/**
+ * refill_pool - refill a fastmap pool from the free tree.
+ * @ubi: UBI device description object
+ * @pool: the pool to refill
+ * @wl_target: non-zero if this is the wear-leveling pool
+ *
+ * Note, @ubi->wl_lock has to be locked.
+ */
+static void refill_pool(struct ubi_device *ubi, struct ubi_fm_pool *pool,
+			int wl_target)
+{
+	struct ubi_wl_entry *e;
+	int anchor;
+
+	pool->used = pool->size = 0;
+
+	/* Resort to the anchor area only if nothing else is left */
+	for (anchor = 0; anchor < 2 && !pool->size; anchor++)
+		while (pool->size < pool->max_size) {
+			if (wl_target && ubi->free_count - ubi->beb_rsvd_pebs <
+					 WL_POOL_RESERVE)
+				break;
+			e = pick_pool_peb(ubi, wl_target, anchor);
+			if (!e)
+				break;
+
+			rb_erase(&e->u.rb, &ubi->free);
+			ubi->free_count -= 1;
+			pool->pebs[pool->size++] = e->pnum;
+		}
+}
+
+/**
+ * return_unused_pool_pebs - return the PEBs not handed out to the free tree.
+ * @ubi: UBI device description object
+ * @pool: the pool to empty
+ *
+ * Note, @ubi->wl_lock has to be locked.
+ */
+static void return_unused_pool_pebs(struct ubi_device *ubi,
+				    struct ubi_fm_pool *pool)
+{
+	int i;
+
+	for (i = pool->used; i < pool->size; i++) {
+		wl_tree_add(ubi->lookuptbl[pool->pebs[i]], &ubi->free);
+		ubi->free_count += 1;
+	}
+	pool->used = pool->size = 0;
+}
+
+/**
+ * ubi_refill_pools - refill the fastmap pools.
+ * @ubi: UBI device description object
+ *
+ * The PEBs which were not handed out are returned to the free tree first, so
+ * both pools always contain the best choice of the moment. The user pool is
+ * refilled first, writes must not fail for PEBs held by the wear-leveling
+ * pool. This function is called by the fastmap code right before a new
+ * fastmap is written. Note, @ubi->wl_lock has to be locked.
+ */
+void ubi_refill_pools(struct ubi_device *ubi)
+{
+	return_unused_pool_pebs(ubi, &ubi->fm_wl_pool);
+	return_unused_pool_pebs(ubi, &ubi->fm_pool);
+
+	refill_pool(ubi, &ubi->fm_pool, 0);
+	refill_pool(ubi, &ubi->fm_wl_pool, 1);
+}
+
+/**
+ * ubi_wl_get_fm_peb - get a free physical eraseblock for the fastmap.
+ * @ubi: UBI device description object
+ *
+ * This function returns the least worn out free PEB below %UBI_FM_MAX_START,
+ * or %NULL if there is none. Note, @ubi->wl_lock has to be locked.
+ */
+struct ubi_wl_entry *ubi_wl_get_fm_peb(struct ubi_device *ubi)
+{
+	struct rb_node *p;
+	struct ubi_wl_entry *e;
+
+	for (p = rb_first(&ubi->free); p; p = rb_next(p)) {
+		e = rb_entry(p, struct ubi_wl_entry, u.rb);
+		if (e->pnum < UBI_FM_MAX_START) {
+			paranoid_check_in_wl_tree(ubi, e, &ubi->free);
+			rb_erase(&e->u.rb, &ubi->free);
+			ubi->free_count -= 1;
+			return e;
+		}
+	}
+
+	return NULL;
+}
+
+/**
+ * fm_pool_exhausted - make free physical eraseblocks available again.
+ * @ubi: UBI device description object
+ *
+ * This function is called by 'ubi_wl_get_peb()' when the pool is empty. It
+ * writes a new fastmap, which refills the pools, or, if there are no free PEBs
+ * at all, produces some by doing pending works first. Returns zero in case of
+ * success and a negative error code in case of failure.
+ */
+static int fm_pool_exhausted(struct ubi_device *ubi)
+{
+	int produce = 0;
+
+	spin_lock(&ubi->wl_lock);
+	if (!ubi->free.rb_node && !ubi->fm_deferred_count) {
+		if (ubi->works_count == 0) {
+			ubi_assert(list_empty(&ubi->works));
+			ubi_err("no free eraseblocks");
+			spin_unlock(&ubi->wl_lock);
+			return -ENOSPC;
+		}
+		produce = 1;
+	}
+	spin_unlock(&ubi->wl_lock);
+
+	if (produce)
+		return produce_free_peb(ubi);
+	return ubi_update_fastmap(ubi);
+}
+#endif
+
 /**
  * ubi_wl_get_peb - get a physical eraseblock.
  * @ubi: UBI device description object
@@ -386,6 +682,12 @@ static struct ubi_wl_entry *find_wl_entry(struct rb_root *root, int max)
  *
  * This function returns a physical eraseblock in case of success and a
  * negative error code in case of failure. Might sleep.
+ *
+ * In case of success, @ubi->fm_eba_sem is held for reading on return, which
+ * keeps a fastmap from being written while the new PEB is not yet recorded in
+ * the EBA table. The caller releases it after updating the EBA table or after
+ * returning the PEB with 'ubi_wl_put_peb()'. The data type hint is ignored
+ * while the fastmap is enabled.
  */
 int ubi_wl_get_peb(struct ubi_device *ubi, int dtype)
 {
@@ -396,15 +698,37 @@ int ubi_wl_get_peb(struct ubi_device *ubi, int dtype)
 		   dtype == UBI_UNKNOWN);
 
 retry:
+	down_read(&ubi->fm_eba_sem);
 	spin_lock(&ubi->wl_lock);
+#ifdef CONFIG_MTD_UBI_FASTMAP
+	if (!ubi->fm_disabled) {
+		struct ubi_fm_pool *pool = &ubi->fm_pool;
+
+		if (pool->used == pool->size) {
+			spin_unlock(&ubi->wl_lock);
+			up_read(&ubi->fm_eba_sem);
+
+			err = fm_pool_exhausted(ubi);
+			if (err < 0)
+				return err;
+			goto retry;
+		}
+
+		e = ubi->lookuptbl[pool->pebs[pool->used++]];
+		dbg_wl("PEB %d EC %d from the pool", e->pnum, e->ec);
+		goto protect;
+	}
+#endif
 	if (!ubi->free.rb_node) {
 		if (ubi->works_count == 0) {
 			ubi_assert(list_empty(&ubi->works));
 			ubi_err("no free eraseblocks");
 			spin_unlock(&ubi->wl_lock);
+			up_read(&ubi->fm_eba_sem);
 			return -ENOSPC;
 		}
 		spin_unlock(&ubi->wl_lock);
+		up_read(&ubi->fm_eba_sem);
 
 		err = produce_free_peb(ubi);
 		if (err < 0)
@@ -457,7 +781,14 @@ retry:
 	 * be protected from being moved for some time.
 	 */
 	rb_erase(&e->u.rb, &ubi->free);
+	ubi->free_count -= 1;
 	dbg_wl("PEB %d EC %d", e->pnum, e->ec);
+#ifdef CONFIG_MTD_UBI_FASTMAP
+protect:
+	/* Erasures held back for the fastmap are wanted now */
+	if (ubi->fm_deferred_count && low_on_free(ubi))
+		request_fm_update(ubi);
+#endif
 	prot_queue_add(ubi, e);
 	spin_unlock(&ubi->wl_lock);
 
@@ -465,6 +796,7 @@ retry:
 				   ubi->peb_size - ubi->vid_hdr_aloffset);
 	if (err) {
 		ubi_err("new PEB %d does not contain all 0xFF bytes", e->pnum);
+		up_read(&ubi->fm_eba_sem);
 		return err;
 	}
 
@@ -619,8 +951,56 @@ static void schedule_ubi_work(struct ubi_device *ubi, struct ubi_work *wrk)
 	spin_unlock(&ubi->wl_lock);
 }
 
-static int erase_worker(struct ubi_device *ubi, struct ubi_work *wl_wrk,
-			int cancel);
+#ifdef CONFIG_MTD_UBI_FASTMAP
+/**
+ * defer_erase - hold back an erase work until the next fastmap is written.
+ * @ubi: UBI device description object
+ * @wrk: the erase work
+ *
+ * If the fastmap on the flash says the PEB of @wrk holds data, the PEB has to
+ * stay intact until a newer fastmap is written, otherwise attaching from the
+ * old fastmap would find garbage there. This function adds such works to
+ * @ubi->fm_deferred and returns %1, and returns %0 for all other works.
+ */
+static int defer_erase(struct ubi_device *ubi, struct ubi_work *wrk)
+{
+	int pnum = wrk->e->pnum;
+
+	spin_lock(&ubi->wl_lock);
+	if (ubi->fm_disabled || !test_bit(pnum, ubi->fm_recorded)) {
+		spin_unlock(&ubi->wl_lock);
+		return 0;
+	}
+
+	dbg_wl("defer erasure of PEB %d until the next fastmap", pnum);
+	list_add_tail(&wrk->list, &ubi->fm_deferred);
+	ubi->fm_deferred_count += 1;
+	if (ubi->fm_deferred_count >= ubi->fm_pool.max_size)
+		request_fm_update(ubi);
+	spin_unlock(&ubi->wl_lock);
+	return 1;
+}
+
+/**
+ * ubi_wl_release_deferred - schedule the deferred erase works.
+ * @ubi: UBI device description object
+ *
+ * This function is called once the fastmap recording the PEBs of the deferred
+ * works was superseded or invalidated.
+ */
+void ubi_wl_release_deferred(struct ubi_device *ubi)
+{
+	spin_lock(&ubi->wl_lock);
+	if (ubi->fm_deferred_count) {
+		list_splice_tail_init(&ubi->fm_deferred, &ubi->works);
+		ubi->works_count += ubi->fm_deferred_count;
+		ubi->fm_deferred_count = 0;
+		if (ubi->thread_enabled && !ubi_dbg_is_bgt_disabled(ubi))
+			wake_up_process(ubi->bgt_thread);
+	}
+	spin_unlock(&ubi->wl_lock);
+}
+#endif
 
 /**
  * schedule_erase - schedule an erase work.
@@ -647,10 +1027,123 @@ static int schedule_erase(struct ubi_device *ubi, struct ubi_wl_entry *e,
 	wl_wrk->e = e;
 	wl_wrk->torture = torture;
 
+#ifdef CONFIG_MTD_UBI_FASTMAP
+	if (defer_erase(ubi, wl_wrk))
+		return 0;
+#endif
 	schedule_ubi_work(ubi, wl_wrk);
 	return 0;
 }
 
+#ifdef CONFIG_MTD_UBI_FASTMAP
+/**
+ * ubi_wl_put_fm_peb - return a fastmap physical eraseblock.
+ * @ubi: UBI device description object
+ * @e: the WL entry of the fastmap PEB
+ * @erased: non-zero if the PEB has just been erased by the caller
+ *
+ * Fastmap PEBs are not in any WL tree. Freshly erased ones go to the free tree
+ * straight away, the others are scheduled for erasure. This function returns
+ * zero in case of success and a %-ENOMEM in case of failure.
+ */
+int ubi_wl_put_fm_peb(struct ubi_device *ubi, struct ubi_wl_entry *e,
+		      int erased)
+{
+	if (!erased)
+		return schedule_erase(ubi, e, 0);
+
+	spin_lock(&ubi->wl_lock);
+	wl_tree_add(e, &ubi->free);
+	ubi->free_count += 1;
+	spin_unlock(&ubi->wl_lock);
+	return 0;
+}
+
+/**
+ * ubi_wl_disable_fastmap - switch the WL sub-system to working without the
+ *                          fastmap.
+ * @ubi: UBI device description object
+ *
+ * This function returns the pool PEBs to the free tree and releases the
+ * deferred erasures. The caller has to get rid of the fastmap on the flash
+ * first.
+ */
+void ubi_wl_disable_fastmap(struct ubi_device *ubi)
+{
+	spin_lock(&ubi->wl_lock);
+	ubi->fm_disabled = 1;
+	return_unused_pool_pebs(ubi, &ubi->fm_wl_pool);
+	return_unused_pool_pebs(ubi, &ubi->fm_pool);
+	spin_unlock(&ubi->wl_lock);
+
+	ubi_wl_release_deferred(ubi);
+}
+#endif
+
+/**
+ * peek_wl_target - find the physical eraseblock to move data to.
+ * @ubi: UBI device description object
+ *
+ * Returns %NULL if there is no target at the moment. Note, @ubi->wl_lock has
+ * to be locked.
+ */
+static struct ubi_wl_entry *peek_wl_target(struct ubi_device *ubi)
+{
+#ifdef CONFIG_MTD_UBI_FASTMAP
+	if (!ubi->fm_disabled) {
+		struct ubi_fm_pool *pool = &ubi->fm_wl_pool;
+
+		if (pool->used == pool->size)
+			return NULL;
+		return ubi->lookuptbl[pool->pebs[pool->used]];
+	}
+#endif
+	if (!ubi->free.rb_node)
+		return NULL;
+	return find_wl_entry(&ubi->free, WL_FREE_MAX_DIFF);
+}
+
+/**
+ * take_wl_target - take the physical eraseblock returned by 'peek_wl_target()'.
+ * @ubi: UBI device description object
+ * @e: the physical eraseblock
+ *
+ * Note, @ubi->wl_lock has to be locked.
+ */
+static void take_wl_target(struct ubi_device *ubi, struct ubi_wl_entry *e)
+{
+#ifdef CONFIG_MTD_UBI_FASTMAP
+	if (!ubi->fm_disabled) {
+		ubi->fm_wl_pool.used += 1;
+		return;
+	}
+#endif
+	paranoid_check_in_wl_tree(ubi, e, &ubi->free);
+	rb_erase(&e->u.rb, &ubi->free);
+	ubi->free_count -= 1;
+}
+
+/**
+ * find_anchor_used - find a used physical eraseblock in the fastmap anchor
+ *                    area.
+ * @ubi: UBI device description object
+ *
+ * Returns %NULL if there is none. Note, @ubi->wl_lock has to be locked.
+ */
+static struct ubi_wl_entry *find_anchor_used(struct ubi_device *ubi)
+{
+	int pnum;
+	struct ubi_wl_entry *e;
+
+	for (pnum = 0; pnum < min(ubi->peb_count, UBI_FM_MAX_START); pnum++) {
+		e = ubi->lookuptbl[pnum];
+		if (e && in_wl_tree(e, &ubi->used))
+			return e;
+	}
+
+	return NULL;
+}
+
 /**
  * wear_leveling_worker - wear-leveling worker function.
  * @ubi: UBI device description object
@@ -658,14 +1151,15 @@ static int schedule_erase(struct ubi_device *ubi, struct ubi_wl_entry *e,
  * @cancel: non-zero if the worker has to free memory and exit
  *
  * This function copies a more worn out physical eraseblock to a less worn out
- * one. Returns zero in case of success and a negative error code in case of
- * failure.
+ * one. Anchor works (see 'ubi_ensure_anchor_pebs()') move data out of the
+ * fastmap anchor area instead. Returns zero in case of success and a negative
+ * error code in case of failure.
  */
 static int wear_leveling_worker(struct ubi_device *ubi, struct ubi_work *wrk,
 				int cancel)
 {
 	int err, scrubbing = 0, torture = 0, protect = 0, erroneous = 0;
-	int vol_id = -1, uninitialized_var(lnum);
+	int vol_id = -1, uninitialized_var(lnum), anchor = wrk->anchor;
 	struct ubi_wl_entry *e1, *e2;
 	struct ubi_vid_hdr *vid_hdr;
 
@@ -682,12 +1176,15 @@ static int wear_leveling_worker(struct ubi_device *ubi, struct ubi_work *wrk,
 	ubi_assert(!ubi->move_from && !ubi->move_to);
 	ubi_assert(!ubi->move_to_put);
 
-	if (!ubi->free.rb_node ||
-	    (!ubi->used.rb_node && !ubi->scrub.rb_node)) {
+	e2 = peek_wl_target(ubi);
+	if (!e2 || (!ubi->used.rb_node && !ubi->scrub.rb_node)) {
 		/*
 		 * No free physical eraseblocks? Well, they must be waiting in
 		 * the queue to be erased. Cancel movement - it will be
 		 * triggered again when a free physical eraseblock appears.
+		 * With the fastmap, they may also sit in the free tree while
+		 * the wear-leveling pool is empty - a new fastmap refills it
+		 * and triggers wear-leveling again.
 		 *
 		 * No used physical eraseblocks? They must be temporarily
 		 * protected from being moved. They will be moved to the
@@ -695,18 +1192,35 @@ static int wear_leveling_worker(struct ubi_device *ubi, struct ubi_work *wrk,
 		 * triggered again.
 		 */
 		dbg_wl("cancel WL, a list is empty: free %d, used %d",
-		       !ubi->free.rb_node, !ubi->used.rb_node);
+		       !e2, !ubi->used.rb_node);
+#ifdef CONFIG_MTD_UBI_FASTMAP
+		if (!e2 && !ubi->fm_disabled && ubi->free.rb_node)
+			request_fm_update(ubi);
+#endif
 		goto out_cancel;
 	}
 
-	if (!ubi->scrub.rb_node) {
+	if (anchor) {
+		e1 = find_anchor_used(ubi);
+		if (!e1 || e2->pnum < UBI_FM_MAX_START) {
+			dbg_wl("cancel anchor move");
+			goto out_cancel;
+		}
+		paranoid_check_in_wl_tree(ubi, e1, &ubi->used);
+		rb_erase(&e1->u.rb, &ubi->used);
+		dbg_wl("anchor-move PEB %d to PEB %d", e1->pnum, e2->pnum);
+	} else if (!ubi->scrub.rb_node) {
+		if (erase_works_pending(ubi)) {
+			dbg_wl("erasures are pending, put off WL");
+			goto out_cancel;
+		}
+
 		/*
 		 * Now pick the least worn-out used physical eraseblock and a
 		 * highly worn-out free physical eraseblock. If the erase
 		 * counters differ much enough, start wear-leveling.
 		 */
 		e1 = rb_entry(rb_first(&ubi->used), struct ubi_wl_entry, u.rb);
-		e2 = find_wl_entry(&ubi->free, WL_FREE_MAX_DIFF);
 
 		if (!(e2->ec - e1->ec >= UBI_WL_THRESHOLD)) {
 			dbg_wl("no WL needed: min used EC %d, max free EC %d",
@@ -721,14 +1235,12 @@ static int wear_leveling_worker(struct ubi_device *ubi, struct ubi_work *wrk,
 		/* Perform scrubbing */
 		scrubbing = 1;
 		e1 = rb_entry(rb_first(&ubi->scrub), struct ubi_wl_entry, u.rb);
-		e2 = find_wl_entry(&ubi->free, WL_FREE_MAX_DIFF);
 		paranoid_check_in_wl_tree(ubi, e1, &ubi->scrub);
 		rb_erase(&e1->u.rb, &ubi->scrub);
 		dbg_wl("scrub PEB %d to PEB %d", e1->pnum, e2->pnum);
 	}
 
-	paranoid_check_in_wl_tree(ubi, e2, &ubi->free);
-	rb_erase(&e2->u.rb, &ubi->free);
+	take_wl_target(ubi, e2);
 	ubi->move_from = e1;
 	ubi->move_to = e2;
 	spin_unlock(&ubi->wl_lock);
@@ -853,6 +1365,13 @@ static int wear_leveling_worker(struct ubi_device *ubi, struct ubi_work *wrk,
 		goto out_ro;
 	}
 
+	if (anchor) {
+		/* See whether there is enough room for the fastmap now */
+		spin_lock(&ubi->wl_lock);
+		request_fm_update(ubi);
+		spin_unlock(&ubi->wl_lock);
+	}
+
 	if (e2) {
 		/*
 		 * Well, the target PEB was put meanwhile, schedule it for
@@ -962,10 +1481,24 @@ static int ensure_wear_leveling(struct ubi_device *ubi)
 	 * the WL worker has to be scheduled anyway.
 	 */
 	if (!ubi->scrub.rb_node) {
-		if (!ubi->used.rb_node || !ubi->free.rb_node)
+		e2 = peek_wl_target(ubi);
+#ifdef CONFIG_MTD_UBI_FASTMAP
+		/* The worker gets the wear-leveling pool refilled */
+		if (!e2 && !ubi->fm_disabled && ubi->free.rb_node)
+			e2 = find_wl_entry(&ubi->free, WL_FREE_MAX_DIFF);
+#endif
+		if (!ubi->used.rb_node || !e2)
 			/* No physical eraseblocks - no deal */
 			goto out_unlock;
 
+		/*
+		 * Let the pending erasures replenish the free physical
+		 * eraseblocks first, the last of them will bring us here
+		 * again.
+		 */
+		if (erase_works_pending(ubi))
+			goto out_unlock;
+
 		/*
 		 * We schedule wear-leveling only if the difference between the
 		 * lowest erase counter of used physical eraseblocks and a high
@@ -973,7 +1506,6 @@ static int ensure_wear_leveling(struct ubi_device *ubi)
 		 * %UBI_WL_THRESHOLD.
 		 */
 		e1 = rb_entry(rb_first(&ubi->used), struct ubi_wl_entry, u.rb);
-		e2 = find_wl_entry(&ubi->free, WL_FREE_MAX_DIFF);
 
 		if (!(e2->ec - e1->ec >= UBI_WL_THRESHOLD))
 			goto out_unlock;
@@ -990,6 +1522,7 @@ static int ensure_wear_leveling(struct ubi_device *ubi)
 		goto out_cancel;
 	}
 
+	wrk->anchor = 0;
 	wrk->func = &wear_leveling_worker;
 	schedule_ubi_work(ubi, wrk);
 	return err;
@@ -1002,6 +1535,43 @@ out_unlock:
 	return err;
 }
 
+#ifdef CONFIG_MTD_UBI_FASTMAP
+/**
+ * ubi_ensure_anchor_pebs - make room for the fastmap in the anchor area.
+ * @ubi: UBI device description object
+ *
+ * This function schedules a wear-leveling work which moves data from a PEB
+ * below %UBI_FM_MAX_START to another one. Once the move is done, a fastmap
+ * update is requested, which schedules more moves if still needed. Returns
+ * zero in case of success and a negative error code in case of failure.
+ */
+int ubi_ensure_anchor_pebs(struct ubi_device *ubi)
+{
+	struct ubi_work *wrk;
+
+	spin_lock(&ubi->wl_lock);
+	if (ubi->wl_scheduled) {
+		spin_unlock(&ubi->wl_lock);
+		return 0;
+	}
+	ubi->wl_scheduled = 1;
+	spin_unlock(&ubi->wl_lock);
+
+	wrk = kmalloc(sizeof(struct ubi_work), GFP_NOFS);
+	if (!wrk) {
+		spin_lock(&ubi->wl_lock);
+		ubi->wl_scheduled = 0;
+		spin_unlock(&ubi->wl_lock);
+		return -ENOMEM;
+	}
+
+	wrk->anchor = 1;
+	wrk->func = &wear_leveling_worker;
+	schedule_ubi_work(ubi, wrk);
+	return 0;
+}
+#endif
+
 /**
  * erase_worker - physical eraseblock erase worker function.
  * @ubi: UBI device description object
@@ -1017,7 +1587,7 @@ static int erase_worker(struct ubi_device *ubi, struct ubi_work *wl_wrk,
 			int cancel)
 {
 	struct ubi_wl_entry *e = wl_wrk->e;
-	int pnum = e->pnum, err, need;
+	int pnum = e->pnum, torture = wl_wrk->torture, err, need;
 
 	if (cancel) {
 		dbg_wl("cancel erasure of PEB %d EC %d", pnum, e->ec);
@@ -1028,13 +1598,17 @@ static int erase_worker(struct ubi_device *ubi, struct ubi_work *wl_wrk,
 
 	dbg_wl("erase PEB %d EC %d", pnum, e->ec);
 
-	err = sync_erase(ubi, e, wl_wrk->torture);
+	err = sync_erase(ubi, e, torture);
 	if (!err) {
 		/* Fine, we've erased it successfully */
 		kfree(wl_wrk);
 
 		spin_lock(&ubi->wl_lock);
 		wl_tree_add(e, &ubi->free);
+		ubi->free_count += 1;
+		ubi->wl_stats.erased += 1;
+		if (torture)
+			ubi->wl_stats.tortured += 1;
 		spin_unlock(&ubi->wl_lock);
 
 		/*
@@ -1131,6 +1705,9 @@ out_ro:
  * free physical eraseblocks. The @torture flag has to be set if an I/O error
  * occurred to this @pnum and it has to be tested. This function returns zero
  * in case of success, and a negative error code in case of failure.
+ *
+ * The caller has to hold @ubi->fm_eba_sem for reading, so that the PEB is not
+ * in between the WL trees and the erase works while a fastmap is written.
  */
 int ubi_wl_put_peb(struct ubi_device *ubi, int pnum, int torture)
 {
@@ -1282,6 +1859,16 @@ int ubi_wl_flush(struct ubi_device *ubi)
 {
 	int err;
 
+	/*
+	 * Erasures held back for the fastmap are pending works as well, a new
+	 * fastmap releases them.
+	 */
+	if (ubi->fm_deferred_count) {
+		err = ubi_update_fastmap(ubi);
+		if (err)
+			return err;
+	}
+
 	/*
 	 * Erase while the pending works queue is not empty, but not more than
 	 * the number of currently pending works.
@@ -1359,7 +1946,7 @@ int ubi_thread(void *u)
 
 	set_freezable();
 	for (;;) {
-		int err;
+		int err, fm_update;
 
 		if (kthread_should_stop())
 			break;
@@ -1368,16 +1955,24 @@ int ubi_thread(void *u)
 			continue;
 
 		spin_lock(&ubi->wl_lock);
-		if (list_empty(&ubi->works) || ubi->ro_mode ||
-		    !ubi->thread_enabled || ubi_dbg_is_bgt_disabled(ubi)) {
+		if ((list_empty(&ubi->works) && !ubi->fm_update_needed) ||
+		    ubi->ro_mode || !ubi->thread_enabled ||
+		    ubi_dbg_is_bgt_disabled(ubi)) {
 			set_current_state(TASK_INTERRUPTIBLE);
 			spin_unlock(&ubi->wl_lock);
 			schedule();
 			continue;
 		}
+		fm_update = ubi->fm_update_needed;
+		ubi->fm_update_needed = 0;
 		spin_unlock(&ubi->wl_lock);
 
-		err = do_work(ubi);
+		if (fm_update) {
+			err = ubi_update_fastmap(ubi);
+			if (!err)
+				err = ensure_wear_leveling(ubi);
+		} else
+			err = do_work(ubi);
 		if (err) {
 			ubi_err("%s: work failed with error code %d",
 				ubi->bgt_name, err);
@@ -1419,6 +2014,44 @@ static void cancel_pending(struct ubi_device *ubi)
 	}
 }
 
+/**
+ * fastmap_destroy - free the fastmap related WL state.
+ * @ubi: UBI device description object
+ *
+ * This function frees the deferred erase works, the unused pool PEBs and the
+ * fastmap PEBs, none of which are in any WL tree.
+ */
+static void fastmap_destroy(struct ubi_device *ubi)
+{
+#ifdef CONFIG_MTD_UBI_FASTMAP
+	struct ubi_fm_pool *pools[] = { &ubi->fm_pool, &ubi->fm_wl_pool };
+	int i, j;
+
+	while (!list_empty(&ubi->fm_deferred)) {
+		struct ubi_work *wrk;
+
+		wrk = list_entry(ubi->fm_deferred.next, struct ubi_work, list);
+		list_del(&wrk->list);
+		wrk->func(ubi, wrk, 1);
+		ubi->fm_deferred_count -= 1;
+	}
+
+	for (i = 0; i < ARRAY_SIZE(pools); i++) {
+		for (j = pools[i]->used; j < pools[i]->size; j++)
+			kmem_cache_free(ubi_wl_entry_slab,
+					ubi->lookuptbl[pools[i]->pebs[j]]);
+		pools[i]->used = pools[i]->size = 0;
+	}
+
+	for (i = 0; i < UBI_FM_MAX_BLOCKS; i++) {
+		if (ubi->fm_blocks[i])
+			kmem_cache_free(ubi_wl_entry_slab, ubi->fm_blocks[i]);
+		ubi->fm_blocks[i] = NULL;
+	}
+	ubi->fm_used_blocks = 0;
+#endif
+}
+
 /**
  * ubi_wl_init_scan - initialize the WL sub-system using scanning information.
  * @ubi: UBI device description object
@@ -1441,6 +2074,7 @@ int ubi_wl_init_scan(struct ubi_device *ubi, struct ubi_scan_info *si)
 	init_rwsem(&ubi->work_sem);
 	ubi->max_ec = si->max_ec;
 	INIT_LIST_HEAD(&ubi->works);
+	INIT_LIST_HEAD(&ubi->fm_deferred);
 
 	sprintf(ubi->bgt_name, UBI_BGT_NAME_PATTERN, ubi->ubi_num);
 
@@ -1480,6 +2114,7 @@ int ubi_wl_init_scan(struct ubi_device *ubi, struct ubi_scan_info *si)
 		e->ec = seb->ec;
 		ubi_assert(e->ec >= 0);
 		wl_tree_add(e, &ubi->free);
+		ubi->free_count += 1;
 		ubi->lookuptbl[e->pnum] = e;
 	}
 
@@ -1506,6 +2141,21 @@ int ubi_wl_init_scan(struct ubi_device *ubi, struct ubi_scan_info *si)
 		}
 	}
 
+#ifdef CONFIG_MTD_UBI_FASTMAP
+	list_for_each_entry(seb, &si->fastmap, u.list) {
+		cond_resched();
+
+		e = kmem_cache_alloc(ubi_wl_entry_slab, GFP_KERNEL);
+		if (!e)
+			goto out_free;
+
+		e->pnum = seb->pnum;
+		e->ec = seb->ec;
+		ubi->lookuptbl[e->pnum] = e;
+		ubi->fm_blocks[seb->lnum] = e;
+	}
+#endif
+
 	if (ubi->avail_pebs < WL_RESERVED_PEBS) {
 		ubi_err("no enough physical eraseblocks (%d, need %d)",
 			ubi->avail_pebs, WL_RESERVED_PEBS);
@@ -1517,6 +2167,23 @@ int ubi_wl_init_scan(struct ubi_device *ubi, struct ubi_scan_info *si)
 	ubi->avail_pebs -= WL_RESERVED_PEBS;
 	ubi->rsvd_pebs += WL_RESERVED_PEBS;
 
+#ifdef CONFIG_MTD_UBI_FASTMAP
+	if (!ubi->fm_disabled) {
+		/* The old fastmap stays until the new one has been written */
+		int need = 2 * ubi->fm_size / ubi->leb_size;
+
+		if (ubi->avail_pebs < need) {
+			ubi_warn("no enough physical eraseblocks for the "
+				 "fastmap (%d, need %d), disabling it",
+				 ubi->avail_pebs, need);
+			ubi_disable_fastmap(ubi);
+		} else {
+			ubi->avail_pebs -= need;
+			ubi->rsvd_pebs += need;
+		}
+	}
+#endif
+
 	/* Schedule wear-leveling if needed */
 	err = ensure_wear_leveling(ubi);
 	if (err)
@@ -1526,6 +2193,7 @@ int ubi_wl_init_scan(struct ubi_device *ubi, struct ubi_scan_info *si)
 
 out_free:
 	cancel_pending(ubi);
+	fastmap_destroy(ubi);
 	tree_destroy(&ubi->used);
 	tree_destroy(&ubi->free);
 	tree_destroy(&ubi->scrub);
@@ -1558,6 +2226,7 @@ void ubi_wl_close(struct ubi_device *ubi)
 {
 	dbg_wl("close the WL sub-system");
 	cancel_pending(ubi);
+	fastmap_destroy(ubi);
 	protection_queue_destroy(ubi);
 	tree_destroy(&ubi->used);
 	tree_destroy(&ubi->erroneous);
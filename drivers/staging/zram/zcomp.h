@@ -0,0 +1,85 @@
+/*
+ * Compressed RAM block device
+ *
+ * Copyright (C) 2008, 2009, 2010  Nitin Gupta
+ *
+ * This code is released using a dual license strategy: BSD/GPL
+ * You can choose the licence that better fits your requirements.
+ *
+ * Released under the terms of 3-clause BSD License
+ * Released under the terms of GNU General Public License Version 2.0
+ *
+ * Project home: http://compcache.googlecode.com
+ */
+
+#ifndef _ZCOMP_H_
+#define _ZCOMP_H_
+
+#include <linux/list.h>
+#include <linux/spinlock.h>
+#include <linux/wait.h>
+#include <linux/crypto.h>
+
+#define ZCOMP_NAME_LEN		CRYPTO_MAX_ALG_NAME
+#define ZCOMP_DEFAULT		"lzo"
+
+/*
+ * A compression stream: a crypto API compressor instance plus a buffer
+ * large enough for the worst case compressed size of one page.  A stream
+ * is owned by one user from zcomp_strm_find() to zcomp_strm_release(),
+ * and the owner may sleep in between (e.g. allocating storage for the
+ * compressed object).  Decompression also needs a stream, as some
+ * compressors (deflate) keep state in the transform.
+ */
+struct zcomp_strm {
+	struct crypto_comp *tfm;
+	void *buffer;		/* compressed output, 2 pages */
+	struct list_head list;
+	/* Accounted into struct zcomp on release */
+	u64 comp_ns;
+	u64 decomp_ns;
+	unsigned long comp_count;
+	unsigned long decomp_count;
+};
+
+struct zcomp_stats {
+	u64 comp_ns;		/* total time spent compressing */
+	u64 decomp_ns;		/* total time spent decompressing */
+	unsigned long comp_count;
+	unsigned long decomp_count;
+	unsigned long strm_waits;	/* times a user slept for a stream */
+};
+
+/*
+ * Pool of compression streams, all using the same algorithm.  Streams
+ * are allocated from process context (device init and the
+ * max_comp_streams attribute) only, never from the I/O path.
+ */
+struct zcomp {
+	char name[ZCOMP_NAME_LEN];
+	spinlock_t strm_lock;		/* protects idle list and counters */
+	struct list_head idle_strm;
+	wait_queue_head_t strm_wait;
+	int avail_strm;			/* streams allocated */
+	int max_strm;			/* upper bound on avail_strm */
+	struct zcomp_stats stats;
+};
+
+extern int zcomp_available(const char *name);
+extern ssize_t zcomp_available_show(const char *cur, char *buf);
+
+extern struct zcomp *zcomp_create(const char *name, int max_strm);
+extern void zcomp_destroy(struct zcomp *comp);
+extern int zcomp_set_max_streams(struct zcomp *comp, int num_strm);
+extern void zcomp_get_stats(struct zcomp *comp, struct zcomp_stats *stats);
+
+extern struct zcomp_strm *zcomp_strm_find(struct zcomp *comp);
+extern void zcomp_strm_release(struct zcomp *comp, struct zcomp_strm *zstrm);
+
+extern int zcomp_compress(struct zcomp_strm *zstrm,
+			  const unsigned char *src, size_t *dst_len);
+extern int zcomp_decompress(struct zcomp_strm *zstrm,
+			    const unsigned char *src, size_t src_len,
+			    unsigned char *dst);
+
+#endif
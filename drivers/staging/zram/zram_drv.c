@@ -28,8 +28,10 @@
 #include <linux/device.h>
 #include <linux/genhd.h>
 #include <linux/highmem.h>
+#include <linux/jhash.h>
+#include <linux/rbtree.h>
 #include <linux/slab.h>
-#include <linux/lzo.h>
+#include <linux/bit_spinlock.h>
 #include <linux/string.h>
 #include <linux/vmalloc.h>
 
@@ -42,16 +44,6 @@ struct zram *zram_devices;
 /* Module params (documentation at end) */
 unsigned int zram_num_devices;
 
-static void zram_stat_inc(u32 *v)
-{
-	*v = *v + 1;
-}
-
-static void zram_stat_dec(u32 *v)
-{
-	*v = *v - 1;
-}
-
 static void zram_stat64_add(struct zram *zram, u64 *v, u64 inc)
 {
 	spin_lock(&zram->stat64_lock);
@@ -71,6 +63,25 @@ static void zram_stat64_inc(struct zram *zram, u64 *v)
 	zram_stat64_add(zram, v, 1);
 }
 
+/*
+ * Per-slot lock.  Readers, writers and swap slot free notifications of
+ * different slots proceed in parallel; only the table entry update is
+ * done under the lock, compression and allocation happen outside it.
+ */
+static void zram_slot_lock(struct zram *zram, u32 index)
+{
+	if (likely(bit_spin_trylock(ZRAM_ACCESS, &zram->table[index].flags)))
+		return;
+
+	zram_stat64_inc(zram, &zram->stats.slot_contention);
+	bit_spin_lock(ZRAM_ACCESS, &zram->table[index].flags);
+}
+
+static void zram_slot_unlock(struct zram *zram, u32 index)
+{
+	bit_spin_unlock(ZRAM_ACCESS, &zram->table[index].flags);
+}
+
 static int zram_test_flag(struct zram *zram, u32 index,
 			enum zram_pageflags flag)
 {
@@ -133,48 +144,159 @@ static void zram_set_disksize(struct zram *zram, size_t totalram_bytes)
 	zram->disksize &= PAGE_MASK;
 }
 
-static void zram_free_page(struct zram *zram, size_t index)
+/*
+ * Return the object backing a slot and its size, looking through the
+ * dedup node for shared objects.  Called with the slot lock held; the
+ * node's handle never changes while a slot holds a reference to it.
+ */
+static unsigned long zram_slot_obj(struct zram *zram, u32 index, u32 *size)
+{
+	struct table *t = &zram->table[index];
+
+	if (zram_test_flag(zram, index, ZRAM_DEDUP)) {
+		*size = t->dnode->clen;
+		return t->dnode->handle;
+	}
+
+	*size = t->size;
+	return t->handle;
+}
+
+static int zram_dedup_match(struct zram *zram, struct zram_dedup_node *dnode,
+			    const unsigned char *buf)
+{
+	unsigned char *cmem;
+	int ret;
+
+	cmem = zs_map_object(zram->mem_pool, dnode->handle, ZS_MM_RO);
+	ret = !memcmp(cmem, buf, dnode->clen);
+	zs_unmap_object(zram->mem_pool, dnode->handle);
+
+	return ret;
+}
+
+/*
+ * Look for an object with the same checksum and compressed contents,
+ * and take a reference to it.  Nodes with equal checksums are adjacent
+ * in the tree, so find the first one and walk forward.
+ */
+static struct zram_dedup_node *zram_dedup_find(struct zram *zram,
+		u32 checksum, const unsigned char *buf, size_t clen)
+{
+	struct rb_node *rb, *first = NULL;
+	struct zram_dedup_node *dnode;
+
+	spin_lock(&zram->dedup_lock);
+	rb = zram->dedup_root.rb_node;
+	while (rb) {
+		dnode = rb_entry(rb, struct zram_dedup_node, node);
+		if (checksum <= dnode->checksum) {
+			if (checksum == dnode->checksum)
+				first = rb;
+			rb = rb->rb_left;
+		} else
+			rb = rb->rb_right;
+	}
+
+	for (rb = first; rb; rb = rb_next(rb)) {
+		dnode = rb_entry(rb, struct zram_dedup_node, node);
+		if (dnode->checksum != checksum)
+			break;
+		if (dnode->clen == clen &&
+		    zram_dedup_match(zram, dnode, buf)) {
+			dnode->refcount++;
+			spin_unlock(&zram->dedup_lock);
+			return dnode;
+		}
+	}
+	spin_unlock(&zram->dedup_lock);
+
+	return NULL;
+}
+
+static void zram_dedup_insert(struct zram *zram, struct zram_dedup_node *new)
 {
-	u32 clen;
-	void *obj;
+	struct rb_node **link = &zram->dedup_root.rb_node, *parent = NULL;
+	struct zram_dedup_node *dnode;
+
+	spin_lock(&zram->dedup_lock);
+	while (*link) {
+		parent = *link;
+		dnode = rb_entry(parent, struct zram_dedup_node, node);
+		if (new->checksum < dnode->checksum)
+			link = &parent->rb_left;
+		else
+			link = &parent->rb_right;
+	}
+	rb_link_node(&new->node, parent, link);
+	rb_insert_color(&new->node, &zram->dedup_root);
+	spin_unlock(&zram->dedup_lock);
+}
 
-	struct page *page = zram->table[index].page;
-	u32 offset = zram->table[index].offset;
+/* Drop a slot's reference; returns 1 if the object is now unused. */
+static int zram_dedup_put(struct zram *zram, struct zram_dedup_node *dnode)
+{
+	int last;
+
+	spin_lock(&zram->dedup_lock);
+	last = !--dnode->refcount;
+	if (last)
+		rb_erase(&dnode->node, &zram->dedup_root);
+	spin_unlock(&zram->dedup_lock);
 
-	if (unlikely(!page)) {
+	return last;
+}
+
+static void zram_free_page(struct zram *zram, size_t index)
+{
+	unsigned long handle = zram->table[index].handle;
+	u32 clen = zram->table[index].size;
+
+	if (unlikely(!handle)) {
 		/*
 		 * No memory is allocated for zero filled pages.
 		 * Simply clear zero page flag.
 		 */
 		if (zram_test_flag(zram, index, ZRAM_ZERO)) {
 			zram_clear_flag(zram, index, ZRAM_ZERO);
-			zram_stat_dec(&zram->stats.pages_zero);
+			atomic_dec(&zram->stats.pages_zero);
 		}
 		return;
 	}
 
+	if (zram_test_flag(zram, index, ZRAM_DEDUP)) {
+		struct zram_dedup_node *dnode = zram->table[index].dnode;
+
+		zram_clear_flag(zram, index, ZRAM_DEDUP);
+		if (!zram_dedup_put(zram, dnode)) {
+			/* Still used by other slots */
+			atomic_dec(&zram->stats.dup_pages);
+			goto out_slot;
+		}
+		handle = dnode->handle;
+		clen = dnode->clen;
+		kfree(dnode);
+	}
+
 	if (unlikely(zram_test_flag(zram, index, ZRAM_UNCOMPRESSED))) {
 		clen = PAGE_SIZE;
-		__free_page(page);
+		__free_page(zram->table[index].page);
 		zram_clear_flag(zram, index, ZRAM_UNCOMPRESSED);
-		zram_stat_dec(&zram->stats.pages_expand);
+		atomic_dec(&zram->stats.pages_expand);
 		goto out;
 	}
 
-	obj = kmap_atomic(page, KM_USER0) + offset;
-	clen = xv_get_object_size(obj) - sizeof(struct zobj_header);
-	kunmap_atomic(obj, KM_USER0);
-
-	xv_free(zram->mem_pool, page, offset);
+	zs_free(zram->mem_pool, handle);
 	if (clen <= PAGE_SIZE / 2)
-		zram_stat_dec(&zram->stats.good_compress);
+		atomic_dec(&zram->stats.good_compress);
 
 out:
 	zram_stat64_sub(zram, &zram->stats.compr_size, clen);
-	zram_stat_dec(&zram->stats.pages_stored);
+out_slot:
+	atomic_dec(&zram->stats.pages_stored);
 
-	zram->table[index].page = NULL;
-	zram->table[index].offset = 0;
+	zram->table[index].handle = 0;
+	zram->table[index].size = 0;
 }
 
 static void handle_zero_page(struct bio_vec *bvec)
@@ -213,105 +335,112 @@ static inline int is_partial_io(struct bio_vec *bvec)
 static int zram_bvec_read(struct zram *zram, struct bio_vec *bvec,
 			  u32 index, int offset, struct bio *bio)
 {
-	int ret;
-	size_t clen;
+	int ret = 0;
+	u32 size;
+	unsigned long handle;
 	struct page *page;
-	struct zobj_header *zheader;
+	struct zcomp_strm *zstrm;
 	unsigned char *user_mem, *cmem, *uncmem = NULL;
 
 	page = bvec->bv_page;
 
+	if (is_partial_io(bvec)) {
+		/* Use  a temporary buffer to decompress the page */
+		uncmem = kmalloc(PAGE_SIZE, GFP_NOIO);
+		if (!uncmem) {
+			pr_info("Error allocating temp memory!\n");
+			return -ENOMEM;
+		}
+	}
+
+	/* Decompression can't wait for a stream under the slot lock */
+	zstrm = zcomp_strm_find(zram->comp);
+	zram_slot_lock(zram, index);
+
 	if (zram_test_flag(zram, index, ZRAM_ZERO)) {
+		zram_slot_unlock(zram, index);
 		handle_zero_page(bvec);
-		return 0;
+		goto out;
 	}
 
 	/* Requested page is not present in compressed area */
-	if (unlikely(!zram->table[index].page)) {
+	if (unlikely(!zram->table[index].handle)) {
+		zram_slot_unlock(zram, index);
 		pr_debug("Read before write: sector=%lu, size=%u",
 			 (ulong)(bio->bi_sector), bio->bi_size);
 		handle_zero_page(bvec);
-		return 0;
+		goto out;
 	}
 
 	/* Page is stored uncompressed since it's incompressible */
 	if (unlikely(zram_test_flag(zram, index, ZRAM_UNCOMPRESSED))) {
 		handle_uncompressed_page(zram, bvec, index, offset);
-		return 0;
-	}
-
-	if (is_partial_io(bvec)) {
-		/* Use  a temporary buffer to decompress the page */
-		uncmem = kmalloc(PAGE_SIZE, GFP_KERNEL);
-		if (!uncmem) {
-			pr_info("Error allocating temp memory!\n");
-			return -ENOMEM;
-		}
+		zram_slot_unlock(zram, index);
+		goto out;
 	}
 
 	user_mem = kmap_atomic(page, KM_USER0);
 	if (!is_partial_io(bvec))
 		uncmem = user_mem;
-	clen = PAGE_SIZE;
 
-	cmem = kmap_atomic(zram->table[index].page, KM_USER1) +
-		zram->table[index].offset;
+	handle = zram_slot_obj(zram, index, &size);
+	cmem = zs_map_object(zram->mem_pool, handle, ZS_MM_RO);
+	ret = zcomp_decompress(zstrm, cmem, size, uncmem);
+	zs_unmap_object(zram->mem_pool, handle);
+	zram_slot_unlock(zram, index);
 
-	ret = lzo1x_decompress_safe(cmem + sizeof(*zheader),
-				    xv_get_object_size(cmem) - sizeof(*zheader),
-				    uncmem, &clen);
-
-	if (is_partial_io(bvec)) {
+	if (is_partial_io(bvec))
 		memcpy(user_mem + bvec->bv_offset, uncmem + offset,
 		       bvec->bv_len);
-		kfree(uncmem);
-	}
 
-	kunmap_atomic(cmem, KM_USER1);
 	kunmap_atomic(user_mem, KM_USER0);
 
 	/* Should NEVER happen. Return bio error if it does. */
-	if (unlikely(ret != LZO_E_OK)) {
+	if (unlikely(ret)) {
 		pr_err("Decompression failed! err=%d, page=%u\n", ret, index);
 		zram_stat64_inc(zram, &zram->stats.failed_reads);
-		return ret;
+		goto out;
 	}
 
 	flush_dcache_page(page);
 
-	return 0;
+out:
+	zcomp_strm_release(zram->comp, zstrm);
+	if (is_partial_io(bvec))
+		kfree(uncmem);
+	return ret;
 }
 
-static int zram_read_before_write(struct zram *zram, char *mem, u32 index)
+/* Called with the slot lock held */
+static int zram_read_before_write(struct zram *zram, struct zcomp_strm *zstrm,
+				  char *mem, u32 index)
 {
 	int ret;
-	size_t clen = PAGE_SIZE;
-	struct zobj_header *zheader;
+	u32 size;
+	unsigned long handle;
 	unsigned char *cmem;
 
 	if (zram_test_flag(zram, index, ZRAM_ZERO) ||
-	    !zram->table[index].page) {
+	    !zram->table[index].handle) {
 		memset(mem, 0, PAGE_SIZE);
 		return 0;
 	}
 
-	cmem = kmap_atomic(zram->table[index].page, KM_USER0) +
-		zram->table[index].offset;
-
 	/* Page is stored uncompressed since it's incompressible */
 	if (unlikely(zram_test_flag(zram, index, ZRAM_UNCOMPRESSED))) {
+		cmem = kmap_atomic(zram->table[index].page, KM_USER0);
 		memcpy(mem, cmem, PAGE_SIZE);
 		kunmap_atomic(cmem, KM_USER0);
 		return 0;
 	}
 
-	ret = lzo1x_decompress_safe(cmem + sizeof(*zheader),
-				    xv_get_object_size(cmem) - sizeof(*zheader),
-				    mem, &clen);
-	kunmap_atomic(cmem, KM_USER0);
+	handle = zram_slot_obj(zram, index, &size);
+	cmem = zs_map_object(zram->mem_pool, handle, ZS_MM_RO);
+	ret = zcomp_decompress(zstrm, cmem, size, mem);
+	zs_unmap_object(zram->mem_pool, handle);
 
 	/* Should NEVER happen. Return bio error if it does. */
-	if (unlikely(ret != LZO_E_OK)) {
+	if (unlikely(ret)) {
 		pr_err("Decompression failed! err=%d, page=%u\n", ret, index);
 		zram_stat64_inc(zram, &zram->stats.failed_reads);
 		return ret;
@@ -324,41 +453,40 @@ static int zram_bvec_write(struct zram *zram, struct bio_vec *bvec, u32 index,
 			   int offset)
 {
 	int ret;
-	u32 store_offset;
+	u32 checksum = 0;
 	size_t clen;
-	struct zobj_header *zheader;
-	struct page *page, *page_store;
+	unsigned long handle = 0;
+	struct zcomp_strm *zstrm;
+	struct zram_dedup_node *dnode = NULL;
+	struct page *page, *page_store = NULL;
 	unsigned char *user_mem, *cmem, *src, *uncmem = NULL;
 
 	page = bvec->bv_page;
-	src = zram->compress_buffer;
+
+	/*
+	 * Compression happens without the slot lock, in a stream of our
+	 * own, so writers to different slots compress concurrently.
+	 */
+	zstrm = zcomp_strm_find(zram->comp);
 
 	if (is_partial_io(bvec)) {
 		/*
 		 * This is a partial IO. We need to read the full page
 		 * before to write the changes.
 		 */
-		uncmem = kmalloc(PAGE_SIZE, GFP_KERNEL);
+		uncmem = kmalloc(PAGE_SIZE, GFP_NOIO);
 		if (!uncmem) {
 			pr_info("Error allocating temp memory!\n");
 			ret = -ENOMEM;
-			goto out;
-		}
-		ret = zram_read_before_write(zram, uncmem, index);
-		if (ret) {
-			kfree(uncmem);
-			goto out;
+			goto out_strm;
 		}
+		zram_slot_lock(zram, index);
+		ret = zram_read_before_write(zram, zstrm, uncmem, index);
+		zram_slot_unlock(zram, index);
+		if (ret)
+			goto out_strm;
 	}
 
-	/*
-	 * System overwrites unused sectors. Free memory associated
-	 * with this sector now.
-	 */
-	if (zram->table[index].page ||
-	    zram_test_flag(zram, index, ZRAM_ZERO))
-		zram_free_page(zram, index);
-
 	user_mem = kmap_atomic(page, KM_USER0);
 
 	if (is_partial_io(bvec))
@@ -369,24 +497,34 @@ static int zram_bvec_write(struct zram *zram, struct bio_vec *bvec, u32 index,
 
 	if (page_zero_filled(uncmem)) {
 		kunmap_atomic(user_mem, KM_USER0);
-		if (is_partial_io(bvec))
-			kfree(uncmem);
-		zram_stat_inc(&zram->stats.pages_zero);
+		zcomp_strm_release(zram->comp, zstrm);
+
+		/*
+		 * System overwrites unused sectors. Free memory associated
+		 * with this sector now.
+		 */
+		zram_slot_lock(zram, index);
+		zram_free_page(zram, index);
 		zram_set_flag(zram, index, ZRAM_ZERO);
+		zram_slot_unlock(zram, index);
+
+		atomic_inc(&zram->stats.pages_zero);
 		ret = 0;
 		goto out;
 	}
 
-	ret = lzo1x_1_compress(uncmem, PAGE_SIZE, src, &clen,
-			       zram->compress_workmem);
+	if (zram->dedup)
+		checksum = jhash2((u32 *)uncmem, PAGE_SIZE / sizeof(u32), 0);
+
+	ret = zcomp_compress(zstrm, uncmem, &clen);
 
 	kunmap_atomic(user_mem, KM_USER0);
-	if (is_partial_io(bvec))
-			kfree(uncmem);
+	if (!is_partial_io(bvec))
+		uncmem = NULL;
 
-	if (unlikely(ret != LZO_E_OK)) {
+	if (unlikely(ret)) {
 		pr_err("Compression failed! err=%d\n", ret);
-		goto out;
+		goto out_strm;
 	}
 
 	/*
@@ -401,56 +539,90 @@ static int zram_bvec_write(struct zram *zram, struct bio_vec *bvec, u32 index,
 			pr_info("Error allocating memory for "
 				"incompressible page: %u\n", index);
 			ret = -ENOMEM;
-			goto out;
+			goto out_strm;
+		}
+		src = uncmem ? uncmem : kmap_atomic(page, KM_USER0);
+		cmem = kmap_atomic(page_store, KM_USER1);
+		memcpy(cmem, src, clen);
+		kunmap_atomic(cmem, KM_USER1);
+		if (!uncmem)
+			kunmap_atomic(src, KM_USER0);
+	} else {
+		if (zram->dedup) {
+			dnode = zram_dedup_find(zram, checksum,
+						zstrm->buffer, clen);
+			if (dnode) {
+				zcomp_strm_release(zram->comp, zstrm);
+				atomic_inc(&zram->stats.dup_pages);
+				goto install;
+			}
+
+			dnode = kmalloc(sizeof(*dnode), GFP_NOIO);
+			if (!dnode) {
+				ret = -ENOMEM;
+				goto out_strm;
+			}
 		}
 
-		store_offset = 0;
-		zram_set_flag(zram, index, ZRAM_UNCOMPRESSED);
-		zram_stat_inc(&zram->stats.pages_expand);
-		zram->table[index].page = page_store;
-		src = kmap_atomic(page, KM_USER0);
-		goto memstore;
-	}
-
-	if (xv_malloc(zram->mem_pool, clen + sizeof(*zheader),
-		      &zram->table[index].page, &store_offset,
-		      GFP_NOIO | __GFP_HIGHMEM)) {
-		pr_info("Error allocating memory for compressed "
-			"page: %u, size=%zu\n", index, clen);
-		ret = -ENOMEM;
-		goto out;
+		handle = zs_malloc(zram->mem_pool, clen);
+		if (!handle) {
+			kfree(dnode);
+			pr_info("Error allocating memory for compressed "
+				"page: %u, size=%zu\n", index, clen);
+			ret = -ENOMEM;
+			goto out_strm;
+		}
+		cmem = zs_map_object(zram->mem_pool, handle, ZS_MM_WO);
+		memcpy(cmem, zstrm->buffer, clen);
+		zs_unmap_object(zram->mem_pool, handle);
 	}
 
-memstore:
-	zram->table[index].offset = store_offset;
+	zcomp_strm_release(zram->comp, zstrm);
 
-	cmem = kmap_atomic(zram->table[index].page, KM_USER1) +
-		zram->table[index].offset;
-
-#if 0
-	/* Back-reference needed for memory defragmentation */
-	if (!zram_test_flag(zram, index, ZRAM_UNCOMPRESSED)) {
-		zheader = (struct zobj_header *)cmem;
-		zheader->table_idx = index;
-		cmem += sizeof(*zheader);
+	if (dnode) {
+		dnode->checksum = checksum;
+		dnode->refcount = 1;
+		dnode->handle = handle;
+		dnode->clen = clen;
+		zram_dedup_insert(zram, dnode);
 	}
-#endif
-
-	memcpy(cmem, src, clen);
-
-	kunmap_atomic(cmem, KM_USER1);
-	if (unlikely(zram_test_flag(zram, index, ZRAM_UNCOMPRESSED)))
-		kunmap_atomic(src, KM_USER0);
 
 	/* Update stats */
 	zram_stat64_add(zram, &zram->stats.compr_size, clen);
-	zram_stat_inc(&zram->stats.pages_stored);
-	if (clen <= PAGE_SIZE / 2)
-		zram_stat_inc(&zram->stats.good_compress);
+	if (page_store)
+		atomic_inc(&zram->stats.pages_expand);
+	else if (clen <= PAGE_SIZE / 2)
+		atomic_inc(&zram->stats.good_compress);
 
-	return 0;
+install:
+	/*
+	 * System overwrites unused sectors. Free memory associated
+	 * with this sector now, and publish the new object.
+	 */
+	zram_slot_lock(zram, index);
+	zram_free_page(zram, index);
+	if (dnode) {
+		zram->table[index].dnode = dnode;
+		zram_set_flag(zram, index, ZRAM_DEDUP);
+	} else if (page_store) {
+		zram->table[index].page = page_store;
+		zram->table[index].size = PAGE_SIZE;
+		zram_set_flag(zram, index, ZRAM_UNCOMPRESSED);
+	} else {
+		zram->table[index].handle = handle;
+		zram->table[index].size = clen;
+	}
+	zram_slot_unlock(zram, index);
 
+	atomic_inc(&zram->stats.pages_stored);
+	ret = 0;
+	goto out;
+
+out_strm:
+	zcomp_strm_release(zram->comp, zstrm);
 out:
+	if (is_partial_io(bvec))
+		kfree(uncmem);
 	if (ret)
 		zram_stat64_inc(zram, &zram->stats.failed_writes);
 	return ret;
@@ -461,15 +633,10 @@ static int zram_bvec_rw(struct zram *zram, struct bio_vec *bvec, u32 index,
 {
 	int ret;
 
-	if (rw == READ) {
-		down_read(&zram->lock);
+	if (rw == READ)
 		ret = zram_bvec_read(zram, bvec, index, offset, bio);
-		up_read(&zram->lock);
-	} else {
-		down_write(&zram->lock);
+	else
 		ret = zram_bvec_write(zram, bvec, index, offset);
-		up_write(&zram->lock);
-	}
 
 	return ret;
 }
@@ -589,34 +756,24 @@ void __zram_reset_device(struct zram *zram)
 
 	zram->init_done = 0;
 
-	/* Free various per-device buffers */
-	kfree(zram->compress_workmem);
-	free_pages((unsigned long)zram->compress_buffer, 1);
-
-	zram->compress_workmem = NULL;
-	zram->compress_buffer = NULL;
-
-	/* Free all pages that are still in this zram device */
-	for (index = 0; index < zram->disksize >> PAGE_SHIFT; index++) {
-		struct page *page;
-		u16 offset;
-
-		page = zram->table[index].page;
-		offset = zram->table[index].offset;
-
-		if (!page)
-			continue;
+	/* Free compression streams */
+	if (zram->comp)
+		zcomp_destroy(zram->comp);
+	zram->comp = NULL;
 
-		if (unlikely(zram_test_flag(zram, index, ZRAM_UNCOMPRESSED)))
-			__free_page(page);
-		else
-			xv_free(zram->mem_pool, page, offset);
-	}
+	/*
+	 * Free all pages that are still in this zram device.  Going
+	 * through zram_free_page() drops shared objects exactly once.
+	 */
+	for (index = 0; index < zram->disksize >> PAGE_SHIFT; index++)
+		zram_free_page(zram, index);
+	zram->dedup_root = RB_ROOT;
 
 	vfree(zram->table);
 	zram->table = NULL;
 
-	xv_destroy_pool(zram->mem_pool);
+	if (zram->mem_pool)
+		zs_destroy_pool(zram->mem_pool);
 	zram->mem_pool = NULL;
 
 	/* Reset stats */
@@ -646,17 +803,11 @@ int zram_init_device(struct zram *zram)
 
 	zram_set_disksize(zram, totalram_pages << PAGE_SHIFT);
 
-	zram->compress_workmem = kzalloc(LZO1X_MEM_COMPRESS, GFP_KERNEL);
-	if (!zram->compress_workmem) {
-		pr_err("Error allocating compressor working memory!\n");
-		ret = -ENOMEM;
-		goto fail_no_table;
-	}
-
-	zram->compress_buffer = (void *)__get_free_pages(__GFP_ZERO, 1);
-	if (!zram->compress_buffer) {
-		pr_err("Error allocating compressor buffer space\n");
-		ret = -ENOMEM;
+	zram->comp = zcomp_create(zram->compressor, zram->max_comp_streams);
+	if (IS_ERR(zram->comp)) {
+		pr_err("Error initializing %s compressor\n", zram->compressor);
+		ret = PTR_ERR(zram->comp);
+		zram->comp = NULL;
 		goto fail_no_table;
 	}
 
@@ -673,7 +824,8 @@ int zram_init_device(struct zram *zram)
 	/* zram devices sort of resembles non-rotational disks */
 	queue_flag_set_unlocked(QUEUE_FLAG_NONROT, zram->disk->queue);
 
-	zram->mem_pool = xv_create_pool();
+	zram->mem_pool = zs_create_pool(zram->disk->disk_name,
+					GFP_NOIO | __GFP_HIGHMEM);
 	if (!zram->mem_pool) {
 		pr_err("Error creating memory pool\n");
 		ret = -ENOMEM;
@@ -702,7 +854,9 @@ static void zram_slot_free_notify(struct block_device *bdev,
 	struct zram *zram;
 
 	zram = bdev->bd_disk->private_data;
+	zram_slot_lock(zram, index);
 	zram_free_page(zram, index);
+	zram_slot_unlock(zram, index);
 	zram_stat64_inc(zram, &zram->stats.notify_free);
 }
 
@@ -715,9 +869,10 @@ static int create_device(struct zram *zram, int device_id)
 {
 	int ret = 0;
 
-	init_rwsem(&zram->lock);
 	init_rwsem(&zram->init_lock);
 	spin_lock_init(&zram->stat64_lock);
+	spin_lock_init(&zram->dedup_lock);
+	zram->dedup_root = RB_ROOT;
 
 	zram->queue = blk_alloc_queue(GFP_KERNEL);
 	if (!zram->queue) {
@@ -770,6 +925,8 @@ static int create_device(struct zram *zram, int device_id)
 	}
 
 	zram->init_done = 0;
+	zram->max_comp_streams = num_online_cpus();
+	strlcpy(zram->compressor, ZCOMP_DEFAULT, sizeof(zram->compressor));
 
 out:
 	return ret;
@@ -17,8 +17,10 @@
 
 #include <linux/spinlock.h>
 #include <linux/mutex.h>
+#include <linux/rbtree.h>
 
-#include "xvmalloc.h"
+#include "zsmalloc.h"
+#include "zcomp.h"
 
 /*
  * Some arbitrary value. This is just to catch
@@ -26,18 +28,6 @@
  */
 static const unsigned max_num_devices = 32;
 
-/*
- * Stored at beginning of each compressed object.
- *
- * It stores back-reference to table entry which points to this
- * object. This is required to support memory defragmentation.
- */
-struct zobj_header {
-#if 0
-	u32 table_idx;
-#endif
-};
-
 /*-- Configurable parameters */
 
 /* Default zram disk size: 25% of total RAM */
@@ -50,9 +40,8 @@ static const unsigned default_disksize_perc_ram = 25;
 static const size_t max_zpage_size = PAGE_SIZE / 4 * 3;
 
 /*
- * NOTE: max_zpage_size must be less than or equal to:
- *   XV_MAX_ALLOC_SIZE - sizeof(struct zobj_header)
- * otherwise, xv_malloc() would always return failure.
+ * NOTE: max_zpage_size must be less than or equal to ZS_MAX_ALLOC_SIZE,
+ * otherwise, zs_malloc() would always return failure.
  */
 
 /*-- End of configurable params */
@@ -74,17 +63,46 @@ enum zram_pageflags {
 	/* Page consists entirely of zeros */
 	ZRAM_ZERO,
 
+	/* Slot lock, see zram_slot_lock() */
+	ZRAM_ACCESS,
+
+	/* Slot points to a shared zram_dedup_node, not to the object */
+	ZRAM_DEDUP,
+
 	__NR_ZRAM_PAGEFLAGS,
 };
 
 /*-- Data structures */
 
-/* Allocated for each disk page */
+/*
+ * A compressed object shared by all slots holding identical data.
+ * Nodes live in zram->dedup_root, keyed by a checksum of the
+ * uncompressed page; equal checksums are confirmed by comparing the
+ * compressed bytes.  The tree linkage and refcount are protected by
+ * zram->dedup_lock; the object fields never change once inserted.
+ */
+struct zram_dedup_node {
+	struct rb_node node;
+	u32 checksum;
+	u32 refcount;		/* slots pointing to this object */
+	unsigned long handle;
+	u32 clen;		/* compressed length */
+};
+
+/*
+ * Allocated for each disk page.  All fields are protected by the
+ * ZRAM_ACCESS bit lock in flags; flags is an unsigned long so it can
+ * be used with bit_spin_lock().
+ */
 struct table {
-	struct page *page;
-	u16 offset;
+	union {
+		unsigned long handle;		/* zsmalloc object */
+		struct page *page;		/* if ZRAM_UNCOMPRESSED */
+		struct zram_dedup_node *dnode;	/* if ZRAM_DEDUP */
+	};
+	u32 size;	/* object size, unless ZRAM_DEDUP */
 	u8 count;	/* object ref count (not yet used) */
-	u8 flags;
+	unsigned long flags;
 } __attribute__((aligned(4)));
 
 struct zram_stats {
@@ -95,20 +113,20 @@ struct zram_stats {
 	u64 failed_writes;	/* can happen when memory is too low */
 	u64 invalid_io;		/* non-page-aligned I/O requests */
 	u64 notify_free;	/* no. of swap slot free notifications */
-	u32 pages_zero;		/* no. of zero filled pages */
-	u32 pages_stored;	/* no. of pages currently stored */
-	u32 good_compress;	/* % of pages with compression ratio<=50% */
-	u32 pages_expand;	/* % of incompressible pages */
+	u64 slot_contention;	/* slot lock found already held */
+	u64 pages_compacted;	/* pages freed by compaction */
+	atomic_t pages_zero;		/* no. of zero filled pages */
+	atomic_t pages_stored;	/* no. of pages currently stored */
+	atomic_t good_compress;	/* % of pages with compression ratio<=50% */
+	atomic_t pages_expand;	/* % of incompressible pages */
+	atomic_t dup_pages;	/* no. of pages sharing another's object */
 };
 
 struct zram {
-	struct xv_pool *mem_pool;
-	void *compress_workmem;
-	void *compress_buffer;
+	struct zs_pool *mem_pool;
+	struct zcomp *comp;	/* pool of compression streams */
 	struct table *table;
 	spinlock_t stat64_lock;	/* protect 64-bit stats */
-	struct rw_semaphore lock; /* protect compression buffers and table
-				   * against concurrent read and writes */
 	struct request_queue *queue;
 	struct gendisk *disk;
 	int init_done;
@@ -119,6 +137,15 @@ struct zram {
 	 * we can store in a disk.
 	 */
 	u64 disksize;	/* bytes */
+	/* Upper bound on concurrently compressing writers */
+	int max_comp_streams;
+	/* Crypto API compressor, fixed once the device is initialized */
+	char compressor[ZCOMP_NAME_LEN];
+
+	/* Same-page deduplication, see zram_dedup_find() */
+	int dedup;
+	spinlock_t dedup_lock;
+	struct rb_root dedup_root;
 
 	struct zram_stats stats;
 };
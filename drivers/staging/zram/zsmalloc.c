@@ -0,0 +1,686 @@
+/*
+ * zsmalloc memory allocator
+ *
+ * Copyright (C) 2008, 2009, 2010  Nitin Gupta
+ *
+ * This code is released using a dual license strategy: BSD/GPL
+ * You can choose the licence that better fits your requirements.
+ *
+ * Released under the terms of 3-clause BSD License
+ * Released under the terms of GNU General Public License Version 2.0
+ */
+
+/*
+ * Objects are grouped by size class.  Each class carves groups of
+ * order-0 pages ("zspages") into equal slots, so freeing an object
+ * never leaves an odd-sized hole, and an emptied zspage goes straight
+ * back to the page allocator.  What remains is partially used zspages;
+ * zs_compact() moves objects out of the emptiest ones to free them.
+ * Users only hold handles, which stay valid when objects move.
+ */
+
+#ifdef CONFIG_ZRAM_DEBUG
+#define DEBUG
+#endif
+
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/errno.h>
+#include <linux/highmem.h>
+#include <linux/init.h>
+#include <linux/string.h>
+#include <linux/slab.h>
+#include <linux/vmalloc.h>
+#include <linux/percpu.h>
+#include <linux/sched.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+
+#include "zsmalloc.h"
+#include "zsmalloc_int.h"
+
+/* State of the current mapping on this cpu, see zs_map_object() */
+struct mapping_area {
+	char *buf;		/* bounce buffer for objects spanning pages */
+	void *vaddr;		/* kmap_atomic() address, if not bounced */
+	struct zspage *zspage;
+	int offset;
+	int size;
+	enum zs_mapmode mm;
+};
+
+static DEFINE_PER_CPU(struct mapping_area, zs_map_area);
+static struct kmem_cache *zs_handle_cachep;
+
+static int get_size_class_index(int size)
+{
+	if (likely(size > ZS_MIN_ALLOC_SIZE))
+		return DIV_ROUND_UP(size - ZS_MIN_ALLOC_SIZE,
+				    ZS_SIZE_CLASS_DELTA);
+	return 0;
+}
+
+/*
+ * Number of pages per zspage which wastes the least space at the end
+ * of the zspage for objects of this size.
+ */
+static int get_pages_per_zspage(int size)
+{
+	int i, best = 1, max_usedpc = 0;
+
+	for (i = 1; i <= ZS_MAX_PAGES_PER_ZSPAGE; i++) {
+		int zspage_size = i * PAGE_SIZE;
+		int usedpc = (zspage_size - zspage_size % size) * 100 /
+				zspage_size;
+
+		if (usedpc > max_usedpc) {
+			max_usedpc = usedpc;
+			best = i;
+		}
+	}
+
+	return best;
+}
+
+static enum fullness_group get_fullness_group(struct size_class *class,
+					      struct zspage *zspage)
+{
+	unsigned int inuse = zspage->inuse;
+	unsigned int max = class->objs_per_zspage;
+
+	if (!inuse)
+		return ZS_EMPTY;
+	if (inuse == max)
+		return ZS_FULL;
+	if (inuse <= max * (ZS_FULLNESS_THRESHOLD_FRAC - 1) /
+			ZS_FULLNESS_THRESHOLD_FRAC)
+		return ZS_ALMOST_EMPTY;
+	return ZS_ALMOST_FULL;
+}
+
+/* Move zspage to the list matching its fullness.  Class lock held. */
+static void fix_fullness_group(struct size_class *class,
+			       struct zspage *zspage)
+{
+	enum fullness_group fg = get_fullness_group(class, zspage);
+
+	if (fg == zspage->fullness)
+		return;
+
+	list_move(&zspage->list, &class->fullness_list[fg]);
+	zspage->fullness = fg;
+}
+
+static int handle_is_free(unsigned long entry)
+{
+	return entry & ZS_FREE_TAG;
+}
+
+static unsigned int obj_alloc_idx(struct zspage *zspage,
+				  struct zs_handle *zh)
+{
+	unsigned int idx = zspage->freeidx;
+
+	zspage->freeidx = zspage->handles[idx] >> 1;
+	zspage->handles[idx] = (unsigned long)zh;
+	zspage->inuse++;
+
+	return idx;
+}
+
+static void obj_free_idx(struct zspage *zspage, unsigned int idx)
+{
+	zspage->handles[idx] = ((unsigned long)zspage->freeidx << 1) |
+				ZS_FREE_TAG;
+	zspage->freeidx = idx;
+	zspage->inuse--;
+}
+
+static void free_zspage(struct zs_pool *pool, struct size_class *class,
+			struct zspage *zspage)
+{
+	int i;
+
+	for (i = 0; i < class->pages_per_zspage; i++)
+		__free_page(zspage->pages[i]);
+	kfree(zspage);
+
+	atomic_long_sub(class->pages_per_zspage, &pool->pages_allocated);
+}
+
+/* Allocate a zspage and thread all its slots on the free list */
+static struct zspage *alloc_zspage(struct zs_pool *pool,
+				   struct size_class *class)
+{
+	int i;
+	struct zspage *zspage;
+
+	zspage = kzalloc(sizeof(*zspage) + class->objs_per_zspage *
+			 sizeof(unsigned long), pool->flags & ~__GFP_HIGHMEM);
+	if (!zspage)
+		return NULL;
+
+	for (i = 0; i < class->pages_per_zspage; i++) {
+		zspage->pages[i] = alloc_page(pool->flags);
+		if (!zspage->pages[i])
+			goto fail;
+	}
+
+	for (i = 0; i < class->objs_per_zspage; i++)
+		zspage->handles[i] = ((unsigned long)(i + 1) << 1) |
+					ZS_FREE_TAG;
+	zspage->freeidx = 0;
+	zspage->fullness = ZS_EMPTY;
+	INIT_LIST_HEAD(&zspage->list);
+
+	atomic_long_add(class->pages_per_zspage, &pool->pages_allocated);
+	return zspage;
+
+fail:
+	while (i--)
+		__free_page(zspage->pages[i]);
+	kfree(zspage);
+	return NULL;
+}
+
+/*
+ * Copy len bytes between objects, possibly spanning pages on either
+ * side, one page-contained chunk at a time.
+ */
+static void copy_object(struct zspage *dst, int doff,
+			struct zspage *src, int soff, int len)
+{
+	while (len) {
+		int dpoff = doff & ~PAGE_MASK, spoff = soff & ~PAGE_MASK;
+		int n = min3(len, (int)PAGE_SIZE - dpoff,
+			     (int)PAGE_SIZE - spoff);
+		char *s, *d;
+
+		s = kmap_atomic(src->pages[soff >> PAGE_SHIFT], KM_USER0);
+		d = kmap_atomic(dst->pages[doff >> PAGE_SHIFT], KM_USER1);
+		memcpy(d + dpoff, s + spoff, n);
+		kunmap_atomic(d, KM_USER1);
+		kunmap_atomic(s, KM_USER0);
+
+		soff += n;
+		doff += n;
+		len -= n;
+	}
+}
+
+/*
+ * Bounce an object spanning two pages to or from the per-cpu buffer.
+ */
+static void copy_spanning(struct mapping_area *area, int to_buf)
+{
+	int off = area->offset & ~PAGE_MASK;
+	int first = PAGE_SIZE - off;
+	struct page **pages = &area->zspage->pages[area->offset >> PAGE_SHIFT];
+	char *addr;
+
+	addr = kmap_atomic(pages[0], KM_USER0);
+	if (to_buf)
+		memcpy(area->buf, addr + off, first);
+	else
+		memcpy(addr + off, area->buf, first);
+	kunmap_atomic(addr, KM_USER0);
+
+	addr = kmap_atomic(pages[1], KM_USER0);
+	if (to_buf)
+		memcpy(area->buf + first, addr, area->size - first);
+	else
+		memcpy(addr, area->buf + first, area->size - first);
+	kunmap_atomic(addr, KM_USER0);
+}
+
+/**
+ * zs_map_object - get a pointer to an allocated object
+ * @pool: pool the object was allocated from
+ * @handle: handle returned by zs_malloc()
+ * @mm: how the object will be accessed
+ *
+ * The mapping is atomic: the caller must not sleep and must call
+ * zs_unmap_object() before mapping another object.  The object is not
+ * moved by compaction while mapped.
+ */
+void *zs_map_object(struct zs_pool *pool, unsigned long handle,
+			enum zs_mapmode mm)
+{
+	struct zs_handle *zh = (struct zs_handle *)handle;
+	struct size_class *class = &pool->size_class[zh->class_idx];
+	struct mapping_area *area;
+	int off;
+
+	read_lock(&pool->migrate_lock);
+	area = &get_cpu_var(zs_map_area);
+	area->zspage = zh->zspage;
+	area->offset = zh->idx * class->size;
+	area->size = class->size;
+	area->mm = mm;
+
+	off = area->offset & ~PAGE_MASK;
+	if (off + class->size <= PAGE_SIZE) {
+		area->vaddr = kmap_atomic(
+			area->zspage->pages[area->offset >> PAGE_SHIFT],
+			KM_USER1);
+		return area->vaddr + off;
+	}
+
+	area->vaddr = NULL;
+	if (mm != ZS_MM_WO)
+		copy_spanning(area, 1);
+	return area->buf;
+}
+EXPORT_SYMBOL_GPL(zs_map_object);
+
+void zs_unmap_object(struct zs_pool *pool, unsigned long handle)
+{
+	struct mapping_area *area = &__get_cpu_var(zs_map_area);
+
+	if (area->vaddr)
+		kunmap_atomic(area->vaddr, KM_USER1);
+	else if (area->mm != ZS_MM_RO)
+		copy_spanning(area, 0);
+
+	put_cpu_var(zs_map_area);
+	read_unlock(&pool->migrate_lock);
+}
+EXPORT_SYMBOL_GPL(zs_unmap_object);
+
+/*
+ * Pick a zspage with free slots, preferring fuller ones so objects
+ * pack into as few zspages as possible.  Class lock held.
+ */
+static struct zspage *find_get_zspage(struct size_class *class)
+{
+	struct list_head *head;
+
+	head = &class->fullness_list[ZS_ALMOST_FULL];
+	if (!list_empty(head))
+		return list_first_entry(head, struct zspage, list);
+
+	head = &class->fullness_list[ZS_ALMOST_EMPTY];
+	if (!list_empty(head))
+		return list_first_entry(head, struct zspage, list);
+
+	return NULL;
+}
+
+/**
+ * zs_malloc - allocate an object from the pool
+ * @pool: pool to allocate from
+ * @size: object size, at most ZS_MAX_ALLOC_SIZE
+ *
+ * May sleep if the pool's gfp flags allow it.  Returns a handle to be
+ * passed to zs_map_object() and zs_free(), or 0 on failure.
+ */
+unsigned long zs_malloc(struct zs_pool *pool, size_t size)
+{
+	struct zs_handle *zh;
+	struct size_class *class;
+	struct zspage *zspage;
+
+	if (unlikely(!size || size > ZS_MAX_ALLOC_SIZE))
+		return 0;
+
+	zh = kmem_cache_alloc(zs_handle_cachep, pool->flags & ~__GFP_HIGHMEM);
+	if (!zh)
+		return 0;
+
+	class = &pool->size_class[get_size_class_index(size)];
+	zh->class_idx = class->index;
+
+	spin_lock(&class->lock);
+	zspage = find_get_zspage(class);
+	if (!zspage) {
+		spin_unlock(&class->lock);
+		zspage = alloc_zspage(pool, class);
+		if (unlikely(!zspage)) {
+			kmem_cache_free(zs_handle_cachep, zh);
+			return 0;
+		}
+
+		spin_lock(&class->lock);
+		list_add(&zspage->list, &class->fullness_list[ZS_EMPTY]);
+		class->stats.zspages++;
+		class->stats.objs_total += class->objs_per_zspage;
+	}
+
+	zh->zspage = zspage;
+	zh->idx = obj_alloc_idx(zspage, zh);
+	class->stats.objs_used++;
+	fix_fullness_group(class, zspage);
+	spin_unlock(&class->lock);
+
+	return (unsigned long)zh;
+}
+EXPORT_SYMBOL_GPL(zs_malloc);
+
+/* Unlink an empty zspage; the caller frees it.  Class lock held. */
+static void remove_zspage(struct size_class *class, struct zspage *zspage)
+{
+	list_del(&zspage->list);
+	class->stats.zspages--;
+	class->stats.objs_total -= class->objs_per_zspage;
+}
+
+void zs_free(struct zs_pool *pool, unsigned long handle)
+{
+	struct zs_handle *zh = (struct zs_handle *)handle;
+	struct size_class *class;
+	struct zspage *zspage;
+
+	if (unlikely(!handle))
+		return;
+
+	class = &pool->size_class[zh->class_idx];
+
+	spin_lock(&class->lock);
+	zspage = zh->zspage;
+	obj_free_idx(zspage, zh->idx);
+	class->stats.objs_used--;
+
+	if (!zspage->inuse) {
+		remove_zspage(class, zspage);
+		spin_unlock(&class->lock);
+		free_zspage(pool, class, zspage);
+	} else {
+		fix_fullness_group(class, zspage);
+		spin_unlock(&class->lock);
+	}
+
+	kmem_cache_free(zs_handle_cachep, zh);
+}
+EXPORT_SYMBOL_GPL(zs_free);
+
+/*
+ * Compaction can free a zspage only if the other zspages of the class
+ * have room for all its objects.
+ */
+static int zs_can_compact(struct size_class *class)
+{
+	return class->stats.objs_total - class->stats.objs_used >=
+		class->objs_per_zspage;
+}
+
+/*
+ * Move objects from the last almost empty zspage to the fullest
+ * zspage with room, until one is exhausted.  Returns the number of
+ * pages freed, or -1 when there is nothing left to do for this class.
+ */
+static int compact_zspage_pair(struct zs_pool *pool, struct size_class *class)
+{
+	struct zspage *src, *dst = NULL;
+	struct list_head *ae = &class->fullness_list[ZS_ALMOST_EMPTY];
+	int i, freed = 0;
+
+	write_lock(&pool->migrate_lock);
+	spin_lock(&class->lock);
+
+	if (!zs_can_compact(class) || list_empty(ae))
+		goto out_done;
+
+	src = list_entry(ae->prev, struct zspage, list);
+	if (!list_empty(&class->fullness_list[ZS_ALMOST_FULL]))
+		dst = list_first_entry(&class->fullness_list[ZS_ALMOST_FULL],
+				       struct zspage, list);
+	else if (ae->next != &src->list)
+		dst = list_first_entry(ae, struct zspage, list);
+	if (!dst)
+		goto out_done;
+
+	for (i = 0; i < class->objs_per_zspage; i++) {
+		struct zs_handle *zh;
+		unsigned int idx;
+
+		if (handle_is_free(src->handles[i]))
+			continue;
+		if (dst->inuse == class->objs_per_zspage)
+			break;
+
+		zh = (struct zs_handle *)src->handles[i];
+		idx = obj_alloc_idx(dst, zh);
+		copy_object(dst, idx * class->size,
+			    src, i * class->size, class->size);
+		zh->zspage = dst;
+		zh->idx = idx;
+		obj_free_idx(src, i);
+		class->stats.objs_moved++;
+	}
+
+	fix_fullness_group(class, dst);
+	if (!src->inuse) {
+		remove_zspage(class, src);
+		class->stats.pages_compacted += class->pages_per_zspage;
+		freed = class->pages_per_zspage;
+	} else
+		fix_fullness_group(class, src);
+
+	spin_unlock(&class->lock);
+	write_unlock(&pool->migrate_lock);
+
+	if (freed)
+		free_zspage(pool, class, src);
+	return freed;
+
+out_done:
+	spin_unlock(&class->lock);
+	write_unlock(&pool->migrate_lock);
+	return -1;
+}
+
+/**
+ * zs_compact - migrate objects to release partially used zspages
+ * @pool: pool to compact
+ *
+ * Must be called from process context.  Mappings and allocations
+ * proceed between steps; each step holds off mappers only for the
+ * time needed to move the objects of one zspage.
+ *
+ * Returns the number of pages released.
+ */
+unsigned long zs_compact(struct zs_pool *pool)
+{
+	unsigned long pages_freed = 0;
+	int i, ret;
+
+	for (i = ZS_SIZE_CLASSES - 1; i >= 0; i--) {
+		struct size_class *class = &pool->size_class[i];
+
+		while ((ret = compact_zspage_pair(pool, class)) >= 0) {
+			pages_freed += ret;
+			cond_resched();
+		}
+	}
+
+	return pages_freed;
+}
+EXPORT_SYMBOL_GPL(zs_compact);
+
+u64 zs_get_total_size_bytes(struct zs_pool *pool)
+{
+	return (u64)atomic_long_read(&pool->pages_allocated) << PAGE_SHIFT;
+}
+EXPORT_SYMBOL_GPL(zs_get_total_size_bytes);
+
+#ifdef CONFIG_DEBUG_FS
+
+static struct dentry *zs_stats_root;
+
+static int zs_stats_show(struct seq_file *s, void *v)
+{
+	struct zs_pool *pool = s->private;
+	struct zs_class_stats stats;
+	int i;
+
+	seq_printf(s, "%5s %5s %9s %9s %7s %5s %5s %9s %9s\n",
+		   "class", "size", "obj_used", "obj_total", "zspages",
+		   "ppz", "frag%", "moved", "compacted");
+
+	for (i = 0; i < ZS_SIZE_CLASSES; i++) {
+		struct size_class *class = &pool->size_class[i];
+
+		spin_lock(&class->lock);
+		stats = class->stats;
+		spin_unlock(&class->lock);
+
+		if (!stats.objs_total && !stats.pages_compacted)
+			continue;
+
+		seq_printf(s, "%5d %5d %9lu %9lu %7lu %5d %5lu %9lu %9lu\n",
+			   i, class->size, stats.objs_used, stats.objs_total,
+			   stats.zspages, class->pages_per_zspage,
+			   stats.objs_total ? (stats.objs_total -
+				stats.objs_used) * 100 / stats.objs_total : 0,
+			   stats.objs_moved, stats.pages_compacted);
+	}
+
+	return 0;
+}
+
+static int zs_stats_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, zs_stats_show, inode->i_private);
+}
+
+static const struct file_operations zs_stats_fops = {
+	.owner		= THIS_MODULE,
+	.open		= zs_stats_open,
+	.read		= seq_read,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
+
+static void zs_pool_stats_create(struct zs_pool *pool)
+{
+	if (!zs_stats_root)
+		return;
+
+	pool->stats_dentry = debugfs_create_file(pool->name, S_IRUGO,
+					zs_stats_root, pool, &zs_stats_fops);
+}
+
+static void zs_pool_stats_destroy(struct zs_pool *pool)
+{
+	debugfs_remove(pool->stats_dentry);
+}
+
+static void __init zs_stats_init(void)
+{
+	zs_stats_root = debugfs_create_dir("zsmalloc", NULL);
+	if (IS_ERR(zs_stats_root))
+		zs_stats_root = NULL;
+}
+
+static void zs_stats_exit(void)
+{
+	debugfs_remove(zs_stats_root);
+}
+
+#else
+
+static void zs_pool_stats_create(struct zs_pool *pool) { }
+static void zs_pool_stats_destroy(struct zs_pool *pool) { }
+static void __init zs_stats_init(void) { }
+static void zs_stats_exit(void) { }
+
+#endif
+
+/**
+ * zs_create_pool - create a memory pool for compressed objects
+ * @name: pool name, used for the debugfs statistics file
+ * @flags: allocation flags for backing pages (may include __GFP_HIGHMEM)
+ */
+struct zs_pool *zs_create_pool(const char *name, gfp_t flags)
+{
+	int i, j;
+	struct zs_pool *pool;
+
+	pool = vzalloc(sizeof(*pool));
+	if (!pool)
+		return NULL;
+
+	strlcpy(pool->name, name, sizeof(pool->name));
+	pool->flags = flags;
+	rwlock_init(&pool->migrate_lock);
+	atomic_long_set(&pool->pages_allocated, 0);
+
+	for (i = 0; i < ZS_SIZE_CLASSES; i++) {
+		struct size_class *class = &pool->size_class[i];
+
+		spin_lock_init(&class->lock);
+		class->index = i;
+		class->size = ZS_MIN_ALLOC_SIZE + i * ZS_SIZE_CLASS_DELTA;
+		class->pages_per_zspage = get_pages_per_zspage(class->size);
+		class->objs_per_zspage = class->pages_per_zspage * PAGE_SIZE /
+					class->size;
+		for (j = 0; j < _ZS_NR_FULLNESS_GROUPS; j++)
+			INIT_LIST_HEAD(&class->fullness_list[j]);
+	}
+
+	zs_pool_stats_create(pool);
+	return pool;
+}
+EXPORT_SYMBOL_GPL(zs_create_pool);
+
+/*
+ * All objects must have been freed: handles still outstanding would
+ * point into the released zspages.
+ */
+void zs_destroy_pool(struct zs_pool *pool)
+{
+	int i, j;
+
+	zs_pool_stats_destroy(pool);
+
+	for (i = 0; i < ZS_SIZE_CLASSES; i++) {
+		struct size_class *class = &pool->size_class[i];
+
+		for (j = 0; j < _ZS_NR_FULLNESS_GROUPS; j++)
+			WARN_ON(!list_empty(&class->fullness_list[j]));
+	}
+	vfree(pool);
+}
+EXPORT_SYMBOL_GPL(zs_destroy_pool);
+
+static int __init zs_init(void)
+{
+	int cpu;
+
+	zs_handle_cachep = kmem_cache_create("zs_handle",
+				sizeof(struct zs_handle), 0, 0, NULL);
+	if (!zs_handle_cachep)
+		return -ENOMEM;
+
+	for_each_possible_cpu(cpu) {
+		struct mapping_area *area = &per_cpu(zs_map_area, cpu);
+
+		area->buf = kmalloc(ZS_MAX_ALLOC_SIZE, GFP_KERNEL);
+		if (!area->buf)
+			goto fail;
+	}
+
+	zs_stats_init();
+	return 0;
+
+fail:
+	for_each_possible_cpu(cpu)
+		kfree(per_cpu(zs_map_area, cpu).buf);
+	kmem_cache_destroy(zs_handle_cachep);
+	return -ENOMEM;
+}
+
+static void __exit zs_exit(void)
+{
+	int cpu;
+
+	zs_stats_exit();
+	for_each_possible_cpu(cpu)
+		kfree(per_cpu(zs_map_area, cpu).buf);
+	kmem_cache_destroy(zs_handle_cachep);
+}
+
+module_init(zs_init);
+module_exit(zs_exit);
+
+MODULE_LICENSE("Dual BSD/GPL");
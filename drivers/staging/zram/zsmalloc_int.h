@@ -0,0 +1,119 @@
+/*
+ * zsmalloc memory allocator
+ *
+ * Copyright (C) 2008, 2009, 2010  Nitin Gupta
+ *
+ * This code is released using a dual license strategy: BSD/GPL
+ * You can choose the licence that better fits your requirements.
+ *
+ * Released under the terms of 3-clause BSD License
+ * Released under the terms of GNU General Public License Version 2.0
+ */
+
+#ifndef _ZS_MALLOC_INT_H_
+#define _ZS_MALLOC_INT_H_
+
+#include <linux/kernel.h>
+#include <linux/types.h>
+#include <linux/list.h>
+#include <linux/spinlock.h>
+
+/* User configurable params */
+
+/*
+ * A zspage is a group of up to ZS_MAX_PAGES_PER_ZSPAGE order-0 pages
+ * holding objects of one size class back to back; objects may span a
+ * page boundary.  Larger groups waste less space at the end for sizes
+ * that do not divide PAGE_SIZE.
+ */
+#define ZS_MAX_PAGES_PER_ZSPAGE	4
+
+#define ZS_MIN_ALLOC_SIZE	32
+#define ZS_MAX_ALLOC_SIZE	PAGE_SIZE
+
+/*
+ * Size classes are ZS_SIZE_CLASS_DELTA bytes apart, which bounds the
+ * internal fragmentation of an object: 16 bytes for 4k pages.
+ */
+#define ZS_SIZE_CLASS_DELTA	(PAGE_SIZE >> 8)
+#define ZS_SIZE_CLASSES		((ZS_MAX_ALLOC_SIZE - ZS_MIN_ALLOC_SIZE) \
+					/ ZS_SIZE_CLASS_DELTA + 1)
+
+/*
+ * A zspage with at most this fraction of its objects in use is
+ * "almost empty" and is a source for compaction.
+ */
+#define ZS_FULLNESS_THRESHOLD_FRAC	4
+
+/* End of user params */
+
+enum fullness_group {
+	ZS_EMPTY,
+	ZS_ALMOST_EMPTY,
+	ZS_ALMOST_FULL,
+	ZS_FULL,
+	_ZS_NR_FULLNESS_GROUPS,
+};
+
+struct size_class;
+
+/*
+ * A handle points to one of these.  Compaction moves an object by
+ * rewriting zspage/idx; the handle itself never changes.
+ */
+struct zs_handle {
+	struct zspage *zspage;
+	u16 idx;		/* object index in the zspage */
+	u16 class_idx;		/* fixed for the life of the handle */
+};
+
+/*
+ * Descriptor for a group of pages.  handles[] maps each object index
+ * to its handle so compaction can find the owner of an object; free
+ * slots instead hold the next free index, tagged with ZS_FREE_TAG.
+ */
+struct zspage {
+	struct list_head list;		/* in class->fullness_list[] */
+	unsigned int inuse;		/* objects allocated */
+	unsigned int freeidx;		/* first free object */
+	enum fullness_group fullness;
+	struct page *pages[ZS_MAX_PAGES_PER_ZSPAGE];
+	unsigned long handles[0];
+};
+
+#define ZS_FREE_TAG	1UL
+
+struct zs_class_stats {
+	unsigned long objs_used;	/* objects allocated */
+	unsigned long objs_total;	/* object slots in all zspages */
+	unsigned long zspages;
+	unsigned long objs_moved;	/* by compaction */
+	unsigned long pages_compacted;	/* freed by compaction */
+};
+
+struct size_class {
+	spinlock_t lock;	/* protects lists, zspages and stats */
+	int index;
+	int size;		/* object size */
+	int pages_per_zspage;
+	int objs_per_zspage;
+	struct list_head fullness_list[_ZS_NR_FULLNESS_GROUPS];
+	struct zs_class_stats stats;
+};
+
+struct zs_pool {
+	char name[16];
+	gfp_t flags;		/* allocation flags for zspage pages */
+	/*
+	 * Held for read while an object is mapped and for write while
+	 * compaction moves objects, so a mapping never goes stale.
+	 */
+	rwlock_t migrate_lock;
+	atomic_long_t pages_allocated;
+	struct size_class size_class[ZS_SIZE_CLASSES];
+#ifdef CONFIG_DEBUG_FS
+	struct dentry *stats_dentry;
+#endif
+};
+
+#endif
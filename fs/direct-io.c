@@ -32,6 +32,7 @@
 #include <linux/wait.h>
 #include <linux/err.h>
 #include <linux/blkdev.h>
+#include <linux/blk-iopoll.h>
 #include <linux/buffer_head.h>
 #include <linux/rwsem.h>
 #include <linux/uio.h>
@@ -130,6 +131,13 @@ struct dio {
 	struct bio *bio_list;		/* singly linked via bi_private */
 	struct task_struct *waiter;	/* waiting task (NULL if none) */
 
+	/* synchronous I/O only, for polled completion and its statistics */
+	struct request_queue *poll_q;	/* queue of the first bio */
+	u64 submit_time;		/* last bio submitted, ktime ns */
+	u64 end_time;			/* last bio completed, ktime ns */
+	int polled;			/* spun waiting for a bio */
+	int slept;			/* slept waiting for a bio */
+
 	/* AIO related stuff */
 	struct kiocb *iocb;		/* kiocb */
 	ssize_t result;                 /* IO result */
@@ -352,6 +360,8 @@ static void dio_bio_end_io(struct bio *bio, int error)
 	spin_lock_irqsave(&dio->bio_lock, flags);
 	bio->bi_private = dio->bio_list;
 	dio->bio_list = bio;
+	if (dio->poll_q)
+		dio->end_time = ktime_to_ns(ktime_get());
 	if (--dio->refcount == 1 && dio->waiter)
 		wake_up_process(dio->waiter);
 	spin_unlock_irqrestore(&dio->bio_lock, flags);
@@ -422,6 +432,12 @@ static inline void dio_bio_submit(struct dio *dio, struct dio_submit *sdio)
 	if (dio->is_async && dio->rw == READ)
 		bio_set_pages_dirty(bio);
 
+	if (!dio->is_async) {
+		if (!dio->poll_q)
+			dio->poll_q = bdev_get_queue(bio->bi_bdev);
+		dio->submit_time = ktime_to_ns(ktime_get());
+	}
+
 	if (sdio->submit_io)
 		sdio->submit_io(dio->rw, bio, dio->inode,
 			       sdio->logical_offset_in_bio);
@@ -442,6 +458,17 @@ static inline void dio_cleanup(struct dio *dio, struct dio_submit *sdio)
 		page_cache_release(dio_get_page(dio, sdio));
 }
 
+/*
+ * Unlocked check of dio_await_one()'s wait condition for polling, it is
+ * checked again under the bio_lock.
+ */
+static bool dio_poll_done(void *data)
+{
+	struct dio *dio = data;
+
+	return ACCESS_ONCE(dio->refcount) <= 1 || ACCESS_ONCE(dio->bio_list);
+}
+
 /*
  * Wait for the next BIO to complete.  Remove it and return it.  NULL is
  * returned once all BIOs have been completed.  This must only be called once
@@ -452,6 +479,7 @@ static struct bio *dio_await_one(struct dio *dio)
 {
 	unsigned long flags;
 	struct bio *bio = NULL;
+	bool poll = dio->poll_q && dio->poll_q->dio_poll;
 
 	spin_lock_irqsave(&dio->bio_lock, flags);
 
@@ -460,8 +488,23 @@ static struct bio *dio_await_one(struct dio *dio)
 	 * completion drops the count, maybe adds to the list, and wakes while
 	 * holding the bio_lock so we don't need set_current_state()'s barrier
 	 * and can call it after testing our condition.
+	 *
+	 * If the queue asks for it, spin for the completion first.  The waiter
+	 * is set while polling too, hybrid polling sleeps for part of it.
 	 */
 	while (dio->refcount > 1 && dio->bio_list == NULL) {
+		if (poll) {
+			poll = false;
+			dio->polled = 1;
+			dio->waiter = current;
+			spin_unlock_irqrestore(&dio->bio_lock, flags);
+			blk_poll_wait(dio->poll_q, dio->submit_time,
+				      dio_poll_done, dio);
+			spin_lock_irqsave(&dio->bio_lock, flags);
+			dio->waiter = NULL;
+			continue;
+		}
+		dio->slept = 1;
 		__set_current_state(TASK_UNINTERRUPTIBLE);
 		dio->waiter = current;
 		spin_unlock_irqrestore(&dio->bio_lock, flags);
@@ -520,6 +563,17 @@ static void dio_await_completion(struct dio *dio)
 		if (bio)
 			dio_bio_complete(dio, bio);
 	} while (bio);
+
+	if (dio->poll_q) {
+		u64 now = ktime_to_ns(ktime_get());
+		int how = BLK_POLL_SLEPT;
+
+		if (dio->polled)
+			how = dio->slept ? BLK_POLL_MISS : BLK_POLL_HIT;
+		blk_poll_account(dio->poll_q,
+				 dio->end_time - dio->submit_time,
+				 now - dio->submit_time, how);
+	}
 }
 
 /*
@@ -23,6 +23,7 @@
 #include <linux/poll.h>
 #include <linux/string.h>
 #include <linux/list.h>
+#include <linux/llist.h>
 #include <linux/hash.h>
 #include <linux/spinlock.h>
 #include <linux/syscalls.h>
@@ -48,11 +49,12 @@
  * 3) ep->lock (spinlock)
  *
  * The acquire order is the one listed above, from 1 to 3.
- * We need a spinlock (ep->lock) because we manipulate objects
- * from inside the poll callback, that might be triggered from
- * a wake_up() that in turn might be called from IRQ context.
- * So we can't sleep inside the poll callback and hence we need
- * a spinlock. During the event transfer loop (from kernel to
+ * We need a spinlock (ep->lock) because the ready list is manipulated
+ * from contexts that cannot sleep. The poll callback, which might be
+ * triggered from a wake_up() in IRQ context, does not take "ep->lock"
+ * at all: it pushes the item on the lock-less "ep->wakelist" and the
+ * items are moved to the ready list, under "ep->lock", by whoever
+ * next scans it. During the event transfer loop (from kernel to
  * user space) we could end up sleeping due a copy_to_user(), so
  * we need a lock that will allow us to sleep. This lock is a
  * mutex (ep->mtx). It is acquired during the event transfer loop,
@@ -135,10 +137,11 @@ struct epitem {
 	struct list_head rdllink;
 
 	/*
-	 * Works together "struct eventpoll"->ovflist in keeping the
-	 * single linked chain of items.
+	 * Lock-less node used by the poll callback to queue this item on
+	 * "struct eventpoll"->wakelist. Its "next" field is EP_UNACTIVE_PTR
+	 * while the item is not queued there.
 	 */
-	struct epitem *next;
+	struct llist_node wakenode;
 
 	/* The file descriptor information this item refers to */
 	struct epoll_filefd ffd;
@@ -189,11 +192,11 @@ struct eventpoll {
 	struct rb_root rbr;
 
 	/*
-	 * This is a single linked list that chains all the "struct epitem" that
-	 * happened while transferring ready events to userspace w/out
-	 * holding ->lock.
+	 * Lock-less list that chains all the "struct epitem" reported ready
+	 * by the poll callback. Items are moved from here to "rdllist" with
+	 * ->lock held, so the wakeup path never contends on ->lock.
 	 */
-	struct epitem *ovflist;
+	struct llist_head wakelist;
 
 	/* The user that created the eventpoll descriptor */
 	struct user_struct *user;
@@ -233,6 +236,7 @@ struct ep_pqueue {
 struct ep_send_events_data {
 	int maxevents;
 	struct epoll_event __user *events;
+	int *pending;
 };
 
 /*
@@ -360,7 +364,50 @@ static void ep_nested_calls_init(struct nested_calls *ncalls)
  */
 static inline int ep_events_available(struct eventpoll *ep)
 {
-	return !list_empty(&ep->rdllist) || ep->ovflist != EP_UNACTIVE_PTR;
+	return !list_empty(&ep->rdllist) || !llist_empty(&ep->wakelist);
+}
+
+/**
+ * ep_drain_wakelist - Moves the items queued by ep_poll_callback() on the
+ *                     lock-less wake list, to the tail of the ready list.
+ *
+ * @ep: Pointer to the eventpoll context.
+ *
+ * Must be called with "ep->lock" held. Items already linked to a ready
+ * list (either "ep->rdllist" or a scan private list) are left where they
+ * are.
+ */
+static void ep_drain_wakelist(struct eventpoll *ep)
+{
+	struct llist_node *node, *next, *prev = NULL;
+	struct epitem *epi;
+
+	node = llist_del_all(&ep->wakelist);
+	if (!node)
+		return;
+
+	/* The wake list is LIFO, restore the order events arrived in */
+	while (node) {
+		next = node->next;
+		node->next = prev;
+		prev = node;
+		node = next;
+	}
+
+	for (node = prev; node; node = next) {
+		epi = llist_entry(node, struct epitem, wakenode);
+		next = node->next;
+
+		/*
+		 * Release the item, so that ep_poll_callback() can queue it
+		 * again. An event hitting between this store and the
+		 * list_add_tail() below is not lost, since it will find the
+		 * item on the ready list on the next drain.
+		 */
+		node->next = EP_UNACTIVE_PTR;
+		if (!ep_is_linked(&epi->rdllink))
+			list_add_tail(&epi->rdllink, &ep->rdllist);
+	}
 }
 
 /**
@@ -523,7 +570,6 @@ static int ep_scan_ready_list(struct eventpoll *ep,
 {
 	int error, pwake = 0;
 	unsigned long flags;
-	struct epitem *epi, *nepi;
 	LIST_HEAD(txlist);
 
 	/*
@@ -534,15 +580,14 @@ static int ep_scan_ready_list(struct eventpoll *ep,
 
 	/*
 	 * Steal the ready list, and re-init the original one to the
-	 * empty list. Also, set ep->ovflist to NULL so that events
-	 * happening while looping w/out locks, are not lost. We cannot
-	 * have the poll callback to queue directly on ep->rdllist,
-	 * because we want the "sproc" callback to be able to do it
-	 * in a lockless way.
+	 * empty list. Events happening while looping w/out locks keep
+	 * piling up on ep->wakelist, which is never touched by the
+	 * "sproc" callback, so that it can add to ep->rdllist in a
+	 * lockless way.
 	 */
 	spin_lock_irqsave(&ep->lock, flags);
+	ep_drain_wakelist(ep);
 	list_splice_init(&ep->rdllist, &txlist);
-	ep->ovflist = NULL;
 	spin_unlock_irqrestore(&ep->lock, flags);
 
 	/*
@@ -554,25 +599,11 @@ static int ep_scan_ready_list(struct eventpoll *ep,
 	/*
 	 * During the time we spent inside the "sproc" callback, some
 	 * other events might have been queued by the poll callback.
-	 * We re-insert them inside the main ready-list here.
+	 * We re-insert them inside the main ready-list here. Items which
+	 * are still on "txlist" are skipped by ep_drain_wakelist(), and
+	 * the list_splice() below takes care of them.
 	 */
-	for (nepi = ep->ovflist; (epi = nepi) != NULL;
-	     nepi = epi->next, epi->next = EP_UNACTIVE_PTR) {
-		/*
-		 * We need to check if the item is already in the list.
-		 * During the "sproc" callback execution time, items are
-		 * queued into ->ovflist but the "txlist" might already
-		 * contain them, and the list_splice() below takes care of them.
-		 */
-		if (!ep_is_linked(&epi->rdllink))
-			list_add_tail(&epi->rdllink, &ep->rdllist);
-	}
-	/*
-	 * We need to set back ep->ovflist to EP_UNACTIVE_PTR, so that after
-	 * releasing the lock, events will be queued in the normal way inside
-	 * ep->rdllist.
-	 */
-	ep->ovflist = EP_UNACTIVE_PTR;
+	ep_drain_wakelist(ep);
 
 	/*
 	 * Quickly re-inject items left on "txlist".
@@ -585,7 +616,7 @@ static int ep_scan_ready_list(struct eventpoll *ep,
 		 * the ->poll() wait list (delayed after we release the lock).
 		 */
 		if (waitqueue_active(&ep->wq))
-			wake_up_locked(&ep->wq);
+			wake_up(&ep->wq);
 		if (waitqueue_active(&ep->poll_wait))
 			pwake++;
 	}
@@ -627,7 +658,13 @@ static int ep_remove(struct eventpoll *ep, struct epitem *epi)
 
 	rb_erase(&epi->rbn, &ep->rbr);
 
+	/*
+	 * No poll callback can hit the item anymore, but it might still
+	 * be sitting on ep->wakelist, so flush it before unlinking.
+	 */
 	spin_lock_irqsave(&ep->lock, flags);
+	if (epi->wakenode.next != EP_UNACTIVE_PTR)
+		ep_drain_wakelist(ep);
 	if (ep_is_linked(&epi->rdllink))
 		list_del_init(&epi->rdllink);
 	spin_unlock_irqrestore(&ep->lock, flags);
@@ -806,7 +843,7 @@ static int ep_alloc(struct eventpoll **pep)
 	init_waitqueue_head(&ep->poll_wait);
 	INIT_LIST_HEAD(&ep->rdllist);
 	ep->rbr = RB_ROOT;
-	ep->ovflist = EP_UNACTIVE_PTR;
+	init_llist_head(&ep->wakelist);
 	ep->user = user;
 
 	*pep = ep;
@@ -854,8 +891,6 @@ static struct epitem *ep_find(struct eventpoll *ep, struct file *file, int fd)
  */
 static int ep_poll_callback(wait_queue_t *wait, unsigned mode, int sync, void *key)
 {
-	int pwake = 0;
-	unsigned long flags;
 	struct epitem *epi = ep_item_from_wait(wait);
 	struct eventpoll *ep = epi->ep;
 
@@ -870,8 +905,6 @@ static int ep_poll_callback(wait_queue_t *wait, unsigned mode, int sync, void *k
 		list_del_init(&wait->task_list);
 	}
 
-	spin_lock_irqsave(&ep->lock, flags);
-
 	/*
 	 * If the event mask does not contain any poll(2) event, we consider the
 	 * descriptor to be disabled. This condition is likely the effect of the
@@ -879,7 +912,7 @@ static int ep_poll_callback(wait_queue_t *wait, unsigned mode, int sync, void *k
 	 * until the next EPOLL_CTL_MOD will be issued.
 	 */
 	if (!(epi->event.events & ~EP_PRIVATE_BITS))
-		goto out_unlock;
+		return 1;
 
 	/*
 	 * Check the events coming with the callback. At this stage, not
@@ -888,40 +921,27 @@ static int ep_poll_callback(wait_queue_t *wait, unsigned mode, int sync, void *k
 	 * test for "key" != NULL before the event match test.
 	 */
 	if (key && !((unsigned long) key & epi->event.events))
-		goto out_unlock;
+		return 1;
 
 	/*
-	 * If we are transferring events to userspace, we can hold no locks
-	 * (because we're accessing user memory, and because of linux f_op->poll()
-	 * semantics). All the events that happen during that period of time are
-	 * chained in ep->ovflist and requeued later on.
+	 * Claim the item for the wake list. If somebody else already queued
+	 * it, and nobody drained it yet, the waiters have been woken up by
+	 * that same somebody and we exit soon. The wake list is lock-less,
+	 * so this never contends with ep_poll() and the event transfer loop
+	 * on "ep->lock".
 	 */
-	if (unlikely(ep->ovflist != EP_UNACTIVE_PTR)) {
-		if (epi->next == EP_UNACTIVE_PTR) {
-			epi->next = ep->ovflist;
-			ep->ovflist = epi;
-		}
-		goto out_unlock;
-	}
-
-	/* If this file is already in the ready list we exit soon */
-	if (!ep_is_linked(&epi->rdllink))
-		list_add_tail(&epi->rdllink, &ep->rdllist);
+	if (cmpxchg(&epi->wakenode.next, EP_UNACTIVE_PTR, NULL) != EP_UNACTIVE_PTR)
+		return 1;
+	llist_add(&epi->wakenode, &ep->wakelist);
 
 	/*
 	 * Wake up ( if active ) both the eventpoll wait list and the ->poll()
-	 * wait list.
+	 * wait list. The llist_add() above implies a full memory barrier,
+	 * which pairs with the set_current_state() inside ep_poll().
 	 */
 	if (waitqueue_active(&ep->wq))
-		wake_up_locked(&ep->wq);
+		wake_up(&ep->wq);
 	if (waitqueue_active(&ep->poll_wait))
-		pwake++;
-
-out_unlock:
-	spin_unlock_irqrestore(&ep->lock, flags);
-
-	/* We have to call this outside the lock */
-	if (pwake)
 		ep_poll_safewake(&ep->poll_wait);
 
 	return 1;
@@ -1092,7 +1112,7 @@ static int ep_insert(struct eventpoll *ep, struct epoll_event *event,
 	ep_set_ffd(&epi->ffd, tfile, fd);
 	epi->event = *event;
 	epi->nwait = 0;
-	epi->next = EP_UNACTIVE_PTR;
+	epi->wakenode.next = EP_UNACTIVE_PTR;
 
 	/* Initialize the poll table using the queue callback */
 	epq.epi = epi;
@@ -1141,7 +1161,7 @@ static int ep_insert(struct eventpoll *ep, struct epoll_event *event,
 
 		/* Notify waiting tasks that events are available */
 		if (waitqueue_active(&ep->wq))
-			wake_up_locked(&ep->wq);
+			wake_up(&ep->wq);
 		if (waitqueue_active(&ep->poll_wait))
 			pwake++;
 	}
@@ -1169,11 +1189,11 @@ error_unregister:
 
 	/*
 	 * We need to do this because an event could have been arrived on some
-	 * allocated wait queue. Note that we don't care about the ep->ovflist
-	 * list, since that is used/cleaned only inside a section bound by "mtx".
-	 * And ep_insert() is called with "mtx" held.
+	 * allocated wait queue, and the item queued on ep->wakelist.
 	 */
 	spin_lock_irqsave(&ep->lock, flags);
+	if (epi->wakenode.next != EP_UNACTIVE_PTR)
+		ep_drain_wakelist(ep);
 	if (ep_is_linked(&epi->rdllink))
 		list_del_init(&epi->rdllink);
 	spin_unlock_irqrestore(&ep->lock, flags);
@@ -1217,7 +1237,7 @@ static int ep_modify(struct eventpoll *ep, struct epitem *epi, struct epoll_even
 
 			/* Notify waiting tasks that events are available */
 			if (waitqueue_active(&ep->wq))
-				wake_up_locked(&ep->wq);
+				wake_up(&ep->wq);
 			if (waitqueue_active(&ep->poll_wait))
 				pwake++;
 		}
@@ -1231,6 +1251,22 @@ static int ep_modify(struct eventpoll *ep, struct epitem *epi, struct epoll_even
 	return 0;
 }
 
+/*
+ * Returns the number of items left on the scan private list once the
+ * caller buffer has been filled up. They are known to have pending events
+ * that will be reported by the next epoll_wait(2).
+ */
+static int ep_count_pending(struct list_head *head)
+{
+	int count = 0;
+	struct list_head *pos;
+
+	list_for_each(pos, head)
+		count++;
+
+	return count;
+}
+
 static int ep_send_events_proc(struct eventpoll *ep, struct list_head *head,
 			       void *priv)
 {
@@ -1264,6 +1300,8 @@ static int ep_send_events_proc(struct eventpoll *ep, struct list_head *head,
 			if (__put_user(revents, &uevent->events) ||
 			    __put_user(epi->event.data, &uevent->data)) {
 				list_add(&epi->rdllink, head);
+				if (esed->pending)
+					*esed->pending = ep_count_pending(head);
 				return eventcnt ? eventcnt : -EFAULT;
 			}
 			eventcnt++;
@@ -1280,23 +1318,28 @@ static int ep_send_events_proc(struct eventpoll *ep, struct list_head *head,
 				 * into ep->rdllist besides us. The epoll_ctl()
 				 * callers are locked out by
 				 * ep_scan_ready_list() holding "mtx" and the
-				 * poll callback will queue them in ep->ovflist.
+				 * poll callback will queue them in ep->wakelist.
 				 */
 				list_add_tail(&epi->rdllink, &ep->rdllist);
 			}
 		}
 	}
 
+	if (esed->pending)
+		*esed->pending = ep_count_pending(head);
+
 	return eventcnt;
 }
 
 static int ep_send_events(struct eventpoll *ep,
-			  struct epoll_event __user *events, int maxevents)
+			  struct epoll_event __user *events, int maxevents,
+			  int *pending)
 {
 	struct ep_send_events_data esed;
 
 	esed.maxevents = maxevents;
 	esed.events = events;
+	esed.pending = pending;
 
 	return ep_scan_ready_list(ep, ep_send_events_proc, &esed, 0);
 }
@@ -1325,15 +1368,16 @@ static inline struct timespec ep_set_mstimeout(long ms)
  *           while if the @timeout is less than zero, the function will block
  *           until at least one event has been retrieved (or an error
  *           occurred).
+ * @pending: If not NULL, where to store the number of ready items which did
+ *           not fit inside the caller event buffer.
  *
  * Returns: Returns the number of ready events which have been fetched, or an
  *          error code, in case of error.
  */
 static int ep_poll(struct eventpoll *ep, struct epoll_event __user *events,
-		   int maxevents, long timeout)
+		   int maxevents, long timeout, int *pending)
 {
 	int res = 0, eavail, timed_out = 0;
-	unsigned long flags;
 	long slack = 0;
 	wait_queue_t wait;
 	ktime_t expires, *to = NULL;
@@ -1350,21 +1394,20 @@ static int ep_poll(struct eventpoll *ep, struct epoll_event __user *events,
 		 * caller specified a non blocking operation.
 		 */
 		timed_out = 1;
-		spin_lock_irqsave(&ep->lock, flags);
 		goto check_events;
 	}
 
 fetch_events:
-	spin_lock_irqsave(&ep->lock, flags);
-
 	if (!ep_events_available(ep)) {
 		/*
 		 * We don't have any available event to return to the caller.
 		 * We need to sleep here, and we will be wake up by
 		 * ep_poll_callback() when events will become available.
+		 * The poll callback does not take "ep->lock", so the wait
+		 * queue is protected by its own lock.
 		 */
 		init_waitqueue_entry(&wait, current);
-		__add_wait_queue_exclusive(&ep->wq, &wait);
+		add_wait_queue_exclusive(&ep->wq, &wait);
 
 		for (;;) {
 			/*
@@ -1380,13 +1423,10 @@ fetch_events:
 				break;
 			}
 
-			spin_unlock_irqrestore(&ep->lock, flags);
 			if (!schedule_hrtimeout_range(to, slack, HRTIMER_MODE_ABS))
 				timed_out = 1;
-
-			spin_lock_irqsave(&ep->lock, flags);
 		}
-		__remove_wait_queue(&ep->wq, &wait);
+		remove_wait_queue(&ep->wq, &wait);
 
 		set_current_state(TASK_RUNNING);
 	}
@@ -1394,15 +1434,14 @@ check_events:
 	/* Is it worth to try to dig for events ? */
 	eavail = ep_events_available(ep);
 
-	spin_unlock_irqrestore(&ep->lock, flags);
-
 	/*
 	 * Try to transfer events to user space. In case we get 0 events and
 	 * there's still timeout left over, we go trying again in search of
 	 * more luck.
 	 */
 	if (!res && eavail &&
-	    !(res = ep_send_events(ep, events, maxevents)) && !timed_out)
+	    !(res = ep_send_events(ep, events, maxevents, pending)) &&
+	    !timed_out)
 		goto fetch_events;
 
 	return res;
@@ -1685,11 +1724,11 @@ error_return:
 }
 
 /*
- * Implement the event wait interface for the eventpoll file. It is the kernel
- * part of the user space epoll_wait(2).
+ * Common code for the epoll_wait(2) family. If @pending is not NULL, it
+ * receives the number of ready items which did not fit inside @events.
  */
-SYSCALL_DEFINE4(epoll_wait, int, epfd, struct epoll_event __user *, events,
-		int, maxevents, int, timeout)
+static int do_epoll_wait(int epfd, struct epoll_event __user *events,
+			 int maxevents, int timeout, int *pending)
 {
 	int error;
 	struct file *file;
@@ -1726,7 +1765,7 @@ SYSCALL_DEFINE4(epoll_wait, int, epfd, struct epoll_event __user *, events,
 	ep = file->private_data;
 
 	/* Time to fish for events ... */
-	error = ep_poll(ep, events, maxevents, timeout);
+	error = ep_poll(ep, events, maxevents, timeout, pending);
 
 error_fput:
 	fput(file);
@@ -1735,6 +1774,36 @@ error_return:
 	return error;
 }
 
+/*
+ * Implement the event wait interface for the eventpoll file. It is the kernel
+ * part of the user space epoll_wait(2).
+ */
+SYSCALL_DEFINE4(epoll_wait, int, epfd, struct epoll_event __user *, events,
+		int, maxevents, int, timeout)
+{
+	return do_epoll_wait(epfd, events, maxevents, timeout, NULL);
+}
+
+/*
+ * Same as epoll_wait(2), but also stores inside @npending the number of
+ * ready file descriptors that did not fit inside @events. A caller seeing
+ * zero there can go doing work instead of issuing another epoll_wait(2)
+ * just to find out there is nothing left, while a non zero value tells it
+ * how many more events are immediately available. This is a hint: new
+ * events can arrive at any time after the call returns.
+ */
+SYSCALL_DEFINE5(epoll_wait_hint, int, epfd, struct epoll_event __user *, events,
+		int, maxevents, int, timeout, int __user *, npending)
+{
+	int error, pending = 0;
+
+	error = do_epoll_wait(epfd, events, maxevents, timeout, &pending);
+	if (error >= 0 && put_user(pending, npending))
+		return error ? error : -EFAULT;
+
+	return error;
+}
+
 #ifdef HAVE_SET_RESTORE_SIGMASK
 
 /*
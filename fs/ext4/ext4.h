@@ -314,6 +314,22 @@ struct flex_groups {
 	atomic_t used_dirs;
 };
 
+/*
+ * Where the last stream allocation on a cpu ended, see mb_stream_percpu
+ */
+struct ext4_stream_goal {
+	ext4_group_t group;
+	ext4_grpblk_t start;
+};
+
+/*
+ * Contention on one of the hashed block group locks, see mb_lock_stats
+ */
+struct ext4_group_lock_stat {
+	unsigned long contended;
+	u64 wait_ns;
+};
+
 #define EXT4_BG_INODE_UNINIT	0x0001 /* Inode table/bitmap not in use */
 #define EXT4_BG_BLOCK_UNINIT	0x0002 /* Block bitmap not in use */
 #define EXT4_BG_INODE_ZEROED	0x0004 /* On-disk itable initialized to zero */
@@ -1201,9 +1217,13 @@ struct ext4_sb_info {
 	unsigned int s_mb_order2_reqs;
 	unsigned int s_mb_group_prealloc;
 	unsigned int s_max_writeback_mb_bump;
+	unsigned int s_mb_stream_percpu;
+	unsigned int s_flush_workers;
 	/* where last allocation was done - for stream allocation */
 	unsigned long s_mb_last_group;
 	unsigned long s_mb_last_start;
+	/* the same per cpu, with s_mb_stream_percpu set */
+	struct ext4_stream_goal __percpu *s_mb_stream_goals;
 
 	/* stats for buddy allocator */
 	atomic_t s_bal_reqs;	/* number of reqs with len > 1 */
@@ -1220,6 +1240,8 @@ struct ext4_sb_info {
 	atomic_t s_mb_preallocated;
 	atomic_t s_mb_discarded;
 	atomic_t s_lock_busy;
+	/* contention on each of the hashed group locks */
+	struct ext4_group_lock_stat s_group_lock_stats[NR_BG_LOCKS];
 
 	/* locality groups */
 	struct ext4_locality_group __percpu *s_locality_groups;
@@ -1234,6 +1256,9 @@ struct ext4_sb_info {
 	/* workqueue for dio unwritten */
 	struct workqueue_struct *dio_unwritten_wq;
 
+	/* workqueue for parallel delalloc flushing */
+	struct workqueue_struct *flush_wq;
+
 	/* timer for periodic error stats printing */
 	struct timer_list s_err_report;
 
@@ -1295,6 +1320,7 @@ enum {
 	EXT4_STATE_DIO_UNWRITTEN,	/* need convert on dio done*/
 	EXT4_STATE_NEWENTRY,		/* File just added to dir */
 	EXT4_STATE_DELALLOC_RESERVED,	/* blks already reserved for delalloc */
+	EXT4_STATE_FLUSH_QUEUED,	/* queued to a flush worker */
 };
 
 #define EXT4_INODE_BIT_FNS(name, field, offset)				\
@@ -1309,6 +1335,11 @@ static inline void ext4_set_inode_##name(struct inode *inode, int bit)	\
 static inline void ext4_clear_inode_##name(struct inode *inode, int bit) \
 {									\
 	clear_bit(bit + (offset), &EXT4_I(inode)->i_##field);		\
+}									\
+static inline int ext4_test_and_set_inode_##name(struct inode *inode,	\
+						 int bit)		\
+{									\
+	return test_and_set_bit(bit + (offset), &EXT4_I(inode)->i_##field); \
 }
 
 EXT4_INODE_BIT_FNS(flag, flags, 0)
@@ -1848,6 +1879,8 @@ extern int ext4_mb_add_groupinfo(struct super_block *sb,
 extern int ext4_group_add_blocks(handle_t *handle, struct super_block *sb,
 				ext4_fsblk_t block, unsigned long count);
 extern int ext4_trim_fs(struct super_block *, struct fstrim_range *);
+extern void ext4_lock_group_contended(struct super_block *sb,
+				      ext4_group_t group, spinlock_t *lock);
 
 /* inode.c */
 struct buffer_head *ext4_getblk(handle_t *, struct inode *,
@@ -2188,7 +2221,7 @@ static inline void ext4_lock_group(struct super_block *sb, ext4_group_t group)
 		 */
 		atomic_add_unless(&EXT4_SB(sb)->s_lock_busy, 1,
 				  EXT4_MAX_CONTENTION);
-		spin_lock(lock);
+		ext4_lock_group_contended(sb, group, lock);
 	}
 }
 
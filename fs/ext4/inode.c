@@ -2176,6 +2176,64 @@ out:
 	return ret;
 }
 
+/*
+ * Background writeback goes through the inodes of a file system one at a
+ * time from the single flusher thread of the bdi, so with many writers
+ * allocating delalloc blocks for one inode after the other leaves the
+ * other cpus idle. With flush_workers set, the flusher only queues the
+ * inode to sbi->flush_wq and moves on; up to flush_workers inodes are then
+ * allocated and written in parallel.
+ */
+struct ext4_flush_work {
+	struct work_struct	work;
+	struct inode		*inode;
+};
+
+static void ext4_flush_work(struct work_struct *work)
+{
+	struct ext4_flush_work *fw =
+		container_of(work, struct ext4_flush_work, work);
+	struct inode *inode = fw->inode;
+	struct writeback_control wbc = {
+		.sync_mode		= WB_SYNC_NONE,
+		.nr_to_write		= LONG_MAX,
+		.range_cyclic		= 1,
+		.tagged_writepages	= 1,
+	};
+
+	do_writepages(inode->i_mapping, &wbc);
+	ext4_clear_inode_state(inode, EXT4_STATE_FLUSH_QUEUED);
+	iput(inode);
+	kfree(fw);
+}
+
+/*
+ * Returns true if the inode is left to a flush worker, false if the
+ * caller has to write it itself.
+ */
+static bool ext4_flush_queue(struct inode *inode)
+{
+	struct ext4_flush_work *fw;
+
+	if (ext4_test_and_set_inode_state(inode, EXT4_STATE_FLUSH_QUEUED))
+		return true;
+
+	fw = kmalloc(sizeof(*fw), GFP_NOFS);
+	if (!fw)
+		goto out_clear;
+	fw->inode = igrab(inode);
+	if (!fw->inode) {
+		kfree(fw);
+		goto out_clear;
+	}
+	INIT_WORK(&fw->work, ext4_flush_work);
+	queue_work(EXT4_SB(inode->i_sb)->flush_wq, &fw->work);
+	return true;
+
+out_clear:
+	ext4_clear_inode_state(inode, EXT4_STATE_FLUSH_QUEUED);
+	return false;
+}
 
 static int ext4_da_writepages(struct address_space *mapping,
 			      struct writeback_control *wbc)
@@ -2219,6 +2277,15 @@ static int ext4_da_writepages(struct address_space *mapping,
 	if (unlikely(sbi->s_mount_flags & EXT4_MF_FS_ABORTED))
 		return -EROFS;
 
+	/*
+	 * Leave background writeback to the flush workers. nr_to_write is
+	 * not consumed, so the flusher goes on to the next inode.
+	 */
+	if (sbi->s_flush_workers &&
+	    (wbc->for_background || wbc->for_kupdate) &&
+	    ext4_flush_queue(inode))
+		return 0;
+
 	if (wbc->range_start == 0 && wbc->range_end == LLONG_MAX)
 		range_whole = 1;
 
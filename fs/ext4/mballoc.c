@@ -1553,7 +1553,14 @@ static void ext4_mb_use_best_found(struct ext4_allocation_context *ac,
 	ac->ac_buddy_page = e4b->bd_buddy_page;
 	get_page(ac->ac_buddy_page);
 	/* store last allocated for subsequent stream allocation */
-	if (ac->ac_flags & EXT4_MB_STREAM_ALLOC) {
+	if ((ac->ac_flags & EXT4_MB_STREAM_ALLOC) && sbi->s_mb_stream_percpu) {
+		struct ext4_stream_goal *goal;
+
+		goal = get_cpu_ptr(sbi->s_mb_stream_goals);
+		goal->group = ac->ac_f_ex.fe_group;
+		goal->start = ac->ac_f_ex.fe_start;
+		put_cpu_ptr(sbi->s_mb_stream_goals);
+	} else if (ac->ac_flags & EXT4_MB_STREAM_ALLOC) {
 		spin_lock(&sbi->s_md_lock);
 		sbi->s_mb_last_group = ac->ac_f_ex.fe_group;
 		sbi->s_mb_last_start = ac->ac_f_ex.fe_start;
@@ -2002,8 +2009,20 @@ ext4_mb_regular_allocator(struct ext4_allocation_context *ac)
 			ac->ac_2order = i - 1;
 	}
 
-	/* if stream allocation is enabled, use global goal */
-	if (ac->ac_flags & EXT4_MB_STREAM_ALLOC) {
+	/*
+	 * if stream allocation is enabled, use global goal, or the goal
+	 * of this cpu so that writers on different cpus stream into
+	 * different groups and don't fight over s_md_lock and the
+	 * group locks.
+	 */
+	if ((ac->ac_flags & EXT4_MB_STREAM_ALLOC) && sbi->s_mb_stream_percpu) {
+		struct ext4_stream_goal *goal;
+
+		goal = get_cpu_ptr(sbi->s_mb_stream_goals);
+		ac->ac_g_ex.fe_group = goal->group;
+		ac->ac_g_ex.fe_start = goal->start;
+		put_cpu_ptr(sbi->s_mb_stream_goals);
+	} else if (ac->ac_flags & EXT4_MB_STREAM_ALLOC) {
 		/* TBD: may be hot point */
 		spin_lock(&sbi->s_md_lock);
 		ac->ac_g_ex.fe_group = sbi->s_mb_last_group;
@@ -2195,6 +2214,65 @@ static const struct file_operations ext4_mb_seq_groups_fops = {
 	.release	= seq_release,
 };
 
+static int ext4_mb_seq_lock_stats_show(struct seq_file *seq, void *v)
+{
+	struct super_block *sb = seq->private;
+	struct ext4_sb_info *sbi = EXT4_SB(sb);
+	struct ext4_group_lock_stat *stat;
+	unsigned long contended = 0;
+	u64 wait_ns = 0;
+	int i;
+
+	for (i = 0; i < NR_BG_LOCKS; i++) {
+		contended += sbi->s_group_lock_stats[i].contended;
+		wait_ns += sbi->s_group_lock_stats[i].wait_ns;
+	}
+	seq_printf(seq, "locks: %u\n", NR_BG_LOCKS);
+	seq_printf(seq, "contended: %lu\n", contended);
+	seq_printf(seq, "wait_us: %llu\n", div_u64(wait_ns, NSEC_PER_USEC));
+	seq_printf(seq, "busy: %d\n", atomic_read(&sbi->s_lock_busy));
+
+	seq_printf(seq, "#lock contended wait_us\n");
+	for (i = 0; i < NR_BG_LOCKS; i++) {
+		stat = &sbi->s_group_lock_stats[i];
+		if (!stat->contended)
+			continue;
+		seq_printf(seq, "%-5d %9lu %7llu\n", i, stat->contended,
+			   div_u64(stat->wait_ns, NSEC_PER_USEC));
+	}
+	return 0;
+}
+
+static int ext4_mb_seq_lock_stats_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, ext4_mb_seq_lock_stats_show, PDE(inode)->data);
+}
+
+static const struct file_operations ext4_mb_seq_lock_stats_fops = {
+	.owner		= THIS_MODULE,
+	.open		= ext4_mb_seq_lock_stats_open,
+	.read		= seq_read,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
+
+/*
+ * Slow path of ext4_lock_group(): the group lock was busy. Account
+ * how long we spin for it, the groups sharing a lock are the ones
+ * equal modulo NR_BG_LOCKS.
+ */
+void ext4_lock_group_contended(struct super_block *sb, ext4_group_t group,
+			       spinlock_t *lock)
+{
+	struct ext4_group_lock_stat *stat;
+	u64 start = local_clock();
+
+	spin_lock(lock);
+	stat = &EXT4_SB(sb)->s_group_lock_stats[group & (NR_BG_LOCKS - 1)];
+	stat->contended++;
+	stat->wait_ns += local_clock() - start;
+}
+
 static struct kmem_cache *get_groupinfo_cache(int blocksize_bits)
 {
 	int cache_index = blocksize_bits - EXT4_MIN_BLOCK_LOG_SIZE;
@@ -2513,20 +2591,40 @@ int ext4_mb_init(struct super_block *sb, int needs_recovery)
 		spin_lock_init(&lg->lg_prealloc_lock);
 	}
 
+	sbi->s_mb_stream_goals = alloc_percpu(struct ext4_stream_goal);
+	if (sbi->s_mb_stream_goals == NULL) {
+		ret = -ENOMEM;
+		goto out_free_locality_groups;
+	}
+	/* spread the cpus over the file system to start with */
+	for_each_possible_cpu(i) {
+		struct ext4_stream_goal *goal;
+		goal = per_cpu_ptr(sbi->s_mb_stream_goals, i);
+		goal->group = div_u64((u64)i * ext4_get_groups_count(sb),
+				      nr_cpu_ids);
+		goal->start = 0;
+	}
+
 	/* init file for buddy data */
 	ret = ext4_mb_init_backend(sb);
 	if (ret != 0)
-		goto out_free_locality_groups;
+		goto out_free_stream_goals;
 
-	if (sbi->s_proc)
+	if (sbi->s_proc) {
 		proc_create_data("mb_groups", S_IRUGO, sbi->s_proc,
 				 &ext4_mb_seq_groups_fops, sb);
+		proc_create_data("mb_lock_stats", S_IRUGO, sbi->s_proc,
+				 &ext4_mb_seq_lock_stats_fops, sb);
+	}
 
 	if (sbi->s_journal)
 		sbi->s_journal->j_commit_callback = release_blocks_on_commit;
 
 	return 0;
 
+out_free_stream_goals:
+	free_percpu(sbi->s_mb_stream_goals);
+	sbi->s_mb_stream_goals = NULL;
 out_free_locality_groups:
 	free_percpu(sbi->s_locality_groups);
 	sbi->s_locality_groups = NULL;
@@ -2567,8 +2665,10 @@ int ext4_mb_release(struct super_block *sb)
 	struct ext4_sb_info *sbi = EXT4_SB(sb);
 	struct kmem_cache *cachep = get_groupinfo_cache(sb->s_blocksize_bits);
 
-	if (sbi->s_proc)
+	if (sbi->s_proc) {
+		remove_proc_entry("mb_lock_stats", sbi->s_proc);
 		remove_proc_entry("mb_groups", sbi->s_proc);
+	}
 
 	if (sbi->s_group_info) {
 		for (i = 0; i < ngroups; i++) {
@@ -2616,6 +2716,7 @@ int ext4_mb_release(struct super_block *sb)
 				atomic_read(&sbi->s_mb_discarded));
 	}
 
+	free_percpu(sbi->s_mb_stream_goals);
 	free_percpu(sbi->s_locality_groups);
 
 	return 0;
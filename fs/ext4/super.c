@@ -805,6 +805,8 @@ static void ext4_put_super(struct super_block *sb)
 	ext4_unregister_li_request(sb);
 	dquot_disable(sb, -1, DQUOT_USAGE_ENABLED | DQUOT_LIMITS_ENABLED);
 
+	flush_workqueue(sbi->flush_wq);
+	destroy_workqueue(sbi->flush_wq);
 	flush_workqueue(sbi->dio_unwritten_wq);
 	destroy_workqueue(sbi->dio_unwritten_wq);
 
@@ -2522,6 +2524,20 @@ static ssize_t inode_readahead_blks_store(struct ext4_attr *a,
 	return count;
 }
 
+static ssize_t flush_workers_store(struct ext4_attr *a,
+				   struct ext4_sb_info *sbi,
+				   const char *buf, size_t count)
+{
+	unsigned long t;
+
+	if (parse_strtoul(buf, WQ_UNBOUND_MAX_ACTIVE, &t))
+		return -EINVAL;
+
+	workqueue_set_max_active(sbi->flush_wq, max_t(int, t, 1));
+	sbi->s_flush_workers = t;
+	return count;
+}
+
 static ssize_t sbi_ui_show(struct ext4_attr *a,
 			   struct ext4_sb_info *sbi, char *buf)
 {
@@ -2573,6 +2589,9 @@ EXT4_RW_ATTR_SBI_UI(mb_order2_req, s_mb_order2_reqs);
 EXT4_RW_ATTR_SBI_UI(mb_stream_req, s_mb_stream_request);
 EXT4_RW_ATTR_SBI_UI(mb_group_prealloc, s_mb_group_prealloc);
 EXT4_RW_ATTR_SBI_UI(max_writeback_mb_bump, s_max_writeback_mb_bump);
+EXT4_RW_ATTR_SBI_UI(mb_stream_percpu, s_mb_stream_percpu);
+EXT4_ATTR_OFFSET(flush_workers, 0644, sbi_ui_show,
+		 flush_workers_store, s_flush_workers);
 
 static struct attribute *ext4_attrs[] = {
 	ATTR_LIST(delayed_allocation_blocks),
@@ -2587,6 +2606,8 @@ static struct attribute *ext4_attrs[] = {
 	ATTR_LIST(mb_stream_req),
 	ATTR_LIST(mb_group_prealloc),
 	ATTR_LIST(max_writeback_mb_bump),
+	ATTR_LIST(mb_stream_percpu),
+	ATTR_LIST(flush_workers),
 	NULL,
 };
 
@@ -3830,6 +3851,19 @@ no_journal:
 		goto failed_mount_wq;
 	}
 
+	/*
+	 * Background writeback of delalloc inodes is handed to this
+	 * workqueue when flush_workers is set, see ext4_flush_queue().
+	 * Its max_active follows flush_workers.
+	 */
+	EXT4_SB(sb)->flush_wq =
+		alloc_workqueue("ext4-flush", WQ_MEM_RECLAIM | WQ_UNBOUND, 1);
+	if (!EXT4_SB(sb)->flush_wq) {
+		printk(KERN_ERR "EXT4-fs: failed to create flush workqueue\n");
+		destroy_workqueue(EXT4_SB(sb)->dio_unwritten_wq);
+		goto failed_mount_wq;
+	}
+
 	/*
 	 * The jbd2_journal_load will have done any necessary log recovery,
 	 * so we can safely mount the rest of the filesystem now.
@@ -3950,6 +3984,7 @@ failed_mount4:
 	iput(root);
 	sb->s_root = NULL;
 	ext4_msg(sb, KERN_ERR, "mount failed");
+	destroy_workqueue(EXT4_SB(sb)->flush_wq);
 	destroy_workqueue(EXT4_SB(sb)->dio_unwritten_wq);
 failed_mount_wq:
 	if (sbi->s_journal) {
@@ -4412,6 +4447,7 @@ static int ext4_sync_fs(struct super_block *sb, int wait)
 	struct ext4_sb_info *sbi = EXT4_SB(sb);
 
 	trace_ext4_sync_fs(sb, wait);
+	flush_workqueue(sbi->flush_wq);
 	flush_workqueue(sbi->dio_unwritten_wq);
 	if (jbd2_journal_start_commit(sbi->s_journal, &target)) {
 		if (wait)
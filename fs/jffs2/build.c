@@ -14,6 +14,7 @@
 #include <linux/sched.h>
 #include <linux/slab.h>
 #include <linux/vmalloc.h>
+#include <linux/ktime.h>
 #include <linux/mtd/mtd.h>
 #include "nodelist.h"
 
@@ -97,17 +98,20 @@ static int jffs2_build_filesystem(struct jffs2_sb_info *c)
 	struct jffs2_inode_cache *ic;
 	struct jffs2_full_dirent *fd;
 	struct jffs2_full_dirent *dead_fds = NULL;
+	ktime_t start, scanned;
 
 	dbg_fsbuild("build FS data structures\n");
 
 	/* First, scan the medium and build all the inode caches with
 	   lists of physical nodes */
 
+	start = ktime_get();
 	c->flags |= JFFS2_SB_FLAG_SCANNING;
 	ret = jffs2_scan_medium(c);
 	c->flags &= ~JFFS2_SB_FLAG_SCANNING;
 	if (ret)
 		goto exit;
+	scanned = ktime_get();
 
 	dbg_fsbuild("scanned flash completely\n");
 	jffs2_dbg_dump_block_lists_nolock(c);
@@ -169,6 +173,9 @@ static int jffs2_build_filesystem(struct jffs2_sb_info *c)
 	c->flags &= ~JFFS2_SB_FLAG_BUILDING;
 
 	dbg_fsbuild("FS build complete\n");
+	printk(KERN_INFO "JFFS2: %s: scanning took %lld ms, building took %lld ms\n",
+	       c->mtd->name, ktime_to_ms(ktime_sub(scanned, start)),
+	       ktime_to_ms(ktime_sub(ktime_get(), scanned)));
 
 	/* Rotate the lists by some number to ensure wear levelling */
 	jffs2_rotate_lists(c);
@@ -16,6 +16,7 @@
 #include <linux/pagemap.h>
 #include <linux/crc32.h>
 #include <linux/compiler.h>
+#include <linux/workqueue.h>
 #include "nodelist.h"
 #include "summary.h"
 #include "debug.h"
@@ -34,8 +35,22 @@
 
 static uint32_t pseudo_random;
 
+/* Summary of an eraseblock, read and checked ahead of the scan */
+struct sum_prefetch {
+	struct work_struct work;
+	struct jffs2_sb_info *c;
+	struct jffs2_eraseblock *jeb;
+	struct jffs2_raw_summary *sumptr;	/* checked summary, or NULL */
+	uint32_t sumlen;
+	int crc_err;
+	int err;
+};
+
 static int jffs2_scan_eraseblock (struct jffs2_sb_info *c, struct jffs2_eraseblock *jeb,
-				  unsigned char *buf, uint32_t buf_size, struct jffs2_summary *s);
+				  unsigned char *buf, uint32_t buf_size, struct jffs2_summary *s,
+				  struct sum_prefetch *pf);
+static int jffs2_fill_scan_buf(struct jffs2_sb_info *c, void *buf,
+			       uint32_t ofs, uint32_t len);
 
 /* These helper functions _must_ increase ofs and also do the dirty/used space accounting.
  * Returning an error will abort the mount - bad checksums etc. should just mark the space
@@ -86,6 +101,150 @@ static int file_dirty(struct jffs2_sb_info *c, struct jffs2_eraseblock *jeb)
 	return 0;
 }
 
+#ifdef CONFIG_JFFS2_SUMMARY_PREFETCH
+/*
+ * Summaries of this many eraseblocks are read and checked ahead of the scan.
+ * The reads and the CRC checks run on the unbound workqueue, so they overlap
+ * with each other and with the scan, which only merges the checked summaries
+ * into the in-memory structures.
+ */
+#define SUM_PREFETCH_BLOCKS 32
+
+static void sum_prefetch_work(struct work_struct *work)
+{
+	struct sum_prefetch *pf = container_of(work, struct sum_prefetch, work);
+	struct jffs2_sb_info *c = pf->c;
+	uint32_t end = pf->jeb->offset + c->sector_size;
+	struct jffs2_raw_summary *sumptr;
+	struct jffs2_sum_marker sm;
+	uint32_t sumlen;
+	int err;
+
+	err = jffs2_fill_scan_buf(c, &sm, end - sizeof(sm), sizeof(sm));
+	if (err || je32_to_cpu(sm.magic) != JFFS2_SUM_MAGIC)
+		goto out;
+
+	sumlen = c->sector_size - je32_to_cpu(sm.offset);
+	if (sumlen > c->sector_size || sumlen < JFFS2_SUMMARY_FRAME_SIZE) {
+		pf->crc_err = 1;
+		goto out;
+	}
+
+	sumptr = kmalloc(sumlen, GFP_KERNEL);
+	if (!sumptr) {
+		err = -ENOMEM;
+		goto out;
+	}
+
+	err = jffs2_fill_scan_buf(c, sumptr, end - sumlen, sumlen);
+	if (err) {
+		kfree(sumptr);
+		goto out;
+	}
+
+	if (!jffs2_sum_check_sumnode(sumptr, sumlen)) {
+		kfree(sumptr);
+		pf->crc_err = 1;
+		goto out;
+	}
+
+	pf->sumptr = sumptr;
+	pf->sumlen = sumlen;
+out:
+	pf->err = err;
+}
+
+static void sum_prefetch_queue(struct jffs2_sb_info *c, struct sum_prefetch *pf,
+			       struct jffs2_eraseblock *jeb)
+{
+	pf->c = c;
+	pf->jeb = jeb;
+	pf->sumptr = NULL;
+	pf->crc_err = 0;
+	pf->err = 0;
+	INIT_WORK(&pf->work, sum_prefetch_work);
+	queue_work(system_unbound_wq, &pf->work);
+}
+
+static struct sum_prefetch *sum_prefetch_start(struct jffs2_sb_info *c)
+{
+	struct sum_prefetch *pf;
+	int i;
+
+	pf = kcalloc(SUM_PREFETCH_BLOCKS, sizeof(*pf), GFP_KERNEL);
+	if (!pf) {
+		JFFS2_WARNING("Can't allocate memory for summary prefetch\n");
+		return NULL;
+	}
+
+	for (i = 0; i < min_t(uint32_t, c->nr_blocks, SUM_PREFETCH_BLOCKS); i++)
+		sum_prefetch_queue(c, &pf[i], &c->blocks[i]);
+	return pf;
+}
+
+static struct sum_prefetch *sum_prefetch_slot(struct sum_prefetch *pf, int i)
+{
+	return pf ? &pf[i % SUM_PREFETCH_BLOCKS] : NULL;
+}
+
+/* Called when block @i is done, reuses its slot for a block further ahead */
+static void sum_prefetch_next(struct jffs2_sb_info *c, struct sum_prefetch *pf,
+			      int i)
+{
+	struct sum_prefetch *slot = sum_prefetch_slot(pf, i);
+
+	if (!slot)
+		return;
+
+	flush_work(&slot->work);
+	kfree(slot->sumptr);
+	slot->sumptr = NULL;
+	if (i + SUM_PREFETCH_BLOCKS < c->nr_blocks)
+		sum_prefetch_queue(c, slot, &c->blocks[i + SUM_PREFETCH_BLOCKS]);
+}
+
+static void sum_prefetch_stop(struct jffs2_sb_info *c, struct sum_prefetch *pf)
+{
+	int i;
+
+	if (!pf)
+		return;
+
+	for (i = 0; i < min_t(uint32_t, c->nr_blocks, SUM_PREFETCH_BLOCKS); i++) {
+		flush_work(&pf[i].work);
+		kfree(pf[i].sumptr);
+	}
+	kfree(pf);
+}
+
+/* Wait for the summary of @pf->jeb; returns a read error if there was one */
+static int sum_prefetch_wait(struct sum_prefetch *pf)
+{
+	flush_work(&pf->work);
+	if (pf->crc_err)
+		JFFS2_WARNING("Summary node crc error, skipping summary information.\n");
+	return pf->err;
+}
+#else
+static inline struct sum_prefetch *sum_prefetch_start(struct jffs2_sb_info *c)
+{
+	return NULL;
+}
+static inline struct sum_prefetch *sum_prefetch_slot(struct sum_prefetch *pf,
+						     int i)
+{
+	return NULL;
+}
+static inline void sum_prefetch_next(struct jffs2_sb_info *c,
+				     struct sum_prefetch *pf, int i) { }
+static inline void sum_prefetch_stop(struct jffs2_sb_info *c,
+				     struct sum_prefetch *pf) { }
+static inline int sum_prefetch_wait(struct sum_prefetch *pf)
+{
+	return 0;
+}
+#endif
+
 int jffs2_scan_medium(struct jffs2_sb_info *c)
 {
 	int i, ret;
@@ -93,6 +252,7 @@ int jffs2_scan_medium(struct jffs2_sb_info *c)
 	unsigned char *flashbuf = NULL;
 	uint32_t buf_size = 0;
 	struct jffs2_summary *s = NULL; /* summary info collected by the scan process */
+	struct sum_prefetch *pf = NULL;
 #ifndef __ECOS
 	size_t pointlen, try_size;
 
@@ -137,6 +297,9 @@ int jffs2_scan_medium(struct jffs2_sb_info *c)
 			ret = -ENOMEM;
 			goto out;
 		}
+		/* Nothing to read ahead when the flash is mapped */
+		if (buf_size)
+			pf = sum_prefetch_start(c);
 	}
 
 	for (i=0; i<c->nr_blocks; i++) {
@@ -148,7 +311,8 @@ int jffs2_scan_medium(struct jffs2_sb_info *c)
 		jffs2_sum_reset_collected(s);
 
 		ret = jffs2_scan_eraseblock(c, jeb, buf_size?flashbuf:(flashbuf+jeb->offset),
-						buf_size, s);
+					    buf_size, s, sum_prefetch_slot(pf, i));
+		sum_prefetch_next(c, pf, i);
 
 		if (ret < 0)
 			goto out;
@@ -269,6 +433,7 @@ int jffs2_scan_medium(struct jffs2_sb_info *c)
 	}
 	ret = 0;
  out:
+	sum_prefetch_stop(c, pf);
 	if (buf_size)
 		kfree(flashbuf);
 #ifndef __ECOS
@@ -433,7 +598,8 @@ static int jffs2_scan_xref_node(struct jffs2_sb_info *c, struct jffs2_eraseblock
 /* Called with 'buf_size == 0' if buf is in fact a pointer _directly_ into
    the flash, XIP-style */
 static int jffs2_scan_eraseblock (struct jffs2_sb_info *c, struct jffs2_eraseblock *jeb,
-				  unsigned char *buf, uint32_t buf_size, struct jffs2_summary *s) {
+				  unsigned char *buf, uint32_t buf_size, struct jffs2_summary *s,
+				  struct sum_prefetch *pf) {
 	struct jffs2_unknown_node *node;
 	struct jffs2_unknown_node crcnode;
 	uint32_t ofs, prevofs, max_ofs;
@@ -477,7 +643,19 @@ static int jffs2_scan_eraseblock (struct jffs2_sb_info *c, struct jffs2_eraseblo
 		void *sumptr = NULL;
 		uint32_t sumlen;
 	      
-		if (!buf_size) {
+		if (pf) {
+			/* The summary has been read and checked ahead of us */
+			err = sum_prefetch_wait(pf);
+			if (err)
+				return err;
+			if (pf->sumptr) {
+				err = jffs2_sum_process_sumnode(c, jeb, pf->sumptr,
+								pf->sumlen, &pseudo_random);
+				/* Same as for jffs2_sum_scan_sumnode() below */
+				if (err)
+					return err;
+			}
+		} else if (!buf_size) {
 			/* XIP case. Just look, point at the summary if it's there */
 			sm = (void *)buf + c->sector_size - sizeof(*sm);
 			if (je32_to_cpu(sm->magic) == JFFS2_SUM_MAGIC) {
@@ -563,21 +563,12 @@ static int jffs2_sum_process_sum_data(struct jffs2_sb_info *c, struct jffs2_eras
 	return 0;
 }
 
-/* Process the summary node - called from jffs2_scan_eraseblock() */
-int jffs2_sum_scan_sumnode(struct jffs2_sb_info *c, struct jffs2_eraseblock *jeb,
-			   struct jffs2_raw_summary *summary, uint32_t sumsize,
-			   uint32_t *pseudo_random)
+/* Check the summary node header and CRCs. Returns 1 if the node is valid */
+int jffs2_sum_check_sumnode(struct jffs2_raw_summary *summary, uint32_t sumsize)
 {
 	struct jffs2_unknown_node crcnode;
-	int ret, ofs;
 	uint32_t crc;
 
-	ofs = c->sector_size - sumsize;
-
-	dbg_summary("summary found for 0x%08x at 0x%08x (0x%x bytes)\n",
-		    jeb->offset, jeb->offset + ofs, sumsize);
-
-	/* OK, now check for node validity and CRC */
 	crcnode.magic = cpu_to_je16(JFFS2_MAGIC_BITMASK);
 	crcnode.nodetype = cpu_to_je16(JFFS2_NODETYPE_SUMMARY);
 	crcnode.totlen = summary->totlen;
@@ -586,28 +577,43 @@ int jffs2_sum_scan_sumnode(struct jffs2_sb_info *c, struct jffs2_eraseblock *jeb
 	if (je32_to_cpu(summary->hdr_crc) != crc) {
 		dbg_summary("Summary node header is corrupt (bad CRC or "
 				"no summary at all)\n");
-		goto crc_err;
+		return 0;
 	}
 
 	if (je32_to_cpu(summary->totlen) != sumsize) {
 		dbg_summary("Summary node is corrupt (wrong erasesize?)\n");
-		goto crc_err;
+		return 0;
 	}
 
 	crc = crc32(0, summary, sizeof(struct jffs2_raw_summary)-8);
 
 	if (je32_to_cpu(summary->node_crc) != crc) {
 		dbg_summary("Summary node is corrupt (bad CRC)\n");
-		goto crc_err;
+		return 0;
 	}
 
 	crc = crc32(0, summary->sum, sumsize - sizeof(struct jffs2_raw_summary));
 
 	if (je32_to_cpu(summary->sum_crc) != crc) {
 		dbg_summary("Summary node data is corrupt (bad CRC)\n");
-		goto crc_err;
+		return 0;
 	}
 
+	return 1;
+}
+
+/* Process a summary node which has already passed jffs2_sum_check_sumnode() */
+int jffs2_sum_process_sumnode(struct jffs2_sb_info *c, struct jffs2_eraseblock *jeb,
+			      struct jffs2_raw_summary *summary, uint32_t sumsize,
+			      uint32_t *pseudo_random)
+{
+	int ret, ofs;
+
+	ofs = c->sector_size - sumsize;
+
+	dbg_summary("summary found for 0x%08x at 0x%08x (0x%x bytes)\n",
+		    jeb->offset, jeb->offset + ofs, sumsize);
+
 	if ( je32_to_cpu(summary->cln_mkr) ) {
 
 		dbg_summary("Summary : CLEANMARKER node \n");
@@ -657,11 +663,19 @@ int jffs2_sum_scan_sumnode(struct jffs2_sb_info *c, struct jffs2_eraseblock *jeb
 	}
 
 	return jffs2_scan_classify_jeb(c, jeb);
+}
 
-crc_err:
-	JFFS2_WARNING("Summary node crc error, skipping summary information.\n");
+/* Process the summary node - called from jffs2_scan_eraseblock() */
+int jffs2_sum_scan_sumnode(struct jffs2_sb_info *c, struct jffs2_eraseblock *jeb,
+			   struct jffs2_raw_summary *summary, uint32_t sumsize,
+			   uint32_t *pseudo_random)
+{
+	if (!jffs2_sum_check_sumnode(summary, sumsize)) {
+		JFFS2_WARNING("Summary node crc error, skipping summary information.\n");
+		return 0;
+	}
 
-	return 0;
+	return jffs2_sum_process_sumnode(c, jeb, summary, sumsize, pseudo_random);
 }
 
 /* Write summary data to flash - helper function for jffs2_sum_write_sumnode() */
@@ -1804,7 +1804,7 @@ out:
 	return ~0U;
 }
 
-#define PROC_FDINFO_MAX 64
+#define PROC_FDINFO_MAX 256
 
 static int proc_fd_info(struct inode *inode, struct path *path, char *info)
 {
@@ -1837,12 +1837,33 @@ static int proc_fd_info(struct inode *inode, struct path *path, char *info)
 				*path = file->f_path;
 				path_get(&file->f_path);
 			}
-			if (info)
-				snprintf(info, PROC_FDINFO_MAX,
-					 "pos:\t%lli\n"
-					 "flags:\t0%o\n",
-					 (long long) file->f_pos,
-					 f_flags);
+			if (info) {
+				struct file_ra_state *ra = &file->f_ra;
+				int len;
+
+				len = snprintf(info, PROC_FDINFO_MAX,
+					       "pos:\t%lli\n"
+					       "flags:\t0%o\n",
+					       (long long) file->f_pos,
+					       f_flags);
+				if (S_ISREG(file->f_path.dentry->d_inode->i_mode))
+					snprintf(info + len,
+						 PROC_FDINFO_MAX - len,
+						 "ra_window:\t%u\n"
+						 "ra_sync:\t%lu\n"
+						 "ra_async:\t%lu\n"
+						 "ra_pages:\t%lu\n"
+						 "ra_wasted:\t%lu\n"
+						 "ra_strided:\t%lu\n"
+						 "ra_reverse:\t%lu\n",
+						 ra->ra_pages,
+						 ra->stats.sync,
+						 ra->stats.async,
+						 ra->stats.pages,
+						 ra->stats.wasted,
+						 ra->stats.strided,
+						 ra->stats.reverse);
+			}
 			spin_unlock(&files->file_lock);
 			put_files_struct(files);
 			return 0;
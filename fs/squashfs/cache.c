@@ -23,7 +23,10 @@
 
 /*
  * Blocks in Squashfs are compressed.  To avoid repeatedly decompressing
- * recently accessed data Squashfs uses two small metadata and fragment caches.
+ * recently accessed data Squashfs uses metadata and fragment caches, sized
+ * at mount time.  Entries are found through a small hash table without
+ * taking the cache lock, and idle entries are reused least recently
+ * released first.
  *
  * This file implements a generic cache implementation used for both caches,
  * plus functions layered ontop of the generic cache implementation to
@@ -52,11 +55,104 @@
 #include <linux/spinlock.h>
 #include <linux/wait.h>
 #include <linux/pagemap.h>
+#include <linux/hash.h>
+#include <linux/log2.h>
+#include <linux/percpu.h>
+#include <linux/rculist.h>
 
 #include "squashfs_fs.h"
 #include "squashfs_fs_sb.h"
 #include "squashfs.h"
 
+static inline struct hlist_head *squashfs_cache_bucket(
+	struct squashfs_cache *cache, u64 block)
+{
+	return &cache->hash[hash_64(block, cache->hash_bits)];
+}
+
+
+/*
+ * Take a reference to an entry found by a hash lookup.  The cache itself
+ * holds one reference on every entry, so a refcount of one means the entry
+ * is idle and a refcount of zero means it is being recycled under
+ * cache->lock and must not be used.  Reviving an idle entry takes it off
+ * the unused count.
+ */
+static int squashfs_cache_grab(struct squashfs_cache_entry *entry)
+{
+	int old, c = atomic_read(&entry->refcount);
+
+	for (;;) {
+		if (c == 0)
+			return 0;
+		old = atomic_cmpxchg(&entry->refcount, c, c + 1);
+		if (old == c)
+			break;
+		c = old;
+	}
+
+	if (c == 1)
+		atomic_dec(&entry->cache->unused);
+	return 1;
+}
+
+
+/*
+ * Find block in the cache hash and take a reference to it.  Called either
+ * under rcu_read_lock() (the lock-free hit path) or under cache->lock.
+ * Entries are never freed while the cache exists, only recycled, so a
+ * lock-free walk may at worst be moved onto another chain and miss; the
+ * caller then retries under cache->lock.
+ */
+static struct squashfs_cache_entry *squashfs_cache_lookup(
+	struct squashfs_cache *cache, u64 block)
+{
+	struct squashfs_cache_entry *entry;
+	struct hlist_node *node;
+
+	hlist_for_each_entry_rcu(entry, node,
+			squashfs_cache_bucket(cache, block), hash) {
+		if (entry->block != block || !squashfs_cache_grab(entry))
+			continue;
+
+		/*
+		 * Recycled between the compare and the grab? The grab is a
+		 * full barrier, block and then pending are read after it.
+		 */
+		if (entry->block == block)
+			return entry;
+		squashfs_cache_put(entry);
+	}
+
+	return NULL;
+}
+
+
+/*
+ * Pick the least recently released idle entry for reuse.  Called with
+ * cache->lock held.  Entries in use stay on the LRU list in the position
+ * of their previous release; they are moved to the tail when their last
+ * user drops them.
+ */
+static struct squashfs_cache_entry *squashfs_cache_evict(
+	struct squashfs_cache *cache)
+{
+	struct squashfs_cache_entry *entry;
+
+	if (atomic_read(&cache->unused) == 0)
+		return NULL;
+
+	list_for_each_entry(entry, &cache->lru, lru) {
+		if (atomic_cmpxchg(&entry->refcount, 1, 0) == 1) {
+			atomic_dec(&cache->unused);
+			return entry;
+		}
+	}
+
+	return NULL;
+}
+
+
 /*
  * Look-up block in cache, and increment usage count.  If not in cache, read
  * and decompress it from disk.
@@ -64,110 +160,100 @@
 struct squashfs_cache_entry *squashfs_cache_get(struct super_block *sb,
 	struct squashfs_cache *cache, u64 block, int length)
 {
-	int i, n;
 	struct squashfs_cache_entry *entry;
 
+	/*
+	 * Fast path, block already in cache.  No cache-wide lock is taken,
+	 * the entry is pinned by its own reference count.
+	 */
+	rcu_read_lock();
+	entry = squashfs_cache_lookup(cache, block);
+	rcu_read_unlock();
+	if (entry)
+		goto hit;
+
 	spin_lock(&cache->lock);
 
 	while (1) {
-		for (i = 0; i < cache->entries; i++)
-			if (cache->entry[i].block == block)
-				break;
-
-		if (i == cache->entries) {
-			/*
-			 * Block not in cache, if all cache entries are used
-			 * go to sleep waiting for one to become available.
-			 */
-			if (cache->unused == 0) {
-				cache->num_waiters++;
-				spin_unlock(&cache->lock);
-				wait_event(cache->wait_queue, cache->unused);
-				spin_lock(&cache->lock);
-				cache->num_waiters--;
-				continue;
-			}
-
-			/*
-			 * At least one unused cache entry.  A simple
-			 * round-robin strategy is used to choose the entry to
-			 * be evicted from the cache.
-			 */
-			i = cache->next_blk;
-			for (n = 0; n < cache->entries; n++) {
-				if (cache->entry[i].refcount == 0)
-					break;
-				i = (i + 1) % cache->entries;
-			}
-
-			cache->next_blk = (i + 1) % cache->entries;
-			entry = &cache->entry[i];
-
-			/*
-			 * Initialise chosen cache entry, and fill it in from
-			 * disk.
-			 */
-			cache->unused--;
-			entry->block = block;
-			entry->refcount = 1;
-			entry->pending = 1;
-			entry->num_waiters = 0;
-			entry->error = 0;
+		entry = squashfs_cache_lookup(cache, block);
+		if (entry) {
 			spin_unlock(&cache->lock);
+			goto hit;
+		}
 
-			entry->length = squashfs_read_data(sb, entry->data,
-				block, length, &entry->next_index,
-				cache->block_size, cache->pages);
+		entry = squashfs_cache_evict(cache);
+		if (entry)
+			break;
 
-			spin_lock(&cache->lock);
+		/*
+		 * Block not in cache, and all cache entries are used.
+		 * Go to sleep waiting for one to become available.
+		 */
+		cache->num_waiters++;
+		spin_unlock(&cache->lock);
+		wait_event(cache->wait_queue, atomic_read(&cache->unused));
+		spin_lock(&cache->lock);
+		cache->num_waiters--;
+	}
 
-			if (entry->length < 0)
-				entry->error = entry->length;
+	/*
+	 * Initialise chosen cache entry, and fill it in from disk.  The
+	 * entry is published in the hash with pending set, so concurrent
+	 * lookups of the same block wait for it rather than re-reading it.
+	 */
+	if (entry->block != SQUASHFS_INVALID_BLK) {
+		hlist_del_rcu(&entry->hash);
+		this_cpu_inc(cache->stats->evictions);
+	}
+	entry->block = block;
+	entry->pending = 1;
+	entry->error = 0;
+	/*
+	 * A lock-free lookup may still hold the entry from its old chain.
+	 * Once it can grab it, it must see the new block with pending set
+	 * (pairs with the full barrier of the cmpxchg in the grab).
+	 */
+	smp_wmb();
+	atomic_set(&entry->refcount, 2);
+	hlist_add_head_rcu(&entry->hash, squashfs_cache_bucket(cache, block));
+	list_move_tail(&entry->lru, &cache->lru);
+	spin_unlock(&cache->lock);
 
-			entry->pending = 0;
+	this_cpu_inc(cache->stats->misses);
 
-			/*
-			 * While filling this entry one or more other processes
-			 * have looked it up in the cache, and have slept
-			 * waiting for it to become available.
-			 */
-			if (entry->num_waiters) {
-				spin_unlock(&cache->lock);
-				wake_up_all(&entry->wait_queue);
-			} else
-				spin_unlock(&cache->lock);
+	entry->length = squashfs_read_data(sb, entry->data, block, length,
+		&entry->next_index, cache->block_size, cache->pages);
 
-			goto out;
-		}
+	if (entry->length < 0)
+		entry->error = entry->length;
 
-		/*
-		 * Block already in cache.  Increment refcount so it doesn't
-		 * get reused until we're finished with it, if it was
-		 * previously unused there's one less cache entry available
-		 * for reuse.
-		 */
-		entry = &cache->entry[i];
-		if (entry->refcount == 0)
-			cache->unused--;
-		entry->refcount++;
+	/*
+	 * Make the data visible before clearing pending, and clear pending
+	 * before checking for sleepers (pairs with the barrier in
+	 * wait_event's prepare_to_wait).
+	 */
+	smp_wmb();
+	entry->pending = 0;
+	smp_mb();
+	if (waitqueue_active(&entry->wait_queue))
+		wake_up_all(&entry->wait_queue);
 
-		/*
-		 * If the entry is currently being filled in by another process
-		 * go to sleep waiting for it to become available.
-		 */
-		if (entry->pending) {
-			entry->num_waiters++;
-			spin_unlock(&cache->lock);
-			wait_event(entry->wait_queue, !entry->pending);
-		} else
-			spin_unlock(&cache->lock);
+	goto out;
 
-		goto out;
-	}
+hit:
+	this_cpu_inc(cache->stats->hits);
+
+	/*
+	 * If the entry is currently being filled in by another process
+	 * go to sleep waiting for it to become available.
+	 */
+	if (entry->pending)
+		wait_event(entry->wait_queue, !entry->pending);
+	smp_rmb();
 
 out:
-	TRACE("Got %s %d, start block %lld, refcount %d, error %d\n",
-		cache->name, i, entry->block, entry->refcount, entry->error);
+	TRACE("Got %s block %lld, refcount %d, error %d\n", cache->name,
+		entry->block, atomic_read(&entry->refcount), entry->error);
 
 	if (entry->error)
 		ERROR("Unable to read %s cache entry [%llx]\n", cache->name,
@@ -183,10 +269,14 @@ void squashfs_cache_put(struct squashfs_cache_entry *entry)
 {
 	struct squashfs_cache *cache = entry->cache;
 
+	/* Not the last user, the LRU position is left alone */
+	if (atomic_add_unless(&entry->refcount, -1, 2))
+		return;
+
 	spin_lock(&cache->lock);
-	entry->refcount--;
-	if (entry->refcount == 0) {
-		cache->unused++;
+	if (atomic_dec_return(&entry->refcount) == 1) {
+		list_move_tail(&entry->lru, &cache->lru);
+		atomic_inc(&cache->unused);
 		/*
 		 * If there's any processes waiting for a block to become
 		 * available, wake one up.
@@ -200,6 +290,27 @@ void squashfs_cache_put(struct squashfs_cache_entry *entry)
 	spin_unlock(&cache->lock);
 }
 
+/*
+ * Sum the per-cpu hit/miss/eviction counters of a cache.
+ */
+void squashfs_cache_stats(struct squashfs_cache *cache,
+	struct squashfs_cache_stats *stats)
+{
+	int cpu;
+
+	memset(stats, 0, sizeof(*stats));
+	if (cache == NULL)
+		return;
+
+	for_each_possible_cpu(cpu) {
+		struct squashfs_cache_stats *s = per_cpu_ptr(cache->stats, cpu);
+
+		stats->hits += s->hits;
+		stats->misses += s->misses;
+		stats->evictions += s->evictions;
+	}
+}
+
 /*
  * Delete cache reclaiming all kmalloced buffers.
  */
@@ -210,14 +321,18 @@ void squashfs_cache_delete(struct squashfs_cache *cache)
 	if (cache == NULL)
 		return;
 
-	for (i = 0; i < cache->entries; i++) {
-		if (cache->entry[i].data) {
-			for (j = 0; j < cache->pages; j++)
-				kfree(cache->entry[i].data[j]);
-			kfree(cache->entry[i].data);
+	if (cache->entry) {
+		for (i = 0; i < cache->entries; i++) {
+			if (cache->entry[i].data) {
+				for (j = 0; j < cache->pages; j++)
+					kfree(cache->entry[i].data[j]);
+				kfree(cache->entry[i].data);
+			}
 		}
 	}
 
+	free_percpu(cache->stats);
+	kfree(cache->hash);
 	kfree(cache->entry);
 	kfree(cache);
 }
@@ -231,7 +346,7 @@ void squashfs_cache_delete(struct squashfs_cache *cache)
 struct squashfs_cache *squashfs_cache_init(char *name, int entries,
 	int block_size)
 {
-	int i, j;
+	int i, j, buckets;
 	struct squashfs_cache *cache = kzalloc(sizeof(*cache), GFP_KERNEL);
 
 	if (cache == NULL) {
@@ -245,8 +360,16 @@ struct squashfs_cache *squashfs_cache_init(char *name, int entries,
 		goto cleanup;
 	}
 
-	cache->next_blk = 0;
-	cache->unused = entries;
+	buckets = roundup_pow_of_two(max(entries, 2));
+	cache->hash_bits = ilog2(buckets);
+	cache->hash = kcalloc(buckets, sizeof(*(cache->hash)), GFP_KERNEL);
+	cache->stats = alloc_percpu(struct squashfs_cache_stats);
+	if (cache->hash == NULL || cache->stats == NULL) {
+		ERROR("Failed to allocate %s cache\n", name);
+		goto cleanup;
+	}
+
+	atomic_set(&cache->unused, entries);
 	cache->entries = entries;
 	cache->block_size = block_size;
 	cache->pages = block_size >> PAGE_CACHE_SHIFT;
@@ -255,6 +378,7 @@ struct squashfs_cache *squashfs_cache_init(char *name, int entries,
 	cache->num_waiters = 0;
 	spin_lock_init(&cache->lock);
 	init_waitqueue_head(&cache->wait_queue);
+	INIT_LIST_HEAD(&cache->lru);
 
 	for (i = 0; i < entries; i++) {
 		struct squashfs_cache_entry *entry = &cache->entry[i];
@@ -262,6 +386,9 @@ struct squashfs_cache *squashfs_cache_init(char *name, int entries,
 		init_waitqueue_head(&cache->entry[i].wait_queue);
 		entry->cache = cache;
 		entry->block = SQUASHFS_INVALID_BLK;
+		atomic_set(&entry->refcount, 1);
+		INIT_HLIST_NODE(&entry->hash);
+		list_add_tail(&entry->lru, &cache->lru);
 		entry->data = kcalloc(cache->pages, sizeof(void *), GFP_KERNEL);
 		if (entry->data == NULL) {
 			ERROR("Failed to allocate %s cache entry\n", name);
@@ -23,29 +23,42 @@
  * squashfs_fs_sb.h
  */
 
+#include <linux/kobject.h>
+#include <linux/completion.h>
+
 #include "squashfs_fs.h"
 
+struct squashfs_cache_stats {
+	unsigned long		hits;
+	unsigned long		misses;
+	unsigned long		evictions;
+};
+
 struct squashfs_cache {
 	char			*name;
 	int			entries;
-	int			next_blk;
 	int			num_waiters;
-	int			unused;
+	atomic_t		unused;
 	int			block_size;
 	int			pages;
+	int			hash_bits;
 	spinlock_t		lock;
 	wait_queue_head_t	wait_queue;
+	struct list_head	lru;
+	struct hlist_head	*hash;
+	struct squashfs_cache_stats __percpu *stats;
 	struct squashfs_cache_entry *entry;
 };
 
 struct squashfs_cache_entry {
 	u64			block;
 	int			length;
-	int			refcount;
+	atomic_t		refcount;
 	u64			next_index;
 	int			pending;
 	int			error;
-	int			num_waiters;
+	struct hlist_node	hash;
+	struct list_head	lru;
 	wait_queue_head_t	wait_queue;
 	struct squashfs_cache	*cache;
 	void			**data;
@@ -62,7 +75,6 @@ struct squashfs_sb_info {
 	__le64					*id_table;
 	__le64					*fragment_index;
 	__le64					*xattr_id_table;
-	struct mutex				read_data_mutex;
 	struct mutex				meta_index_mutex;
 	struct meta_index			*meta_index;
 	void					*stream;
@@ -75,5 +87,7 @@ struct squashfs_sb_info {
 	long long				bytes_used;
 	unsigned int				inodes;
 	int					xattr_ids;
+	struct kobject				kobj;
+	struct completion			kobj_unregister;
 };
 #endif
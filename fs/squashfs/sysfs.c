@@ -0,0 +1,193 @@
+/*
+ * Squashfs - a compressed read only filesystem for Linux
+ *
+ * Copyright (c) 2002, 2003, 2004, 2005, 2006, 2007, 2008, 2009
+ * Phillip Lougher <phillip@squashfs.org.uk>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2,
+ * or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ *
+ * sysfs.c
+ */
+
+/*
+ * This file exports per-filesystem cache statistics under
+ * /sys/fs/squashfs/<device>/.  For each of the metadata, fragment and
+ * data caches the number of entries and the hit, miss and eviction counts
+ * are available, to help size the caches with the mount options.
+ */
+
+#include <linux/fs.h>
+#include <linux/kobject.h>
+#include <linux/sysfs.h>
+#include <linux/stddef.h>
+
+#include "squashfs_fs.h"
+#include "squashfs_fs_sb.h"
+#include "squashfs.h"
+
+static struct kset *squashfs_kset;
+
+enum {
+	CACHE_ENTRIES,
+	CACHE_HITS,
+	CACHE_MISSES,
+	CACHE_EVICTIONS
+};
+
+struct squashfs_attr {
+	struct attribute attr;
+	ssize_t (*show)(struct squashfs_attr *, struct squashfs_sb_info *,
+			char *);
+	int offset;
+	int field;
+};
+
+static ssize_t cache_stat_show(struct squashfs_attr *a,
+			       struct squashfs_sb_info *msblk, char *buf)
+{
+	struct squashfs_cache *cache =
+		*(struct squashfs_cache **)((char *) msblk + a->offset);
+	struct squashfs_cache_stats stats;
+	unsigned long val;
+
+	squashfs_cache_stats(cache, &stats);
+
+	switch (a->field) {
+	case CACHE_ENTRIES:
+		val = cache ? cache->entries : 0;
+		break;
+	case CACHE_HITS:
+		val = stats.hits;
+		break;
+	case CACHE_MISSES:
+		val = stats.misses;
+		break;
+	default:
+		val = stats.evictions;
+		break;
+	}
+
+	return snprintf(buf, PAGE_SIZE, "%lu\n", val);
+}
+
+#define SQUASHFS_CACHE_ATTR(_name, _cache, _stat, _field)		\
+static struct squashfs_attr squashfs_attr_##_name##_##_stat = {		\
+	.attr = { .name = __stringify(_name) "_" __stringify(_stat),	\
+		  .mode = S_IRUGO },					\
+	.show	= cache_stat_show,					\
+	.offset	= offsetof(struct squashfs_sb_info, _cache),		\
+	.field	= _field,						\
+}
+
+#define SQUASHFS_CACHE_ATTRS(_name, _cache)				\
+	SQUASHFS_CACHE_ATTR(_name, _cache, entries, CACHE_ENTRIES);	\
+	SQUASHFS_CACHE_ATTR(_name, _cache, hits, CACHE_HITS);		\
+	SQUASHFS_CACHE_ATTR(_name, _cache, misses, CACHE_MISSES);	\
+	SQUASHFS_CACHE_ATTR(_name, _cache, evictions, CACHE_EVICTIONS)
+
+#define ATTR_LIST(_name, _stat)	(&squashfs_attr_##_name##_##_stat.attr)
+
+SQUASHFS_CACHE_ATTRS(metadata, block_cache);
+SQUASHFS_CACHE_ATTRS(fragment, fragment_cache);
+SQUASHFS_CACHE_ATTRS(data, read_page);
+
+static struct attribute *squashfs_attrs[] = {
+	ATTR_LIST(metadata, entries),
+	ATTR_LIST(metadata, hits),
+	ATTR_LIST(metadata, misses),
+	ATTR_LIST(metadata, evictions),
+	ATTR_LIST(fragment, entries),
+	ATTR_LIST(fragment, hits),
+	ATTR_LIST(fragment, misses),
+	ATTR_LIST(fragment, evictions),
+	ATTR_LIST(data, entries),
+	ATTR_LIST(data, hits),
+	ATTR_LIST(data, misses),
+	ATTR_LIST(data, evictions),
+	NULL,
+};
+
+static ssize_t squashfs_attr_show(struct kobject *kobj,
+				  struct attribute *attr, char *buf)
+{
+	struct squashfs_sb_info *msblk = container_of(kobj,
+					struct squashfs_sb_info, kobj);
+	struct squashfs_attr *a = container_of(attr, struct squashfs_attr,
+					attr);
+
+	return a->show ? a->show(a, msblk, buf) : 0;
+}
+
+static void squashfs_sb_release(struct kobject *kobj)
+{
+	struct squashfs_sb_info *msblk = container_of(kobj,
+					struct squashfs_sb_info, kobj);
+
+	complete(&msblk->kobj_unregister);
+}
+
+static const struct sysfs_ops squashfs_attr_ops = {
+	.show	= squashfs_attr_show,
+};
+
+static struct kobj_type squashfs_ktype = {
+	.default_attrs	= squashfs_attrs,
+	.sysfs_ops	= &squashfs_attr_ops,
+	.release	= squashfs_sb_release,
+};
+
+
+int squashfs_sysfs_register(struct super_block *sb)
+{
+	struct squashfs_sb_info *msblk = sb->s_fs_info;
+	int err;
+
+	msblk->kobj.kset = squashfs_kset;
+	init_completion(&msblk->kobj_unregister);
+	err = kobject_init_and_add(&msblk->kobj, &squashfs_ktype, NULL,
+		"%s", sb->s_id);
+	if (err) {
+		kobject_put(&msblk->kobj);
+		wait_for_completion(&msblk->kobj_unregister);
+	}
+
+	return err;
+}
+
+
+void squashfs_sysfs_unregister(struct super_block *sb)
+{
+	struct squashfs_sb_info *msblk = sb->s_fs_info;
+
+	if (!msblk->kobj.state_in_sysfs)
+		return;
+
+	kobject_put(&msblk->kobj);
+	wait_for_completion(&msblk->kobj_unregister);
+}
+
+
+int __init squashfs_sysfs_init(void)
+{
+	squashfs_kset = kset_create_and_add("squashfs", NULL, fs_kobj);
+
+	return squashfs_kset ? 0 : -ENOMEM;
+}
+
+
+void squashfs_sysfs_exit(void)
+{
+	kset_unregister(squashfs_kset);
+}
@@ -41,13 +41,40 @@
  * latency blips. Note that in any case, the commit does not prevent lookups
  * (as permitted by the TNC mutex), or access to VFS data structures e.g. page
  * cache.
+ *
+ * The index and the LPT are written to different LEBs and from different
+ * buffers, and the LPT end commit already has to cope with concurrent LEB
+ * properties changes, so during commit end the LPT is written by a work on
+ * @c->lpt_cmt_wq while the commit thread writes the index. Commits have to
+ * make progress under memory pressure, so that workqueue has a rescuer.
  */
 
 #include <linux/freezer.h>
 #include <linux/kthread.h>
 #include <linux/slab.h>
+#include <linux/workqueue.h>
 #include "ubifs.h"
 
+/**
+ * struct lpt_commit_work - LPT commit end work.
+ * @work: the work object
+ * @c: UBIFS file-system description object
+ * @err: result of 'ubifs_lpt_end_commit()'
+ */
+struct lpt_commit_work {
+	struct work_struct work;
+	struct ubifs_info *c;
+	int err;
+};
+
+static void lpt_commit_worker(struct work_struct *work)
+{
+	struct lpt_commit_work *lw;
+
+	lw = container_of(work, struct lpt_commit_work, work);
+	lw->err = ubifs_lpt_end_commit(lw->c);
+}
+
 /*
  * nothing_to_commit - check if there is nothing to commit.
  * @c: UBIFS file-system description object
@@ -111,6 +138,8 @@ static int do_commit(struct ubifs_info *c)
 	int err, new_ltail_lnum, old_ltail_lnum, i;
 	struct ubifs_zbranch zroot;
 	struct ubifs_lp_stats lst;
+	struct lpt_commit_work lw;
+	ktime_t start = dbg_hist_start();
 
 	dbg_cmt("start");
 	ubifs_assert(!c->ro_media && !c->ro_mount);
@@ -157,10 +186,15 @@ static int do_commit(struct ubifs_info *c)
 
 	up_write(&c->commit_sem);
 
+	/* Write the LPT while the index is being written */
+	lw.c = c;
+	INIT_WORK_ONSTACK(&lw.work, lpt_commit_worker);
+	queue_work(c->lpt_cmt_wq, &lw.work);
 	err = ubifs_tnc_end_commit(c);
-	if (err)
-		goto out;
-	err = ubifs_lpt_end_commit(c);
+	flush_work(&lw.work);
+	destroy_work_on_stack(&lw.work);
+	if (!err)
+		err = lw.err;
 	if (err)
 		goto out;
 	err = ubifs_orphan_end_commit(c);
@@ -217,6 +251,7 @@ static int do_commit(struct ubifs_info *c)
 	err = ubifs_lpt_post_commit(c);
 	if (err)
 		goto out;
+	dbg_commit_hist(c, start);
 
 out_cancel:
 	spin_lock(&c->cs_lock);
@@ -25,9 +25,21 @@
 /*
  * This file provides a single place to access to compression and
  * decompression.
+ *
+ * It also implements adaptive compression. When it is enabled, the first
+ * %UBIFS_COMPR_PROBE_NODES data nodes an inode writes are compressed
+ * alternately with the inode's compressor and the other one, and the achieved
+ * ratios are recorded. Afterwards the inode uses whichever compressor did
+ * best, or no compression at all if the data turned out to be incompressible,
+ * until %UBIFS_COMPR_REPROBE_NODES data nodes have been written and the probe
+ * starts again. Nothing of this is stored on the media - every data node
+ * records its own compressor anyway.
+ *
+ * Per-compressor statistics are exported in /sys/fs/ubifs/<compressor>/.
  */
 
 #include <linux/crypto.h>
+#include <linux/kobject.h>
 #include "ubifs.h"
 
 /* Fake description object for the "none" compressor */
@@ -74,6 +86,23 @@ static struct ubifs_compressor zlib_compr = {
 /* All UBIFS compressors */
 struct ubifs_compressor *ubifs_compressors[UBIFS_COMPR_TYPES_CNT];
 
+/* The /sys/fs/ubifs directory */
+static struct kobject *ubifs_kobj;
+
+/**
+ * compr_account - account a compression request in compressor statistics.
+ * @compr: compressor which was asked to compress the data
+ * @in_len: uncompressed data length
+ * @out_len: length of the data which was handed back
+ */
+static void compr_account(struct ubifs_compressor *compr, int in_len,
+			  int out_len)
+{
+	atomic64_inc(&compr->nodes);
+	atomic64_add(in_len, &compr->bytes_in);
+	atomic64_add(out_len, &compr->bytes_out);
+}
+
 /**
  * ubifs_compress - compress data.
  * @in_buf: data to compress
@@ -97,6 +126,7 @@ void ubifs_compress(const void *in_buf, int in_len, void *out_buf, int *out_len,
 {
 	int err;
 	struct ubifs_compressor *compr = ubifs_compressors[*compr_type];
+	ktime_t start;
 
 	if (*compr_type == UBIFS_COMPR_NONE)
 		goto no_compr;
@@ -107,8 +137,11 @@ void ubifs_compress(const void *in_buf, int in_len, void *out_buf, int *out_len,
 
 	if (compr->comp_mutex)
 		mutex_lock(compr->comp_mutex);
+	start = ktime_get();
 	err = crypto_comp_compress(compr->cc, in_buf, in_len, out_buf,
 				   (unsigned int *)out_len);
+	atomic64_add(ktime_to_ns(ktime_sub(ktime_get(), start)),
+		     &compr->nsecs);
 	if (compr->comp_mutex)
 		mutex_unlock(compr->comp_mutex);
 	if (unlikely(err)) {
@@ -125,12 +158,108 @@ void ubifs_compress(const void *in_buf, int in_len, void *out_buf, int *out_len,
 	if (in_len - *out_len < UBIFS_MIN_COMPRESS_DIFF)
 		goto no_compr;
 
+	compr_account(compr, in_len, *out_len);
 	return;
 
 no_compr:
 	memcpy(out_buf, in_buf, in_len);
 	*out_len = in_len;
 	*compr_type = UBIFS_COMPR_NONE;
+	compr_account(compr, in_len, in_len);
+}
+
+/**
+ * ubifs_compr_select - select compressor for a data node of an inode.
+ * @ui: UBIFS inode object
+ *
+ * This function is used by adaptive compression and returns the compressor
+ * type which should be used for the next data node of @ui. The inode's own
+ * compressor must not be %UBIFS_COMPR_NONE.
+ */
+int ubifs_compr_select(struct ubifs_inode *ui)
+{
+	int compr_type, other;
+
+	spin_lock(&ui->ui_lock);
+	if (ui->compr_nodes >= UBIFS_COMPR_PROBE_NODES)
+		compr_type = ui->compr_auto;
+	else {
+		/* Probing - try the other compressor every second node */
+		compr_type = ui->compr_type;
+		if (compr_type == UBIFS_COMPR_LZO)
+			other = UBIFS_COMPR_ZLIB;
+		else
+			other = UBIFS_COMPR_LZO;
+		if ((ui->compr_nodes & 1) && ubifs_compr_present(other))
+			compr_type = other;
+	}
+	spin_unlock(&ui->ui_lock);
+
+	return compr_type;
+}
+
+/**
+ * pick_compr - pick compressor for an inode at the end of a probe.
+ * @ui: UBIFS inode object
+ *
+ * This function returns the compressor with the best ratio seen during the
+ * probe. The inode's own compressor is kept unless another one saves at least
+ * 1/16 of the data more. If even the best compressor saves less than 1/8 of
+ * the data, the inode is considered incompressible and %UBIFS_COMPR_NONE is
+ * returned.
+ */
+static int pick_compr(const struct ubifs_inode *ui)
+{
+	int i, best = ui->compr_type;
+	long long in, saved, best_in, best_saved;
+
+	best_in = ui->compr_in[best];
+	best_saved = best_in - ui->compr_out[best];
+	for (i = 0; i < UBIFS_COMPR_TYPES_CNT; i++) {
+		in = ui->compr_in[i];
+		if (i == ui->compr_type || !in)
+			continue;
+		saved = in - ui->compr_out[i];
+		/* Is saved / in > best_saved / best_in + 1 / 16? */
+		if (16 * saved * best_in > 16 * best_saved * in + in * best_in) {
+			best = i;
+			best_in = in;
+			best_saved = saved;
+		}
+	}
+
+	if (8 * best_saved < best_in)
+		return UBIFS_COMPR_NONE;
+	return best;
+}
+
+/**
+ * ubifs_compr_update - feed data node compression result to adaptive
+ *                      compression.
+ * @ui: UBIFS inode object
+ * @compr_type: compressor returned by 'ubifs_compr_select()' for the node
+ * @in_len: uncompressed data length
+ * @out_len: length of the data which is written to the media
+ */
+void ubifs_compr_update(struct ubifs_inode *ui, int compr_type, int in_len,
+			int out_len)
+{
+	spin_lock(&ui->ui_lock);
+	if (ui->compr_nodes < UBIFS_COMPR_PROBE_NODES) {
+		ui->compr_in[compr_type] += in_len;
+		ui->compr_out[compr_type] += out_len;
+		if (ui->compr_nodes == UBIFS_COMPR_PROBE_NODES - 1)
+			ui->compr_auto = pick_compr(ui);
+	}
+
+	ui->compr_nodes += 1;
+	if (ui->compr_nodes >= UBIFS_COMPR_REPROBE_NODES) {
+		/* The data may have changed, probe again */
+		ui->compr_nodes = 0;
+		memset(ui->compr_in, 0, sizeof(ui->compr_in));
+		memset(ui->compr_out, 0, sizeof(ui->compr_out));
+	}
+	spin_unlock(&ui->ui_lock);
 }
 
 /**
@@ -215,6 +344,114 @@ static void compr_exit(struct ubifs_compressor *compr)
 	return;
 }
 
+/* Compressor statistics exported via sysfs */
+enum {
+	COMPR_STAT_NODES,
+	COMPR_STAT_BYTES_IN,
+	COMPR_STAT_BYTES_SAVED,
+	COMPR_STAT_TIME_US,
+};
+
+/**
+ * struct compr_attr - compressor statistics sysfs attribute.
+ * @attr: the sysfs attribute
+ * @compr: compressor the statistics belong to
+ * @stat: which statistics to show (%COMPR_STAT_NODES, etc)
+ */
+struct compr_attr {
+	struct kobj_attribute attr;
+	struct ubifs_compressor *compr;
+	int stat;
+};
+
+static ssize_t compr_stat_show(struct kobject *kobj,
+			       struct kobj_attribute *attr, char *buf)
+{
+	struct compr_attr *ca = container_of(attr, struct compr_attr, attr);
+	struct ubifs_compressor *compr = ca->compr;
+	long long val;
+
+	switch (ca->stat) {
+	case COMPR_STAT_NODES:
+		val = atomic64_read(&compr->nodes);
+		break;
+	case COMPR_STAT_BYTES_IN:
+		val = atomic64_read(&compr->bytes_in);
+		break;
+	case COMPR_STAT_BYTES_SAVED:
+		val = atomic64_read(&compr->bytes_in) -
+		      atomic64_read(&compr->bytes_out);
+		break;
+	case COMPR_STAT_TIME_US:
+		val = div_u64(atomic64_read(&compr->nsecs), NSEC_PER_USEC);
+		break;
+	default:
+		return -EINVAL;
+	}
+
+	return sprintf(buf, "%lld\n", val);
+}
+
+#define COMPR_ATTR(_type, _name, _stat)					\
+static struct compr_attr _type##_##_name##_attr = {			\
+	.attr = __ATTR(_name, S_IRUGO, compr_stat_show, NULL),		\
+	.compr = &_type##_compr,					\
+	.stat = _stat,							\
+}
+
+#define COMPR_ATTR_GROUP(_type)						\
+COMPR_ATTR(_type, nodes, COMPR_STAT_NODES);				\
+COMPR_ATTR(_type, bytes_in, COMPR_STAT_BYTES_IN);			\
+COMPR_ATTR(_type, bytes_saved, COMPR_STAT_BYTES_SAVED);			\
+COMPR_ATTR(_type, time_us, COMPR_STAT_TIME_US);				\
+static struct attribute *_type##_attrs[] = {				\
+	&_type##_nodes_attr.attr.attr,					\
+	&_type##_bytes_in_attr.attr.attr,				\
+	&_type##_bytes_saved_attr.attr.attr,				\
+	&_type##_time_us_attr.attr.attr,				\
+	NULL,								\
+};									\
+static struct attribute_group _type##_attr_group = {			\
+	.name = #_type,							\
+	.attrs = _type##_attrs,						\
+}
+
+COMPR_ATTR_GROUP(none);
+COMPR_ATTR_GROUP(lzo);
+COMPR_ATTR_GROUP(zlib);
+
+static struct attribute_group *compr_attr_groups[] = {
+	&none_attr_group,
+	&lzo_attr_group,
+	&zlib_attr_group,
+};
+
+/**
+ * compr_sysfs_init - create the compressor statistics sysfs files.
+ *
+ * This function returns zero in case of success and a negative error code in
+ * case of failure.
+ */
+static int __init compr_sysfs_init(void)
+{
+	int i, err;
+
+	ubifs_kobj = kobject_create_and_add("ubifs", fs_kobj);
+	if (!ubifs_kobj)
+		return -ENOMEM;
+
+	for (i = 0; i < ARRAY_SIZE(compr_attr_groups); i++) {
+		err = sysfs_create_group(ubifs_kobj, compr_attr_groups[i]);
+		if (err) {
+			ubifs_err("cannot create sysfs files, error %d", err);
+			kobject_put(ubifs_kobj);
+			return err;
+		}
+	}
+
+	return 0;
+}
+
 /**
  * ubifs_compressors_init - initialize UBIFS compressors.
  *
@@ -233,9 +470,15 @@ int __init ubifs_compressors_init(void)
 	if (err)
 		goto out_lzo;
 
+	err = compr_sysfs_init();
+	if (err)
+		goto out_zlib;
+
 	ubifs_compressors[UBIFS_COMPR_NONE] = &none_compr;
 	return 0;
 
+out_zlib:
+	compr_exit(&zlib_compr);
 out_lzo:
 	compr_exit(&lzo_compr);
 	return err;
@@ -246,6 +489,7 @@ out_lzo:
  */
 void ubifs_compressors_exit(void)
 {
+	kobject_put(ubifs_kobj);
 	compr_exit(&lzo_compr);
 	compr_exit(&zlib_compr);
 }
@@ -2743,6 +2743,41 @@ int dbg_leb_map(struct ubifs_info *c, int lnum, int dtype)
 	return 0;
 }
 
+/**
+ * hist_add - account an event in a latency histogram.
+ * @hist: the histogram
+ * @start: time the event started at
+ */
+static void hist_add(struct ubifs_dbg_hist *hist, ktime_t start)
+{
+	s64 us = ktime_us_delta(ktime_get(), start);
+	int slot = 0;
+
+	if (us > 0)
+		slot = min_t(int, fls64(us), UBIFS_DBG_HIST_SLOTS - 1);
+	atomic_inc(&hist->cnt[slot]);
+}
+
+/**
+ * dbg_lookup_hist - account a TNC lookup.
+ * @c: UBIFS file-system description object
+ * @start: time the lookup started at
+ */
+void dbg_lookup_hist(struct ubifs_info *c, ktime_t start)
+{
+	hist_add(&c->dbg->lookup_hist, start);
+}
+
+/**
+ * dbg_commit_hist - account a commit.
+ * @c: UBIFS file-system description object
+ * @start: time the commit started at
+ */
+void dbg_commit_hist(struct ubifs_info *c, ktime_t start)
+{
+	hist_add(&c->dbg->commit_hist, start);
+}
+
 /*
  * Root directory for UBIFS stuff in debugfs. Contains sub-directories which
  * contain the stuff specific to particular file-system mounts.
@@ -2899,6 +2934,49 @@ static const struct file_operations dfs_fops = {
 	.llseek = no_llseek,
 };
 
+/* Maximum length of a histogram line, e.g. "<    4194304 us: 4294967295" */
+#define HIST_LINE_LEN 32
+
+static ssize_t dfs_hist_read(struct file *file, char __user *u, size_t count,
+			     loff_t *ppos)
+{
+	struct dentry *dent = file->f_path.dentry;
+	struct ubifs_info *c = file->private_data;
+	struct ubifs_debug_info *d = c->dbg;
+	struct ubifs_dbg_hist *hist;
+	char *buf;
+	int i, len = 0;
+	ssize_t ret;
+
+	if (dent == d->dfs_lookup_hist)
+		hist = &d->lookup_hist;
+	else if (dent == d->dfs_commit_hist)
+		hist = &d->commit_hist;
+	else
+		return -EINVAL;
+
+	buf = kmalloc(UBIFS_DBG_HIST_SLOTS * HIST_LINE_LEN, GFP_KERNEL);
+	if (!buf)
+		return -ENOMEM;
+
+	for (i = 0; i < UBIFS_DBG_HIST_SLOTS - 1; i++)
+		len += snprintf(buf + len, HIST_LINE_LEN, "< %10lu us: %u\n",
+				1UL << i, atomic_read(&hist->cnt[i]));
+	len += snprintf(buf + len, HIST_LINE_LEN, ">=%10lu us: %u\n",
+			1UL << (i - 1), atomic_read(&hist->cnt[i]));
+
+	ret = simple_read_from_buffer(u, count, ppos, buf, len);
+	kfree(buf);
+	return ret;
+}
+
+static const struct file_operations dfs_hist_fops = {
+	.open = dfs_file_open,
+	.read = dfs_hist_read,
+	.owner = THIS_MODULE,
+	.llseek = no_llseek,
+};
+
 /**
  * dbg_debugfs_init_fs - initialize debugfs for UBIFS instance.
  * @c: UBIFS file-system description object
@@ -2993,6 +3071,20 @@ int dbg_debugfs_init_fs(struct ubifs_info *c)
 		goto out_remove;
 	d->dfs_tst_rcvry = dent;
 
+	fname = "lookup_hist";
+	dent = debugfs_create_file(fname, S_IRUSR, d->dfs_dir, c,
+				   &dfs_hist_fops);
+	if (IS_ERR_OR_NULL(dent))
+		goto out_remove;
+	d->dfs_lookup_hist = dent;
+
+	fname = "commit_hist";
+	dent = debugfs_create_file(fname, S_IRUSR, d->dfs_dir, c,
+				   &dfs_hist_fops);
+	if (IS_ERR_OR_NULL(dent))
+		goto out_remove;
+	d->dfs_commit_hist = dent;
+
 	return 0;
 
 out_remove:
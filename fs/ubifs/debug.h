@@ -38,6 +38,21 @@ typedef int (*dbg_znode_callback)(struct ubifs_info *c,
 #define UBIFS_DFS_DIR_NAME "ubi%d_%d"
 #define UBIFS_DFS_DIR_LEN  (3 + 1 + 2*2 + 1)
 
+/*
+ * Number of latency histogram slots. Slot 0 counts events which took less than
+ * a microsecond, slot N counts events which took [2^(N-1), 2^N) microseconds,
+ * and the last slot counts everything longer.
+ */
+#define UBIFS_DBG_HIST_SLOTS 24
+
+/**
+ * ubifs_dbg_hist - latency histogram.
+ * @cnt: event counters, one per log2 microseconds slot
+ */
+struct ubifs_dbg_hist {
+	atomic_t cnt[UBIFS_DBG_HIST_SLOTS];
+};
+
 /**
  * ubifs_debug_info - per-FS debugging information.
  * @old_zroot: old index root - used by 'dbg_check_old_index()'
@@ -70,6 +85,9 @@ typedef int (*dbg_znode_callback)(struct ubifs_info *c,
  * @chk_fs: if UBIFS contents extra checks are enabled
  * @tst_rcvry: if UBIFS recovery testing mode enabled
  *
+ * @lookup_hist: 'ubifs_tnc_locate()' latency histogram
+ * @commit_hist: commit duration histogram
+ *
  * @dfs_dir_name: name of debugfs directory containing this file-system's files
  * @dfs_dir: direntry object of the file-system debugfs directory
  * @dfs_dump_lprops: "dump lprops" debugfs knob
@@ -81,6 +99,8 @@ typedef int (*dbg_znode_callback)(struct ubifs_info *c,
  * @dfs_chk_lprops: debugfs knob to enable UBIFS LEP properties extra checks
  * @dfs_chk_fs: debugfs knob to enable UBIFS contents extra checks
  * @dfs_tst_rcvry: debugfs knob to enable UBIFS recovery testing
+ * @dfs_lookup_hist: debugfs file showing the TNC lookup latency histogram
+ * @dfs_commit_hist: debugfs file showing the commit duration histogram
  */
 struct ubifs_debug_info {
 	struct ubifs_zbranch old_zroot;
@@ -113,6 +133,9 @@ struct ubifs_debug_info {
 	unsigned int chk_fs:1;
 	unsigned int tst_rcvry:1;
 
+	struct ubifs_dbg_hist lookup_hist;
+	struct ubifs_dbg_hist commit_hist;
+
 	char dfs_dir_name[UBIFS_DFS_DIR_LEN + 1];
 	struct dentry *dfs_dir;
 	struct dentry *dfs_dump_lprops;
@@ -124,6 +147,8 @@ struct ubifs_debug_info {
 	struct dentry *dfs_chk_lprops;
 	struct dentry *dfs_chk_fs;
 	struct dentry *dfs_tst_rcvry;
+	struct dentry *dfs_lookup_hist;
+	struct dentry *dfs_commit_hist;
 };
 
 /**
@@ -315,6 +340,14 @@ int dbg_leb_change(struct ubifs_info *c, int lnum, const void *buf, int len,
 int dbg_leb_unmap(struct ubifs_info *c, int lnum);
 int dbg_leb_map(struct ubifs_info *c, int lnum, int dtype);
 
+/* Latency histograms */
+static inline ktime_t dbg_hist_start(void)
+{
+	return ktime_get();
+}
+void dbg_lookup_hist(struct ubifs_info *c, ktime_t start);
+void dbg_commit_hist(struct ubifs_info *c, ktime_t start);
+
 /* Debugfs-related stuff */
 int dbg_debugfs_init(void);
 void dbg_debugfs_exit(void);
@@ -466,6 +499,12 @@ static inline int dbg_is_chk_fs(const struct ubifs_info *c)       { return 0; }
 static inline int dbg_is_tst_rcvry(const struct ubifs_info *c)    { return 0; }
 static inline int dbg_is_power_cut(const struct ubifs_info *c)    { return 0; }
 
+static inline ktime_t dbg_hist_start(void)          { return ktime_set(0, 0); }
+static inline void dbg_lookup_hist(struct ubifs_info *c,
+				   ktime_t start)                 { return; }
+static inline void dbg_commit_hist(struct ubifs_info *c,
+				   ktime_t start)                 { return; }
+
 static inline int dbg_debugfs_init(void)                          { return 0; }
 static inline void dbg_debugfs_exit(void)                         { return; }
 static inline int dbg_debugfs_init_fs(struct ubifs_info *c)       { return 0; }
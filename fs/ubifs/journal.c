@@ -693,7 +693,7 @@ int ubifs_jnl_write_data(struct ubifs_info *c, const struct inode *inode,
 			 const union ubifs_key *key, const void *buf, int len)
 {
 	struct ubifs_data_node *data;
-	int err, lnum, offs, compr_type, out_len;
+	int err, lnum, offs, compr_type, tried_compr, out_len, adaptive = 0;
 	int dlen = COMPRESSED_DATA_NODE_BUF_SZ, allocated = 1;
 	struct ubifs_inode *ui = ubifs_inode(inode);
 
@@ -721,15 +721,22 @@ int ubifs_jnl_write_data(struct ubifs_info *c, const struct inode *inode,
 	data->size = cpu_to_le32(len);
 	zero_data_node_unused(data);
 
-	if (!(ui->flags & UBIFS_COMPR_FL))
+	if (!(ui->flags & UBIFS_COMPR_FL)) {
 		/* Compression is disabled for this inode */
 		compr_type = UBIFS_COMPR_NONE;
-	else
+	} else if (c->adaptive_compr && ui->compr_type != UBIFS_COMPR_NONE) {
+		adaptive = 1;
+		compr_type = ubifs_compr_select(ui);
+	} else {
 		compr_type = ui->compr_type;
+	}
 
+	tried_compr = compr_type;
 	out_len = dlen - UBIFS_DATA_NODE_SZ;
 	ubifs_compress(buf, len, &data->data, &out_len, &compr_type);
 	ubifs_assert(out_len <= UBIFS_BLOCK_SIZE);
+	if (adaptive)
+		ubifs_compr_update(ui, tried_compr, len, out_len);
 
 	dlen = UBIFS_DATA_NODE_SZ + out_len;
 	data->compr_type = cpu_to_le16(compr_type);
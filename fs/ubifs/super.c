@@ -434,6 +434,11 @@ static int ubifs_show_options(struct seq_file *s, struct vfsmount *mnt)
 	else if (c->mount_opts.bulk_read == 1)
 		seq_printf(s, ",no_bulk_read");
 
+	if (c->mount_opts.adaptive_compr == 2)
+		seq_printf(s, ",adaptive_compr");
+	else if (c->mount_opts.adaptive_compr == 1)
+		seq_printf(s, ",no_adaptive_compr");
+
 	if (c->mount_opts.chk_data_crc == 2)
 		seq_printf(s, ",chk_data_crc");
 	else if (c->mount_opts.chk_data_crc == 1)
@@ -935,6 +940,8 @@ static int check_volume_empty(struct ubifs_info *c)
  * Opt_norm_unmount: run a journal commit before un-mounting
  * Opt_bulk_read: enable bulk-reads
  * Opt_no_bulk_read: disable bulk-reads
+ * Opt_adaptive_compr: enable adaptive compression
+ * Opt_no_adaptive_compr: disable adaptive compression
  * Opt_chk_data_crc: check CRCs when reading data nodes
  * Opt_no_chk_data_crc: do not check CRCs when reading data nodes
  * Opt_override_compr: override default compressor
@@ -945,6 +952,8 @@ enum {
 	Opt_norm_unmount,
 	Opt_bulk_read,
 	Opt_no_bulk_read,
+	Opt_adaptive_compr,
+	Opt_no_adaptive_compr,
 	Opt_chk_data_crc,
 	Opt_no_chk_data_crc,
 	Opt_override_compr,
@@ -956,6 +965,8 @@ static const match_table_t tokens = {
 	{Opt_norm_unmount, "norm_unmount"},
 	{Opt_bulk_read, "bulk_read"},
 	{Opt_no_bulk_read, "no_bulk_read"},
+	{Opt_adaptive_compr, "adaptive_compr"},
+	{Opt_no_adaptive_compr, "no_adaptive_compr"},
 	{Opt_chk_data_crc, "chk_data_crc"},
 	{Opt_no_chk_data_crc, "no_chk_data_crc"},
 	{Opt_override_compr, "compr=%s"},
@@ -1028,6 +1039,14 @@ static int ubifs_parse_options(struct ubifs_info *c, char *options,
 			c->mount_opts.bulk_read = 1;
 			c->bulk_read = 0;
 			break;
+		case Opt_adaptive_compr:
+			c->mount_opts.adaptive_compr = 2;
+			c->adaptive_compr = 1;
+			break;
+		case Opt_no_adaptive_compr:
+			c->mount_opts.adaptive_compr = 1;
+			c->adaptive_compr = 0;
+			break;
 		case Opt_chk_data_crc:
 			c->mount_opts.chk_data_crc = 2;
 			c->no_chk_data_crc = 0;
@@ -1215,6 +1234,11 @@ static int mount_ubifs(struct ubifs_info *c)
 	if (!c->sbuf)
 		goto out_free;
 
+	c->tlc = kcalloc(UBIFS_TLC_SLOTS, sizeof(struct ubifs_tlc_slot),
+			 GFP_KERNEL);
+	if (!c->tlc)
+		goto out_free;
+
 	if (!c->ro_mount) {
 		c->ileb_buf = vmalloc(c->leb_size);
 		if (!c->ileb_buf)
@@ -1264,6 +1288,13 @@ static int mount_ubifs(struct ubifs_info *c)
 	if (err)
 		goto out_cbuf;
 
+	c->lpt_cmt_wq = alloc_workqueue("ubifs_commit",
+				    WQ_MEM_RECLAIM | WQ_UNBOUND, 1);
+	if (!c->lpt_cmt_wq) {
+		err = -ENOMEM;
+		goto out_wbufs;
+	}
+
 	sprintf(c->bgt_name, BGT_NAME_PATTERN, c->vi.ubi_num, c->vi.vol_id);
 	if (!c->ro_mount) {
 		/* Create background thread */
@@ -1273,7 +1304,7 @@ static int mount_ubifs(struct ubifs_info *c)
 			c->bgt = NULL;
 			ubifs_err("cannot spawn \"%s\", error %d",
 				  c->bgt_name, err);
-			goto out_wbufs;
+			goto out_cmt_wq;
 		}
 		wake_up_process(c->bgt);
 	}
@@ -1505,6 +1536,8 @@ out_master:
 	kfree(c->rcvrd_mst_node);
 	if (c->bgt)
 		kthread_stop(c->bgt);
+out_cmt_wq:
+	destroy_workqueue(c->lpt_cmt_wq);
 out_wbufs:
 	free_wbufs(c);
 out_cbuf:
@@ -1514,6 +1547,7 @@ out_free:
 	kfree(c->bu.buf);
 	vfree(c->ileb_buf);
 	vfree(c->sbuf);
+	kfree(c->tlc);
 	kfree(c->bottom_up_buf);
 	ubifs_debugging_exit(c);
 	return err;
@@ -1540,6 +1574,7 @@ static void ubifs_umount(struct ubifs_info *c)
 
 	if (c->bgt)
 		kthread_stop(c->bgt);
+	destroy_workqueue(c->lpt_cmt_wq);
 
 	destroy_journal(c);
 	free_wbufs(c);
@@ -1553,6 +1588,7 @@ static void ubifs_umount(struct ubifs_info *c)
 	kfree(c->bu.buf);
 	vfree(c->ileb_buf);
 	vfree(c->sbuf);
+	kfree(c->tlc);
 	kfree(c->bottom_up_buf);
 	ubifs_debugging_exit(c);
 }
@@ -28,9 +28,16 @@
  * straightforward. We just have a mutex and lock it when we traverse the
  * tree. If a znode is not in memory, we read it from flash while still having
  * the mutex locked.
+ *
+ * Lookups of non-hashed keys first consult the TNC lookup cache, which is a
+ * small direct-mapped table of recently found leaf node positions. Readers
+ * access its slots under per-slot sequence counters instead of the mutex, and
+ * the positions they get there are then validated exactly like positions
+ * obtained after dropping the mutex (see 'ubifs_tnc_locate()').
  */
 
 #include <linux/crc32.h>
+#include <linux/jhash.h>
 #include <linux/slab.h>
 #include "ubifs.h"
 
@@ -395,6 +402,91 @@ static void lnc_free(struct ubifs_zbranch *zbr)
 	zbr->leaf = NULL;
 }
 
+/**
+ * tlc_slot - find the TNC lookup cache slot of a key.
+ * @c: UBIFS file-system description object
+ * @key: the key
+ */
+static struct ubifs_tlc_slot *tlc_slot(struct ubifs_info *c,
+				       const union ubifs_key *key)
+{
+	u32 hash = jhash_2words(key->u32[0], key->u32[1], 0);
+
+	return &c->tlc[hash & (UBIFS_TLC_SLOTS - 1)];
+}
+
+/**
+ * tlc_add - add a leaf node position to the TNC lookup cache.
+ * @c: UBIFS file-system description object
+ * @zbr: key and position of the node
+ *
+ * This function has to be called with @c->tnc_mutex locked.
+ */
+static void tlc_add(struct ubifs_info *c, const struct ubifs_zbranch *zbr)
+{
+	struct ubifs_tlc_slot *slot = tlc_slot(c, &zbr->key);
+
+	write_seqcount_begin(&slot->seq);
+	key_copy(c, &zbr->key, &slot->key);
+	slot->lnum = zbr->lnum;
+	slot->offs = zbr->offs;
+	slot->len = zbr->len;
+	write_seqcount_end(&slot->seq);
+}
+
+/**
+ * tlc_forget - drop a key from the TNC lookup cache.
+ * @c: UBIFS file-system description object
+ * @key: the key
+ *
+ * This function has to be called with @c->tnc_mutex locked every time the
+ * position of the leaf node of @key changes or the key is removed from TNC.
+ */
+static void tlc_forget(struct ubifs_info *c, const union ubifs_key *key)
+{
+	struct ubifs_tlc_slot *slot = tlc_slot(c, key);
+
+	if (!slot->lnum || !keys_eq(c, key, &slot->key))
+		return;
+
+	write_seqcount_begin(&slot->seq);
+	slot->lnum = 0;
+	write_seqcount_end(&slot->seq);
+}
+
+/**
+ * tlc_lookup - look up a leaf node position in the TNC lookup cache.
+ * @c: UBIFS file-system description object
+ * @key: key to look up
+ * @zbr: key and position of the node are returned here
+ *
+ * This function does not need @c->tnc_mutex. Returns %1 if @key was found and
+ * %0 if not.
+ */
+static int tlc_lookup(struct ubifs_info *c, const union ubifs_key *key,
+		      struct ubifs_zbranch *zbr)
+{
+	struct ubifs_tlc_slot *slot = tlc_slot(c, key);
+	unsigned int seq;
+	int found;
+
+	do {
+		seq = read_seqcount_begin(&slot->seq);
+		found = slot->lnum && keys_eq(c, key, &slot->key);
+		if (found) {
+			zbr->lnum = slot->lnum;
+			zbr->offs = slot->offs;
+			zbr->len = slot->len;
+		}
+	} while (read_seqcount_retry(&slot->seq, seq));
+
+	if (found) {
+		key_copy(c, key, &zbr->key);
+		zbr->leaf = NULL;
+	}
+	return found;
+}
+
 /**
  * tnc_read_node_nm - read a "hashed" leaf node.
  * @c: UBIFS file-system description object
@@ -1432,25 +1524,41 @@ static int maybe_leb_gced(struct ubifs_info *c, int lnum, int gc_seq1)
 }
 
 /**
- * ubifs_tnc_locate - look up a file-system node and return it and its location.
+ * tnc_locate - look up a file-system node and return it and its location.
  * @c: UBIFS file-system description object
  * @key: node key to lookup
  * @node: the node is returned here
  * @lnum: LEB number is returned here
  * @offs: offset is returned here
  *
- * This function looks up and reads node with key @key. The caller has to make
- * sure the @node buffer is large enough to fit the node. Returns zero in case
- * of success, %-ENOENT if the node was not found, and a negative error code in
- * case of failure. The node location can be returned in @lnum and @offs.
+ * This is a helper function for 'ubifs_tnc_locate()' which does the actual
+ * job and has the same return codes.
  */
-int ubifs_tnc_locate(struct ubifs_info *c, const union ubifs_key *key,
-		     void *node, int *lnum, int *offs)
+static int tnc_locate(struct ubifs_info *c, const union ubifs_key *key,
+		      void *node, int *lnum, int *offs)
 {
 	int found, n, err, safely = 0, gc_seq1;
 	struct ubifs_znode *znode;
 	struct ubifs_zbranch zbr, *zt;
 
+	if (!is_hash_key(c, key)) {
+		/*
+		 * The cached position is as good as one obtained under the TNC
+		 * mutex, because the slot is dropped before the node moves.
+		 * Sample the GC sequence number first, so that GC which
+		 * happens after we have looked at the slot is noticed.
+		 */
+		gc_seq1 = c->gc_seq;
+		smp_rmb();
+		if (tlc_lookup(c, key, &zbr)) {
+			if (lnum) {
+				*lnum = zbr.lnum;
+				*offs = zbr.offs;
+			}
+			goto read;
+		}
+	}
+
 again:
 	mutex_lock(&c->tnc_mutex);
 	found = ubifs_lookup_level0(c, key, &znode, &n);
@@ -1480,9 +1588,11 @@ again:
 	}
 	/* Drop the TNC mutex prematurely and race with garbage collection */
 	zbr = znode->zbranch[n];
+	tlc_add(c, &zbr);
 	gc_seq1 = c->gc_seq;
 	mutex_unlock(&c->tnc_mutex);
 
+read:
 	if (ubifs_get_wbuf(c, zbr.lnum)) {
 		/* We do not GC journal heads */
 		err = ubifs_tnc_read_node(c, &zbr, node);
@@ -1505,6 +1615,30 @@ out:
 	return err;
 }
 
+/**
+ * ubifs_tnc_locate - look up a file-system node and return it and its location.
+ * @c: UBIFS file-system description object
+ * @key: node key to lookup
+ * @node: the node is returned here
+ * @lnum: LEB number is returned here
+ * @offs: offset is returned here
+ *
+ * This function looks up and reads node with key @key. The caller has to make
+ * sure the @node buffer is large enough to fit the node. Returns zero in case
+ * of success, %-ENOENT if the node was not found, and a negative error code in
+ * case of failure. The node location can be returned in @lnum and @offs.
+ */
+int ubifs_tnc_locate(struct ubifs_info *c, const union ubifs_key *key,
+		     void *node, int *lnum, int *offs)
+{
+	ktime_t start = dbg_hist_start();
+	int err;
+
+	err = tnc_locate(c, key, node, lnum, offs);
+	dbg_lookup_hist(c, start);
+	return err;
+}
+
 /**
  * ubifs_tnc_get_bu_keys - lookup keys for bulk-read.
  * @c: UBIFS file-system description object
@@ -2173,6 +2307,7 @@ int ubifs_tnc_add(struct ubifs_info *c, const union ubifs_key *key, int lnum,
 
 	mutex_lock(&c->tnc_mutex);
 	dbg_tnc("%d:%d, len %d, key %s", lnum, offs, len, DBGKEY(key));
+	tlc_forget(c, key);
 	found = lookup_level0_dirty(c, key, &znode, &n);
 	if (!found) {
 		struct ubifs_zbranch zbr;
@@ -2223,6 +2358,7 @@ int ubifs_tnc_replace(struct ubifs_info *c, const union ubifs_key *key,
 	mutex_lock(&c->tnc_mutex);
 	dbg_tnc("old LEB %d:%d, new LEB %d:%d, len %d, key %s", old_lnum,
 		old_offs, lnum, offs, len, DBGKEY(key));
+	tlc_forget(c, key);
 	found = lookup_level0_dirty(c, key, &znode, &n);
 	if (found < 0) {
 		err = found;
@@ -2401,6 +2537,7 @@ static int tnc_delete(struct ubifs_info *c, struct ubifs_znode *znode, int n)
 	dbg_tnc("deleting %s", DBGKEY(&znode->zbranch[n].key));
 
 	zbr = &znode->zbranch[n];
+	tlc_forget(c, &zbr->key);
 	lnc_free(zbr);
 
 	err = ubifs_add_dirt(c, zbr->lnum, zbr->len);
@@ -2647,6 +2784,7 @@ int ubifs_tnc_remove_range(struct ubifs_info *c, union ubifs_key *from_key,
 			key = &znode->zbranch[i].key;
 			if (!key_in_range(c, key, from_key, to_key))
 				break;
+			tlc_forget(c, key);
 			lnc_free(&znode->zbranch[i]);
 			err = ubifs_add_dirt(c, znode->zbranch[i].lnum,
 					     znode->zbranch[i].len);
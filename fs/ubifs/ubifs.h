@@ -33,6 +33,7 @@
 #include <linux/spinlock.h>
 #include <linux/mutex.h>
 #include <linux/rwsem.h>
+#include <linux/seqlock.h>
 #include <linux/mtd/ubi.h>
 #include <linux/pagemap.h>
 #include <linux/backing-dev.h>
@@ -160,6 +161,13 @@
 /* Maximum expected tree height for use by bottom_up_buf */
 #define BOTTOM_UP_HEIGHT 64
 
+/*
+ * Adaptive compression: how many data nodes of an inode are written with
+ * probing compressors, and after how many data nodes the inode is probed again
+ */
+#define UBIFS_COMPR_PROBE_NODES 16
+#define UBIFS_COMPR_REPROBE_NODES 1024
+
 /* Maximum number of data nodes to bulk-read */
 #define UBIFS_MAX_BULK_READ 32
 
@@ -353,13 +361,19 @@ struct ubifs_gced_idx_leb {
  * @ui_mutex: serializes inode write-back with the rest of VFS operations,
  *            serializes "clean <-> dirty" state changes, serializes bulk-read,
  *            protects @dirty, @bulk_read, @ui_size, and @xattr_size
- * @ui_lock: protects @synced_i_size
+ * @ui_lock: protects @synced_i_size and the adaptive compression fields
  * @synced_i_size: synchronized size of inode, i.e. the value of inode size
  *                 currently stored on the flash; used only for regular file
  *                 inodes
  * @ui_size: inode size used by UBIFS when writing to flash
  * @flags: inode flags (@UBIFS_COMPR_FL, etc)
  * @compr_type: default compression type used for this inode
+ * @compr_auto: compression type picked by adaptive compression; not a bit
+ *              field because it is changed under @ui_lock, not @ui_mutex
+ * @compr_nodes: data nodes written since the last adaptive compression probe
+ *               started
+ * @compr_in: per-compressor uncompressed bytes seen during the probe
+ * @compr_out: per-compressor compressed bytes produced during the probe
  * @last_page_read: page number of last page read (for bulk read)
  * @read_in_a_row: number of consecutive pages read in a row (for bulk read)
  * @data_len: length of the data attached to the inode
@@ -405,6 +419,10 @@ struct ubifs_inode {
 	unsigned int xattr:1;
 	unsigned int bulk_read:1;
 	unsigned int compr_type:2;
+	int compr_auto;
+	unsigned int compr_nodes;
+	unsigned int compr_in[UBIFS_COMPR_TYPES_CNT];
+	unsigned int compr_out[UBIFS_COMPR_TYPES_CNT];
 	struct mutex ui_mutex;
 	spinlock_t ui_lock;
 	loff_t synced_i_size;
@@ -751,6 +769,29 @@ struct ubifs_zbranch {
 	int len;
 };
 
+/* Number of slots in the TNC lookup cache (must be a power of 2) */
+#define UBIFS_TLC_SLOTS 256
+
+/**
+ * struct ubifs_tlc_slot - TNC lookup cache slot.
+ * @seq: lets lookups read the slot without taking the TNC mutex
+ * @key: key of the cached leaf node
+ * @lnum: LEB number of the leaf node (%0 if the slot is empty)
+ * @offs: leaf node offset within @lnum
+ * @len: leaf node length
+ *
+ * The TNC lookup cache remembers where recently looked up non-hashed leaf
+ * nodes (inodes and data) live, so that 'ubifs_tnc_locate()' does not have to
+ * take the TNC mutex for them. Slots are only changed under the TNC mutex.
+ */
+struct ubifs_tlc_slot {
+	seqcount_t seq;
+	union ubifs_key key;
+	int lnum;
+	int offs;
+	int len;
+};
+
 /**
  * struct ubifs_znode - in-memory representation of an indexing node.
  * @parent: parent znode or NULL if it is the root
@@ -827,6 +868,10 @@ struct ubifs_node_range {
  * @decomp_mutex: mutex used during decompression
  * @name: compressor name
  * @capi_name: cryptoapi compressor name
+ * @nodes: how many times this compressor was asked to compress data
+ * @bytes_in: uncompressed bytes given to this compressor
+ * @bytes_out: bytes this compressor handed back (compressed or not)
+ * @nsecs: time spent compressing in nanoseconds
  */
 struct ubifs_compressor {
 	int compr_type;
@@ -835,6 +880,10 @@ struct ubifs_compressor {
 	struct mutex *decomp_mutex;
 	const char *name;
 	const char *capi_name;
+	atomic64_t nodes;
+	atomic64_t bytes_in;
+	atomic64_t bytes_out;
+	atomic64_t nsecs;
 };
 
 /**
@@ -923,6 +972,8 @@ struct ubifs_orphan {
  * struct ubifs_mount_opts - UBIFS-specific mount options information.
  * @unmount_mode: selected unmount mode (%0 default, %1 normal, %2 fast)
  * @bulk_read: enable/disable bulk-reads (%0 default, %1 disabe, %2 enable)
+ * @adaptive_compr: enable/disable adaptive compression (%0 default, %1 disable,
+ *                  %2 enable)
  * @chk_data_crc: enable/disable CRC data checking when reading data nodes
  *                (%0 default, %1 disabe, %2 enable)
  * @override_compr: override default compressor (%0 - do not override and use
@@ -934,6 +985,7 @@ struct ubifs_orphan {
 struct ubifs_mount_opts {
 	unsigned int unmount_mode:2;
 	unsigned int bulk_read:2;
+	unsigned int adaptive_compr:2;
 	unsigned int chk_data_crc:2;
 	unsigned int override_compr:1;
 	unsigned int compr_type:2;
@@ -1020,11 +1072,13 @@ struct ubifs_debug_info;
  * @no_chk_data_crc: do not check CRCs when reading data nodes (except during
  *                   recovery)
  * @bulk_read: enable bulk-reads
+ * @adaptive_compr: pick data node compressors per inode by observed ratio
  * @default_compr: default compression algorithm (%UBIFS_COMPR_LZO, etc)
  * @rw_incompat: the media is not R/W compatible
  *
  * @tnc_mutex: protects the Tree Node Cache (TNC), @zroot, @cnext, @enext, and
  *             @calc_idx_sz
+ * @tlc: TNC lookup cache slots (changed under @tnc_mutex, read lock-less)
  * @zroot: zbranch which points to the root index node and znode
  * @cnext: next znode to commit
  * @enext: next znode to commit to empty space
@@ -1137,6 +1191,7 @@ struct ubifs_debug_info;
  * @bgt: UBIFS background thread
  * @bgt_name: background thread name
  * @need_bgt: if background thread should run
+ * @lpt_cmt_wq: workqueue writing the LPT during commit end
  * @need_wbuf_sync: if write-buffers have to be synchronized
  *
  * @gc_lnum: LEB number used for garbage collection
@@ -1259,10 +1314,12 @@ struct ubifs_info {
 	unsigned int space_fixup:1;
 	unsigned int no_chk_data_crc:1;
 	unsigned int bulk_read:1;
+	unsigned int adaptive_compr:1;
 	unsigned int default_compr:2;
 	unsigned int rw_incompat:1;
 
 	struct mutex tnc_mutex;
+	struct ubifs_tlc_slot *tlc;
 	struct ubifs_zbranch zroot;
 	struct ubifs_znode *cnext;
 	struct ubifs_znode *enext;
@@ -1367,6 +1424,7 @@ struct ubifs_info {
 	struct task_struct *bgt;
 	char bgt_name[sizeof(BGT_NAME_PATTERN) + 9];
 	int need_bgt;
+	struct workqueue_struct *lpt_cmt_wq;
 	int need_wbuf_sync;
 
 	int gc_lnum;
@@ -1778,6 +1836,9 @@ void ubifs_compress(const void *in_buf, int in_len, void *out_buf, int *out_len,
 		    int *compr_type);
 int ubifs_decompress(const void *buf, int len, void *out, int *out_len,
 		     int compr_type);
+int ubifs_compr_select(struct ubifs_inode *ui);
+void ubifs_compr_update(struct ubifs_inode *ui, int compr_type, int in_len,
+			int out_len);
 
 #include "debug.h"
 #include "misc.h"
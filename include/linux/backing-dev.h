@@ -42,6 +42,8 @@ enum bdi_stat_item {
 	BDI_WRITEBACK,
 	BDI_DIRTIED,
 	BDI_WRITTEN,
+	BDI_DIRTY_PAUSES,	/* balance_dirty_pages() sleeps */
+	BDI_DIRTY_PAUSED,	/* jiffies spent in them */
 	NR_BDI_STAT_ITEMS
 };
 
@@ -94,6 +96,7 @@ struct backing_dev_info {
 
 	unsigned int min_ratio;
 	unsigned int max_ratio, max_prop_frac;
+	unsigned int max_dirty_time;	/* in ms of write bandwidth, 0: none */
 
 	struct bdi_writeback wb;  /* default writeback info for this bdi */
 	spinlock_t wb_lock;	  /* protects work_list */
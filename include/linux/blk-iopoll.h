@@ -1,6 +1,8 @@
 #ifndef BLK_IOPOLL_H
 #define BLK_IOPOLL_H
 
+#include <linux/types.h>
+
 struct blk_iopoll;
 typedef int (blk_iopoll_fn)(struct blk_iopoll *, int);
 
@@ -45,4 +47,34 @@ extern void blk_iopoll_disable(struct blk_iopoll *);
 
 extern int blk_iopoll_enabled;
 
+/*
+ * Polled completion of synchronous direct I/O, selected per queue in
+ * /sys/block/<dev>/queue/dio_poll
+ */
+enum {
+	BLK_POLL_OFF		= 0,	/* sleep until the completion wakes us */
+	BLK_POLL_SPIN		= 1,	/* spin right after submission */
+	BLK_POLL_HYBRID		= 2,	/* sleep half the mean service time, spin */
+};
+
+/* how the submitter waited for the I/O */
+enum {
+	BLK_POLL_SLEPT		= 0,	/* polling off */
+	BLK_POLL_HIT		= 1,	/* completed while polling */
+	BLK_POLL_MISS		= 2,	/* polled, then slept anyway */
+	BLK_POLL_NR,
+};
+
+#define BLK_POLL_SLOTS		32	/* log2 of the wait time in ns */
+
+struct blk_poll_stat {
+	unsigned long lat[BLK_POLL_NR][BLK_POLL_SLOTS];
+	u64 spin_ns;
+};
+
+struct request_queue;
+
+extern bool blk_poll_wait(struct request_queue *, u64, bool (*)(void *), void *);
+extern void blk_poll_account(struct request_queue *, u64, u64, int);
+
 #endif
@@ -31,6 +31,10 @@ struct blk_trace;
 struct request;
 struct sg_io_hdr;
 struct bsg_job;
+struct blk_mq_ops;
+struct blk_mq_ctx;
+struct blk_mq_hw_ctx;
+struct blk_poll_stat;
 
 #define BLKDEV_MIN_RQ	4
 #define BLKDEV_MAX_RQ	128	/* Default maximum */
@@ -82,6 +86,7 @@ struct request {
 	struct call_single_data csd;
 
 	struct request_queue *q;
+	struct blk_mq_ctx *mq_ctx;	/* software queue, multi-queue only */
 
 	unsigned int cmd_flags;
 	enum rq_cmd_type_bits cmd_type;
@@ -286,6 +291,22 @@ struct request_queue {
 	dma_drain_needed_fn	*dma_drain_needed;
 	lld_busy_fn		*lld_busy_fn;
 
+	/*
+	 * Multi-queue request path, see block/blk-mq.c
+	 */
+	struct blk_mq_ops	*mq_ops;
+	unsigned int		*mq_map;	/* cpu -> hardware queue */
+	struct blk_mq_ctx __percpu *queue_ctx;	/* per-cpu software queues */
+	struct blk_mq_hw_ctx	**queue_hw_ctx;
+	unsigned int		nr_hw_queues;
+
+	/*
+	 * Polled completion of synchronous direct I/O, see blk-iopoll.c
+	 */
+	unsigned int		dio_poll;	/* BLK_POLL_OFF/SPIN/HYBRID */
+	unsigned long		dio_poll_mean;	/* service time estimate, ns */
+	struct blk_poll_stat __percpu *dio_poll_stat;
+
 	/*
 	 * Dispatch queue sorting
 	 */
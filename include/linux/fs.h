@@ -939,6 +939,32 @@ struct fown_struct {
 	int signum;		/* posix.1b rt signal to be delivered on IO */
 };
 
+/*
+ * Readahead statistics of a single file, shown in /proc/<pid>/fdinfo/<fd>.
+ * Updated without locking, like the rest of struct file_ra_state.
+ */
+struct file_ra_stats {
+	unsigned long sync;		/* cache misses, reader waited for I/O */
+	unsigned long async;		/* readahead marker hits */
+	unsigned long pages;		/* pages submitted by readahead */
+	unsigned long wasted;		/* abandoned pages, never reached */
+	unsigned long strided;		/* strided windows */
+	unsigned long reverse;		/* reverse windows */
+
+	/* snapshot taken at the last window size adjustment */
+	unsigned int tune_count;
+	unsigned long tune_sync;
+	unsigned long tune_async;
+	unsigned long tune_pages;
+	unsigned long tune_wasted;
+};
+
+/* Access patterns recognised by the readahead logic */
+#define RA_PATTERN_NONE		0	/* random or not yet known */
+#define RA_PATTERN_SEQ		1	/* ascending, contiguous */
+#define RA_PATTERN_STRIDE	2	/* fixed size records, fixed distance */
+#define RA_PATTERN_REVERSE	3	/* descending, contiguous */
+
 /*
  * Track a single file's readahead state
  */
@@ -951,6 +977,11 @@ struct file_ra_state {
 	unsigned int ra_pages;		/* Maximum readahead window */
 	unsigned int mmap_miss;		/* Cache miss stat for mmap accesses */
 	loff_t prev_pos;		/* Cache last read() position */
+
+	pgoff_t prev_miss;		/* where the last cache miss happened */
+	long stride;			/* distance between the last two misses */
+	unsigned int pattern;		/* RA_PATTERN_* of the current window */
+	struct file_ra_stats stats;
 };
 
 /*
@@ -38,6 +38,10 @@ enum stat_item {
 	CMPXCHG_DOUBLE_FAIL,	/* Number of times that cmpxchg double did not match */
 	CPU_PARTIAL_ALLOC,	/* Used cpu partial on alloc */
 	CPU_PARTIAL_FREE,	/* USed cpu partial on free */
+	CPU_PARTIAL_REFILL,	/* Slab moved from node to cpu partial */
+	CPU_PARTIAL_DRAIN,	/* Slab moved from cpu to node partial */
+	LIST_LOCK,		/* list_lock taken by alloc/free paths */
+	LIST_LOCK_CONTENDED,	/* list_lock was held by someone else */
 	NR_SLUB_STAT_ITEMS };
 
 struct kmem_cache_cpu {
@@ -47,7 +51,8 @@ struct kmem_cache_cpu {
 	struct page *partial;	/* Partially allocated frozen slabs */
 	int node;		/* The node of the page (or -1 for debug) */
 #ifdef CONFIG_SLUB_STATS
-	unsigned stat[NR_SLUB_STAT_ITEMS];
+	unsigned long stat[NR_SLUB_STAT_ITEMS];
+	u64 list_lock_nsec;	/* Time list_lock was held in ns */
 #endif
 };
 
@@ -60,6 +65,9 @@ struct kmem_cache_node {
 	atomic_long_t total_objects;
 	struct list_head full;
 #endif
+#ifdef CONFIG_SLUB_STATS
+	u64 lock_time;		/* When list_lock was taken */
+#endif
 };
 
 /*
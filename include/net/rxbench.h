@@ -0,0 +1,45 @@
+#ifndef _NET_RXBENCH_H
+#define _NET_RXBENCH_H
+
+/*
+ * Receive path stage timestamps for the rx benchmark (net/core/rxbench.c).
+ *
+ * The benchmark points this cpu's rxbench_sample at a buffer around each
+ * synthetic packet it injects, with bottom halves disabled, so only its
+ * own packets are stamped.  When the benchmark is not configured the
+ * stamps compile away.
+ */
+
+#include <linux/percpu.h>
+#include <linux/sched.h>
+
+enum rxbench_stage {
+	RXBENCH_NETIF_RECEIVE,		/* __netif_receive_skb() entry */
+	RXBENCH_IP_RCV,			/* ip_rcv() entry */
+	RXBENCH_IP_DELIVER,		/* IP hands off to the L4 handler */
+	RXBENCH_TCP_LOOKUP,		/* tcp_v4_rcv() socket lookup ... */
+	RXBENCH_TCP_LOOKUP_DONE,	/* ... and its completion */
+	RXBENCH_NR_STAGES,
+};
+
+struct rxbench_sample {
+	u64 stamp[RXBENCH_NR_STAGES];
+};
+
+#if IS_ENABLED(CONFIG_NET_RXBENCH)
+DECLARE_PER_CPU(struct rxbench_sample *, rxbench_sample);
+
+static inline void rxbench_stamp(enum rxbench_stage stage)
+{
+	struct rxbench_sample *sample = __this_cpu_read(rxbench_sample);
+
+	if (unlikely(sample))
+		sample->stamp[stage] = local_clock();
+}
+#else
+static inline void rxbench_stamp(enum rxbench_stage stage)
+{
+}
+#endif
+
+#endif /* _NET_RXBENCH_H */
@@ -365,6 +365,52 @@ TRACE_EVENT(balance_dirty_pages,
 	  )
 );
 
+TRACE_EVENT(bdi_dirty_pause,
+
+	TP_PROTO(struct backing_dev_info *bdi,
+		 unsigned long bdi_thresh,
+		 unsigned long bdi_dirty,
+		 long pause,
+		 unsigned long paused),
+
+	TP_ARGS(bdi, bdi_thresh, bdi_dirty, pause, paused),
+
+	TP_STRUCT__entry(
+		__array(	 char,	bdi, 32)
+		__field(unsigned long,	write_bw)
+		__field(unsigned long,	bdi_thresh)
+		__field(unsigned long,	bdi_dirty)
+		__field(unsigned long,	dirty_ms)
+		__field(unsigned int,	max_dirty_ms)
+		__field(	 long,	pause)
+		__field(unsigned long,	paused)
+	),
+
+	TP_fast_assign(
+		strlcpy(__entry->bdi, dev_name(bdi->dev), 32);
+		__entry->write_bw	= KBps(bdi->avg_write_bandwidth);
+		__entry->bdi_thresh	= bdi_thresh;
+		__entry->bdi_dirty	= bdi_dirty;
+		__entry->dirty_ms	= bdi_dirty * 1000 /
+					  (bdi->avg_write_bandwidth + 1);
+		__entry->max_dirty_ms	= bdi->max_dirty_time;
+		__entry->pause		= pause * 1000 / HZ;
+		__entry->paused		= paused * 1000 / HZ;
+	),
+
+	TP_printk("bdi %s: write_bw=%lu bdi_thresh=%lu bdi_dirty=%lu "
+		  "dirty_ms=%lu max_dirty_ms=%u pause=%ld paused=%lu",
+		  __entry->bdi,
+		  __entry->write_bw,	/* KB/s */
+		  __entry->bdi_thresh,
+		  __entry->bdi_dirty,
+		  __entry->dirty_ms,	/* ms of write_bw */
+		  __entry->max_dirty_ms,
+		  __entry->pause,	/* ms */
+		  __entry->paused	/* ms */
+	  )
+);
+
 DECLARE_EVENT_CLASS(writeback_congest_waited_template,
 
 	TP_PROTO(unsigned int usec_timeout, unsigned int usec_delayed),
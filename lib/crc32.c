@@ -27,14 +27,18 @@
 #include <linux/types.h>
 #include <linux/init.h>
 #include <linux/atomic.h>
+#include <linux/cache.h>
+#include <linux/hrtimer.h>
+#include <linux/irqflags.h>
+#include <linux/math64.h>
 #include "crc32defs.h"
-#if CRC_LE_BITS == 8
+#if CRC_LE_BITS >= 8
 # define tole(x) __constant_cpu_to_le32(x)
 #else
 # define tole(x) (x)
 #endif
 
-#if CRC_BE_BITS == 8
+#if CRC_BE_BITS >= 8
 # define tobe(x) __constant_cpu_to_be32(x)
 #else
 # define tobe(x) (x)
@@ -45,26 +49,35 @@ MODULE_AUTHOR("Matt Domsch <Matt_Domsch@dell.com>");
 MODULE_DESCRIPTION("Ethernet CRC32 calculations");
 MODULE_LICENSE("GPL");
 
-#if CRC_LE_BITS == 8 || CRC_BE_BITS == 8
+#if CRC_LE_BITS >= 8 || CRC_BE_BITS >= 8
 
-static inline u32
-crc32_body(u32 crc, unsigned char const *buf, size_t len, const u32 (*tab)[256])
+/*
+ * Fold @len bytes into @crc, @slice bytes per table step.  With @slice == 4
+ * this is the classic four-table loop; with @slice == 8 two words are
+ * folded per iteration through eight tables, which halves the loop-carried
+ * dependency on @crc.  @slice is always a compile-time constant so each
+ * caller gets its own specialised copy of the loop.
+ */
+static __always_inline u32
+crc32_body(u32 crc, unsigned char const *buf, size_t len,
+	   const u32 (*tab)[256], const int slice)
 {
 # ifdef __LITTLE_ENDIAN
 #  define DO_CRC(x) crc = tab[0][(crc ^ (x)) & 255] ^ (crc >> 8)
-#  define DO_CRC4 crc = tab[3][(crc) & 255] ^ \
-		tab[2][(crc >> 8) & 255] ^ \
-		tab[1][(crc >> 16) & 255] ^ \
-		tab[0][(crc >> 24) & 255]
+#  define DO_CRC4 (tab[3][(q) & 255] ^ tab[2][(q >> 8) & 255] ^ \
+		   tab[1][(q >> 16) & 255] ^ tab[0][(q >> 24) & 255])
+#  define DO_CRC8 (tab[7][(q) & 255] ^ tab[6][(q >> 8) & 255] ^ \
+		   tab[5][(q >> 16) & 255] ^ tab[4][(q >> 24) & 255])
 # else
 #  define DO_CRC(x) crc = tab[0][((crc >> 24) ^ (x)) & 255] ^ (crc << 8)
-#  define DO_CRC4 crc = tab[0][(crc) & 255] ^ \
-		tab[1][(crc >> 8) & 255] ^ \
-		tab[2][(crc >> 16) & 255] ^ \
-		tab[3][(crc >> 24) & 255]
+#  define DO_CRC4 (tab[0][(q) & 255] ^ tab[1][(q >> 8) & 255] ^ \
+		   tab[2][(q >> 16) & 255] ^ tab[3][(q >> 24) & 255])
+#  define DO_CRC8 (tab[4][(q) & 255] ^ tab[5][(q >> 8) & 255] ^ \
+		   tab[6][(q >> 16) & 255] ^ tab[7][(q >> 24) & 255])
 # endif
 	const u32 *b;
 	size_t    rem_len;
+	u32       q;
 
 	/* Align it */
 	if (unlikely((long)buf & 3 && len)) {
@@ -72,13 +85,24 @@ crc32_body(u32 crc, unsigned char const *buf, size_t len, const u32 (*tab)[256])
 			DO_CRC(*buf++);
 		} while ((--len) && ((long)buf)&3);
 	}
-	rem_len = len & 3;
+	if (slice == 8) {
+		rem_len = len & 7;
+		len = len >> 3;
+	} else {
+		rem_len = len & 3;
+		len = len >> 2;
+	}
 	/* load data 32 bits wide, xor data 32 bits wide. */
-	len = len >> 2;
 	b = (const u32 *)buf;
 	for (--b; len; --len) {
-		crc ^= *++b; /* use pre increment for speed */
-		DO_CRC4;
+		q = crc ^ *++b; /* use pre increment for speed */
+		if (slice == 8) {
+			crc = DO_CRC8;
+			q = *++b;
+			crc ^= DO_CRC4;
+		} else {
+			crc = DO_CRC4;
+		}
 	}
 	len = rem_len;
 	/* And the last few bytes */
@@ -91,8 +115,19 @@ crc32_body(u32 crc, unsigned char const *buf, size_t len, const u32 (*tab)[256])
 	return crc;
 #undef DO_CRC
 #undef DO_CRC4
+#undef DO_CRC8
 }
 #endif
+
+#if CRC_LE_BITS == 64 || CRC_BE_BITS == 64
+/*
+ * Slice width used by crc32_le()/crc32_be().  Both variants give identical
+ * results, so this may be changed at any time; crc32_init() benchmarks
+ * them and keeps whichever is faster on this CPU.
+ */
+static int crc32_slice __read_mostly = 8;
+#endif
+
 /**
  * crc32_le() - Calculate bitwise little-endian Ethernet AUTODIN II CRC32
  * @crc: seed value for computation.  ~0 for Ethernet, sometimes 0 for
@@ -120,13 +155,14 @@ u32 __pure crc32_le(u32 crc, unsigned char const *p, size_t len)
 }
 #else				/* Table-based approach */
 
-u32 __pure crc32_le(u32 crc, unsigned char const *p, size_t len)
+static __always_inline u32
+__crc32_le(u32 crc, unsigned char const *p, size_t len, const int slice)
 {
-# if CRC_LE_BITS == 8
-	const u32      (*tab)[] = crc32table_le;
+# if CRC_LE_BITS >= 8
+	const u32      (*tab)[256] = crc32table_le;
 
 	crc = __cpu_to_le32(crc);
-	crc = crc32_body(crc, p, len, tab);
+	crc = crc32_body(crc, p, len, tab, slice);
 	return __le32_to_cpu(crc);
 # elif CRC_LE_BITS == 4
 	while (len--) {
@@ -146,6 +182,15 @@ u32 __pure crc32_le(u32 crc, unsigned char const *p, size_t len)
 	return crc;
 # endif
 }
+
+u32 __pure crc32_le(u32 crc, unsigned char const *p, size_t len)
+{
+# if CRC_LE_BITS == 64
+	if (crc32_slice == 8)
+		return __crc32_le(crc, p, len, 8);
+# endif
+	return __crc32_le(crc, p, len, 4);
+}
 #endif
 
 /**
@@ -177,13 +222,14 @@ u32 __pure crc32_be(u32 crc, unsigned char const *p, size_t len)
 }
 
 #else				/* Table-based approach */
-u32 __pure crc32_be(u32 crc, unsigned char const *p, size_t len)
+static __always_inline u32
+__crc32_be(u32 crc, unsigned char const *p, size_t len, const int slice)
 {
-# if CRC_BE_BITS == 8
-	const u32      (*tab)[] = crc32table_be;
+# if CRC_BE_BITS >= 8
+	const u32      (*tab)[256] = crc32table_be;
 
 	crc = __cpu_to_be32(crc);
-	crc = crc32_body(crc, p, len, tab);
+	crc = crc32_body(crc, p, len, tab, slice);
 	return __be32_to_cpu(crc);
 # elif CRC_BE_BITS == 4
 	while (len--) {
@@ -203,11 +249,201 @@ u32 __pure crc32_be(u32 crc, unsigned char const *p, size_t len)
 	return crc;
 # endif
 }
+
+u32 __pure crc32_be(u32 crc, unsigned char const *p, size_t len)
+{
+# if CRC_BE_BITS == 64
+	if (crc32_slice == 8)
+		return __crc32_be(crc, p, len, 8);
+# endif
+	return __crc32_be(crc, p, len, 4);
+}
 #endif
 
 EXPORT_SYMBOL(crc32_le);
 EXPORT_SYMBOL(crc32_be);
 
+#if CRC_LE_BITS == 64 || defined(CONFIG_CRC32_SELFTEST)
+
+#define CRC32_BENCH_LEN		4096
+#define CRC32_BENCH_LOOPS	16
+
+static u8 crc32_test_buf[CRC32_BENCH_LEN] __initdata;
+static u32 crc32_bench_sink __initdata;
+
+static void __init crc32_fill_test_buf(void)
+{
+	u32 seed = 0x2545f491;
+	int i;
+
+	for (i = 0; i < CRC32_BENCH_LEN; i++) {
+		seed = seed * 1103515245 + 12345;
+		crc32_test_buf[i] = seed >> 16;
+	}
+}
+
+/*
+ * Time CRC32_BENCH_LOOPS passes of crc32_le over the test buffer with the
+ * given slice width (0 means "whatever crc32_le() is currently using") and
+ * return the best of three runs in nanoseconds.
+ */
+static s64 __init crc32_bench(int slice)
+{
+	unsigned long flags;
+	ktime_t start;
+	s64 nsec, best = LLONG_MAX;
+	u32 crc = 0;
+	int run, i;
+
+	for (run = 0; run < 3; run++) {
+		local_irq_save(flags);
+		start = ktime_get();
+		for (i = 0; i < CRC32_BENCH_LOOPS; i++) {
+#if CRC_LE_BITS == 64
+			if (slice == 8)
+				crc = __crc32_le(crc, crc32_test_buf,
+						 CRC32_BENCH_LEN, 8);
+			else if (slice == 4)
+				crc = __crc32_le(crc, crc32_test_buf,
+						 CRC32_BENCH_LEN, 4);
+			else
+#endif
+				crc = crc32_le(crc, crc32_test_buf,
+					       CRC32_BENCH_LEN);
+		}
+		nsec = ktime_to_ns(ktime_sub(ktime_get(), start));
+		local_irq_restore(flags);
+		if (nsec < best)
+			best = nsec;
+	}
+	crc32_bench_sink = crc;
+	return best;
+}
+#endif
+
+#if CRC_LE_BITS == 64
+static void __init crc32_select_slice(void)
+{
+	s64 t4, t8;
+
+	t4 = crc32_bench(4);
+	t8 = crc32_bench(8);
+	crc32_slice = t4 < t8 ? 4 : 8;
+	pr_debug("crc32: slice-by-4 %lld ns, slice-by-8 %lld ns, using %d\n",
+		 t4, t8, crc32_slice);
+}
+#endif
+
+#ifdef CONFIG_CRC32_SELFTEST
+static void __init crc32_report(const char *name, s64 nsec)
+{
+	u64 bytes = (u64)CRC32_BENCH_LEN * CRC32_BENCH_LOOPS * 1000;
+
+	if (nsec <= 0)
+		nsec = 1;
+	pr_info("crc32: %s: %llu MB/s\n", name, div_u64(bytes, nsec));
+}
+
+static u32 __init crc32_le_bitwise(u32 crc, unsigned char const *p, size_t len)
+{
+	int i;
+
+	while (len--) {
+		crc ^= *p++;
+		for (i = 0; i < 8; i++)
+			crc = (crc >> 1) ^ ((crc & 1) ? CRCPOLY_LE : 0);
+	}
+	return crc;
+}
+
+static u32 __init crc32_be_bitwise(u32 crc, unsigned char const *p, size_t len)
+{
+	int i;
+
+	while (len--) {
+		crc ^= *p++ << 24;
+		for (i = 0; i < 8; i++)
+			crc = (crc << 1) ^
+			      ((crc & 0x80000000) ? CRCPOLY_BE : 0);
+	}
+	return crc;
+}
+
+/*
+ * Check every variant compiled in against the bit-at-a-time definition
+ * over a spread of seeds, alignments and lengths, then report throughput.
+ */
+static int __init crc32_selftest(void)
+{
+	static const u32 seeds[] __initconst = { 0, ~0, 0x12345678 };
+	int errors = 0, tests = 0;
+	size_t off, len;
+	int s;
+
+	for (s = 0; s < ARRAY_SIZE(seeds); s++) {
+		for (off = 0; off < 8; off++) {
+			for (len = 0; len + off <= 512; len += 1 + len / 8) {
+				const u8 *p = crc32_test_buf + off;
+				u32 le = crc32_le_bitwise(seeds[s], p, len);
+				u32 be = crc32_be_bitwise(seeds[s], p, len);
+
+				tests++;
+				if (crc32_le(seeds[s], p, len) != le ||
+				    crc32_be(seeds[s], p, len) != be)
+					errors++;
+#if CRC_LE_BITS == 64
+				if (__crc32_le(seeds[s], p, len, 4) != le ||
+				    __crc32_le(seeds[s], p, len, 8) != le)
+					errors++;
+#endif
+#if CRC_BE_BITS == 64
+				if (__crc32_be(seeds[s], p, len, 4) != be ||
+				    __crc32_be(seeds[s], p, len, 8) != be)
+					errors++;
+#endif
+			}
+		}
+	}
+
+	if (errors) {
+		pr_warn("crc32: self tests failed: %d of %d\n", errors, tests);
+		return -EINVAL;
+	}
+	pr_info("crc32: self tests passed (%d cases)\n", tests);
+
+#if CRC_LE_BITS == 64
+	crc32_report("slice-by-4", crc32_bench(4));
+	crc32_report("slice-by-8", crc32_bench(8));
+	pr_info("crc32: using slice-by-%d\n", crc32_slice);
+#else
+	crc32_report("crc32_le", crc32_bench(0));
+#endif
+	return 0;
+}
+#endif
+
+static int __init crc32_init(void)
+{
+#if CRC_LE_BITS == 64 || defined(CONFIG_CRC32_SELFTEST)
+	crc32_fill_test_buf();
+#endif
+#if CRC_LE_BITS == 64
+	crc32_select_slice();
+#endif
+#ifdef CONFIG_CRC32_SELFTEST
+	return crc32_selftest();
+#else
+	return 0;
+#endif
+}
+
+static void __exit crc32_exit(void)
+{
+}
+
+module_init(crc32_init);
+module_exit(crc32_exit);
+
 /*
  * A brief CRC tutorial.
  *
@@ -225,12 +225,39 @@ static ssize_t max_ratio_store(struct device *dev,
 }
 BDI_SHOW(max_ratio, bdi->max_ratio)
 
+static ssize_t max_dirty_ms_store(struct device *dev,
+		struct device_attribute *attr, const char *buf, size_t count)
+{
+	struct backing_dev_info *bdi = dev_get_drvdata(dev);
+	char *end;
+	unsigned long ms;
+	ssize_t ret = -EINVAL;
+
+	ms = simple_strtoul(buf, &end, 10);
+	if (*buf && (end[0] == '\0' || (end[0] == '\n' && end[1] == '\0')) &&
+	    ms <= UINT_MAX) {
+		bdi->max_dirty_time = ms;
+		ret = count;
+	}
+	return ret;
+}
+BDI_SHOW(max_dirty_ms, bdi->max_dirty_time)
+
+BDI_SHOW(write_bandwidth, K(bdi->avg_write_bandwidth))
+BDI_SHOW(dirty_pauses, bdi_stat_sum(bdi, BDI_DIRTY_PAUSES))
+BDI_SHOW(dirty_paused_ms,
+	 div_u64(bdi_stat_sum(bdi, BDI_DIRTY_PAUSED) * MSEC_PER_SEC, HZ))
+
 #define __ATTR_RW(attr) __ATTR(attr, 0644, attr##_show, attr##_store)
 
 static struct device_attribute bdi_dev_attrs[] = {
 	__ATTR_RW(read_ahead_kb),
 	__ATTR_RW(min_ratio),
 	__ATTR_RW(max_ratio),
+	__ATTR_RW(max_dirty_ms),
+	__ATTR(write_bandwidth, 0444, write_bandwidth_show, NULL),
+	__ATTR(dirty_pauses, 0444, dirty_pauses_show, NULL),
+	__ATTR(dirty_paused_ms, 0444, dirty_paused_ms_show, NULL),
 	__ATTR_NULL,
 };
 
@@ -682,6 +709,7 @@ int bdi_init(struct backing_dev_info *bdi)
 	bdi->min_ratio = 0;
 	bdi->max_ratio = 100;
 	bdi->max_prop_frac = PROP_FRAC_BASE;
+	bdi->max_dirty_time = 0;
 	spin_lock_init(&bdi->wb_lock);
 	INIT_LIST_HEAD(&bdi->bdi_list);
 	INIT_LIST_HEAD(&bdi->work_list);
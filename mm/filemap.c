@@ -1077,6 +1077,58 @@ static void shrink_readahead_size_eio(struct file *filp,
 	ra->ra_pages /= 4;
 }
 
+/*
+ * Pages for the rest of a large read, looked up by do_generic_file_read()
+ * with a single radix tree gang lookup rather than one find_get_page()
+ * per page. Each page holds a reference until it is consumed or released.
+ */
+struct read_batch {
+	pgoff_t index;			/* page index of pages[next] */
+	unsigned int next;
+	unsigned int nr;
+	struct page *pages[PAGEVEC_SIZE];
+};
+
+static void read_batch_release(struct read_batch *rb)
+{
+	while (rb->next < rb->nr)
+		page_cache_release(rb->pages[rb->next++]);
+}
+
+/*
+ * Return the page at @index with a reference held, or NULL if it is not
+ * in the page cache. If the batch does not hold @index, refill it with up
+ * to @nr_pages contiguous pages starting there.
+ */
+static struct page *read_batch_get(struct address_space *mapping,
+				   struct read_batch *rb, pgoff_t index,
+				   unsigned long nr_pages)
+{
+	if (rb->next < rb->nr) {
+		if (rb->index == index) {
+			rb->index++;
+			return rb->pages[rb->next++];
+		}
+		read_batch_release(rb);
+	}
+
+	if (nr_pages <= 1)
+		return find_get_page(mapping, index);
+
+	rb->nr = find_get_pages_contig(mapping, index,
+				       min_t(unsigned long, nr_pages,
+					     PAGEVEC_SIZE),
+				       rb->pages);
+	count_vm_event(PGREAD_BATCH);
+	count_vm_events(PGREAD_BATCH_PAGES, rb->nr);
+	if (!rb->nr)
+		return NULL;
+
+	rb->next = 1;
+	rb->index = index + 1;
+	return rb->pages[0];
+}
+
 /**
  * do_generic_file_read - generic file read routine
  * @filp:	the file to read
@@ -1101,8 +1153,10 @@ static void do_generic_file_read(struct file *filp, loff_t *ppos,
 	pgoff_t prev_index;
 	unsigned long offset;      /* offset into pagecache page */
 	unsigned int prev_offset;
+	struct read_batch rb;
 	int error;
 
+	rb.next = rb.nr = 0;
 	index = *ppos >> PAGE_CACHE_SHIFT;
 	prev_index = ra->prev_pos >> PAGE_CACHE_SHIFT;
 	prev_offset = ra->prev_pos & (PAGE_CACHE_SIZE-1);
@@ -1117,7 +1171,7 @@ static void do_generic_file_read(struct file *filp, loff_t *ppos,
 
 		cond_resched();
 find_page:
-		page = find_get_page(mapping, index);
+		page = read_batch_get(mapping, &rb, index, last_index - index);
 		if (!page) {
 			page_cache_sync_readahead(mapping,
 					ra, filp,
@@ -1299,6 +1353,7 @@ no_cached_page:
 	}
 
 out:
+	read_batch_release(&rb);
 	ra->prev_pos = prev_index;
 	ra->prev_pos <<= PAGE_CACHE_SHIFT;
 	ra->prev_pos |= prev_offset;
@@ -1604,6 +1659,8 @@ static void do_sync_mmap_readahead(struct vm_area_struct *vma,
 	ra->start = max_t(long, 0, offset - ra_pages / 2);
 	ra->size = ra_pages;
 	ra->async_size = ra_pages / 4;
+	/* a forward window, don't let a stale stride or reverse take it */
+	ra->pattern = RA_PATTERN_SEQ;
 	ra_submit(ra, mapping, file);
 }
 
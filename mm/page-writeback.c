@@ -404,6 +404,28 @@ void global_dirty_limits(unsigned long *pbackground, unsigned long *pdirty)
 	trace_global_dirty_state(background, dirty);
 }
 
+/*
+ * bdi_dirty_time_limit - dirty pages @bdi can write back in max_dirty_ms
+ * @bdi: the backing_dev_info to query
+ * @dirty: global dirty limit in pages
+ *
+ * Scaled by @dirty relative to the hard dirty limit, so that it is the bdi's
+ * counterpart of a background or freerun threshold when passed one of them.
+ * ULONG_MAX when the bdi has no max_dirty_ms set.
+ */
+static unsigned long bdi_dirty_time_limit(struct backing_dev_info *bdi,
+					  unsigned long dirty)
+{
+	unsigned int ms = bdi->max_dirty_time;
+	u64 limit;
+
+	if (!ms)
+		return ULONG_MAX;
+
+	limit = div_u64((u64)bdi->avg_write_bandwidth * ms, MSEC_PER_SEC);
+	return div64_u64(limit * dirty, hard_dirty_limit(dirty));
+}
+
 /**
  * bdi_dirty_limit - @bdi's share of dirty throttling threshold
  * @bdi: the backing_dev_info to query
@@ -425,6 +447,8 @@ void global_dirty_limits(unsigned long *pbackground, unsigned long *pdirty)
  *
  * The bdi's share of dirty limit will be adapting to its throughput and
  * bounded by the bdi->min_ratio and/or bdi->max_ratio parameters, if set.
+ * With bdi->max_dirty_time set, it is also bounded to what the bdi can
+ * write back in that many milliseconds at its estimated write bandwidth.
  */
 unsigned long bdi_dirty_limit(struct backing_dev_info *bdi, unsigned long dirty)
 {
@@ -444,7 +468,7 @@ unsigned long bdi_dirty_limit(struct backing_dev_info *bdi, unsigned long dirty)
 	if (bdi_dirty > (dirty * bdi->max_ratio) / 100)
 		bdi_dirty = dirty * bdi->max_ratio / 100;
 
-	return bdi_dirty;
+	return min_t(u64, bdi_dirty, bdi_dirty_time_limit(bdi, dirty));
 }
 
 /*
@@ -643,6 +667,20 @@ static unsigned long bdi_position_ratio(struct backing_dev_info *bdi,
 			pos_ratio *= 8;
 	}
 
+	/*
+	 * bdi dirty time limit, the one hard limit on bdi_dirty: ramp pos_ratio
+	 * down to 0 over its last quarter, whatever the other control lines say.
+	 */
+	if (bdi->max_dirty_time) {
+		x_intercept = bdi_dirty_time_limit(bdi, thresh);
+		if (bdi_dirty >= x_intercept)
+			return 0;
+		span = x_intercept / 4;
+		if (bdi_dirty > x_intercept - span)
+			pos_ratio = div_u64(pos_ratio * (x_intercept - bdi_dirty),
+					    span + 1);
+	}
+
 	return pos_ratio;
 }
 
@@ -998,6 +1036,22 @@ static unsigned long bdi_max_pause(struct backing_dev_info *bdi,
 	return clamp_val(t, 4, MAX_PAUSE);
 }
 
+/*
+ * A bdi with max_dirty_ms set is throttled on its own once it holds more than
+ * its freerun share of that, even while the system as a whole is in freerun.
+ * Otherwise a slow device could fill the dirty pool for everybody else before
+ * any throttling kicks in.
+ */
+static bool bdi_over_dirty_time(struct backing_dev_info *bdi,
+				unsigned long freerun)
+{
+	if (!bdi->max_dirty_time)
+		return false;
+
+	return bdi_stat(bdi, BDI_RECLAIMABLE) + bdi_stat(bdi, BDI_WRITEBACK) >
+		bdi_dirty_time_limit(bdi, freerun);
+}
+
 /*
  * balance_dirty_pages() must be called by processes which are generating dirty
  * data.  It looks at the number of dirty pages in the machine and will force
@@ -1017,6 +1071,7 @@ static void balance_dirty_pages(struct address_space *mapping,
 	unsigned long dirty_thresh;
 	unsigned long bdi_thresh;
 	long pause = 0;
+	unsigned long paused;
 	long uninitialized_var(max_pause);
 	bool dirty_exceeded = false;
 	unsigned long task_ratelimit;
@@ -1045,7 +1100,7 @@ static void balance_dirty_pages(struct address_space *mapping,
 		 */
 		freerun = dirty_freerun_ceiling(dirty_thresh,
 						background_thresh);
-		if (nr_dirty <= freerun)
+		if (nr_dirty <= freerun && !bdi_over_dirty_time(bdi, freerun))
 			break;
 
 		if (unlikely(!writeback_in_progress(bdi)))
@@ -1138,7 +1193,13 @@ pause:
 					  pause,
 					  start_time);
 		__set_current_state(TASK_KILLABLE);
+		paused = jiffies;
 		io_schedule_timeout(pause);
+		paused = jiffies - paused;
+
+		__inc_bdi_stat(bdi, BDI_DIRTY_PAUSES);
+		__add_bdi_stat(bdi, BDI_DIRTY_PAUSED, paused);
+		trace_bdi_dirty_pause(bdi, bdi_thresh, bdi_dirty, pause, paused);
 
 		/*
 		 * This is typically equal to (nr_dirty < dirty_thresh) and can
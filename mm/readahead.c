@@ -18,6 +18,18 @@
 #include <linux/pagevec.h>
 #include <linux/pagemap.h>
 
+/*
+ * Let the readahead logic adjust each file's maximum window from the
+ * observed hit and waste rates. Tunable via /proc/sys/vm/readahead_autotune.
+ */
+int sysctl_readahead_autotune __read_mostly = 1;
+
+/* Number of readahead decisions between two window size adjustments */
+#define RA_TUNE_PERIOD		32
+
+/* Maximum number of records fetched at once for a strided reader */
+#define RA_STRIDE_MAX		16
+
 /*
  * Initialise a struct file's readahead state.  Assumes that the caller has
  * memset *ra to zero.
@@ -255,6 +267,7 @@ unsigned long ra_submit(struct file_ra_state *ra,
 
 	actual = __do_page_cache_readahead(mapping, filp,
 					ra->start, ra->size, ra->async_size);
+	ra->stats.pages += actual;
 
 	return actual;
 }
@@ -336,6 +349,45 @@ static unsigned long get_next_ra_size(struct file_ra_state *ra,
  * it approaches max_readhead.
  */
 
+/*
+ * The current window is about to be replaced by an unrelated one. Account
+ * the pages the reader did not get to as wasted, judging from the last
+ * position it read. This is an estimate: if the reader is nowhere near the
+ * window, we cannot tell what became of it, and nothing is accounted.
+ */
+static void ra_account_abandon(struct file_ra_state *ra)
+{
+	pgoff_t last, end = ra->start + ra->size;
+	unsigned long unused = 0;
+	long stride = ra->stride;
+
+	if (!ra->size || ra->prev_pos < 0)
+		return;
+	last = ra->prev_pos >> PAGE_CACHE_SHIFT;
+
+	switch (ra->pattern) {
+	case RA_PATTERN_SEQ:
+		/* the previous window might still be partially unread */
+		if (last < end && last + ra->size >= ra->start)
+			unused = end - last - 1;
+		break;
+	case RA_PATTERN_STRIDE:
+		/* ra->start is the last record fetched */
+		if (stride > 0 && last < ra->start)
+			unused = (ra->start - last + stride - 1) / stride;
+		else if (stride < 0 && last > ra->start)
+			unused = (last - ra->start - stride - 1) / -stride;
+		unused = min_t(unsigned long, unused, RA_STRIDE_MAX) * ra->size;
+		break;
+	case RA_PATTERN_REVERSE:
+		if (last >= ra->start && last < end)
+			unused = last - ra->start;
+		break;
+	}
+
+	ra->stats.wasted += unused;
+}
+
 /*
  * Count contiguously cached pages from @offset-1 to @offset-@max,
  * this count is a conservative estimation of
@@ -382,6 +434,7 @@ static int try_context_readahead(struct address_space *mapping,
 	if (size >= offset)
 		size *= 2;
 
+	ra_account_abandon(ra);
 	ra->start = offset;
 	ra->size = get_init_ra_size(size + req_size, max);
 	ra->async_size = ra->size;
@@ -390,7 +443,105 @@ static int try_context_readahead(struct address_space *mapping,
 }
 
 /*
- * A minimal readahead algorithm for trivial sequential/random reads.
+ * Fetch up to RA_STRIDE_MAX records of @len pages, ra->stride pages apart,
+ * starting at @index. The first page of the last record is marked with
+ * PG_readahead, so that reaching it fetches the next batch.
+ */
+static unsigned long ra_stride_readahead(struct address_space *mapping,
+					 struct file_ra_state *ra,
+					 struct file *filp, pgoff_t index,
+					 unsigned long len, unsigned long max)
+{
+	unsigned long nr = clamp_t(unsigned long, max / len, 1, RA_STRIDE_MAX);
+	unsigned long i, actual = 0;
+	long stride = ra->stride;
+
+	ra->pattern = RA_PATTERN_STRIDE;
+	ra->size = len;
+	ra->async_size = len;
+	ra->stats.strided++;
+
+	for (i = 0; i < nr; i++) {
+		ra->start = index;
+		actual += __do_page_cache_readahead(mapping, filp, index, len,
+						    i == nr - 1 ? len : 0);
+		if (stride < 0 && index < -stride)
+			break;
+		index += stride;
+	}
+	ra->stats.pages += actual;
+
+	return actual;
+}
+
+/*
+ * Fetch the @size pages right below @end, for a reader walking the file
+ * backwards. The page in the middle of the window is marked with
+ * PG_readahead, so that reaching it fetches the window below.
+ */
+static unsigned long ra_reverse_readahead(struct address_space *mapping,
+					  struct file_ra_state *ra,
+					  struct file *filp, pgoff_t end,
+					  unsigned long size)
+{
+	unsigned long actual;
+
+	size = min_t(unsigned long, size, end);
+	if (!size)
+		return 0;
+
+	ra->pattern = RA_PATTERN_REVERSE;
+	ra->start = end - size;
+	ra->size = size;
+	ra->async_size = size / 2;
+	ra->stats.reverse++;
+
+	actual = __do_page_cache_readahead(mapping, filp, ra->start, size,
+					   size - ra->async_size);
+	ra->stats.pages += actual;
+
+	return actual;
+}
+
+/*
+ * Adjust the maximum readahead window of a file from its recent history:
+ * shrink it when readahead keeps fetching pages nobody reads, grow it when
+ * there is hardly any waste but the reader keeps missing the page cache.
+ */
+static void ra_autotune(struct file_ra_state *ra,
+			struct address_space *mapping)
+{
+	struct file_ra_stats *st = &ra->stats;
+	unsigned int bdi_pages = mapping->backing_dev_info->ra_pages;
+	unsigned int min_pages = VM_MIN_READAHEAD * 1024 / PAGE_CACHE_SIZE;
+	unsigned long pages, wasted, sync, async;
+
+	if (!sysctl_readahead_autotune || ++st->tune_count < RA_TUNE_PERIOD)
+		return;
+
+	pages = st->pages - st->tune_pages;
+	wasted = st->wasted - st->tune_wasted;
+	sync = st->sync - st->tune_sync;
+	async = st->async - st->tune_async;
+
+	if (wasted * 4 > pages) {
+		if (ra->ra_pages > min_pages)
+			ra->ra_pages = max(ra->ra_pages / 2, min_pages);
+	} else if (async && sync > async && wasted * 16 < pages) {
+		if (ra->ra_pages < 2 * bdi_pages)
+			ra->ra_pages = min(ra->ra_pages * 2, 2 * bdi_pages);
+	}
+
+	st->tune_count = 0;
+	st->tune_pages = st->pages;
+	st->tune_wasted = st->wasted;
+	st->tune_sync = st->sync;
+	st->tune_async = st->async;
+}
+
+/*
+ * A minimal readahead algorithm for trivial sequential/random reads,
+ * plus strided and reverse streams.
  */
 static unsigned long
 ondemand_readahead(struct address_space *mapping,
@@ -399,6 +550,46 @@ ondemand_readahead(struct address_space *mapping,
 		   unsigned long req_size)
 {
 	unsigned long max = max_sane_readahead(ra->ra_pages);
+	long delta = 0, prev_delta = 0;
+	int actual;
+
+	if (hit_readahead_marker) {
+		ra->stats.async++;
+	} else {
+		ra->stats.sync++;
+		delta = offset - ra->prev_miss;
+		ra->prev_miss = offset;
+	}
+
+	/*
+	 * Strided and reverse streams: the expected record or window,
+	 * either because we hit the marker, or because the marker got lost
+	 * and the reader is missing the page cache right there.
+	 */
+	if (ra->pattern == RA_PATTERN_STRIDE) {
+		if (hit_readahead_marker && offset == ra->start)
+			return ra_stride_readahead(mapping, ra, filp,
+						   offset + ra->stride,
+						   ra->size, max);
+		if (!hit_readahead_marker && offset == ra->start + ra->stride)
+			return ra_stride_readahead(mapping, ra, filp, offset,
+						   ra->size, max);
+	} else if (ra->pattern == RA_PATTERN_REVERSE) {
+		if (hit_readahead_marker &&
+		    offset == ra->start + ra->async_size)
+			return ra_reverse_readahead(mapping, ra, filp,
+					ra->start, get_next_ra_size(ra, max));
+		if (!hit_readahead_marker && offset < ra->start &&
+		    offset + req_size >= ra->start)
+			return ra_reverse_readahead(mapping, ra, filp,
+					offset + req_size,
+					get_next_ra_size(ra, max));
+	}
+
+	if (!hit_readahead_marker) {
+		prev_delta = ra->stride;
+		ra->stride = delta;
+	}
 
 	/*
 	 * start of file
@@ -434,6 +625,7 @@ ondemand_readahead(struct address_space *mapping,
 		if (!start || start - offset > max)
 			return 0;
 
+		ra_account_abandon(ra);
 		ra->start = start;
 		ra->size = start - offset;	/* old async_size */
 		ra->size += req_size;
@@ -461,18 +653,42 @@ ondemand_readahead(struct address_space *mapping,
 	if (try_context_readahead(mapping, ra, offset, req_size, max))
 		goto readit;
 
+	/*
+	 * Two cache misses in a row at the same distance: a reader walking
+	 * the file backwards, or going through fixed size records spread
+	 * at fixed intervals (e.g. an index followed by its payload).
+	 */
+	if (delta && delta == prev_delta) {
+		if (delta < 0 && -delta <= (long)req_size) {
+			ra_account_abandon(ra);
+			return ra_reverse_readahead(mapping, ra, filp,
+					offset + req_size,
+					get_init_ra_size(req_size, max));
+		}
+		if (delta > (long)req_size || -delta > (long)req_size) {
+			ra_account_abandon(ra);
+			return ra_stride_readahead(mapping, ra, filp, offset,
+						   req_size, max);
+		}
+	}
+
 	/*
 	 * standalone, small random read
 	 * Read as is, and do not pollute the readahead state.
 	 */
-	return __do_page_cache_readahead(mapping, filp, offset, req_size, 0);
+	actual = __do_page_cache_readahead(mapping, filp, offset, req_size, 0);
+	ra->stats.pages += actual;
+	return actual;
 
 initial_readahead:
+	ra_account_abandon(ra);
 	ra->start = offset;
 	ra->size = get_init_ra_size(req_size, max);
 	ra->async_size = ra->size > req_size ? ra->size - req_size : ra->size;
 
 readit:
+	ra->pattern = RA_PATTERN_SEQ;
+
 	/*
 	 * Will this read hit the readahead marker made by itself?
 	 * If so, trigger the readahead marker hit now, and merge
@@ -516,6 +732,7 @@ void page_cache_sync_readahead(struct address_space *mapping,
 
 	/* do read-ahead */
 	ondemand_readahead(mapping, ra, filp, false, offset, req_size);
+	ra_autotune(ra, mapping);
 }
 EXPORT_SYMBOL_GPL(page_cache_sync_readahead);
 
@@ -560,5 +777,6 @@ page_cache_async_readahead(struct address_space *mapping,
 
 	/* do read-ahead */
 	ondemand_readahead(mapping, ra, filp, true, offset, req_size);
+	ra_autotune(ra, mapping);
 }
 EXPORT_SYMBOL_GPL(page_cache_async_readahead);
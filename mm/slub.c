@@ -232,6 +232,36 @@ static inline void stat(const struct kmem_cache *s, enum stat_item si)
 #endif
 }
 
+/*
+ * Take and drop the list_lock of a node from the allocation and free paths.
+ * Interrupts must be disabled. With CONFIG_SLUB_STATS this also accounts how
+ * often the lock is taken, how often it is contended and how long it is held.
+ */
+static inline void lock_node_list(struct kmem_cache *s,
+				  struct kmem_cache_node *n)
+{
+#ifdef CONFIG_SLUB_STATS
+	if (!spin_trylock(&n->list_lock)) {
+		stat(s, LIST_LOCK_CONTENDED);
+		spin_lock(&n->list_lock);
+	}
+	stat(s, LIST_LOCK);
+	n->lock_time = local_clock();
+#else
+	spin_lock(&n->list_lock);
+#endif
+}
+
+static inline void unlock_node_list(struct kmem_cache *s,
+				    struct kmem_cache_node *n)
+{
+#ifdef CONFIG_SLUB_STATS
+	__this_cpu_add(s->cpu_slab->list_lock_nsec,
+		       local_clock() - n->lock_time);
+#endif
+	spin_unlock(&n->list_lock);
+}
+
 /********************************************************************
  * 			Core slab cache functions
  *******************************************************************/
@@ -1545,7 +1575,7 @@ static void *get_partial_node(struct kmem_cache *s,
 	if (!n || !n->nr_partial)
 		return NULL;
 
-	spin_lock(&n->list_lock);
+	lock_node_list(s, n);
 	list_for_each_entry_safe(page, page2, &n->partial, lru) {
 		void *t = acquire_slab(s, n, page, object == NULL);
 		int available;
@@ -1561,12 +1591,13 @@ static void *get_partial_node(struct kmem_cache *s,
 			available =  page->objects - page->inuse;
 		} else {
 			available = put_cpu_partial(s, page, 0);
+			stat(s, CPU_PARTIAL_REFILL);
 		}
 		if (kmem_cache_debug(s) || available > s->cpu_partial / 2)
 			break;
 
 	}
-	spin_unlock(&n->list_lock);
+	unlock_node_list(s, n);
 	return object;
 }
 
@@ -1815,7 +1846,7 @@ redo:
 			 * that acquire_slab() will see a slab page that
 			 * is frozen
 			 */
-			spin_lock(&n->list_lock);
+			lock_node_list(s, n);
 		}
 	} else {
 		m = M_FULL;
@@ -1826,7 +1857,7 @@ redo:
 			 * slabs from diagnostic functions will not see
 			 * any frozen slabs.
 			 */
-			spin_lock(&n->list_lock);
+			lock_node_list(s, n);
 		}
 	}
 
@@ -1861,7 +1892,7 @@ redo:
 		goto redo;
 
 	if (lock)
-		spin_unlock(&n->list_lock);
+		unlock_node_list(s, n);
 
 	if (m == M_FREE) {
 		stat(s, DEACTIVATE_EMPTY);
@@ -1885,6 +1916,7 @@ static void unfreeze_partials(struct kmem_cache *s)
 
 		c->partial = page->next;
 		l = M_FREE;
+		stat(s, CPU_PARTIAL_DRAIN);
 
 		do {
 
@@ -1906,10 +1938,10 @@ static void unfreeze_partials(struct kmem_cache *s)
 				m = M_PARTIAL;
 				if (n != n2) {
 					if (n)
-						spin_unlock(&n->list_lock);
+						unlock_node_list(s, n);
 
 					n = n2;
-					spin_lock(&n->list_lock);
+					lock_node_list(s, n);
 				}
 			}
 
@@ -1935,7 +1967,7 @@ static void unfreeze_partials(struct kmem_cache *s)
 	}
 
 	if (n)
-		spin_unlock(&n->list_lock);
+		unlock_node_list(s, n);
 
 	while (discard_page) {
 		page = discard_page;
@@ -2449,7 +2481,8 @@ static void __slab_free(struct kmem_cache *s, struct page *page,
 				 * Otherwise the list_lock will synchronize with
 				 * other processors updating the list of slabs.
 				 */
-				spin_lock_irqsave(&n->list_lock, flags);
+				local_irq_save(flags);
+				lock_node_list(s, n);
 
 			}
 		}
@@ -2498,7 +2531,8 @@ static void __slab_free(struct kmem_cache *s, struct page *page,
 			stat(s, FREE_ADD_PARTIAL);
 		}
 	}
-	spin_unlock_irqrestore(&n->list_lock, flags);
+	unlock_node_list(s, n);
+	local_irq_restore(flags);
 	return;
 
 slab_empty:
@@ -2512,7 +2546,8 @@ slab_empty:
 		/* Slab must be on the full list */
 		remove_full(s, page);
 
-	spin_unlock_irqrestore(&n->list_lock, flags);
+	unlock_node_list(s, n);
+	local_irq_restore(flags);
 	stat(s, FREE_SLAB);
 	discard_slab(s, page);
 }
@@ -4982,13 +5017,14 @@ static int show_stat(struct kmem_cache *s, char *buf, enum stat_item si)
 	unsigned long sum  = 0;
 	int cpu;
 	int len;
-	int *data = kmalloc(nr_cpu_ids * sizeof(int), GFP_KERNEL);
+	unsigned long *data = kmalloc(nr_cpu_ids * sizeof(unsigned long),
+				      GFP_KERNEL);
 
 	if (!data)
 		return -ENOMEM;
 
 	for_each_online_cpu(cpu) {
-		unsigned x = per_cpu_ptr(s->cpu_slab, cpu)->stat[si];
+		unsigned long x = per_cpu_ptr(s->cpu_slab, cpu)->stat[si];
 
 		data[cpu] = x;
 		sum += x;
@@ -4999,7 +5035,7 @@ static int show_stat(struct kmem_cache *s, char *buf, enum stat_item si)
 #ifdef CONFIG_SMP
 	for_each_online_cpu(cpu) {
 		if (data[cpu] && len < PAGE_SIZE - 20)
-			len += sprintf(buf + len, " C%d=%u", cpu, data[cpu]);
+			len += sprintf(buf + len, " C%d=%lu", cpu, data[cpu]);
 	}
 #endif
 	kfree(data);
@@ -5053,6 +5089,46 @@ STAT_ATTR(CMPXCHG_DOUBLE_CPU_FAIL, cmpxchg_double_cpu_fail);
 STAT_ATTR(CMPXCHG_DOUBLE_FAIL, cmpxchg_double_fail);
 STAT_ATTR(CPU_PARTIAL_ALLOC, cpu_partial_alloc);
 STAT_ATTR(CPU_PARTIAL_FREE, cpu_partial_free);
+STAT_ATTR(CPU_PARTIAL_REFILL, cpu_partial_refill);
+STAT_ATTR(CPU_PARTIAL_DRAIN, cpu_partial_drain);
+STAT_ATTR(LIST_LOCK, list_lock);
+STAT_ATTR(LIST_LOCK_CONTENDED, list_lock_contended);
+
+/* Kept apart from the stat[] counters, it wraps a 32 bit long in seconds */
+static ssize_t list_lock_nsec_show(struct kmem_cache *s, char *buf)
+{
+	u64 sum = 0;
+	int cpu;
+	int len;
+
+	for_each_online_cpu(cpu)
+		sum += per_cpu_ptr(s->cpu_slab, cpu)->list_lock_nsec;
+
+	len = sprintf(buf, "%llu", sum);
+
+#ifdef CONFIG_SMP
+	for_each_online_cpu(cpu) {
+		u64 x = per_cpu_ptr(s->cpu_slab, cpu)->list_lock_nsec;
+
+		if (x && len < PAGE_SIZE - 30)
+			len += sprintf(buf + len, " C%d=%llu", cpu, x);
+	}
+#endif
+	return len + sprintf(buf + len, "\n");
+}
+
+static ssize_t list_lock_nsec_store(struct kmem_cache *s,
+				    const char *buf, size_t length)
+{
+	int cpu;
+
+	if (buf[0] != '0')
+		return -EINVAL;
+	for_each_online_cpu(cpu)
+		per_cpu_ptr(s->cpu_slab, cpu)->list_lock_nsec = 0;
+	return length;
+}
+SLAB_ATTR(list_lock_nsec);
 #endif
 
 static struct attribute *slab_attrs[] = {
@@ -5118,6 +5194,11 @@ static struct attribute *slab_attrs[] = {
 	&cmpxchg_double_cpu_fail_attr.attr,
 	&cpu_partial_alloc_attr.attr,
 	&cpu_partial_free_attr.attr,
+	&cpu_partial_refill_attr.attr,
+	&cpu_partial_drain_attr.attr,
+	&list_lock_attr.attr,
+	&list_lock_contended_attr.attr,
+	&list_lock_nsec_attr.attr,
 #endif
 #ifdef CONFIG_FAILSLAB
 	&failslab_attr.attr,
@@ -0,0 +1,322 @@
+/*
+ * mm/vmalloc-bench.c
+ *
+ * vmalloc()/vfree() latency benchmark.
+ *
+ * Runs a few allocation patterns against the kernel virtual area allocator
+ * when loaded and prints a log2 latency histogram for each of them:
+ *
+ *   fixed	vmalloc()/vfree() pairs of "pages" pages
+ *   random	vmalloc()/vfree() pairs of 1..max_pages pages
+ *   fragment	"live" areas of random size are kept allocated and every
+ *		other one freed, then random sized areas are allocated into
+ *		and freed from the fragmented space
+ *   map_ram	vm_map_ram()/vm_unmap_ram() of 1..BITS_PER_LONG pages,
+ *		which goes through the per-cpu vmap blocks
+ *
+ * With threads=N every pattern is run by N kernel threads at once, each
+ * bound to a different online CPU, to measure contention on the
+ * allocator. The module always fails to load once the run is complete:
+ *
+ *   modprobe vmalloc-bench iterations=100000 threads=4
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#define pr_fmt(fmt) KBUILD_MODNAME ": " fmt
+
+#include <linux/init.h>
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/moduleparam.h>
+#include <linux/sched.h>
+#include <linux/kthread.h>
+#include <linux/completion.h>
+#include <linux/cpumask.h>
+#include <linux/random.h>
+#include <linux/slab.h>
+#include <linux/vmalloc.h>
+#include <linux/mm.h>
+#include <linux/log2.h>
+#include <linux/math64.h>
+#include <asm/div64.h>
+
+static unsigned int iterations = 10000;
+module_param(iterations, uint, 0444);
+MODULE_PARM_DESC(iterations, "Allocations per pattern and thread");
+
+static unsigned int pages = 1;
+module_param(pages, uint, 0444);
+MODULE_PARM_DESC(pages, "Size of the fixed pattern in pages");
+
+static unsigned int max_pages = 64;
+module_param(max_pages, uint, 0444);
+MODULE_PARM_DESC(max_pages, "Largest size of the random patterns in pages");
+
+static unsigned int live = 1024;
+module_param(live, uint, 0444);
+MODULE_PARM_DESC(live, "Areas kept allocated by the fragment pattern");
+
+static unsigned int threads = 1;
+module_param(threads, uint, 0444);
+MODULE_PARM_DESC(threads, "Threads running each pattern concurrently");
+
+#define VB_HIST_SLOTS	32
+
+struct vb_hist {
+	unsigned long cnt[VB_HIST_SLOTS];
+	unsigned long nr;
+	unsigned long failed;
+	u64 total;
+	u64 max;
+};
+
+struct vb_thread {
+	struct task_struct *task;
+	int (*fn)(struct vb_thread *);
+	struct vb_hist hist;
+	struct completion *done;
+	atomic_t *running;
+	unsigned long seed;
+	int ret;
+};
+
+static unsigned long vb_rand(struct vb_thread *t)
+{
+	t->seed = t->seed * 1103515245 + 12345;
+	return t->seed >> 16;
+}
+
+static void vb_account(struct vb_hist *h, u64 start)
+{
+	u64 ns = local_clock() - start;
+	int slot = ns ? ilog2(ns) : 0;
+
+	if (slot >= VB_HIST_SLOTS)
+		slot = VB_HIST_SLOTS - 1;
+	h->cnt[slot]++;
+	h->nr++;
+	h->total += ns;
+	if (ns > h->max)
+		h->max = ns;
+}
+
+/* Time one vmalloc() and the matching vfree() of @nr pages */
+static int vb_alloc_free(struct vb_thread *t, unsigned int nr)
+{
+	void *p;
+	u64 start;
+
+	start = local_clock();
+	p = vmalloc(nr << PAGE_SHIFT);
+	if (!p) {
+		t->hist.failed++;
+		return -ENOMEM;
+	}
+	vfree(p);
+	vb_account(&t->hist, start);
+	return 0;
+}
+
+static int vb_fixed(struct vb_thread *t)
+{
+	unsigned int i;
+
+	for (i = 0; i < iterations; i++) {
+		vb_alloc_free(t, pages);
+		cond_resched();
+	}
+	return 0;
+}
+
+static int vb_random(struct vb_thread *t)
+{
+	unsigned int i;
+
+	for (i = 0; i < iterations; i++) {
+		vb_alloc_free(t, vb_rand(t) % max_pages + 1);
+		cond_resched();
+	}
+	return 0;
+}
+
+static int vb_fragment(struct vb_thread *t)
+{
+	void **areas;
+	unsigned int i;
+
+	areas = vzalloc(live * sizeof(*areas));
+	if (!areas)
+		return -ENOMEM;
+
+	for (i = 0; i < live; i++)
+		areas[i] = vmalloc((vb_rand(t) % max_pages + 1) << PAGE_SHIFT);
+	for (i = 0; i < live; i += 2) {
+		vfree(areas[i]);
+		areas[i] = NULL;
+	}
+
+	for (i = 0; i < iterations; i++) {
+		vb_alloc_free(t, vb_rand(t) % max_pages + 1);
+		cond_resched();
+	}
+
+	for (i = 0; i < live; i++)
+		vfree(areas[i]);
+	vfree(areas);
+	return 0;
+}
+
+static int vb_map_ram(struct vb_thread *t)
+{
+	struct page *page;
+	struct page **pv;
+	unsigned int i, nr;
+	u64 start;
+	void *p;
+
+	page = alloc_page(GFP_KERNEL);
+	pv = kmalloc(BITS_PER_LONG * sizeof(*pv), GFP_KERNEL);
+	if (!page || !pv) {
+		kfree(pv);
+		if (page)
+			__free_page(page);
+		return -ENOMEM;
+	}
+	for (i = 0; i < BITS_PER_LONG; i++)
+		pv[i] = page;
+
+	for (i = 0; i < iterations; i++) {
+		nr = vb_rand(t) % BITS_PER_LONG + 1;
+		start = local_clock();
+		p = vm_map_ram(pv, nr, -1, PAGE_KERNEL);
+		if (!p) {
+			t->hist.failed++;
+			continue;
+		}
+		vm_unmap_ram(p, nr);
+		vb_account(&t->hist, start);
+		cond_resched();
+	}
+
+	kfree(pv);
+	__free_page(page);
+	return 0;
+}
+
+static int vb_thread_fn(void *data)
+{
+	struct vb_thread *t = data;
+
+	t->ret = t->fn(t);
+	if (atomic_dec_and_test(t->running))
+		complete(t->done);
+	/* wait for kthread_stop() so that the task can be reaped */
+	set_current_state(TASK_INTERRUPTIBLE);
+	while (!kthread_should_stop()) {
+		schedule();
+		set_current_state(TASK_INTERRUPTIBLE);
+	}
+	__set_current_state(TASK_RUNNING);
+	return 0;
+}
+
+static void vb_report(const char *name, struct vb_hist *h, u64 elapsed)
+{
+	u64 avg = h->total;
+	int i;
+
+	if (h->nr)
+		do_div(avg, h->nr);
+	pr_info("%s: %lu ops, %lu failed, avg %llu ns, max %llu ns, "
+		"wall %llu us\n", name, h->nr, h->failed,
+		(unsigned long long)avg, (unsigned long long)h->max,
+		(unsigned long long)div_u64(elapsed, NSEC_PER_USEC));
+	for (i = 0; i < VB_HIST_SLOTS; i++)
+		if (h->cnt[i])
+			pr_info("%s:   < %llu ns: %lu\n", name,
+				1ULL << (i + 1), h->cnt[i]);
+}
+
+static int vb_run(const char *name, int (*fn)(struct vb_thread *))
+{
+	DECLARE_COMPLETION_ONSTACK(done);
+	atomic_t running;
+	struct vb_thread *t;
+	struct vb_hist sum;
+	unsigned int i, nr = 0;
+	int cpu, j, ret = 0;
+	u64 start;
+
+	t = kcalloc(threads, sizeof(*t), GFP_KERNEL);
+	if (!t)
+		return -ENOMEM;
+
+	atomic_set(&running, 1);
+	cpu = cpumask_first(cpu_online_mask);
+	for (i = 0; i < threads; i++) {
+		t[i].fn = fn;
+		t[i].done = &done;
+		t[i].running = &running;
+		t[i].seed = get_random_int();
+		t[i].task = kthread_create(vb_thread_fn, &t[i], "vbench/%u", i);
+		if (IS_ERR(t[i].task)) {
+			ret = PTR_ERR(t[i].task);
+			break;
+		}
+		kthread_bind(t[i].task, cpu);
+		cpu = cpumask_next(cpu, cpu_online_mask);
+		if (cpu >= nr_cpu_ids)
+			cpu = cpumask_first(cpu_online_mask);
+		nr++;
+	}
+
+	start = local_clock();
+	atomic_add(nr, &running);
+	for (i = 0; i < nr; i++)
+		wake_up_process(t[i].task);
+	if (!atomic_dec_and_test(&running))
+		wait_for_completion(&done);
+	start = local_clock() - start;
+
+	memset(&sum, 0, sizeof(sum));
+	for (i = 0; i < nr; i++) {
+		kthread_stop(t[i].task);
+		if (t[i].ret && !ret)
+			ret = t[i].ret;
+		for (j = 0; j < VB_HIST_SLOTS; j++)
+			sum.cnt[j] += t[i].hist.cnt[j];
+		sum.nr += t[i].hist.nr;
+		sum.failed += t[i].hist.failed;
+		sum.total += t[i].hist.total;
+		sum.max = max(sum.max, t[i].hist.max);
+	}
+	kfree(t);
+
+	if (ret)
+		pr_err("%s: failed with %d\n", name, ret);
+	else
+		vb_report(name, &sum, start);
+	return ret;
+}
+
+static int __init vmalloc_bench_init(void)
+{
+	if (!iterations || !pages || !max_pages || !threads)
+		return -EINVAL;
+
+	pr_info("%u iterations, %u threads\n", iterations, threads);
+	vb_run("fixed", vb_fixed);
+	vb_run("random", vb_random);
+	vb_run("fragment", vb_fragment);
+	vb_run("map_ram", vb_map_ram);
+
+	/* nothing to keep around, fail the load so it can be run again */
+	return -EAGAIN;
+}
+module_init(vmalloc_bench_init);
+
+MODULE_LICENSE("GPL");
+MODULE_DESCRIPTION("vmalloc/vfree latency benchmark");
@@ -21,6 +21,7 @@
 #include <linux/debugobjects.h>
 #include <linux/kallsyms.h>
 #include <linux/list.h>
+#include <linux/llist.h>
 #include <linux/rbtree.h>
 #include <linux/radix-tree.h>
 #include <linux/rcupdate.h>
@@ -254,14 +255,18 @@ struct vmap_area {
 	unsigned long va_end;
 	unsigned long flags;
 	struct rb_node rb_node;		/* address sorted rbtree */
+	unsigned long subtree_start;	/* lowest va_start in rb subtree */
+	unsigned long subtree_end;	/* highest va_end in rb subtree */
+	unsigned long subtree_gap;	/* largest hole within rb subtree */
 	struct list_head list;		/* address sorted list */
-	struct list_head purge_list;	/* "lazy purge" list */
+	struct llist_node purge_list;	/* "lazy purge" list */
 	struct vm_struct *vm;
 	struct rcu_head rcu_head;
 };
 
 static DEFINE_SPINLOCK(vmap_area_lock);
 static LIST_HEAD(vmap_area_list);
+static LLIST_HEAD(vmap_purge_list);
 static struct rb_root vmap_area_root = RB_ROOT;
 
 /* The vmap cache globals are protected by vmap_area_lock */
@@ -291,6 +296,39 @@ static struct vmap_area *__find_vmap_area(unsigned long addr)
 	return NULL;
 }
 
+/*
+ * Each node of the vmap_area rbtree caches the extent of its subtree and
+ * the largest hole between two areas inside it, so that alloc_vmap_area()
+ * can skip whole subtrees which cannot hold the request instead of walking
+ * every area in address order.
+ */
+static void vmap_area_augment_cb(struct rb_node *node, void *unused)
+{
+	struct vmap_area *va = rb_entry(node, struct vmap_area, rb_node);
+	unsigned long start = va->va_start;
+	unsigned long end = va->va_end;
+	unsigned long gap = 0;
+
+	if (node->rb_left) {
+		struct vmap_area *l;
+
+		l = rb_entry(node->rb_left, struct vmap_area, rb_node);
+		start = l->subtree_start;
+		gap = max(l->subtree_gap, va->va_start - l->subtree_end);
+	}
+	if (node->rb_right) {
+		struct vmap_area *r;
+
+		r = rb_entry(node->rb_right, struct vmap_area, rb_node);
+		end = r->subtree_end;
+		gap = max3(gap, r->subtree_gap, r->subtree_start - va->va_end);
+	}
+
+	va->subtree_start = start;
+	va->subtree_end = end;
+	va->subtree_gap = gap;
+}
+
 static void __insert_vmap_area(struct vmap_area *va)
 {
 	struct rb_node **p = &vmap_area_root.rb_node;
@@ -312,6 +350,7 @@ static void __insert_vmap_area(struct vmap_area *va)
 
 	rb_link_node(&va->rb_node, parent, p);
 	rb_insert_color(&va->rb_node, &vmap_area_root);
+	rb_augment_insert(&va->rb_node, vmap_area_augment_cb, NULL);
 
 	/* address-sort this list so it is usable like the vmlist */
 	tmp = rb_prev(&va->rb_node);
@@ -325,6 +364,108 @@ static void __insert_vmap_area(struct vmap_area *va)
 
 static void purge_vmap_area_lazy(void);
 
+/*
+ * Check whether the hole [lo, hi) can hold @size bytes aligned to @align
+ * within [vstart, vend), and return the address in *addrp if so.
+ */
+static inline bool vmap_hole_fits(unsigned long lo, unsigned long hi,
+				  unsigned long size, unsigned long align,
+				  unsigned long vstart, unsigned long vend,
+				  unsigned long *addrp)
+{
+	unsigned long addr = ALIGN(max(lo, vstart), align);
+
+	if (addr < lo || addr + size - 1 < addr)
+		return false;
+	if (addr + size > min(hi, vend))
+		return false;
+	*addrp = addr;
+	return true;
+}
+
+/*
+ * Record a hole we could not use, so that alloc_vmap_area() knows when
+ * it has to rescan from vstart. See the comment about cached_hole_size.
+ */
+static inline void vmap_note_hole(unsigned long lo, unsigned long hi,
+				  unsigned long vstart)
+{
+	lo = max(lo, vstart);
+	if (lo < hi && hi - lo > cached_hole_size)
+		cached_hole_size = hi - lo;
+}
+
+/*
+ * Find the lowest free range of @size bytes aligned to @align within
+ * [vstart, vend). This is an in-order walk of the vmap_area rbtree which
+ * skips every subtree whose largest hole, and the hole in front of it,
+ * are too small, so it normally touches O(log n) areas. Must be called
+ * with vmap_area_lock held.
+ */
+static bool find_vmap_hole(unsigned long size, unsigned long align,
+			   unsigned long vstart, unsigned long vend,
+			   unsigned long *addrp)
+{
+	struct rb_node *n = vmap_area_root.rb_node;
+	unsigned long prev_end = vstart;	/* end of the area before n */
+	struct vmap_area *va;
+
+	while (n) {
+		if (prev_end >= vend)
+			return false;
+
+		va = rb_entry(n, struct vmap_area, rb_node);
+		if (va->subtree_end > vstart &&
+		    (va->subtree_gap >= size ||
+		     vmap_hole_fits(prev_end, va->subtree_start, size, align,
+				    vstart, vend, addrp))) {
+			if (n->rb_left) {
+				n = n->rb_left;
+				continue;
+			}
+			if (vmap_hole_fits(prev_end, va->va_start, size, align,
+					   vstart, vend, addrp))
+				return true;
+			vmap_note_hole(prev_end, va->va_start, vstart);
+			prev_end = va->va_end;
+			if (n->rb_right) {
+				n = n->rb_right;
+				continue;
+			}
+		} else {
+			if (va->subtree_end > vstart) {
+				vmap_note_hole(prev_end, va->subtree_start, vstart);
+				if (va->subtree_gap > cached_hole_size)
+					cached_hole_size = va->subtree_gap;
+			}
+			prev_end = va->subtree_end;
+		}
+
+		/* the subtree at n is done, climb to the next unvisited area */
+		for (;;) {
+			struct rb_node *parent = rb_parent(n);
+
+			if (!parent)
+				goto last;
+			if (n == parent->rb_left) {
+				va = rb_entry(parent, struct vmap_area, rb_node);
+				if (vmap_hole_fits(prev_end, va->va_start, size,
+						   align, vstart, vend, addrp))
+					return true;
+				vmap_note_hole(prev_end, va->va_start, vstart);
+				prev_end = va->va_end;
+				if (parent->rb_right) {
+					n = parent->rb_right;
+					break;
+				}
+			}
+			n = parent;
+		}
+	}
+last:
+	return vmap_hole_fits(prev_end, vend, size, align, vstart, vend, addrp);
+}
+
 /*
  * Allocate a region of KVA of the specified size and alignment, within the
  * vstart and vend.
@@ -335,7 +476,6 @@ static struct vmap_area *alloc_vmap_area(unsigned long size,
 				int node, gfp_t gfp_mask)
 {
 	struct vmap_area *va;
-	struct rb_node *n;
 	unsigned long addr;
 	int purged = 0;
 	struct vmap_area *first;
@@ -380,48 +520,14 @@ nocache:
 			goto nocache;
 		if (addr + size - 1 < addr)
 			goto overflow;
-
 	} else {
 		addr = ALIGN(vstart, align);
 		if (addr + size - 1 < addr)
 			goto overflow;
-
-		n = vmap_area_root.rb_node;
-		first = NULL;
-
-		while (n) {
-			struct vmap_area *tmp;
-			tmp = rb_entry(n, struct vmap_area, rb_node);
-			if (tmp->va_end >= addr) {
-				first = tmp;
-				if (tmp->va_start <= addr)
-					break;
-				n = n->rb_left;
-			} else
-				n = n->rb_right;
-		}
-
-		if (!first)
-			goto found;
-	}
-
-	/* from the starting point, walk areas until a suitable hole is found */
-	while (addr + size > first->va_start && addr + size <= vend) {
-		if (addr + cached_hole_size < first->va_start)
-			cached_hole_size = first->va_start - addr;
-		addr = ALIGN(first->va_end, align);
-		if (addr + size - 1 < addr)
-			goto overflow;
-
-		n = rb_next(&first->rb_node);
-		if (n)
-			first = rb_entry(n, struct vmap_area, rb_node);
-		else
-			goto found;
 	}
 
-found:
-	if (addr + size > vend)
+	/* from the starting point, find the lowest suitable hole */
+	if (!find_vmap_hole(size, align, addr, vend, &addr))
 		goto overflow;
 
 	va->va_start = addr;
@@ -454,6 +560,8 @@ overflow:
 
 static void __free_vmap_area(struct vmap_area *va)
 {
+	struct rb_node *deepest;
+
 	BUG_ON(RB_EMPTY_NODE(&va->rb_node));
 
 	if (free_vmap_cache) {
@@ -471,7 +579,9 @@ static void __free_vmap_area(struct vmap_area *va)
 			}
 		}
 	}
+	deepest = rb_augment_erase_begin(&va->rb_node);
 	rb_erase(&va->rb_node, &vmap_area_root);
+	rb_augment_erase_end(deepest, vmap_area_augment_cb, NULL);
 	RB_CLEAR_NODE(&va->rb_node);
 	list_del_rcu(&va->list);
 
@@ -579,7 +689,7 @@ static void __purge_vmap_area_lazy(unsigned long *start, unsigned long *end,
 					int sync, int force_flush)
 {
 	static DEFINE_SPINLOCK(purge_lock);
-	LIST_HEAD(valist);
+	struct llist_node *valist;
 	struct vmap_area *va;
 	struct vmap_area *n_va;
 	int nr = 0;
@@ -598,20 +708,20 @@ static void __purge_vmap_area_lazy(unsigned long *start, unsigned long *end,
 	if (sync)
 		purge_fragmented_blocks_allcpus();
 
-	rcu_read_lock();
-	list_for_each_entry_rcu(va, &vmap_area_list, list) {
-		if (va->flags & VM_LAZY_FREE) {
-			if (va->va_start < *start)
-				*start = va->va_start;
-			if (va->va_end > *end)
-				*end = va->va_end;
-			nr += (va->va_end - va->va_start) >> PAGE_SHIFT;
-			list_add_tail(&va->purge_list, &valist);
-			va->flags |= VM_LAZY_FREEING;
-			va->flags &= ~VM_LAZY_FREE;
-		}
+	/*
+	 * Lazily freed areas are queued on vmap_purge_list, so only those
+	 * need to be visited instead of every area on vmap_area_list.
+	 */
+	valist = llist_del_all(&vmap_purge_list);
+	llist_for_each_entry(va, valist, purge_list) {
+		if (va->va_start < *start)
+			*start = va->va_start;
+		if (va->va_end > *end)
+			*end = va->va_end;
+		nr += (va->va_end - va->va_start) >> PAGE_SHIFT;
+		va->flags |= VM_LAZY_FREEING;
+		va->flags &= ~VM_LAZY_FREE;
 	}
-	rcu_read_unlock();
 
 	if (nr)
 		atomic_sub(nr, &vmap_lazy_nr);
@@ -621,8 +731,13 @@ static void __purge_vmap_area_lazy(unsigned long *start, unsigned long *end,
 
 	if (nr) {
 		spin_lock(&vmap_area_lock);
-		list_for_each_entry_safe(va, n_va, &valist, purge_list)
+		va = llist_entry(valist, struct vmap_area, purge_list);
+		while (valist) {
+			valist = valist->next;
+			n_va = llist_entry(valist, struct vmap_area, purge_list);
 			__free_vmap_area(va);
+			va = n_va;
+		}
 		spin_unlock(&vmap_area_lock);
 	}
 	spin_unlock(&purge_lock);
@@ -658,6 +773,7 @@ static void free_vmap_area_noflush(struct vmap_area *va)
 {
 	va->flags |= VM_LAZY_FREE;
 	atomic_add((va->va_end - va->va_start) >> PAGE_SHIFT, &vmap_lazy_nr);
+	llist_add(&va->purge_list, &vmap_purge_list);
 	if (unlikely(atomic_read(&vmap_lazy_nr) > lazy_max_pages()))
 		try_purge_vmap_area_lazy();
 }
@@ -123,6 +123,7 @@
 #include <linux/if_vlan.h>
 #include <linux/ip.h>
 #include <net/ip.h>
+#include <net/rxbench.h>
 #include <linux/ipv6.h>
 #include <linux/in.h>
 #include <linux/jhash.h>
@@ -283,6 +284,11 @@ static RAW_NOTIFIER_HEAD(netdev_chain);
 DEFINE_PER_CPU_ALIGNED(struct softnet_data, softnet_data);
 EXPORT_PER_CPU_SYMBOL(softnet_data);
 
+#if IS_ENABLED(CONFIG_NET_RXBENCH)
+DEFINE_PER_CPU(struct rxbench_sample *, rxbench_sample);
+EXPORT_PER_CPU_SYMBOL_GPL(rxbench_sample);
+#endif
+
 #ifdef CONFIG_LOCKDEP
 /*
  * register_netdevice() inits txq->_xmit_lock and sets lockdep class
@@ -3229,6 +3235,7 @@ static int __netif_receive_skb(struct sk_buff *skb)
 		net_timestamp_check(skb);
 
 	trace_netif_receive_skb(skb);
+	rxbench_stamp(RXBENCH_NETIF_RECEIVE);
 
 	/* if we've gotten here through NAPI, check netpoll */
 	if (netpoll_receive_skb(skb))
@@ -0,0 +1,540 @@
+/*
+ * Receive path benchmark.
+ *
+ * Injects synthetic TCP/IPv4 frames for one flow into napi_gro_receive()
+ * on a dummy device, as a NIC driver's NAPI poll would, and reports the
+ * average time spent per packet in each receive stage:
+ *
+ *   gro_receive	napi_gro_receive() until the stack is entered, or the
+ *			whole call for merged and held packets, plus flushes
+ *   netif_receive	__netif_receive_skb() up to ip_rcv()
+ *   ip_rcv		ip_rcv() up to the hand-off to TCP
+ *   tcp_demux		TCP socket lookup
+ *
+ * Stage boundaries are stamped by rxbench_stamp() calls in the stack
+ * (see include/net/rxbench.h), only for packets injected from here.
+ * This complements pktgen, which only exercises the transmit side.
+ *
+ * Usage, see Documentation/networking/rxbench.txt:
+ *
+ *   ip addr add 198.18.0.1/24 dev rxbench0
+ *   ip link set rxbench0 up
+ *   echo "count 1000000" > /proc/net/rxbench
+ *   echo run > /proc/net/rxbench
+ *   cat /proc/net/rxbench
+ *
+ * GRO can be switched off with "ethtool -K rxbench0 gro off" to compare
+ * against per-packet delivery.
+ */
+
+#define pr_fmt(fmt) KBUILD_MODNAME ": " fmt
+
+#include <linux/module.h>
+#include <linux/moduleparam.h>
+#include <linux/kernel.h>
+#include <linux/mutex.h>
+#include <linux/sched.h>
+#include <linux/string.h>
+#include <linux/errno.h>
+#include <linux/capability.h>
+#include <linux/init.h>
+#include <linux/skbuff.h>
+#include <linux/netdevice.h>
+#include <linux/etherdevice.h>
+#include <linux/inet.h>
+#include <linux/inetdevice.h>
+#include <linux/in.h>
+#include <linux/ip.h>
+#include <linux/tcp.h>
+#include <linux/proc_fs.h>
+#include <linux/seq_file.h>
+#include <linux/uaccess.h>
+#include <net/net_namespace.h>
+#include <net/checksum.h>
+#include <net/ip.h>
+#include <net/rxbench.h>
+#include <asm/div64.h>
+
+#define RXB_PROC_NAME	"rxbench"
+#define RXB_MAX_BURST	256
+
+enum rxb_stage {
+	RXB_GRO,
+	RXB_NETIF,
+	RXB_IP,
+	RXB_TCP,
+	RXB_NR_STAGES,
+};
+
+static const char * const rxb_stage_names[RXB_NR_STAGES] = {
+	[RXB_GRO]	= "gro_receive",
+	[RXB_NETIF]	= "netif_receive",
+	[RXB_IP]	= "ip_rcv",
+	[RXB_TCP]	= "tcp_demux",
+};
+
+static const char * const rxb_gro_names[] = {
+	[GRO_MERGED]		= "merged",
+	[GRO_MERGED_FREE]	= "merged_free",
+	[GRO_HELD]		= "held",
+	[GRO_NORMAL]		= "normal",
+	[GRO_DROP]		= "drop",
+};
+
+struct rxb_stat {
+	u64 ns;
+	u64 samples;
+};
+
+struct rxbench {
+	struct net_device *dev;
+	struct napi_struct napi;
+	struct mutex lock;		/* serializes runs and parameter changes */
+
+	/* Parameters */
+	u64 count;			/* packets per run */
+	unsigned int burst;		/* packets per simulated NAPI poll */
+	unsigned int pkt_size;		/* TCP payload bytes */
+	__be32 saddr;			/* 0: address after the device's */
+	__be16 sport, dport;
+
+	/* Flow state */
+	u32 seq;
+	u16 ip_id;
+	struct sk_buff *skbs[RXB_MAX_BURST];
+
+	/* Results of the last run */
+	int status;
+	u64 injected;
+	u64 delivered;
+	u64 elapsed_ns;
+	u64 gro_result[ARRAY_SIZE(rxb_gro_names)];
+	struct rxb_stat stage[RXB_NR_STAGES];
+};
+
+static struct net_device *rxb_dev;
+
+static int count_d = 100000;
+static int burst_d = 64;
+static int pkt_size_d = 1448;
+
+static const u8 rxb_src_mac[ETH_ALEN] = { 0x02, 0x00, 0x00, 0x00, 0x00, 0x01 };
+
+static netdev_tx_t rxbench_xmit(struct sk_buff *skb, struct net_device *dev)
+{
+	/* Replies generated by the stack (e.g. resets) go nowhere */
+	dev->stats.tx_packets++;
+	dev->stats.tx_bytes += skb->len;
+	dev_kfree_skb(skb);
+	return NETDEV_TX_OK;
+}
+
+static int rxbench_poll(struct napi_struct *napi, int budget)
+{
+	/* Never scheduled: packets are injected by rxbench_run() */
+	return 0;
+}
+
+static const struct net_device_ops rxbench_netdev_ops = {
+	.ndo_start_xmit		= rxbench_xmit,
+	.ndo_validate_addr	= eth_validate_addr,
+	.ndo_set_mac_address	= eth_mac_addr,
+};
+
+static void rxbench_setup(struct net_device *dev)
+{
+	ether_setup(dev);
+	dev->netdev_ops = &rxbench_netdev_ops;
+	dev->flags |= IFF_NOARP;
+	dev->tx_queue_len = 0;
+	random_ether_addr(dev->dev_addr);
+}
+
+static struct sk_buff *rxbench_build(struct rxbench *rb,
+				     __be32 saddr, __be32 daddr)
+{
+	unsigned int len = ETH_HLEN + sizeof(struct iphdr) +
+			   sizeof(struct tcphdr) + rb->pkt_size;
+	struct sk_buff *skb;
+	struct ethhdr *eth;
+	struct iphdr *iph;
+	struct tcphdr *th;
+
+	skb = netdev_alloc_skb_ip_align(rb->dev, len);
+	if (!skb)
+		return NULL;
+
+	eth = (struct ethhdr *)skb_put(skb, len);
+	memcpy(eth->h_dest, rb->dev->dev_addr, ETH_ALEN);
+	memcpy(eth->h_source, rxb_src_mac, ETH_ALEN);
+	eth->h_proto = htons(ETH_P_IP);
+
+	iph = (struct iphdr *)(eth + 1);
+	iph->version = 4;
+	iph->ihl = 5;
+	iph->tos = 0;
+	iph->tot_len = htons(len - ETH_HLEN);
+	iph->id = htons(rb->ip_id++);
+	iph->frag_off = htons(IP_DF);
+	iph->ttl = 64;
+	iph->protocol = IPPROTO_TCP;
+	iph->saddr = saddr;
+	iph->daddr = daddr;
+	iph->check = 0;
+	iph->check = ip_fast_csum((void *)iph, iph->ihl);
+
+	th = (struct tcphdr *)(iph + 1);
+	memset(th, 0, sizeof(*th) + rb->pkt_size);
+	th->source = rb->sport;
+	th->dest = rb->dport;
+	th->seq = htonl(rb->seq);
+	th->ack_seq = htonl(1);
+	th->doff = sizeof(*th) / 4;
+	th->ack = 1;
+	th->window = htons(65535);
+	rb->seq += rb->pkt_size;
+
+	/* As if the NIC verified the checksum, which GRO requires */
+	skb->ip_summed = CHECKSUM_UNNECESSARY;
+	skb->protocol = eth_type_trans(skb, rb->dev);
+
+	return skb;
+}
+
+static void rxbench_stat_add(struct rxbench *rb, enum rxb_stage stage,
+			     u64 ns)
+{
+	rb->stage[stage].ns += ns;
+	rb->stage[stage].samples++;
+}
+
+static void rxbench_account(struct rxbench *rb, struct rxbench_sample *s,
+			    u64 start, u64 end)
+{
+	const u64 *st = s->stamp;
+
+	if (!st[RXBENCH_NETIF_RECEIVE]) {
+		rxbench_stat_add(rb, RXB_GRO, end - start);
+		return;
+	}
+
+	rb->delivered++;
+	rxbench_stat_add(rb, RXB_GRO, st[RXBENCH_NETIF_RECEIVE] - start);
+
+	if (st[RXBENCH_IP_RCV]) {
+		rxbench_stat_add(rb, RXB_NETIF,
+				 st[RXBENCH_IP_RCV] - st[RXBENCH_NETIF_RECEIVE]);
+		if (st[RXBENCH_IP_DELIVER])
+			rxbench_stat_add(rb, RXB_IP, st[RXBENCH_IP_DELIVER] -
+					 st[RXBENCH_IP_RCV]);
+	}
+
+	if (st[RXBENCH_TCP_LOOKUP_DONE])
+		rxbench_stat_add(rb, RXB_TCP, st[RXBENCH_TCP_LOOKUP_DONE] -
+				 st[RXBENCH_TCP_LOOKUP]);
+}
+
+/*
+ * One simulated NAPI poll: feed a burst to GRO, then flush it.  Called
+ * with bottom halves disabled, so this cpu's sample pointer only ever
+ * sees our packets.
+ */
+static void rxbench_poll_once(struct rxbench *rb, unsigned int n)
+{
+	struct rxbench_sample sample;
+	gro_result_t ret;
+	u64 start, end;
+	unsigned int i;
+
+	for (i = 0; i < n; i++) {
+		memset(&sample, 0, sizeof(sample));
+		__this_cpu_write(rxbench_sample, &sample);
+		start = local_clock();
+		ret = napi_gro_receive(&rb->napi, rb->skbs[i]);
+		end = local_clock();
+		__this_cpu_write(rxbench_sample, NULL);
+
+		rb->skbs[i] = NULL;
+		if (ret < ARRAY_SIZE(rb->gro_result))
+			rb->gro_result[ret]++;
+		rxbench_account(rb, &sample, start, end);
+	}
+
+	memset(&sample, 0, sizeof(sample));
+	__this_cpu_write(rxbench_sample, &sample);
+	start = local_clock();
+	napi_gro_flush(&rb->napi);
+	end = local_clock();
+	__this_cpu_write(rxbench_sample, NULL);
+	rxbench_account(rb, &sample, start, end);
+}
+
+static __be32 rxbench_daddr(struct rxbench *rb)
+{
+	struct in_device *in_dev;
+	__be32 daddr = 0;
+
+	rcu_read_lock();
+	in_dev = __in_dev_get_rcu(rb->dev);
+	if (in_dev && in_dev->ifa_list)
+		daddr = in_dev->ifa_list->ifa_local;
+	rcu_read_unlock();
+
+	return daddr;
+}
+
+static int rxbench_run(struct rxbench *rb)
+{
+	__be32 saddr, daddr;
+	u64 start;
+	unsigned int i, n;
+	int err = 0;
+
+	if (!netif_running(rb->dev))
+		return -ENETDOWN;
+
+	daddr = rxbench_daddr(rb);
+	if (!daddr)
+		return -EADDRNOTAVAIL;
+	saddr = rb->saddr ? rb->saddr : htonl(ntohl(daddr) + 1);
+
+	rb->injected = rb->delivered = rb->elapsed_ns = 0;
+	memset(rb->gro_result, 0, sizeof(rb->gro_result));
+	memset(rb->stage, 0, sizeof(rb->stage));
+
+	start = local_clock();
+	while (rb->injected < rb->count) {
+		n = min_t(u64, rb->burst, rb->count - rb->injected);
+
+		/* Packet construction is not part of what we measure */
+		for (i = 0; i < n; i++) {
+			rb->skbs[i] = rxbench_build(rb, saddr, daddr);
+			if (!rb->skbs[i]) {
+				while (i--)
+					kfree_skb(rb->skbs[i]);
+				err = -ENOMEM;
+				goto out;
+			}
+		}
+
+		local_bh_disable();
+		rxbench_poll_once(rb, n);
+		local_bh_enable();
+		rb->injected += n;
+
+		if (signal_pending(current)) {
+			err = -EINTR;
+			break;
+		}
+		cond_resched();
+	}
+
+out:
+	rb->elapsed_ns = local_clock() - start;
+	return err;
+}
+
+static u64 rxbench_avg(const struct rxb_stat *stat)
+{
+	u64 ns = stat->ns;
+
+	if (!stat->samples)
+		return 0;
+	do_div(ns, stat->samples);
+	return ns;
+}
+
+static int rxbench_show(struct seq_file *seq, void *v)
+{
+	struct rxbench *rb = seq->private;
+	u64 pps = 0;
+	int i;
+
+	mutex_lock(&rb->lock);
+
+	seq_printf(seq, "Params: count %llu  burst: %u  pkt_size: %u\n",
+		   (unsigned long long)rb->count, rb->burst, rb->pkt_size);
+	seq_printf(seq, "     saddr: %pI4  sport: %u  dport: %u  gro: %s\n",
+		   &rb->saddr, ntohs(rb->sport), ntohs(rb->dport),
+		   rb->dev->features & NETIF_F_GRO ? "on" : "off");
+
+	if (rb->elapsed_ns) {
+		pps = rb->injected * NSEC_PER_SEC;
+		do_div(pps, rb->elapsed_ns);
+	}
+	seq_printf(seq, "Result: %s  injected: %llu  delivered: %llu  "
+		   "elapsed: %lluns  (%llupps)\n",
+		   rb->status ? "error" : "OK",
+		   (unsigned long long)rb->injected,
+		   (unsigned long long)rb->delivered,
+		   (unsigned long long)rb->elapsed_ns,
+		   (unsigned long long)pps);
+	if (rb->status)
+		seq_printf(seq, "     last run failed: %d\n", rb->status);
+
+	seq_puts(seq, "     gro:");
+	for (i = 0; i < ARRAY_SIZE(rxb_gro_names); i++)
+		seq_printf(seq, " %s %llu", rxb_gro_names[i],
+			   (unsigned long long)rb->gro_result[i]);
+	seq_puts(seq, "\n");
+
+	seq_printf(seq, "%-16s %12s %12s\n", "stage", "samples", "avg_ns");
+	for (i = 0; i < RXB_NR_STAGES; i++)
+		seq_printf(seq, "%-16s %12llu %12llu\n", rxb_stage_names[i],
+			   (unsigned long long)rb->stage[i].samples,
+			   (unsigned long long)rxbench_avg(&rb->stage[i]));
+
+	mutex_unlock(&rb->lock);
+	return 0;
+}
+
+static int rxbench_set(struct rxbench *rb, const char *name, char *val)
+{
+	unsigned long num;
+
+	if (!strcmp(name, "saddr")) {
+		rb->saddr = in_aton(val);
+		return 0;
+	}
+
+	if (strict_strtoul(val, 10, &num))
+		return -EINVAL;
+
+	if (!strcmp(name, "count")) {
+		rb->count = num;
+	} else if (!strcmp(name, "burst")) {
+		if (!num || num > RXB_MAX_BURST)
+			return -EINVAL;
+		rb->burst = num;
+	} else if (!strcmp(name, "pkt_size")) {
+		if (num > rb->dev->mtu - sizeof(struct iphdr) -
+		    sizeof(struct tcphdr))
+			return -EINVAL;
+		rb->pkt_size = num;
+	} else if (!strcmp(name, "sport")) {
+		rb->sport = htons(num);
+	} else if (!strcmp(name, "dport")) {
+		rb->dport = htons(num);
+	} else
+		return -EINVAL;
+
+	return 0;
+}
+
+static ssize_t rxbench_write(struct file *file, const char __user *buf,
+			     size_t count, loff_t *ppos)
+{
+	struct rxbench *rb = ((struct seq_file *)file->private_data)->private;
+	char data[64], *cmd, *val;
+	int err;
+
+	if (!capable(CAP_NET_ADMIN))
+		return -EPERM;
+
+	if (!count)
+		return -EINVAL;
+	if (count > sizeof(data))
+		count = sizeof(data);
+	if (copy_from_user(data, buf, count))
+		return -EFAULT;
+	data[count - 1] = 0;	/* Make string */
+
+	cmd = val = strim(data);
+	strsep(&val, " \t");
+	if (val)
+		val = skip_spaces(val);
+
+	mutex_lock(&rb->lock);
+	if (!strcmp(cmd, "run") && !val) {
+		err = rxbench_run(rb);
+		rb->status = err;
+	} else if (val && *val) {
+		err = rxbench_set(rb, cmd, val);
+	} else
+		err = -EINVAL;
+	mutex_unlock(&rb->lock);
+
+	if (err == -EINVAL)
+		pr_warning("Unknown command: %s\n", cmd);
+
+	return err ? err : count;
+}
+
+static int rxbench_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, rxbench_show, PDE(inode)->data);
+}
+
+static const struct file_operations rxbench_fops = {
+	.owner   = THIS_MODULE,
+	.open    = rxbench_open,
+	.read    = seq_read,
+	.llseek  = seq_lseek,
+	.write   = rxbench_write,
+	.release = single_release,
+};
+
+static int __init rxbench_init(void)
+{
+	struct proc_dir_entry *pe;
+	struct rxbench *rb;
+	int err;
+
+	rxb_dev = alloc_netdev(sizeof(*rb), "rxbench%d", rxbench_setup);
+	if (!rxb_dev)
+		return -ENOMEM;
+
+	rb = netdev_priv(rxb_dev);
+	rb->dev = rxb_dev;
+	mutex_init(&rb->lock);
+	rb->count = count_d;
+	rb->burst = clamp(burst_d, 1, RXB_MAX_BURST);
+	rb->pkt_size = pkt_size_d;
+	rb->sport = htons(9);
+	rb->dport = htons(9);
+	netif_napi_add(rxb_dev, &rb->napi, rxbench_poll, rb->burst);
+
+	err = register_netdev(rxb_dev);
+	if (err)
+		goto free;
+
+	pe = proc_create_data(RXB_PROC_NAME, 0600, init_net.proc_net,
+			      &rxbench_fops, rb);
+	if (!pe) {
+		pr_err("ERROR: cannot create %s procfs entry\n",
+		       RXB_PROC_NAME);
+		err = -EINVAL;
+		goto unregister;
+	}
+
+	return 0;
+
+unregister:
+	unregister_netdev(rxb_dev);
+free:
+	netif_napi_del(&rb->napi);
+	free_netdev(rxb_dev);
+	return err;
+}
+
+static void __exit rxbench_exit(void)
+{
+	struct rxbench *rb = netdev_priv(rxb_dev);
+
+	proc_net_remove(&init_net, RXB_PROC_NAME);
+	unregister_netdev(rxb_dev);
+	netif_napi_del(&rb->napi);
+	free_netdev(rxb_dev);
+}
+
+module_init(rxbench_init);
+module_exit(rxbench_exit);
+
+MODULE_DESCRIPTION("Receive path benchmark");
+MODULE_LICENSE("GPL");
+module_param(count_d, int, 0);
+MODULE_PARM_DESC(count_d, "Default number of packets to inject");
+module_param(burst_d, int, 0);
+MODULE_PARM_DESC(burst_d, "Default packets per simulated NAPI poll");
+module_param(pkt_size_d, int, 0);
+MODULE_PARM_DESC(pkt_size_d, "Default TCP payload size");
@@ -142,6 +142,7 @@
 #include <net/checksum.h>
 #include <linux/netfilter_ipv4.h>
 #include <net/xfrm.h>
+#include <net/rxbench.h>
 #include <linux/mroute.h>
 #include <linux/netlink.h>
 
@@ -223,6 +224,7 @@ static int ip_local_deliver_finish(struct sk_buff *skb)
 				}
 				nf_reset(skb);
 			}
+			rxbench_stamp(RXBENCH_IP_DELIVER);
 			ret = ipprot->handler(skb);
 			if (ret < 0) {
 				protocol = -ret;
@@ -377,6 +379,8 @@ int ip_rcv(struct sk_buff *skb, struct net_device *dev, struct packet_type *pt,
 	const struct iphdr *iph;
 	u32 len;
 
+	rxbench_stamp(RXBENCH_IP_RCV);
+
 	/* When the interface is in promisc. mode, drop all the crap
 	 * that it receives, do not try to analyse it.
 	 */
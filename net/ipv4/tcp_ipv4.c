@@ -73,6 +73,7 @@
 #include <net/xfrm.h>
 #include <net/netdma.h>
 #include <net/secure_seq.h>
+#include <net/rxbench.h>
 
 #include <linux/inet.h>
 #include <linux/ipv6.h>
@@ -1698,7 +1699,9 @@ int tcp_v4_rcv(struct sk_buff *skb)
 	TCP_SKB_CB(skb)->ip_dsfield = ipv4_get_dsfield(iph);
 	TCP_SKB_CB(skb)->sacked	 = 0;
 
+	rxbench_stamp(RXBENCH_TCP_LOOKUP);
 	sk = __inet_lookup_skb(&tcp_hashinfo, skb, th->source, th->dest);
+	rxbench_stamp(RXBENCH_TCP_LOOKUP_DONE);
 	if (!sk)
 		goto no_tcp_socket;
 
@@ -43,6 +43,9 @@ struct slabinfo {
 	unsigned long cmpxchg_double_cpu_fail, cmpxchg_double_fail;
 	unsigned long alloc_node_mismatch, deactivate_bypass;
 	unsigned long cpu_partial_alloc, cpu_partial_free;
+	unsigned long cpu_partial_refill, cpu_partial_drain;
+	unsigned long list_lock, list_lock_contended;
+	unsigned long long list_lock_nsec;
 	int numa[MAX_NODES];
 	int numa_partial[MAX_NODES];
 } slabinfo[MAX_SLABS];
@@ -163,6 +166,14 @@ static unsigned long get_obj(const char *name)
 	return atol(buffer);
 }
 
+static unsigned long long get_obj_ull(const char *name)
+{
+	if (!read_obj(name))
+		return 0;
+
+	return strtoull(buffer, NULL, 10);
+}
+
 static unsigned long get_obj_and_str(const char *name, char **x)
 {
 	unsigned long result = 0;
@@ -497,6 +508,26 @@ static void slab_stats(struct slabinfo *s)
 		printf("\nCmpxchg_double Looping\n------------------------\n");
 		printf("Locked Cmpxchg Double redos   %lu\nUnlocked Cmpxchg Double redos %lu\n",
 			s->cmpxchg_double_fail, s->cmpxchg_double_cpu_fail);
+
+	if (s->cpu_partial_refill || s->cpu_partial_drain) {
+		printf("\nCpu Partial Batching\n------------------------\n");
+		printf("Slabs refilled from node      %7lu", s->cpu_partial_refill);
+		if (s->alloc_from_partial)
+			printf("  (%lu per node partial alloc)",
+				s->cpu_partial_refill / s->alloc_from_partial);
+		printf("\nSlabs drained to node         %7lu\n",
+			s->cpu_partial_drain);
+	}
+
+	if (s->list_lock) {
+		printf("\nNode list_lock\n------------------------\n");
+		printf("Acquired                      %7lu\n", s->list_lock);
+		printf("Contended                     %7lu  %3lu%%\n",
+			s->list_lock_contended,
+			s->list_lock_contended * 100 / s->list_lock);
+		printf("Average hold time             %7llu ns\n",
+			s->list_lock_nsec / s->list_lock);
+	}
 }
 
 static void report(struct slabinfo *s)
@@ -1217,6 +1248,11 @@ static void read_slab_dir(void)
 			slab->cmpxchg_double_fail = get_obj("cmpxchg_double_fail");
 			slab->cpu_partial_alloc = get_obj("cpu_partial_alloc");
 			slab->cpu_partial_free = get_obj("cpu_partial_free");
+			slab->cpu_partial_refill = get_obj("cpu_partial_refill");
+			slab->cpu_partial_drain = get_obj("cpu_partial_drain");
+			slab->list_lock = get_obj("list_lock");
+			slab->list_lock_contended = get_obj("list_lock_contended");
+			slab->list_lock_nsec = get_obj_ull("list_lock_nsec");
 			slab->alloc_node_mismatch = get_obj("alloc_node_mismatch");
 			slab->deactivate_bypass = get_obj("deactivate_bypass");
 			chdir("..");